@@ -25,27 +25,110 @@
 
 #include "plugin.h"
 #include "utils/common/common.h"
+#include "utils/avltree/avltree.h"
 #include "utils/ignorelist/ignorelist.h"
 #include "utils/mount/mount.h"
+#include "utils/worker_pool/worker_pool.h"
+#include "utils_complain.h"
 
-static char const *config_keys[] = {"CGroup", "IgnoreSelected"};
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+
+static char const *config_keys[] = {"CGroup", "IgnoreSelected", "ReadThreads"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *il_cgroup;
 
+/* Number of cgroups a thread reads before taking the next ones. */
+#define CG2_CHUNK_SIZE 32
+/* Number of reads after which files that could not be opened, usually because
+ * the controller is not enabled for the cgroup, are tried again. */
+#define CG2_REOPEN_INTERVAL 16
+
+enum {
+  CG2_CPU_STAT,
+  CG2_MEMORY_STAT,
+  CG2_IO_STAT,
+  CG2_CPU_PRESSURE,
+  CG2_MEMORY_PRESSURE,
+  CG2_IO_PRESSURE,
+  CG2_FILES_NUM
+};
+
+static char const *const cg2_files[CG2_FILES_NUM] = {
+    "cpu.stat",     "memory.stat",     "io.stat",
+    "cpu.pressure", "memory.pressure", "io.pressure"};
+
+/* Keys of memory.stat which are reported, in bytes. */
+static char const *const cg2_memory_keys[] = {
+    "anon",       "file",  "kernel_stack", "pagetables",    "percpu",
+    "sock",       "shmem", "slab",         "file_mapped",   "file_dirty",
+    "file_writeback"};
+
+/* A directory of the cgroup v2 hierarchy. The files are kept open and read
+ * with pread(2) in every interval, as long as the plugin stays within its
+ * share of RLIMIT_NOFILE (see cg2_fd_reserve()). Beyond that, the directory
+ * and files are opened and closed for every read. */
+typedef struct {
+  char *path; /* relative to the mount point, "" for the root */
+  char *name; /* "path" with '/' replaced by '-', the plugin instance */
+  int wd;     /* inotify watch descriptor */
+  int dir_fd;
+  int fds[CG2_FILES_NUM];
+  unsigned missing; /* bit i is set if cg2_files[i] could not be opened */
+  int reopen;       /* reads until missing files are opened again */
+  uint64_t generation;
+  bool ignored;
+} cg2_entry_t;
+
+static char *cg2_mount;
+static int cg2_inotify_fd = -1;
+static bool cg2_watch_failed;
+static bool cg2_rescan = true;
+static uint64_t cg2_generation;
+static c_avl_tree_t *cg2_by_path;
+static c_avl_tree_t *cg2_by_wd;
+
+/* The cgroups read in an interval, rebuilt when the tree changed. */
+static cg2_entry_t **cg2_entries;
+static size_t cg2_entries_num;
+static bool cg2_entries_dirty = true;
+
+static long cg2_clock_ticks;
+
+/* Number of descriptors the entries may keep open, half of RLIMIT_NOFILE, and
+ * the number they do. Accessed atomically. */
+static size_t cg2_fds_max = SIZE_MAX;
+static size_t cg2_fds_num;
+static c_complain_t cg2_fds_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* Worker pool reading the cgroups in parallel. The participants take chunks
+ * of cg2_entries by advancing cg2_next atomically. */
+static size_t cg2_threads_num = 1;
+static worker_pool_t *cg2_pool;
+static size_t cg2_next;
+
 __attribute__((nonnull(1))) __attribute__((nonnull(2))) static void
-cgroups_submit_one(char const *plugin_instance, char const *type_instance,
-                   value_t value) {
+cgroups_submit(char const *plugin_instance, char const *type,
+               char const *type_instance, value_t *values, size_t values_len) {
   value_list_t vl = VALUE_LIST_INIT;
 
-  vl.values = &value;
-  vl.values_len = 1;
+  vl.values = values;
+  vl.values_len = values_len;
   sstrncpy(vl.plugin, "cgroups", sizeof(vl.plugin));
   sstrncpy(vl.plugin_instance, plugin_instance, sizeof(vl.plugin_instance));
-  sstrncpy(vl.type, "cpu", sizeof(vl.type));
-  sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
+  sstrncpy(vl.type, type, sizeof(vl.type));
+  if (type_instance != NULL)
+    sstrncpy(vl.type_instance, type_instance, sizeof(vl.type_instance));
 
   plugin_dispatch_values(&vl);
+} /* void cgroups_submit */
+
+__attribute__((nonnull(1))) __attribute__((nonnull(2))) static void
+cgroups_submit_one(char const *plugin_instance, char const *type_instance,
+                   value_t value) {
+  cgroups_submit(plugin_instance, "cpu", type_instance, &value, 1);
 } /* void cgroups_submit_one */
 
 /*
@@ -154,15 +237,674 @@ static int read_cpuacct_root(const char *dirname, const char *filename,
   return 0;
 }
 
+
+static int cg2_compare_wd(const void *a, const void *b) {
+  int wd_a = *(const int *)a;
+  int wd_b = *(const int *)b;
+
+  return (wd_a > wd_b) - (wd_a < wd_b);
+} /* int cg2_compare_wd */
+
+/* Accounts for a descriptor kept open by an entry. Returns false if the
+ * plugin has used up its share of descriptors, in which case the caller closes
+ * the descriptor after use. */
+static bool cg2_fd_reserve(void) {
+  size_t num = __atomic_load_n(&cg2_fds_num, __ATOMIC_RELAXED);
+  do {
+    if (num >= __atomic_load_n(&cg2_fds_max, __ATOMIC_RELAXED))
+      return false;
+  } while (!__atomic_compare_exchange_n(&cg2_fds_num, &num, num + 1,
+                                        /* weak = */ true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+  return true;
+} /* bool cg2_fd_reserve */
+
+static void cg2_fd_close(int fd) {
+  close(fd);
+  __atomic_sub_fetch(&cg2_fds_num, 1, __ATOMIC_RELAXED);
+} /* void cg2_fd_close */
+
+/* Called when opening "path" failed with "err". Returns true if the process
+ * ran out of descriptors. In that case, the number of descriptors the entries
+ * may keep open is lowered to what they currently hold, so the remaining files
+ * are opened and closed for every read. */
+static bool cg2_open_failed(char const *path, int err) {
+  if ((err != EMFILE) && (err != ENFILE))
+    return false;
+
+  size_t num = __atomic_load_n(&cg2_fds_num, __ATOMIC_RELAXED);
+  __atomic_store_n(&cg2_fds_max, num, __ATOMIC_RELAXED);
+  ERROR("cgroups plugin: Opening \"%s\" failed: %s. Keeping at most %" PRIsz
+        " files open from now on.",
+        path, STRERROR(err), num);
+  return true;
+} /* bool cg2_open_failed */
+
+/* Opens "file" in the directory of "e", "." for the directory itself. */
+static int cg2_entry_openat(cg2_entry_t const *e, char const *file,
+                            int flags) {
+  if (e->dir_fd >= 0)
+    return openat(e->dir_fd, file, flags);
+
+  char abs_path[PATH_MAX];
+  if (e->path[0] == '\0')
+    snprintf(abs_path, sizeof(abs_path), "%s/%s", cg2_mount, file);
+  else
+    snprintf(abs_path, sizeof(abs_path), "%s/%s/%s", cg2_mount, e->path, file);
+  return open(abs_path, flags);
+} /* int cg2_entry_openat */
+
+static void cg2_entry_close(cg2_entry_t *e) {
+  for (size_t i = 0; i < CG2_FILES_NUM; i++) {
+    if (e->fds[i] >= 0)
+      cg2_fd_close(e->fds[i]);
+    e->fds[i] = -1;
+  }
+} /* void cg2_entry_close */
+
+static void cg2_entry_free(cg2_entry_t *e) {
+  if (e == NULL)
+    return;
+
+  cg2_entry_close(e);
+  if (e->dir_fd >= 0)
+    cg2_fd_close(e->dir_fd);
+  sfree(e->path);
+  sfree(e->name);
+  sfree(e);
+} /* void cg2_entry_free */
+
+static void cg2_entry_remove(cg2_entry_t *e) {
+  DEBUG("cgroups plugin: Removing cgroup \"%s\".", e->path);
+
+  c_avl_remove(cg2_by_path, e->path, NULL, NULL);
+  if (e->wd >= 0) {
+    c_avl_remove(cg2_by_wd, &e->wd, NULL, NULL);
+    /* Fails if the directory is already gone, which is fine. */
+    inotify_rm_watch(cg2_inotify_fd, e->wd);
+  }
+
+  cg2_entry_free(e);
+  cg2_entries_dirty = true;
+} /* void cg2_entry_remove */
+
+/* Removes the entries below "path", which was moved away. */
+static void cg2_remove_children(char const *path) {
+  size_t path_len = strlen(path);
+  cg2_entry_t **remove = NULL;
+  size_t remove_num = 0;
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(cg2_by_path);
+  char *key;
+  cg2_entry_t *e;
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&e) == 0) {
+    if ((strncmp(key, path, path_len) != 0) || (key[path_len] != '/'))
+      continue;
+
+    cg2_entry_t **tmp = realloc(remove, (remove_num + 1) * sizeof(*remove));
+    if (tmp == NULL)
+      break;
+    remove = tmp;
+    remove[remove_num++] = e;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < remove_num; i++)
+    cg2_entry_remove(remove[i]);
+  sfree(remove);
+} /* void cg2_remove_children */
+
+/* Returns the entry of "path", creating it and watching the directory for new
+ * and removed cgroups if necessary. */
+static cg2_entry_t *cg2_entry_get(char const *path) {
+  cg2_entry_t *e = NULL;
+  if (c_avl_get(cg2_by_path, path, (void *)&e) == 0) {
+    e->generation = cg2_generation;
+    return e;
+  }
+
+  char abs_path[PATH_MAX];
+  if (path[0] == '\0')
+    sstrncpy(abs_path, cg2_mount, sizeof(abs_path));
+  else
+    snprintf(abs_path, sizeof(abs_path), "%s/%s", cg2_mount, path);
+
+  e = calloc(1, sizeof(*e));
+  if (e == NULL)
+    return NULL;
+  e->wd = -1;
+  for (size_t i = 0; i < CG2_FILES_NUM; i++)
+    e->fds[i] = -1;
+  e->generation = cg2_generation;
+
+  e->path = strdup(path);
+  e->name = strdup(path);
+  if ((e->path == NULL) || (e->name == NULL)) {
+    sfree(e->path);
+    sfree(e->name);
+    sfree(e);
+    return NULL;
+  }
+  /* Nested cgroups often share their last component, e.g. "init.scope" or
+   * the cgroups of containers, so the whole path identifies the cgroup. */
+  for (char *ptr = e->name; *ptr != '\0'; ptr++)
+    if (*ptr == '/')
+      *ptr = '-';
+  e->ignored = (path[0] == '\0') || ignorelist_match(il_cgroup, e->name);
+
+  e->dir_fd = open(abs_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (e->dir_fd < 0) {
+    /* Most likely removed again in the meantime. */
+    DEBUG("cgroups plugin: open (\"%s\") failed: %s", abs_path, STRERRNO);
+    cg2_open_failed(abs_path, errno);
+    cg2_entry_free(e);
+    return NULL;
+  }
+  if (!cg2_fd_reserve()) {
+    close(e->dir_fd);
+    e->dir_fd = -1;
+  }
+
+  if (!cg2_watch_failed) {
+    e->wd = inotify_add_watch(cg2_inotify_fd, abs_path,
+                              IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                  IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (e->wd < 0) {
+      WARNING("cgroups plugin: inotify_add_watch (\"%s\") failed: %s. "
+              "Rescanning all cgroups in every interval from now on; "
+              "consider raising fs.inotify.max_user_watches.",
+              abs_path, STRERRNO);
+      cg2_watch_failed = true;
+    }
+  }
+
+  if (c_avl_insert(cg2_by_path, e->path, e) != 0) {
+    cg2_entry_free(e);
+    return NULL;
+  }
+  if ((e->wd >= 0) && (c_avl_insert(cg2_by_wd, &e->wd, e) != 0)) {
+    /* Watching a directory twice returns the same descriptor; keep the old
+     * mapping. */
+    e->wd = -1;
+  }
+
+  DEBUG("cgroups plugin: Added cgroup \"%s\".", e->path);
+  cg2_entries_dirty = true;
+  return e;
+} /* cg2_entry_t *cg2_entry_get */
+
+/* Adds the cgroup "path" and all cgroups below it. The directory is watched
+ * before it is read, so cgroups created concurrently are not missed. */
+static int cg2_scan(char const *path) {
+  cg2_entry_t *e = cg2_entry_get(path);
+  if (e == NULL)
+    return -1;
+
+  int fd = cg2_entry_openat(e, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    cg2_open_failed(e->path, errno);
+    return -1;
+  }
+  DIR *dh = fdopendir(fd);
+  if (dh == NULL) {
+    close(fd);
+    return -1;
+  }
+
+  struct dirent *ent;
+  while ((ent = readdir(dh)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    if (ent->d_type == DT_UNKNOWN) {
+      struct stat statbuf;
+      if ((fstatat(fd, ent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) ||
+          !S_ISDIR(statbuf.st_mode))
+        continue;
+    } else if (ent->d_type != DT_DIR) {
+      continue;
+    }
+
+    char child[PATH_MAX];
+    if (path[0] == '\0')
+      sstrncpy(child, ent->d_name, sizeof(child));
+    else
+      snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+
+    cg2_scan(child);
+  }
+
+  closedir(dh);
+  return 0;
+} /* int cg2_scan */
+
+/* Scans the whole hierarchy and removes the cgroups which no longer exist. */
+static void cg2_scan_all(void) {
+  cg2_generation++;
+  cg2_scan("");
+
+  cg2_entry_t **remove = NULL;
+  size_t remove_num = 0;
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(cg2_by_path);
+  char *key;
+  cg2_entry_t *e;
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&e) == 0) {
+    if (e->generation == cg2_generation)
+      continue;
+
+    cg2_entry_t **tmp = realloc(remove, (remove_num + 1) * sizeof(*remove));
+    if (tmp == NULL)
+      break;
+    remove = tmp;
+    remove[remove_num++] = e;
+  }
+  c_avl_iterator_destroy(iter);
+
+  for (size_t i = 0; i < remove_num; i++)
+    cg2_entry_remove(remove[i]);
+  sfree(remove);
+} /* void cg2_scan_all */
+
+static void cg2_handle_event(struct inotify_event const *event) {
+  if (event->mask & IN_Q_OVERFLOW) {
+    NOTICE("cgroups plugin: The inotify queue overflowed; "
+           "rescanning all cgroups.");
+    cg2_rescan = true;
+    return;
+  }
+
+  if (((event->mask & IN_ISDIR) == 0) || (event->len == 0))
+    return;
+
+  cg2_entry_t *parent = NULL;
+  if (c_avl_get(cg2_by_wd, &event->wd, (void *)&parent) != 0)
+    return;
+
+  char path[PATH_MAX];
+  if (parent->path[0] == '\0')
+    sstrncpy(path, event->name, sizeof(path));
+  else
+    snprintf(path, sizeof(path), "%s/%s", parent->path, event->name);
+
+  if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+    cg2_scan(path);
+    return;
+  }
+
+  /* IN_DELETE or IN_MOVED_FROM */
+  cg2_entry_t *e = NULL;
+  if (c_avl_get(cg2_by_path, path, (void *)&e) == 0) {
+    if (event->mask & IN_MOVED_FROM)
+      cg2_remove_children(path);
+    cg2_entry_remove(e);
+  }
+} /* void cg2_handle_event */
+
+/* Applies the changes to the hierarchy since the last read. */
+static void cg2_update(void) {
+  char buf[8192]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (cg2_inotify_fd >= 0) {
+    ssize_t len = read(cg2_inotify_fd, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN) {
+        ERROR("cgroups plugin: Reading inotify events failed: %s", STRERRNO);
+        cg2_rescan = true;
+      }
+      break;
+    }
+
+    for (char *ptr = buf; ptr < buf + len;) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+      cg2_handle_event(event);
+      ptr += sizeof(*event) + event->len;
+    }
+  }
+
+  if (cg2_rescan || cg2_watch_failed) {
+    cg2_rescan = false;
+    cg2_scan_all();
+  }
+
+  if (!cg2_entries_dirty)
+    return;
+
+  int num = c_avl_size(cg2_by_path);
+  cg2_entry_t **tmp = realloc(cg2_entries, num * sizeof(*cg2_entries));
+  if ((tmp == NULL) && (num > 0)) {
+    ERROR("cgroups plugin: realloc failed.");
+    return;
+  }
+  cg2_entries = tmp;
+  cg2_entries_num = 0;
+
+  c_avl_iterator_t *iter = c_avl_get_iterator(cg2_by_path);
+  char *key;
+  cg2_entry_t *e;
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&e) == 0) {
+    if (!e->ignored)
+      cg2_entries[cg2_entries_num++] = e;
+  }
+  c_avl_iterator_destroy(iter);
+
+  cg2_entries_dirty = false;
+
+  size_t fds_needed = (size_t)num + cg2_entries_num * (size_t)CG2_FILES_NUM;
+  size_t fds_max = __atomic_load_n(&cg2_fds_max, __ATOMIC_RELAXED);
+  if (fds_needed > fds_max)
+    c_complain(LOG_WARNING, &cg2_fds_complaint,
+               "cgroups plugin: Reading %" PRIsz " cgroups takes up to %" PRIsz
+               " file descriptors, but only %" PRIsz " may be kept open. The "
+               "remaining files are opened for every read; consider raising "
+               "the open files limit (RLIMIT_NOFILE).",
+               cg2_entries_num, fds_needed, fds_max);
+  else
+    c_release(LOG_INFO, &cg2_fds_complaint,
+              "cgroups plugin: All %" PRIsz " cgroups fit into the open files "
+              "limit again.",
+              cg2_entries_num);
+} /* void cg2_update */
+
+/* Reads one of the files of "e" into "buf". Returns the number of bytes read
+ * or less than zero if the file is not available. */
+static ssize_t cg2_read_file(cg2_entry_t *e, size_t idx, char *buf,
+                             size_t buf_size) {
+  int fd = e->fds[idx];
+  bool keep = true;
+
+  if (fd < 0) {
+    if (e->missing & (1u << idx))
+      return -1;
+
+    fd = cg2_entry_openat(e, cg2_files[idx], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s/%s", e->path, cg2_files[idx]);
+      if (!cg2_open_failed(path, errno)) {
+        /* Usually the controller is not enabled for this cgroup. */
+        e->missing |= 1u << idx;
+        e->reopen = CG2_REOPEN_INTERVAL;
+      }
+      return -1;
+    }
+
+    keep = cg2_fd_reserve();
+    if (keep)
+      e->fds[idx] = fd;
+  }
+
+  ssize_t len = pread(fd, buf, buf_size - 1, 0);
+  if (len < 0) {
+    /* ENODEV: the cgroup has been removed. The entry goes away with the
+     * inotify event. */
+    if (errno != ENODEV)
+      ERROR("cgroups plugin: Reading \"%s/%s\" failed: %s", e->path,
+            cg2_files[idx], STRERRNO);
+    if (keep) {
+      cg2_fd_close(fd);
+      e->fds[idx] = -1;
+    } else {
+      close(fd);
+    }
+    return -1;
+  }
+
+  if (!keep)
+    close(fd);
+
+  buf[len] = '\0';
+  return len;
+} /* ssize_t cg2_read_file */
+
+static void cg2_submit_cpu(cg2_entry_t *e, char *buf) {
+  char *saveptr = NULL;
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[4];
+    if (strsplit(line, fields, STATIC_ARRAY_SIZE(fields)) != 2)
+      continue;
+
+    char const *type_instance;
+    if (strcmp(fields[0], "user_usec") == 0)
+      type_instance = "user";
+    else if (strcmp(fields[0], "system_usec") == 0)
+      type_instance = "system";
+    else
+      continue;
+
+    value_t value;
+    if (strtoderive(fields[1], &value.derive) != 0)
+      continue;
+    /* Report clock ticks, like cpuacct.stat of cgroup v1. */
+    value.derive = value.derive * cg2_clock_ticks / 1000000;
+
+    cgroups_submit_one(e->name, type_instance, value);
+  }
+} /* void cg2_submit_cpu */
+
+static void cg2_submit_memory(cg2_entry_t *e, char *buf) {
+  char *saveptr = NULL;
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[4];
+    if (strsplit(line, fields, STATIC_ARRAY_SIZE(fields)) != 2)
+      continue;
+
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(cg2_memory_keys); i++) {
+      if (strcmp(fields[0], cg2_memory_keys[i]) != 0)
+        continue;
+
+      value_t value;
+      if (strtogauge(fields[1], &value.gauge) == 0)
+        cgroups_submit(e->name, "memory", fields[0], &value, 1);
+      break;
+    }
+  }
+} /* void cg2_submit_memory */
+
+/* Sums the counters of all devices in io.stat, which has lines like
+ * "8:0 rbytes=1 wbytes=2 rios=3 wios=4 dbytes=0 dios=0". */
+static void cg2_submit_io(cg2_entry_t *e, char *buf) {
+  derive_t rbytes = 0, wbytes = 0, rios = 0, wios = 0;
+
+  char *saveptr = NULL;
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[16];
+    int fields_num = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
+
+    for (int i = 1; i < fields_num; i++) {
+      char *value = strchr(fields[i], '=');
+      if (value == NULL)
+        continue;
+      *value++ = '\0';
+
+      derive_t tmp;
+      if (strtoderive(value, &tmp) != 0)
+        continue;
+
+      if (strcmp(fields[i], "rbytes") == 0)
+        rbytes += tmp;
+      else if (strcmp(fields[i], "wbytes") == 0)
+        wbytes += tmp;
+      else if (strcmp(fields[i], "rios") == 0)
+        rios += tmp;
+      else if (strcmp(fields[i], "wios") == 0)
+        wios += tmp;
+    }
+  }
+
+  value_t octets[] = {{.derive = rbytes}, {.derive = wbytes}};
+  cgroups_submit(e->name, "disk_octets", NULL, octets,
+                 STATIC_ARRAY_SIZE(octets));
+  value_t ops[] = {{.derive = rios}, {.derive = wios}};
+  cgroups_submit(e->name, "disk_ops", NULL, ops, STATIC_ARRAY_SIZE(ops));
+} /* void cg2_submit_io */
+
+/* Reports the total stall time of the "some" and "full" lines of a pressure
+ * file, e.g. "some avg10=0.00 avg60=0.00 avg300=0.00 total=1234". */
+static void cg2_submit_pressure(cg2_entry_t *e, char const *resource,
+                                char *buf) {
+  char *saveptr = NULL;
+  for (char *line = strtok_r(buf, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[8];
+    int fields_num = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
+    if (fields_num < 2)
+      continue;
+
+    for (int i = 1; i < fields_num; i++) {
+      if (strncmp(fields[i], "total=", strlen("total=")) != 0)
+        continue;
+
+      value_t value;
+      if (strtoderive(fields[i] + strlen("total="), &value.derive) != 0)
+        break;
+      /* microseconds */
+      value.derive /= 1000;
+
+      char type_instance[DATA_MAX_NAME_LEN];
+      snprintf(type_instance, sizeof(type_instance), "%s-%s", resource,
+               fields[0]);
+      cgroups_submit(e->name, "total_time_in_ms", type_instance, &value, 1);
+      break;
+    }
+  }
+} /* void cg2_submit_pressure */
+
+static void cg2_read_entry(cg2_entry_t *e, char *buf, size_t buf_size) {
+  if (e->reopen > 0)
+    e->reopen--;
+  else
+    e->missing = 0;
+
+  if (cg2_read_file(e, CG2_CPU_STAT, buf, buf_size) >= 0)
+    cg2_submit_cpu(e, buf);
+  if (cg2_read_file(e, CG2_MEMORY_STAT, buf, buf_size) >= 0)
+    cg2_submit_memory(e, buf);
+  if (cg2_read_file(e, CG2_IO_STAT, buf, buf_size) >= 0)
+    cg2_submit_io(e, buf);
+  if (cg2_read_file(e, CG2_CPU_PRESSURE, buf, buf_size) >= 0)
+    cg2_submit_pressure(e, "cpu", buf);
+  if (cg2_read_file(e, CG2_MEMORY_PRESSURE, buf, buf_size) >= 0)
+    cg2_submit_pressure(e, "memory", buf);
+  if (cg2_read_file(e, CG2_IO_PRESSURE, buf, buf_size) >= 0)
+    cg2_submit_pressure(e, "io", buf);
+} /* void cg2_read_entry */
+
+/* Reads chunks of cg2_entries until all of them are taken. */
+static void cg2_read_entries(__attribute__((unused)) size_t index,
+                             __attribute__((unused)) void *user_data) {
+  char buf[16384];
+
+  while (1) {
+    size_t start =
+        __atomic_fetch_add(&cg2_next, CG2_CHUNK_SIZE, __ATOMIC_RELAXED);
+
+    if (start >= cg2_entries_num)
+      break;
+
+    size_t end = start + CG2_CHUNK_SIZE;
+    if (end > cg2_entries_num)
+      end = cg2_entries_num;
+
+    for (size_t i = start; i < end; i++)
+      cg2_read_entry(cg2_entries[i], buf, sizeof(buf));
+  }
+} /* void cg2_read_entries */
+
+static int cg2_read(void) {
+  cg2_update();
+
+  /* Published to the workers by worker_pool_run(). */
+  cg2_next = 0;
+  worker_pool_run(cg2_pool);
+
+  return 0;
+} /* int cg2_read */
+
+static int cg2_init(char const *mount) {
+  cg2_clock_ticks = sysconf(_SC_CLK_TCK);
+  if (cg2_clock_ticks <= 0)
+    cg2_clock_ticks = 100;
+
+  /* Leave half of the descriptors to the rest of the daemon. */
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    WARNING("cgroups plugin: getrlimit (RLIMIT_NOFILE) failed: %s", STRERRNO);
+  else if (rl.rlim_cur != RLIM_INFINITY)
+    cg2_fds_max = (size_t)rl.rlim_cur / 2;
+
+  cg2_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (cg2_inotify_fd < 0) {
+    WARNING("cgroups plugin: inotify_init1 failed: %s. "
+            "Rescanning all cgroups in every interval.",
+            STRERRNO);
+    cg2_watch_failed = true;
+  }
+
+  cg2_rescan = true;
+  cg2_entries_dirty = true;
+
+  cg2_mount = strdup(mount);
+  cg2_by_path = c_avl_create((int (*)(const void *, const void *))strcmp);
+  cg2_by_wd = c_avl_create(cg2_compare_wd);
+  if ((cg2_mount == NULL) || (cg2_by_path == NULL) || (cg2_by_wd == NULL)) {
+    ERROR("cgroups plugin: Allocating memory failed.");
+    return ENOMEM;
+  }
+
+  cg2_pool = worker_pool_create(cg2_threads_num, cg2_read_entries, NULL,
+                                "cgroups read");
+  if (cg2_pool == NULL) {
+    ERROR("cgroups plugin: Creating the worker pool failed.");
+    return ENOMEM;
+  }
+
+  INFO("cgroups plugin: Reading the cgroup v2 hierarchy at \"%s\" with %zu "
+       "thread(s), keeping up to %" PRIsz " files open.",
+       cg2_mount, worker_pool_size(cg2_pool), cg2_fds_max);
+  return 0;
+} /* int cg2_init */
+
+/* Looks for the cgroup hierarchy to read. A cgroup v1 hierarchy with the
+ * cpuacct controller is preferred, so hybrid setups keep reporting the same
+ * values; otherwise the unified cgroup v2 hierarchy is used. */
 static int cgroups_init(void) {
   if (il_cgroup == NULL)
     il_cgroup = ignorelist_create(1);
 
-  return 0;
-}
+  cu_mount_t *mnt_list = NULL;
+  if (cu_mount_getlist(&mnt_list) == NULL)
+    return 0;
+
+  char const *cgroup2 = NULL;
+  for (cu_mount_t *mnt_ptr = mnt_list; mnt_ptr != NULL;
+       mnt_ptr = mnt_ptr->next) {
+    if ((strcmp(mnt_ptr->type, "cgroup") == 0) &&
+        cu_mount_checkoption(mnt_ptr->options, "cpuacct", /* full = */ 1)) {
+      cgroup2 = NULL;
+      break;
+    }
+    if ((cgroup2 == NULL) && (strcmp(mnt_ptr->type, "cgroup2") == 0))
+      cgroup2 = mnt_ptr->dir;
+  }
+
+  int status = 0;
+  if (cgroup2 != NULL)
+    status = cg2_init(cgroup2);
+
+  cu_mount_freelist(mnt_list);
+  return status;
+} /* int cgroups_init */
 
 static int cgroups_config(const char *key, const char *value) {
-  cgroups_init();
+  if (il_cgroup == NULL)
+    il_cgroup = ignorelist_create(1);
 
   if (strcasecmp(key, "CGroup") == 0) {
     if (ignorelist_add(il_cgroup, value))
@@ -174,6 +916,14 @@ static int cgroups_config(const char *key, const char *value) {
     else
       ignorelist_set_invert(il_cgroup, 1);
     return 0;
+  } else if (strcasecmp(key, "ReadThreads") == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      ERROR("cgroups plugin: ReadThreads must be at least 1.");
+      return 1;
+    }
+    cg2_threads_num = (size_t)tmp;
+    return 0;
   }
 
   return -1;
@@ -183,6 +933,9 @@ static int cgroups_read(void) {
   cu_mount_t *mnt_list = NULL;
   bool cgroup_found = false;
 
+  if (cg2_mount != NULL)
+    return cg2_read();
+
   if (cu_mount_getlist(&mnt_list) == NULL) {
     ERROR("cgroups plugin: cu_mount_getlist failed.");
     return -1;
@@ -216,9 +969,41 @@ static int cgroups_read(void) {
   return 0;
 } /* int cgroup_read */
 
+static int cgroups_shutdown(void) {
+  worker_pool_destroy(cg2_pool);
+  cg2_pool = NULL;
+
+  if (cg2_by_path != NULL) {
+    char *key;
+    cg2_entry_t *e;
+    while (c_avl_pick(cg2_by_path, (void *)&key, (void *)&e) == 0)
+      cg2_entry_free(e);
+    c_avl_destroy(cg2_by_path);
+    cg2_by_path = NULL;
+  }
+  if (cg2_by_wd != NULL) {
+    c_avl_destroy(cg2_by_wd);
+    cg2_by_wd = NULL;
+  }
+  sfree(cg2_entries);
+  cg2_entries_num = 0;
+
+  if (cg2_inotify_fd >= 0) {
+    close(cg2_inotify_fd);
+    cg2_inotify_fd = -1;
+  }
+  sfree(cg2_mount);
+
+  ignorelist_free(il_cgroup);
+  il_cgroup = NULL;
+
+  return 0;
+} /* int cgroups_shutdown */
+
 void module_register(void) {
   plugin_register_config("cgroups", cgroups_config, config_keys,
                          config_keys_num);
   plugin_register_init("cgroups", cgroups_init);
   plugin_register_read("cgroups", cgroups_read);
+  plugin_register_shutdown("cgroups", cgroups_shutdown);
 } /* void module_register */
@@ -0,0 +1,256 @@
+/**
+ * collectd - src/cgroups_test.c
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the license is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#define plugin_dispatch_values plugin_dispatch_values_cgroups_test
+
+#include "cgroups.c" /* sic */
+#include "testing.h"
+
+#define TEST_CGROUPS_NUM 4
+
+typedef struct {
+  char plugin_instance[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  char type_instance[DATA_MAX_NAME_LEN];
+  derive_t values[2];
+} dispatched_t;
+
+static dispatched_t dispatched[64];
+static size_t dispatched_num;
+
+int plugin_dispatch_values_cgroups_test(value_list_t const *vl) {
+  if (dispatched_num >= STATIC_ARRAY_SIZE(dispatched))
+    return ENOMEM;
+
+  dispatched_t *d = dispatched + dispatched_num++;
+  sstrncpy(d->plugin_instance, vl->plugin_instance,
+           sizeof(d->plugin_instance));
+  sstrncpy(d->type, vl->type, sizeof(d->type));
+  sstrncpy(d->type_instance, vl->type_instance, sizeof(d->type_instance));
+  for (size_t i = 0; (i < vl->values_len) && (i < 2); i++)
+    d->values[i] = vl->values[i].derive;
+  return 0;
+}
+
+/* Returns the value dispatched last for the given identifier, if any. */
+static dispatched_t *find(char const *plugin_instance, char const *type,
+                          char const *type_instance) {
+  for (size_t i = dispatched_num; i > 0; i--) {
+    dispatched_t *d = dispatched + i - 1;
+    if ((strcmp(plugin_instance, d->plugin_instance) == 0) &&
+        (strcmp(type, d->type) == 0) &&
+        (strcmp(type_instance, d->type_instance) == 0))
+      return d;
+  }
+  return NULL;
+}
+
+static size_t count(char const *type) {
+  size_t ret = 0;
+  for (size_t i = 0; i < dispatched_num; i++)
+    if (strcmp(type, dispatched[i].type) == 0)
+      ret++;
+  return ret;
+}
+
+/* Creates the file "name" of the cgroup "cgroup" below "mount". */
+static int write_file(char const *mount, char const *cgroup, char const *name,
+                      char const *content) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s/%s", mount, cgroup, name);
+
+  FILE *fh = fopen(path, "w");
+  if (fh == NULL)
+    return -1;
+  fputs(content, fh);
+  return fclose(fh);
+}
+
+DEF_TEST(submit_io) {
+  cg2_entry_t e = {.name = "test"};
+  char buf[] = "8:16 rbytes=1000 wbytes=2000 rios=10 wios=20 dbytes=0 dios=0\n"
+               "8:0 rbytes=100 wbytes=200 rios=1 wios=2 dbytes=5 dios=1\n"
+               "253:0 rbytes=garbage wbytes=3 rios wios=4\n";
+
+  dispatched_num = 0;
+  cg2_submit_io(&e, buf);
+
+  dispatched_t *d = find("test", "disk_octets", "");
+  OK(d != NULL);
+  EXPECT_EQ_INT(1100, d->values[0]);
+  EXPECT_EQ_INT(2203, d->values[1]);
+
+  d = find("test", "disk_ops", "");
+  OK(d != NULL);
+  EXPECT_EQ_INT(11, d->values[0]);
+  EXPECT_EQ_INT(26, d->values[1]);
+
+  /* An empty file, e.g. without any I/O yet, reports zero. */
+  char empty[] = "";
+  dispatched_num = 0;
+  cg2_submit_io(&e, empty);
+  d = find("test", "disk_ops", "");
+  OK(d != NULL);
+  EXPECT_EQ_INT(0, d->values[0]);
+  EXPECT_EQ_INT(0, d->values[1]);
+
+  return 0;
+}
+
+DEF_TEST(submit_pressure) {
+  cg2_entry_t e = {.name = "test"};
+  char buf[] = "some avg10=1.50 avg60=0.20 avg300=0.00 total=1234567\n"
+               "full avg10=0.00 avg60=0.00 avg300=0.00 total=7654321\n";
+
+  dispatched_num = 0;
+  cg2_submit_pressure(&e, "io", buf);
+  EXPECT_EQ_INT(2, dispatched_num);
+
+  dispatched_t *d = find("test", "total_time_in_ms", "io-some");
+  OK(d != NULL);
+  EXPECT_EQ_INT(1234, d->values[0]);
+
+  d = find("test", "total_time_in_ms", "io-full");
+  OK(d != NULL);
+  EXPECT_EQ_INT(7654, d->values[0]);
+
+  /* cpu.pressure of older kernels has no "full" line; lines without a valid
+   * total are skipped. */
+  char cpu[] = "some avg10=0.00 avg60=0.00 avg300=0.00 total=5000\n"
+               "full avg10=0.00 total=invalid\n";
+  dispatched_num = 0;
+  cg2_submit_pressure(&e, "cpu", cpu);
+  EXPECT_EQ_INT(1, dispatched_num);
+  d = find("test", "total_time_in_ms", "cpu-some");
+  OK(d != NULL);
+  EXPECT_EQ_INT(5, d->values[0]);
+
+  return 0;
+}
+
+/* Reads a fake hierarchy while only a few descriptors may be kept open. */
+DEF_TEST(read_fd_limit) {
+  char mount[] = "/tmp/cgroups_test.XXXXXX";
+  CHECK_NOT_NULL(mkdtemp(mount));
+
+  for (int i = 0; i < TEST_CGROUPS_NUM; i++) {
+    char cgroup[16];
+    snprintf(cgroup, sizeof(cgroup), "cg%d", i);
+    char dir[64];
+    snprintf(dir, sizeof(dir), "%s/%s", mount, cgroup);
+    CHECK_ZERO(mkdir(dir, 0755));
+
+    char io[128];
+    snprintf(io, sizeof(io), "8:0 rbytes=%d wbytes=0 rios=%d wios=0\n",
+             1000 * i, i);
+    CHECK_ZERO(write_file(mount, cgroup, "io.stat", io));
+    CHECK_ZERO(write_file(mount, cgroup, "cpu.pressure",
+                          "some avg10=0.00 avg60=0.00 avg300=0.00 "
+                          "total=3000\n"));
+  }
+
+  il_cgroup = ignorelist_create(1);
+  CHECK_ZERO(cg2_init(mount));
+  /* The root directory and one of the cgroups. */
+  cg2_fds_max = 4;
+
+  for (int round = 0; round < 2; round++) {
+    dispatched_num = 0;
+    CHECK_ZERO(cg2_read());
+
+    EXPECT_EQ_INT(TEST_CGROUPS_NUM, count("disk_ops"));
+    EXPECT_EQ_INT(TEST_CGROUPS_NUM, count("total_time_in_ms"));
+    for (int i = 0; i < TEST_CGROUPS_NUM; i++) {
+      char name[16];
+      snprintf(name, sizeof(name), "cg%d", i);
+      dispatched_t *d = find(name, "disk_ops", "");
+      OK(d != NULL);
+      EXPECT_EQ_INT(i, d->values[0]);
+    }
+    OK(cg2_fds_num <= 4);
+  }
+
+  CHECK_ZERO(cgroups_shutdown());
+  EXPECT_EQ_INT(0, cg2_fds_num);
+
+  for (int i = 0; i < TEST_CGROUPS_NUM; i++) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/cg%d/io.stat", mount, i);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/cg%d/cpu.pressure", mount, i);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/cg%d", mount, i);
+    rmdir(path);
+  }
+  rmdir(mount);
+
+  return 0;
+}
+
+/* Nested cgroups with the same name are reported as different instances. */
+DEF_TEST(read_nested) {
+  char mount[] = "/tmp/cgroups_test.XXXXXX";
+  CHECK_NOT_NULL(mkdtemp(mount));
+
+  char const *cgroups[] = {"init.scope", "user.slice",
+                           "user.slice/init.scope"};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cgroups); i++) {
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s/%s", mount, cgroups[i]);
+    CHECK_ZERO(mkdir(dir, 0755));
+
+    char io[128];
+    snprintf(io, sizeof(io), "8:0 rbytes=0 wbytes=0 rios=%zu wios=0\n", i);
+    CHECK_ZERO(write_file(mount, cgroups[i], "io.stat", io));
+  }
+
+  il_cgroup = ignorelist_create(1);
+  CHECK_ZERO(cg2_init(mount));
+
+  dispatched_num = 0;
+  CHECK_ZERO(cg2_read());
+  EXPECT_EQ_INT(STATIC_ARRAY_SIZE(cgroups), count("disk_ops"));
+
+  dispatched_t *d = find("init.scope", "disk_ops", "");
+  OK(d != NULL);
+  EXPECT_EQ_INT(0, d->values[0]);
+  d = find("user.slice-init.scope", "disk_ops", "");
+  OK(d != NULL);
+  EXPECT_EQ_INT(2, d->values[0]);
+
+  CHECK_ZERO(cgroups_shutdown());
+
+  for (size_t i = STATIC_ARRAY_SIZE(cgroups); i > 0; i--) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s/io.stat", mount, cgroups[i - 1]);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", mount, cgroups[i - 1]);
+    rmdir(path);
+  }
+  rmdir(mount);
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(submit_io);
+  RUN_TEST(submit_pressure);
+  RUN_TEST(read_fd_limit);
+  RUN_TEST(read_nested);
+
+  END_TEST;
+}
@@ -24,19 +24,83 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils_cache.h"
 
+#ifndef CSV_DEFAULT_MAX_OPEN_FILES
+#define CSV_DEFAULT_MAX_OPEN_FILES 128
+#endif
+
+#ifndef CSV_DEFAULT_BUFFER_SIZE
+#define CSV_DEFAULT_BUFFER_SIZE 4096
+#endif
+
+#ifndef CSV_DEFAULT_FLUSH_TIMEOUT
+#define CSV_DEFAULT_FLUSH_TIMEOUT TIME_T_TO_CDTIME_T_STATIC(10)
+#endif
+
+/* Interval in which open files are checked for having been moved or removed. */
+#ifndef CSV_CHECK_INTERVAL
+#define CSV_CHECK_INTERVAL TIME_T_TO_CDTIME_T_STATIC(10)
+#endif
+
+/* csv_file_t is an open CSV file. Lines are collected in "buffer" and written
+ * with a single write(2), during which the file is locked, once the buffer is
+ * full, the data is older than "FlushTimeout", or the file is flushed or
+ * closed. Open files are kept in a least recently used list, so only the
+ * "MaxOpenFiles" most recently written files stay open.
+ *
+ * files_lock protects the list, "refs" and "listed"; "lock" protects the file
+ * descriptor and the buffer. The list holds one reference to each listed file,
+ * writers hold another one while they use the file. A file is closed once it
+ * has been removed from the list and the last reference has been dropped. */
+typedef struct csv_file_s csv_file_t;
+struct csv_file_s {
+  char *filename;
+  pthread_mutex_t lock;
+  size_t refs;
+  bool listed;
+
+  int fd;
+  cdtime_t last_check; /* time "fd" was last compared with "filename" */
+
+  char *buffer;
+  size_t buffer_fill;
+  cdtime_t first_write; /* time the oldest buffered line was added */
+
+  csv_file_t *prev; /* more recently used */
+  csv_file_t *next; /* less recently used */
+};
+
 /*
  * Private variables
  */
-static const char *config_keys[] = {"DataDir", "StoreRates", "FileDate"};
+static const char *config_keys[] = {"DataDir",      "StoreRates",
+                                    "FileDate",     "MaxOpenFiles",
+                                    "BufferSize",   "FlushTimeout"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static char *datadir;
 static int store_rates;
 static int use_stdio;
 static int file_date = 1;
+static size_t max_open_files = CSV_DEFAULT_MAX_OPEN_FILES;
+static size_t buffer_size = CSV_DEFAULT_BUFFER_SIZE;
+static cdtime_t flush_timeout = CSV_DEFAULT_FLUSH_TIMEOUT;
+
+/* Open files by file name, plus the LRU list. Protected by files_lock, which
+ * is only held while looking up files, not while writing them. */
+static c_avl_tree_t *files;
+static csv_file_t *files_head;
+static csv_file_t *files_tail;
+static size_t files_num;
+static cdtime_t files_last_sweep;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Date suffix of the current day and the time it was computed at. */
+static char date_suffix[16];
+static time_t date_suffix_time;
 
 static int value_list_to_string(char *buffer, int buffer_len,
                                 const data_set_t *ds, const value_list_t *vl) {
@@ -118,7 +182,7 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
     ptr += len;
   }
 
-  status = FORMAT_VL(ptr, ptr_size, vl);
+  status = plugin_format_name_vl(ptr, ptr_size, vl);
   if (status != 0)
     return status;
 
@@ -139,21 +203,27 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
     return ENOMEM;
   }
 
-  /* TODO: Find a way to minimize the calls to `localtime_r',
-   * since they are pretty expensive.. */
+  /* `localtime_r' is pretty expensive, so the suffix is computed at most once
+   * per second. Called with files_lock held. */
   now = time(NULL);
-  if (localtime_r(&now, &struct_tm) == NULL) {
-    ERROR("csv plugin: localtime_r failed");
-    return -1;
-  }
+  if (now != date_suffix_time) {
+    if (localtime_r(&now, &struct_tm) == NULL) {
+      ERROR("csv plugin: localtime_r failed");
+      return -1;
+    }
 
-  status = strftime(ptr, ptr_size, "-%Y-%m-%d", &struct_tm);
-  if (status == 0) /* yep, it returns zero on error. */
-  {
-    ERROR("csv plugin: strftime failed");
-    return -1;
+    status = strftime(date_suffix, sizeof(date_suffix), "-%Y-%m-%d",
+                      &struct_tm);
+    if (status == 0) /* yep, it returns zero on error. */
+    {
+      ERROR("csv plugin: strftime failed");
+      date_suffix_time = 0;
+      return -1;
+    }
+    date_suffix_time = now;
   }
 
+  sstrncpy(ptr, date_suffix, ptr_size);
   return 0;
 } /* int value_list_to_filename */
 
@@ -179,6 +249,300 @@ static int csv_create_file(const char *filename, const data_set_t *ds) {
   return 0;
 } /* int csv_create_file */
 
+/* csv_open_file creates "filename" if necessary, then opens it. */
+static int csv_open_file(const char *filename, const data_set_t *ds) {
+  struct stat statbuf;
+
+  if (stat(filename, &statbuf) == -1) {
+    if (errno == ENOENT) {
+      if (csv_create_file(filename, ds))
+        return -1;
+    } else {
+      ERROR("stat(%s) failed: %s", filename, STRERRNO);
+      return -1;
+    }
+  } else if (!S_ISREG(statbuf.st_mode)) {
+    ERROR("stat(%s): Not a regular file!", filename);
+    return -1;
+  }
+
+  int fd = open(filename, O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd < 0) {
+    ERROR("csv plugin: open (%s) failed: %s", filename, STRERRNO);
+    return -1;
+  }
+
+  return fd;
+} /* int csv_open_file */
+
+/* csv_file_write writes "data" to "f", locking the file for the duration of the
+ * write. Called with f->lock held. */
+static int csv_file_write(csv_file_t *f, const void *data, size_t len) {
+  struct flock fl = {
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET,
+      .l_pid = getpid(),
+  };
+
+  if (fcntl(f->fd, F_SETLK, &fl) != 0) {
+    ERROR("csv plugin: flock (%s) failed: %s", f->filename, STRERRNO);
+    return -1;
+  }
+
+  int status = swrite(f->fd, data, len);
+  if (status != 0)
+    ERROR("csv plugin: write (%s) failed: %s", f->filename, STRERRNO);
+
+  fl.l_type = F_UNLCK;
+  fcntl(f->fd, F_SETLK, &fl);
+
+  return status;
+} /* int csv_file_write */
+
+/* csv_file_flush writes the buffered lines of "f" to disk. Called with f->lock
+ * held. */
+static int csv_file_flush(csv_file_t *f) {
+  if ((f->buffer_fill == 0) || (f->fd < 0))
+    return 0;
+
+  int status = csv_file_write(f, f->buffer, f->buffer_fill);
+
+  f->buffer_fill = 0;
+  f->first_write = 0;
+  return status;
+} /* int csv_file_flush */
+
+/* csv_file_check opens "f" if necessary. Every CSV_CHECK_INTERVAL, the open
+ * file descriptor is compared with "filename" and the file is reopened if it
+ * has been moved or removed, e.g. by log rotation. Buffered lines are written
+ * to the new file. Called with f->lock held. */
+static int csv_file_check(csv_file_t *f, const data_set_t *ds, cdtime_t now) {
+  if (f->fd >= 0) {
+    if ((now - f->last_check) < CSV_CHECK_INTERVAL)
+      return 0;
+
+    struct stat path_stat;
+    struct stat fd_stat;
+    if ((stat(f->filename, &path_stat) == 0) &&
+        (fstat(f->fd, &fd_stat) == 0) && (path_stat.st_dev == fd_stat.st_dev) &&
+        (path_stat.st_ino == fd_stat.st_ino)) {
+      f->last_check = now;
+      return 0;
+    }
+
+    INFO("csv plugin: \"%s\" has been moved or removed, reopening it.",
+         f->filename);
+    close(f->fd);
+    f->fd = -1;
+  }
+
+  f->fd = csv_open_file(f->filename, ds);
+  if (f->fd < 0)
+    return -1;
+
+  f->last_check = now;
+  return 0;
+} /* int csv_file_check */
+
+/* csv_file_destroy writes out and closes a file which is no longer listed or
+ * referenced. */
+static void csv_file_destroy(csv_file_t *f) {
+  csv_file_flush(f);
+
+  if (f->fd >= 0)
+    close(f->fd);
+  pthread_mutex_destroy(&f->lock);
+  sfree(f->filename);
+  sfree(f->buffer);
+  sfree(f);
+} /* void csv_file_destroy */
+
+/* csv_files_destroy destroys a list of files linked by "next". */
+static void csv_files_destroy(csv_file_t *list) {
+  while (list != NULL) {
+    csv_file_t *f = list;
+    list = f->next;
+    csv_file_destroy(f);
+  }
+} /* void csv_files_destroy */
+
+static void csv_file_unlink(csv_file_t *f) {
+  if (f->prev != NULL)
+    f->prev->next = f->next;
+  else
+    files_head = f->next;
+
+  if (f->next != NULL)
+    f->next->prev = f->prev;
+  else
+    files_tail = f->prev;
+
+  f->prev = f->next = NULL;
+}
+
+static void csv_file_push(csv_file_t *f) {
+  f->prev = NULL;
+  f->next = files_head;
+  if (files_head != NULL)
+    files_head->prev = f;
+  files_head = f;
+  if (files_tail == NULL)
+    files_tail = f;
+}
+
+/* csv_file_remove removes "f" from the list of open files and drops the list's
+ * reference. If this was the last reference, "f" is added to "closing", to be
+ * destroyed after files_lock has been released. Called with files_lock held. */
+static void csv_file_remove(csv_file_t *f, csv_file_t **closing) {
+  c_avl_remove(files, f->filename, NULL, NULL);
+  csv_file_unlink(f);
+  f->listed = false;
+  files_num--;
+
+  f->refs--;
+  if (f->refs == 0) {
+    f->next = *closing;
+    *closing = f;
+  }
+} /* void csv_file_remove */
+
+static void csv_close_all(csv_file_t **closing) {
+  while (files_head != NULL)
+    csv_file_remove(files_head, closing);
+}
+
+/* csv_file_get returns a reference to the file "filename", adding it to the
+ * list of open files and removing the least recently used files if necessary.
+ * The file itself is opened by csv_file_check(). Called with files_lock held;
+ * the reference must be dropped with csv_file_release(). */
+static csv_file_t *csv_file_get(const char *filename, csv_file_t **closing) {
+  csv_file_t *f = NULL;
+
+  if (c_avl_get(files, filename, (void *)&f) == 0) {
+    if (f != files_head) {
+      csv_file_unlink(f);
+      csv_file_push(f);
+    }
+    f->refs++;
+    return f;
+  }
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL)
+    return NULL;
+
+  f->filename = strdup(filename);
+  if ((f->filename == NULL) ||
+      ((buffer_size > 0) && ((f->buffer = malloc(buffer_size)) == NULL))) {
+    ERROR("csv plugin: malloc failed.");
+    sfree(f->filename);
+    sfree(f);
+    return NULL;
+  }
+  pthread_mutex_init(&f->lock, /* attr = */ NULL);
+  f->fd = -1;
+
+  if (c_avl_insert(files, f->filename, f) != 0) {
+    ERROR("csv plugin: c_avl_insert (%s) failed.", filename);
+    csv_file_destroy(f);
+    return NULL;
+  }
+  csv_file_push(f);
+  f->listed = true;
+  f->refs = 2; /* the list's and the caller's */
+  files_num++;
+
+  while ((files_num > max_open_files) && (files_tail != f))
+    csv_file_remove(files_tail, closing);
+
+  return f;
+} /* csv_file_t *csv_file_get */
+
+/* csv_file_release drops a reference returned by csv_file_get(). If
+ * "close_file" is true, the file is also removed from the list of open files,
+ * so that it is closed once the last reference is gone. */
+static void csv_file_release(csv_file_t *f, bool close_file) {
+  csv_file_t *closing = NULL;
+
+  pthread_mutex_lock(&files_lock);
+  if (close_file && f->listed)
+    csv_file_remove(f, &closing);
+  f->refs--;
+  bool destroy = (f->refs == 0);
+  pthread_mutex_unlock(&files_lock);
+
+  csv_files_destroy(closing);
+  if (destroy)
+    csv_file_destroy(f);
+} /* void csv_file_release */
+
+/* csv_file_append adds one newline terminated line to the buffer of "f",
+ * writing out the buffer first if the line doesn't fit. Lines are never split
+ * across writes. Called with f->lock held. */
+static int csv_file_append(csv_file_t *f, const char *line, cdtime_t now) {
+  size_t len = strlen(line);
+
+  if ((f->buffer_fill + len) > buffer_size) {
+    int status = csv_file_flush(f);
+    if (status != 0)
+      return status;
+  }
+
+  if (len > buffer_size)
+    return csv_file_write(f, line, len);
+
+  if (f->buffer_fill == 0)
+    f->first_write = now;
+  memcpy(f->buffer + f->buffer_fill, line, len);
+  f->buffer_fill += len;
+
+  if ((now - f->first_write) >= flush_timeout)
+    return csv_file_flush(f);
+
+  return 0;
+} /* int csv_file_append */
+
+/* csv_flush_older writes out all buffers holding data older than "timeout".
+ * If "identifier" is not NULL, only matching files are considered. files_lock
+ * is only held while collecting the files. */
+static void csv_flush_older(cdtime_t timeout, const char *identifier,
+                            cdtime_t now) {
+  size_t prefix_len = (datadir != NULL) ? strlen(datadir) + 1 : 0;
+
+  pthread_mutex_lock(&files_lock);
+  csv_file_t **list = calloc(files_num + 1, sizeof(*list));
+  if (list == NULL) {
+    pthread_mutex_unlock(&files_lock);
+    ERROR("csv plugin: calloc failed.");
+    return;
+  }
+
+  size_t list_num = 0;
+  for (csv_file_t *f = files_head; f != NULL; f = f->next) {
+    if ((identifier != NULL) &&
+        (strncmp(f->filename + prefix_len, identifier, strlen(identifier)) !=
+         0))
+      continue;
+
+    f->refs++;
+    list[list_num] = f;
+    list_num++;
+  }
+  pthread_mutex_unlock(&files_lock);
+
+  for (size_t i = 0; i < list_num; i++) {
+    csv_file_t *f = list[i];
+
+    pthread_mutex_lock(&f->lock);
+    if ((timeout == 0) || ((now - f->first_write) >= timeout))
+      csv_file_flush(f);
+    pthread_mutex_unlock(&f->lock);
+
+    csv_file_release(f, /* close_file = */ false);
+  }
+  sfree(list);
+} /* void csv_flush_older */
+
 static int csv_config(const char *key, const char *value) {
   if (strcasecmp("DataDir", key) == 0) {
     if (datadir != NULL) {
@@ -214,6 +578,27 @@ static int csv_config(const char *key, const char *value) {
       file_date = 1;
     else
       file_date = 0;
+  } else if (strcasecmp("MaxOpenFiles", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 0) {
+      WARNING("csv plugin: Invalid MaxOpenFiles \"%s\".", value);
+      return 1;
+    }
+    max_open_files = (size_t)tmp;
+  } else if (strcasecmp("BufferSize", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 0) {
+      WARNING("csv plugin: Invalid BufferSize \"%s\".", value);
+      return 1;
+    }
+    buffer_size = (size_t)tmp;
+  } else if (strcasecmp("FlushTimeout", key) == 0) {
+    double tmp = atof(value);
+    if (tmp < 0.0) {
+      WARNING("csv plugin: Invalid FlushTimeout \"%s\".", value);
+      return 1;
+    }
+    flush_timeout = DOUBLE_TO_CDTIME_T(tmp);
   } else {
     return -1;
   }
@@ -222,12 +607,8 @@ static int csv_config(const char *key, const char *value) {
 
 static int csv_write(const data_set_t *ds, const value_list_t *vl,
                      user_data_t __attribute__((unused)) * user_data) {
-  struct stat statbuf;
   char filename[512];
   char values[4096];
-  FILE *csv;
-  int csv_fd;
-  struct flock fl = {0};
   int status;
 
   if (0 != strcmp(ds->type, vl->type)) {
@@ -235,16 +616,25 @@ static int csv_write(const data_set_t *ds, const value_list_t *vl,
     return -1;
   }
 
-  status = value_list_to_filename(filename, sizeof(filename), vl);
-  if (status != 0)
+  /* leave room for the newline */
+  if (value_list_to_string(values, sizeof(values) - 1, ds, vl) != 0)
     return -1;
 
-  DEBUG("csv plugin: csv_write: filename = %s;", filename);
+  pthread_mutex_lock(&files_lock);
+
+  char old_suffix[sizeof(date_suffix)];
+  sstrncpy(old_suffix, date_suffix, sizeof(old_suffix));
 
-  if (value_list_to_string(values, sizeof(values), ds, vl) != 0)
+  status = value_list_to_filename(filename, sizeof(filename), vl);
+  if (status != 0) {
+    pthread_mutex_unlock(&files_lock);
     return -1;
+  }
+
+  DEBUG("csv plugin: csv_write: filename = %s;", filename);
 
   if (use_stdio) {
+    pthread_mutex_unlock(&files_lock);
     escape_string(filename, sizeof(filename));
 
     /* Replace commas by colons for PUTVAL compatible output. */
@@ -260,47 +650,84 @@ static int csv_write(const data_set_t *ds, const value_list_t *vl,
     return 0;
   }
 
-  if (stat(filename, &statbuf) == -1) {
-    if (errno == ENOENT) {
-      if (csv_create_file(filename, ds))
-        return -1;
-    } else {
-      ERROR("stat(%s) failed: %s", filename, STRERRNO);
-      return -1;
-    }
-  } else if (!S_ISREG(statbuf.st_mode)) {
-    ERROR("stat(%s): Not a regular file!", filename);
-    return -1;
-  }
+  /* A new day has begun: all open files belong to the previous day. */
+  csv_file_t *closing = NULL;
+  if (file_date && (old_suffix[0] != 0) &&
+      (strcmp(old_suffix, date_suffix) != 0))
+    csv_close_all(&closing);
 
-  csv = fopen(filename, "a");
-  if (csv == NULL) {
-    ERROR("csv plugin: fopen (%s) failed: %s", filename, STRERRNO);
-    return -1;
-  }
-  csv_fd = fileno(csv);
+  csv_file_t *f = csv_file_get(filename, &closing);
 
-  fl.l_pid = getpid();
-  fl.l_type = F_WRLCK;
-  fl.l_whence = SEEK_SET;
+  /* Write out files which haven't been written to in a while. */
+  cdtime_t now = cdtime();
+  bool sweep = (f != NULL) && (max_open_files > 0) && (buffer_size > 0) &&
+               ((now - files_last_sweep) >= flush_timeout);
+  if (sweep)
+    files_last_sweep = now;
+  pthread_mutex_unlock(&files_lock);
 
-  status = fcntl(csv_fd, F_SETLK, &fl);
-  if (status != 0) {
-    ERROR("csv plugin: flock (%s) failed: %s", filename, STRERRNO);
-    fclose(csv);
+  csv_files_destroy(closing);
+  if (f == NULL)
     return -1;
+
+  strcat(values, "\n");
+
+  pthread_mutex_lock(&f->lock);
+  status = csv_file_check(f, ds, now);
+  if (status == 0)
+    status = csv_file_append(f, values, now);
+  bool failed = (f->fd < 0);
+  pthread_mutex_unlock(&f->lock);
+
+  /* Not caching files: close the file right away, like we always did. Files
+   * which could not be opened are not kept either. */
+  csv_file_release(f, /* close_file = */ (max_open_files == 0) || failed);
+
+  if (sweep)
+    csv_flush_older(flush_timeout, /* identifier = */ NULL, now);
+
+  return (status == 0) ? 0 : -1;
+} /* int csv_write */
+
+static int csv_flush(cdtime_t timeout, const char *identifier,
+                     user_data_t __attribute__((unused)) * user_data) {
+  csv_flush_older(timeout, identifier, cdtime());
+  return 0;
+} /* int csv_flush */
+
+static int csv_init(void) {
+  pthread_mutex_lock(&files_lock);
+  if (files == NULL) {
+    files = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (files == NULL) {
+      pthread_mutex_unlock(&files_lock);
+      ERROR("csv plugin: c_avl_create failed.");
+      return -1;
+    }
   }
+  pthread_mutex_unlock(&files_lock);
+  return 0;
+} /* int csv_init */
 
-  fprintf(csv, "%s\n", values);
+static int csv_shutdown(void) {
+  csv_file_t *closing = NULL;
 
-  /* The lock is implicitely released. I we don't release it explicitely
-   * because the `FILE *' may need to flush a cache first */
-  fclose(csv);
+  pthread_mutex_lock(&files_lock);
+  if (files != NULL) {
+    csv_close_all(&closing);
+    c_avl_destroy(files);
+    files = NULL;
+  }
+  pthread_mutex_unlock(&files_lock);
 
+  csv_files_destroy(closing);
   return 0;
-} /* int csv_write */
+} /* int csv_shutdown */
 
 void module_register(void) {
   plugin_register_config("csv", csv_config, config_keys, config_keys_num);
+  plugin_register_init("csv", csv_init);
   plugin_register_write("csv", csv_write, /* user_data = */ NULL);
+  plugin_register_flush("csv", csv_flush, /* user_data = */ NULL);
+  plugin_register_shutdown("csv", csv_shutdown);
 } /* void module_register */
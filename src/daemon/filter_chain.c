@@ -30,8 +30,25 @@
 #include "filter_chain.h"
 #include "plugin.h"
 #include "utils/common/common.h"
+#include "utils/avltree/avltree.h"
+#include "utils_cache.h"
 #include "utils_complain.h"
 
+/* Number of identifier fields a rule can be indexed by, see fc_vl_field(). */
+#define FC_FIELDS_NUM 5
+
+/* Match results are remembered per identifier for chains with up to this
+ * many rules. The memo is split into stripes with their own lock, each of
+ * which holds up to FC_MEMO_STRIPE_SIZE identifiers. When a stripe is full, one
+ * entry which has not been used recently is replaced, see
+ * fc_memo_stripe_evict(). */
+#define FC_MEMO_RULES_MAX 1024
+#define FC_MEMO_WORDS_MAX (FC_MEMO_RULES_MAX / 64)
+#define FC_MEMO_STRIPES_BITS 4
+#define FC_MEMO_STRIPES (1 << FC_MEMO_STRIPES_BITS)
+#define FC_MEMO_STRIPE_SIZE 16384
+#define FC_MEMO_BUCKETS 4096
+
 /*
  * Data types
  */
@@ -43,6 +60,8 @@ struct fc_match_s {
   char name[DATA_MAX_NAME_LEN];
   match_proc_t proc;
   void *user_data;
+  /* Set by fc_chain_compile() if the rule's fields replace this match. */
+  bool exact;
   fc_match_t *next;
 }; /* }}} */
 
@@ -65,8 +84,53 @@ struct fc_rule_s {
   fc_match_t *matches;
   fc_target_t *targets;
   fc_rule_t *next;
+
+  /* Set by fc_chain_compile(). "fields" holds the values the identifier
+   * fields must be equal to, NULL meaning any value. "never" is set if the
+   * matches contradict each other. "memoize" is set if the remaining matches
+   * depend only on the identifier. "may_modify" is set if a target may
+   * change the value list. */
+  size_t index;
+  char const *fields[FC_FIELDS_NUM];
+  bool never;
+  bool memoize;
+  bool may_modify;
 }; /* }}} */
 
+/* Sorted list of rule indices. */
+typedef struct {
+  size_t *rules;
+  size_t rules_num;
+} fc_rule_list_t;
+
+/* Match results of one identifier. "bits" holds one word array of rules with
+ * known results, followed by one of rules that matched. */
+struct fc_memo_entry_s;
+typedef struct fc_memo_entry_s fc_memo_entry_t;
+struct fc_memo_entry_s {
+  uc_ident_t *ident;
+  fc_memo_entry_t *next;
+  bool referenced;
+  uint64_t bits[];
+};
+
+/* "entries" lists all entries of the stripe, in the order in which the
+ * eviction "hand" visits them. */
+typedef struct {
+  pthread_mutex_t lock;
+  fc_memo_entry_t **buckets;
+  fc_memo_entry_t **entries;
+  size_t entries_num;
+  size_t hand;
+} fc_memo_stripe_t;
+
+/* Copy of an identifier's memo entry, used while processing a value list. */
+typedef struct {
+  uc_ident_t *ident;
+  bool dirty;
+  uint64_t bits[2 * FC_MEMO_WORDS_MAX];
+} fc_memo_state_t;
+
 /* List of chains, used for `chain_list_head' */
 struct fc_chain_s /* {{{ */
 {
@@ -74,8 +138,29 @@ struct fc_chain_s /* {{{ */
   fc_rule_t *rules;
   fc_target_t *targets;
   fc_chain_t *next;
+
+  /* Compiled form of "rules", see fc_chain_compile(). "index" maps the value
+   * of the "index_field" to the rules which require that value; the other
+   * rules are listed in "unindexed". */
+  fc_rule_t **rule_array;
+  size_t rules_num;
+  int index_field;
+  c_avl_tree_t *index;
+  fc_rule_list_t unindexed;
+  fc_memo_stripe_t *memo;
+  size_t memo_words;
 }; /* }}} */
 
+/* Iterates over the rules of a chain which may match a value list. */
+typedef struct {
+  fc_rule_t *next;
+  bool use_index;
+  fc_rule_list_t const *indexed;
+  size_t indexed_pos;
+  size_t unindexed_pos;
+  size_t pos;
+} fc_rule_iter_t;
+
 /* Writer configuration. */
 struct fc_writer_s;
 typedef struct fc_writer_s fc_writer_t; /* {{{ */
@@ -94,6 +179,197 @@ static fc_chain_t *chain_list_head;
 /*
  * Private functions
  */
+static int fc_chain_compile(fc_chain_t *chain);
+
+static char const *fc_vl_field(value_list_t const *vl, int field) /* {{{ */
+{
+  switch (field) {
+  case 0:
+    return vl->host;
+  case 1:
+    return vl->plugin;
+  case 2:
+    return vl->plugin_instance;
+  case 3:
+    return vl->type;
+  default:
+    return vl->type_instance;
+  }
+} /* }}} char const *fc_vl_field */
+
+static fc_memo_stripe_t *fc_memo_stripe(fc_chain_t *chain, /* {{{ */
+                                        uc_ident_t const *ident,
+                                        fc_memo_entry_t ***ret_bucket) {
+  /* The identifiers are interned, so their address identifies them. */
+  uint64_t hash = (uint64_t)(uintptr_t)ident * UINT64_C(0x9E3779B97F4A7C15);
+  fc_memo_stripe_t *stripe =
+      chain->memo + (hash >> (64 - FC_MEMO_STRIPES_BITS));
+
+  *ret_bucket = NULL;
+  if (stripe->buckets != NULL)
+    *ret_bucket = stripe->buckets + ((hash >> 32) % FC_MEMO_BUCKETS);
+
+  return stripe;
+} /* }}} fc_memo_stripe_t *fc_memo_stripe */
+
+/* Frees all entries of a stripe. */
+static void fc_memo_stripe_destroy(fc_memo_stripe_t *stripe) /* {{{ */
+{
+  for (size_t i = 0; i < stripe->entries_num; i++) {
+    uc_ident_release(stripe->entries[i]->ident);
+    free(stripe->entries[i]);
+  }
+  sfree(stripe->entries);
+  sfree(stripe->buckets);
+  stripe->entries_num = 0;
+  stripe->hand = 0;
+} /* }}} void fc_memo_stripe_destroy */
+
+/* Picks the entry of a full stripe to be replaced with the "clock" algorithm:
+ * the hand skips entries which have been looked up since it last passed them,
+ * clearing their flag. The entry is unlinked from its bucket and keeps its
+ * place in "entries". Must be called with the stripe's lock held. */
+static fc_memo_entry_t *fc_memo_stripe_evict(fc_chain_t *chain, /* {{{ */
+                                             fc_memo_stripe_t *stripe) {
+  fc_memo_entry_t *e;
+  while ((e = stripe->entries[stripe->hand])->referenced) {
+    e->referenced = false;
+    stripe->hand = (stripe->hand + 1) % stripe->entries_num;
+  }
+  stripe->hand = (stripe->hand + 1) % stripe->entries_num;
+
+  fc_memo_entry_t **bucket;
+  fc_memo_stripe(chain, e->ident, &bucket);
+  while (*bucket != e)
+    bucket = &(*bucket)->next;
+  *bucket = e->next;
+
+  return e;
+} /* }}} fc_memo_entry_t *fc_memo_stripe_evict */
+
+static void fc_memo_state_init(fc_chain_t *chain, /* {{{ */
+                               value_list_t const *vl,
+                               fc_memo_state_t *state) {
+  state->ident = NULL;
+  state->dirty = false;
+  if ((chain->memo == NULL) || (vl->ident == NULL))
+    return;
+
+  state->ident = vl->ident;
+  memset(state->bits, 0, 2 * chain->memo_words * sizeof(*state->bits));
+
+  fc_memo_entry_t **bucket;
+  fc_memo_stripe_t *stripe = fc_memo_stripe(chain, state->ident, &bucket);
+
+  pthread_mutex_lock(&stripe->lock);
+  for (fc_memo_entry_t *e = (bucket != NULL) ? *bucket : NULL; e != NULL;
+       e = e->next) {
+    if (e->ident == state->ident) {
+      memcpy(state->bits, e->bits, 2 * chain->memo_words * sizeof(*e->bits));
+      e->referenced = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&stripe->lock);
+} /* }}} void fc_memo_state_init */
+
+/* Stores the results gathered while processing "vl". This must be done
+ * before invoking targets which may drop the value list's reference to the
+ * identifier. */
+static void fc_memo_state_store(fc_chain_t *chain, /* {{{ */
+                                value_list_t const *vl,
+                                fc_memo_state_t *state) {
+  if (!state->dirty || (state->ident == NULL) || (vl->ident != state->ident))
+    return;
+  state->dirty = false;
+
+  fc_memo_entry_t **bucket;
+  fc_memo_stripe_t *stripe = fc_memo_stripe(chain, state->ident, &bucket);
+
+  pthread_mutex_lock(&stripe->lock);
+  if (bucket == NULL) {
+    stripe->buckets = calloc(FC_MEMO_BUCKETS, sizeof(*stripe->buckets));
+    stripe->entries = calloc(FC_MEMO_STRIPE_SIZE, sizeof(*stripe->entries));
+    if ((stripe->buckets == NULL) || (stripe->entries == NULL)) {
+      sfree(stripe->buckets);
+      sfree(stripe->entries);
+      pthread_mutex_unlock(&stripe->lock);
+      return;
+    }
+    fc_memo_stripe(chain, state->ident, &bucket);
+  }
+
+  fc_memo_entry_t *e;
+  for (e = *bucket; e != NULL; e = e->next)
+    if (e->ident == state->ident)
+      break;
+
+  /* The identifier of an evicted entry is released after unlocking the
+   * stripe, so the cache's lock is not taken while holding it. */
+  uc_ident_t *evicted = NULL;
+  if (e == NULL) {
+    if (stripe->entries_num < FC_MEMO_STRIPE_SIZE) {
+      e = calloc(1, sizeof(*e) + 2 * chain->memo_words * sizeof(*e->bits));
+      if (e == NULL) {
+        pthread_mutex_unlock(&stripe->lock);
+        return;
+      }
+      stripe->entries[stripe->entries_num] = e;
+      stripe->entries_num++;
+    } else {
+      e = fc_memo_stripe_evict(chain, stripe);
+      evicted = e->ident;
+      e->referenced = false;
+      memset(e->bits, 0, 2 * chain->memo_words * sizeof(*e->bits));
+    }
+
+    uc_ident_ref(state->ident);
+    e->ident = state->ident;
+    e->next = *bucket;
+    *bucket = e;
+  }
+
+  /* Results of other threads are kept, they are equal to ours. */
+  for (size_t i = 0; i < 2 * chain->memo_words; i++)
+    e->bits[i] |= state->bits[i];
+  pthread_mutex_unlock(&stripe->lock);
+
+  uc_ident_release(evicted);
+} /* }}} void fc_memo_state_store */
+
+/* Frees the compiled form of a chain. The chain is then evaluated by trying
+ * all rules in order. */
+static void fc_chain_uncompile(fc_chain_t *chain) /* {{{ */
+{
+  if (chain->memo != NULL) {
+    for (size_t i = 0; i < FC_MEMO_STRIPES; i++) {
+      fc_memo_stripe_destroy(chain->memo + i);
+      pthread_mutex_destroy(&chain->memo[i].lock);
+    }
+    sfree(chain->memo);
+  }
+  chain->memo_words = 0;
+
+  if (chain->index != NULL) {
+    void *key;
+    fc_rule_list_t *list;
+    while (c_avl_pick(chain->index, &key, (void *)&list) == 0) {
+      /* The keys are owned by the matches. */
+      sfree(list->rules);
+      sfree(list);
+    }
+    c_avl_destroy(chain->index);
+    chain->index = NULL;
+  }
+  chain->index_field = -1;
+
+  sfree(chain->unindexed.rules);
+  chain->unindexed.rules_num = 0;
+
+  sfree(chain->rule_array);
+  chain->rules_num = 0;
+} /* }}} void fc_chain_uncompile */
+
 static void fc_free_matches(fc_match_t *m) /* {{{ */
 {
   if (m == NULL)
@@ -151,6 +427,7 @@ static void fc_free_chains(fc_chain_t *c) /* {{{ */
   if (c == NULL)
     return;
 
+  fc_chain_uncompile(c);
   fc_free_rules(c->rules);
   fc_free_targets(c->targets);
 
@@ -476,6 +753,7 @@ static int fc_config_add_chain(const oconfig_item_t *ci) /* {{{ */
       return -1;
     }
     sstrncpy(chain->name, ci->values[0].value.string, sizeof(chain->name));
+    chain->index_field = -1;
   }
 
   for (int i = 0; i < ci->children_num; i++) {
@@ -501,6 +779,10 @@ static int fc_config_add_chain(const oconfig_item_t *ci) /* {{{ */
     return -1;
   }
 
+  /* Failing to compile the chain is not fatal, the rules are then simply
+   * tried one after another. */
+  fc_chain_compile(chain);
+
   if (chain_list_head != NULL) {
     if (!new_chain)
       return 0;
@@ -747,6 +1029,303 @@ static int fc_bit_write_invoke(const data_set_t *ds, /* {{{ */
   return FC_TARGET_CONTINUE;
 } /* }}} int fc_bit_write_invoke */
 
+/*
+ * Compiled chains
+ *
+ * When a chain has been configured, the matches of each rule are asked to
+ * describe themselves. Identifier fields which must have a certain value are
+ * copied into the rule, so that matches which are fully described by them
+ * need not be called. The field with the most such conditions is used to
+ * index the rules, so only rules requiring the value list's value of that
+ * field, or no particular value, are tried. Finally, the results of rules
+ * whose matches depend only on the identifier are remembered for each
+ * interned identifier attached by the cache.
+ */
+static int fc_rule_list_append(fc_rule_list_t *list, size_t index) /* {{{ */
+{
+  size_t *tmp =
+      realloc(list->rules, (list->rules_num + 1) * sizeof(*list->rules));
+  if (tmp == NULL)
+    return ENOMEM;
+
+  list->rules = tmp;
+  list->rules[list->rules_num] = index;
+  list->rules_num++;
+  return 0;
+} /* }}} int fc_rule_list_append */
+
+static void fc_rule_compile(fc_rule_t *rule) /* {{{ */
+{
+  bool identifier_only = true;
+  bool inexact = false;
+
+  memset(rule->fields, 0, sizeof(rule->fields));
+  rule->never = false;
+
+  for (fc_match_t *m = rule->matches; m != NULL; m = m->next) {
+    fc_match_info_t info = {0};
+
+    m->exact = false;
+    if ((m->proc.describe == NULL) ||
+        ((*m->proc.describe)(m->user_data, &info) != 0)) {
+      identifier_only = false;
+      inexact = true;
+      continue;
+    }
+
+    char const *values[FC_FIELDS_NUM] = {info.host, info.plugin,
+                                         info.plugin_instance, info.type,
+                                         info.type_instance};
+    for (int i = 0; i < FC_FIELDS_NUM; i++) {
+      if (values[i] == NULL)
+        continue;
+      else if (rule->fields[i] == NULL)
+        rule->fields[i] = values[i];
+      else if (strcmp(rule->fields[i], values[i]) != 0)
+        rule->never = true;
+    }
+
+    m->exact = info.exact;
+    if (!info.exact)
+      inexact = true;
+    if (!info.identifier_only)
+      identifier_only = false;
+  }
+
+  /* Rules which only consist of exact matches are cheap to evaluate. */
+  rule->memoize = identifier_only && inexact;
+
+  rule->may_modify = false;
+  for (fc_target_t *t = rule->targets; t != NULL; t = t->next) {
+    if ((t->proc.invoke != fc_bit_write_invoke) &&
+        (t->proc.invoke != fc_bit_stop_invoke) &&
+        (t->proc.invoke != fc_bit_return_invoke))
+      rule->may_modify = true;
+  }
+} /* }}} void fc_rule_compile */
+
+static int fc_chain_index(fc_chain_t *chain) /* {{{ */
+{
+  size_t fields_num[FC_FIELDS_NUM] = {0};
+
+  for (size_t i = 0; i < chain->rules_num; i++) {
+    fc_rule_t *rule = chain->rule_array[i];
+    for (int j = 0; j < FC_FIELDS_NUM; j++)
+      if (!rule->never && (rule->fields[j] != NULL))
+        fields_num[j]++;
+  }
+
+  for (int i = 0; i < FC_FIELDS_NUM; i++)
+    if ((fields_num[i] > 0) &&
+        ((chain->index_field < 0) ||
+         (fields_num[i] > fields_num[chain->index_field])))
+      chain->index_field = i;
+
+  /* An index on a single rule does not save any work. */
+  if ((chain->index_field < 0) || (fields_num[chain->index_field] < 2)) {
+    chain->index_field = -1;
+    return 0;
+  }
+
+  chain->index = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (chain->index == NULL)
+    return ENOMEM;
+
+  for (size_t i = 0; i < chain->rules_num; i++) {
+    fc_rule_t *rule = chain->rule_array[i];
+    char const *key = rule->fields[chain->index_field];
+    fc_rule_list_t *list;
+    int status;
+
+    if (rule->never)
+      continue;
+
+    if (key == NULL) {
+      list = &chain->unindexed;
+    } else if (c_avl_get(chain->index, key, (void *)&list) != 0) {
+      list = calloc(1, sizeof(*list));
+      if (list == NULL)
+        return ENOMEM;
+      status = c_avl_insert(chain->index, (void *)key, list);
+      if (status != 0) {
+        sfree(list);
+        return ENOMEM;
+      }
+    }
+
+    status = fc_rule_list_append(list, i);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* }}} int fc_chain_index */
+
+static int fc_chain_compile(fc_chain_t *chain) /* {{{ */
+{
+  size_t memoize_num = 0;
+  int status;
+
+  fc_chain_uncompile(chain);
+
+  for (fc_rule_t *rule = chain->rules; rule != NULL; rule = rule->next)
+    chain->rules_num++;
+  if (chain->rules_num == 0)
+    return 0;
+
+  chain->rule_array = calloc(chain->rules_num, sizeof(*chain->rule_array));
+  if (chain->rule_array == NULL) {
+    ERROR("fc_chain_compile: calloc failed.");
+    chain->rules_num = 0;
+    return ENOMEM;
+  }
+
+  size_t i = 0;
+  for (fc_rule_t *rule = chain->rules; rule != NULL; rule = rule->next) {
+    chain->rule_array[i] = rule;
+    rule->index = i;
+    fc_rule_compile(rule);
+    if (rule->memoize)
+      memoize_num++;
+    i++;
+  }
+
+  status = fc_chain_index(chain);
+  if (status != 0) {
+    ERROR("fc_chain_compile: Indexing chain %s failed.", chain->name);
+    fc_chain_uncompile(chain);
+    return status;
+  }
+
+  if ((memoize_num > 0) && (chain->rules_num <= FC_MEMO_RULES_MAX)) {
+    chain->memo = calloc(FC_MEMO_STRIPES, sizeof(*chain->memo));
+    if (chain->memo == NULL) {
+      ERROR("fc_chain_compile: calloc failed.");
+      fc_chain_uncompile(chain);
+      return ENOMEM;
+    }
+    for (i = 0; i < FC_MEMO_STRIPES; i++)
+      pthread_mutex_init(&chain->memo[i].lock, NULL);
+    chain->memo_words = (chain->rules_num + 63) / 64;
+  }
+
+  DEBUG("fc_chain_compile (%s): %" PRIsz " rules, %" PRIsz
+        " of them not indexed by field %i, %" PRIsz " memoized.",
+        chain->name, chain->rules_num,
+        (chain->index != NULL) ? chain->unindexed.rules_num : chain->rules_num,
+        chain->index_field, (chain->memo != NULL) ? memoize_num : 0);
+
+  return 0;
+} /* }}} int fc_chain_compile */
+
+static void fc_rule_iter_init(fc_rule_iter_t *iter, /* {{{ */
+                              fc_chain_t *chain, value_list_t const *vl) {
+  *iter = (fc_rule_iter_t){.next = chain->rules};
+
+  if (chain->index == NULL)
+    return;
+
+  iter->use_index = true;
+  if (c_avl_get(chain->index, fc_vl_field(vl, chain->index_field),
+                (void *)&iter->indexed) != 0)
+    iter->indexed = NULL;
+} /* }}} void fc_rule_iter_init */
+
+static fc_rule_t *fc_rule_iter_next(fc_rule_iter_t *iter, /* {{{ */
+                                    fc_chain_t *chain) {
+  if (chain->rule_array == NULL) {
+    fc_rule_t *rule = iter->next;
+    if (rule != NULL)
+      iter->next = rule->next;
+    return rule;
+  }
+
+  if (!iter->use_index) {
+    if (iter->pos >= chain->rules_num)
+      return NULL;
+    return chain->rule_array[iter->pos++];
+  }
+
+  /* Merge the rules indexed by the value list's field with the rules which
+   * are not indexed. Both lists are sorted and disjoint. */
+  fc_rule_list_t const *indexed = iter->indexed;
+  fc_rule_list_t const *unindexed = &chain->unindexed;
+  size_t next = SIZE_MAX;
+
+  if ((indexed != NULL) && (iter->indexed_pos < indexed->rules_num))
+    next = indexed->rules[iter->indexed_pos];
+  if ((iter->unindexed_pos < unindexed->rules_num) &&
+      (unindexed->rules[iter->unindexed_pos] < next)) {
+    next = unindexed->rules[iter->unindexed_pos];
+    iter->unindexed_pos++;
+  } else if (next != SIZE_MAX) {
+    iter->indexed_pos++;
+  } else {
+    return NULL;
+  }
+
+  iter->pos = next + 1;
+  return chain->rule_array[next];
+} /* }}} fc_rule_t *fc_rule_iter_next */
+
+/* Called after the targets of "rule" have been invoked. If they may have
+ * changed the value list, the index is no longer valid for it. */
+static void fc_rule_iter_fired(fc_rule_iter_t *iter, /* {{{ */
+                               fc_rule_t const *rule) {
+  if (rule->may_modify)
+    iter->use_index = false;
+} /* }}} void fc_rule_iter_fired */
+
+/* Returns FC_MATCH_MATCHES if all matches of the rule match, FC_MATCH_NO_MATCH
+ * if they don't and a negative value if a match failed. */
+static int fc_rule_match(const data_set_t *ds, /* {{{ */
+                         const value_list_t *vl, fc_chain_t *chain,
+                         fc_rule_t *rule, fc_memo_state_t *memo) {
+  if (chain->rule_array != NULL) {
+    if (rule->never)
+      return FC_MATCH_NO_MATCH;
+    for (int i = 0; i < FC_FIELDS_NUM; i++)
+      if ((rule->fields[i] != NULL) &&
+          (strcmp(rule->fields[i], fc_vl_field(vl, i)) != 0))
+        return FC_MATCH_NO_MATCH;
+  }
+
+  /* The memo is not used once a target has changed the value list. */
+  bool memoize = rule->memoize && (memo->ident != NULL) &&
+                 (memo->ident == vl->ident) && (chain->memo != NULL);
+  size_t word = rule->index / 64;
+  uint64_t bit = UINT64_C(1) << (rule->index % 64);
+  if (memoize && (memo->bits[word] & bit))
+    return (memo->bits[chain->memo_words + word] & bit) ? FC_MATCH_MATCHES
+                                                         : FC_MATCH_NO_MATCH;
+
+  /* N. B.: rule->matches may be NULL. */
+  for (fc_match_t *match = rule->matches; match != NULL; match = match->next) {
+    if (match->exact && (chain->rule_array != NULL))
+      continue;
+
+    /* FIXME: Pass the meta-data to match targets here (when implemented). */
+    int status =
+        (*match->proc.match)(ds, vl, /* meta = */ NULL, &match->user_data);
+    if (status < 0)
+      return status;
+    else if (status != FC_MATCH_MATCHES) {
+      if (memoize) {
+        memo->bits[word] |= bit;
+        memo->dirty = true;
+      }
+      return FC_MATCH_NO_MATCH;
+    }
+  }
+
+  if (memoize) {
+    memo->bits[word] |= bit;
+    memo->bits[chain->memo_words + word] |= bit;
+    memo->dirty = true;
+  }
+  return FC_MATCH_MATCHES;
+} /* }}} int fc_rule_match */
+
 static int fc_init_once(void) /* {{{ */
 {
   static int done;
@@ -855,6 +1434,23 @@ fc_chain_t *fc_chain_get_by_name(const char *chain_name) /* {{{ */
   return NULL;
 } /* }}} int fc_chain_get_by_name */
 
+/* Invokes "target". Targets other than the built-in ones may modify the
+ * identifier, so the interned identifier attached by the cache is dropped
+ * before calling them. */
+static int fc_target_invoke(const data_set_t *ds, value_list_t *vl, /* {{{ */
+                            fc_target_t *target) {
+  if ((target->proc.invoke != fc_bit_write_invoke) &&
+      (target->proc.invoke != fc_bit_jump_invoke) &&
+      (target->proc.invoke != fc_bit_stop_invoke) &&
+      (target->proc.invoke != fc_bit_return_invoke) && (vl->ident != NULL)) {
+    uc_ident_release(vl->ident);
+    vl->ident = NULL;
+  }
+
+  /* FIXME: Pass the meta-data to match targets here (when implemented). */
+  return (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
+} /* }}} int fc_target_invoke */
+
 int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
                      fc_chain_t *chain) {
   fc_target_t *target;
@@ -865,8 +1461,14 @@ int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
 
   DEBUG("fc_process_chain (chain = %s);", chain->name);
 
-  for (fc_rule_t *rule = chain->rules; rule != NULL; rule = rule->next) {
-    fc_match_t *match;
+  fc_memo_state_t memo;
+  fc_memo_state_init(chain, vl, &memo);
+
+  fc_rule_iter_t iter;
+  fc_rule_iter_init(&iter, chain, vl);
+
+  for (fc_rule_t *rule = fc_rule_iter_next(&iter, chain); rule != NULL;
+       rule = fc_rule_iter_next(&iter, chain)) {
     status = FC_TARGET_CONTINUE;
 
     if (rule->name[0] != 0) {
@@ -874,35 +1476,25 @@ int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
             rule->name);
     }
 
-    /* N. B.: rule->matches may be NULL. */
-    for (match = rule->matches; match != NULL; match = match->next) {
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status =
-          (*match->proc.match)(ds, vl, /* meta = */ NULL, &match->user_data);
-      if (status < 0) {
-        WARNING("fc_process_chain (%s): A match failed.", chain->name);
-        break;
-      } else if (status != FC_MATCH_MATCHES)
-        break;
-    }
-
-    /* for-loop has been aborted: Either error or no match. */
-    if (match != NULL) {
-      status = FC_TARGET_CONTINUE;
+    int match_status = fc_rule_match(ds, vl, chain, rule, &memo);
+    if (match_status < 0) {
+      WARNING("fc_process_chain (%s): A match failed.", chain->name);
+      continue;
+    } else if (match_status != FC_MATCH_MATCHES)
       continue;
-    }
 
     if (rule->name[0] != 0) {
       DEBUG("fc_process_chain (%s): Rule `%s' matches.", chain->name,
             rule->name);
     }
 
+    if (rule->may_modify)
+      fc_memo_state_store(chain, vl, &memo);
+
     for (target = rule->targets; target != NULL; target = target->next) {
       /* If we get here, all matches have matched the value. Execute the
        * target. */
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status =
-          (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
+      status = fc_target_invoke(ds, vl, target);
       if (status < 0) {
         WARNING("fc_process_chain (%s): A target failed.", chain->name);
         continue;
@@ -918,6 +1510,7 @@ int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
                 chain->name, target->name, status);
       }
     }
+    fc_rule_iter_fired(&iter, rule);
 
     if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN)) {
       if (rule->name[0] != 0) {
@@ -930,6 +1523,8 @@ int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
     }
   } /* for (rule) */
 
+  fc_memo_state_store(chain, vl, &memo);
+
   if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN))
     return status;
 
@@ -939,9 +1534,7 @@ int fc_process_chain(const data_set_t *ds, value_list_t *vl, /* {{{ */
   for (target = chain->targets; target != NULL; target = target->next) {
     /* If we get here, all matches have matched the value. Execute the
      * target. */
-    /* FIXME: Pass the meta-data to match targets here (when implemented). */
-    status =
-        (*target->proc.invoke)(ds, vl, /* meta = */ NULL, &target->user_data);
+    status = fc_target_invoke(ds, vl, target);
     if (status < 0) {
       WARNING("fc_process_chain (%s): The default target failed.", chain->name);
     } else if (status == FC_TARGET_CONTINUE)
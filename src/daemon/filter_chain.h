@@ -41,11 +41,34 @@
 /*
  * Match functions
  */
+/* Filled in by a match's optional "describe" callback so that chains can be
+ * compiled when the configuration has been read. Each field, if not NULL,
+ * is a value the corresponding part of the identifier must be equal to for
+ * the match to succeed. The strings must remain valid until the match is
+ * destroyed.
+ *
+ * "exact" is set if these conditions are equivalent to the match, i.e. the
+ * match callback need not be called at all. "identifier_only" is set if the
+ * result of the match depends only on the identifier of the value list, so
+ * that it can be remembered for each identifier. */
+struct fc_match_info_s {
+  char const *host;
+  char const *plugin;
+  char const *plugin_instance;
+  char const *type;
+  char const *type_instance;
+  bool exact;
+  bool identifier_only;
+};
+typedef struct fc_match_info_s fc_match_info_t;
+
 struct match_proc_s {
   int (*create)(const oconfig_item_t *ci, void **user_data);
   int (*destroy)(void **user_data);
   int (*match)(const data_set_t *ds, const value_list_t *vl,
                notification_meta_t **meta, void **user_data);
+  /* Optional. Returns zero if "info" has been filled in. */
+  int (*describe)(void *user_data, fc_match_info_t *info);
 };
 typedef struct match_proc_s match_proc_t;
 
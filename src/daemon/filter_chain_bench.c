@@ -0,0 +1,213 @@
+/**
+ * collectd - src/daemon/filter_chain_bench.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Times a chain of regex-like rules, each of which selects a plugin and some
+ * type instances, uncompiled, compiled and with memoized identifiers. This is
+ * not part of "make check"; build and run it with "make bench_filter_chain". */
+
+/* plugin_mock.c provides a stub of fc_configure(). */
+#define fc_configure fc_configure_bench
+#include "filter_chain.c" /* sic */
+#undef fc_configure
+
+#define BENCH_RULES 300
+#define BENCH_VALUES 200000
+
+int plugin_write(const char *plugin, const data_set_t *ds,
+                 const value_list_t *vl) {
+  return 0;
+}
+
+void plugin_log_available_writers(void) { /* nop */
+}
+
+const char *global_option_get(const char *option) { return "false"; }
+
+/* plugin_mock's cdtime() is constant, so use a real clock for timing. */
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* The "bench" match compares the plugin to a value and the type instance to a
+ * prefix, which it cannot describe as an exact condition. */
+static size_t match_calls;
+
+typedef struct {
+  char *plugin;
+  char *type_instance;
+} bench_match_t;
+
+static int bench_match_destroy(void **user_data) {
+  bench_match_t *m = *user_data;
+  sfree(m->plugin);
+  sfree(m->type_instance);
+  sfree(m);
+  return 0;
+}
+
+static int bench_match_create(const oconfig_item_t *ci, void **user_data) {
+  bench_match_t *m = calloc(1, sizeof(*m));
+  if (m == NULL)
+    return ENOMEM;
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+    if (strcasecmp("Plugin", child->key) == 0)
+      m->plugin = strdup(child->values[0].value.string);
+    else if (strcasecmp("TypeInstancePrefix", child->key) == 0)
+      m->type_instance = strdup(child->values[0].value.string);
+  }
+
+  *user_data = m;
+  return 0;
+}
+
+static int bench_match_match(const data_set_t *ds, const value_list_t *vl,
+                             notification_meta_t **meta, void **user_data) {
+  bench_match_t *m = *user_data;
+
+  match_calls++;
+  if ((m->plugin != NULL) && (strcmp(vl->plugin, m->plugin) != 0))
+    return FC_MATCH_NO_MATCH;
+  if ((m->type_instance != NULL) &&
+      (strncmp(vl->type_instance, m->type_instance,
+               strlen(m->type_instance)) != 0))
+    return FC_MATCH_NO_MATCH;
+
+  return FC_MATCH_MATCHES;
+}
+
+static int bench_match_describe(void *user_data, fc_match_info_t *info) {
+  bench_match_t *m = user_data;
+
+  info->exact = (m->type_instance == NULL);
+  info->identifier_only = true;
+  info->plugin = m->plugin;
+  return 0;
+}
+
+static oconfig_item_t *bench_child(oconfig_item_t *parent, char const *key,
+                                   char const *value) {
+  oconfig_item_t *tmp = realloc(parent->children, (parent->children_num + 1) *
+                                                      sizeof(*tmp));
+  assert(tmp != NULL);
+  parent->children = tmp;
+
+  oconfig_item_t *ci = parent->children + parent->children_num;
+  parent->children_num++;
+
+  *ci = (oconfig_item_t){.key = strdup(key), .parent = parent};
+  if (value != NULL) {
+    ci->values = calloc(1, sizeof(*ci->values));
+    assert(ci->values != NULL);
+    ci->values[0].type = OCONFIG_TYPE_STRING;
+    ci->values[0].value.string = strdup(value);
+    ci->values_num = 1;
+  }
+  return ci;
+}
+
+static void bench_item_free(oconfig_item_t *ci) {
+  for (int i = 0; i < ci->children_num; i++)
+    bench_item_free(ci->children + i);
+  for (int i = 0; i < ci->values_num; i++)
+    sfree(ci->values[i].value.string);
+  sfree(ci->values);
+  sfree(ci->children);
+  sfree(ci->key);
+}
+
+int main(void) {
+  fc_register_match("bench", (match_proc_t){.create = bench_match_create,
+                                            .destroy = bench_match_destroy,
+                                            .match = bench_match_match,
+                                            .describe = bench_match_describe});
+
+  /* <Chain "bench"><Rule><Match "bench">Plugin "pluginN"
+   * TypeInstancePrefix "tiM"</Match><Target "write">Plugin "bench"</Target>
+   * </Rule>...</Chain> */
+  oconfig_item_t ci = {.key = strdup("Chain"), .values_num = 1};
+  ci.values = calloc(1, sizeof(*ci.values));
+  assert(ci.values != NULL);
+  ci.values[0].type = OCONFIG_TYPE_STRING;
+  ci.values[0].value.string = strdup("bench");
+
+  for (size_t i = 0; i < BENCH_RULES; i++) {
+    char value[32];
+    oconfig_item_t *rule = bench_child(&ci, "Rule", NULL);
+    oconfig_item_t *match = bench_child(rule, "Match", "bench");
+    ssnprintf(value, sizeof(value), "plugin%zu", i % 100);
+    bench_child(match, "Plugin", value);
+    ssnprintf(value, sizeof(value), "ti%zu", i % 7);
+    bench_child(match, "TypeInstancePrefix", value);
+    oconfig_item_t *target = bench_child(rule, "Target", "write");
+    bench_child(target, "Plugin", "bench");
+  }
+
+  int status = fc_configure_bench(&ci);
+  bench_item_free(&ci);
+  if (status != 0) {
+    fprintf(stderr, "configuring the chain failed: %d\n", status);
+    return 1;
+  }
+
+  fc_chain_t *chain = fc_chain_get_by_name("bench");
+  if (chain == NULL) {
+    fprintf(stderr, "chain \"bench\" not found\n");
+    return 1;
+  }
+
+  /* 100 plugins with 100 type instances each. */
+  static char fake_idents[10000];
+  char const *modes[] = {"uncompiled", "compiled", "memoized"};
+  for (int mode = 0; mode < 3; mode++) {
+    if (mode == 0)
+      fc_chain_uncompile(chain);
+    else if ((mode == 1) && (fc_chain_compile(chain) != 0)) {
+      fprintf(stderr, "compiling the chain failed\n");
+      return 1;
+    }
+
+    match_calls = 0;
+    double start = bench_now();
+    for (size_t i = 0; i < BENCH_VALUES; i++) {
+      value_list_t vl = {.values_len = 1};
+      size_t n = i % 10000;
+      sstrncpy(vl.host, "example.com", sizeof(vl.host));
+      ssnprintf(vl.plugin, sizeof(vl.plugin), "plugin%zu", n % 100);
+      sstrncpy(vl.type, "gauge", sizeof(vl.type));
+      ssnprintf(vl.type_instance, sizeof(vl.type_instance), "ti%zu", n / 100);
+      if (mode == 2)
+        vl.ident = (uc_ident_t *)(fake_idents + n);
+
+      fc_process_chain(&(data_set_t){"bench"}, &vl, chain);
+    }
+    printf("%s: %d values through %d rules in %.3fs, %zu match calls\n",
+           modes[mode], BENCH_VALUES, BENCH_RULES, bench_now() - start,
+           match_calls);
+  }
+
+  return 0;
+}
@@ -0,0 +1,429 @@
+/**
+ * collectd - src/daemon/filter_chain_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* plugin_mock.c provides a stub of fc_configure(). */
+#define fc_configure fc_configure_test
+#include "filter_chain.c" /* sic */
+#undef fc_configure
+#include "testing.h"
+
+/* The built-in "write" target records the names of the plugins it writes to,
+ * so rules are identified by the plugin name of their write target. */
+static char written[4096];
+
+int plugin_write(const char *plugin, const data_set_t *ds,
+                 const value_list_t *vl) {
+  size_t len = strlen(written);
+  ssnprintf(written + len, sizeof(written) - len, "%s,",
+            (plugin != NULL) ? plugin : "(all)");
+  return 0;
+}
+
+void plugin_log_available_writers(void) { /* nop */
+}
+
+const char *global_option_get(const char *option) { return "false"; }
+
+/* The "test" match compares identifier fields to a value. Values ending in
+ * an asterisk are compared as prefix, which the match cannot describe as an
+ * exact condition. */
+static size_t match_calls;
+
+typedef struct {
+  char *values[FC_FIELDS_NUM];
+  bool prefix[FC_FIELDS_NUM];
+} test_match_t;
+
+static char const *test_fields[FC_FIELDS_NUM] = {
+    "Host", "Plugin", "PluginInstance", "Type", "TypeInstance"};
+
+static int test_field_index(char const *key) {
+  for (int i = 0; i < FC_FIELDS_NUM; i++)
+    if (strcasecmp(test_fields[i], key) == 0)
+      return i;
+  return -1;
+}
+
+static int test_match_destroy(void **user_data) {
+  test_match_t *m = *user_data;
+  for (int i = 0; i < FC_FIELDS_NUM; i++)
+    sfree(m->values[i]);
+  sfree(m);
+  return 0;
+}
+
+static int test_match_create(const oconfig_item_t *ci, void **user_data) {
+  test_match_t *m = calloc(1, sizeof(*m));
+  if (m == NULL)
+    return ENOMEM;
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+    int field = test_field_index(child->key);
+    if (field < 0) {
+      test_match_destroy((void **)&m);
+      return EINVAL;
+    }
+
+    char *value = strdup(child->values[0].value.string);
+    size_t len = strlen(value);
+    if ((len > 0) && (value[len - 1] == '*')) {
+      value[len - 1] = 0;
+      m->prefix[field] = true;
+    }
+    m->values[field] = value;
+  }
+
+  *user_data = m;
+  return 0;
+}
+
+static int test_match_match(const data_set_t *ds, const value_list_t *vl,
+                            notification_meta_t **meta, void **user_data) {
+  test_match_t *m = *user_data;
+
+  match_calls++;
+  for (int i = 0; i < FC_FIELDS_NUM; i++) {
+    if (m->values[i] == NULL)
+      continue;
+    char const *value = fc_vl_field(vl, i);
+    if (m->prefix[i] &&
+        (strncmp(value, m->values[i], strlen(m->values[i])) != 0))
+      return FC_MATCH_NO_MATCH;
+    else if (!m->prefix[i] && (strcmp(value, m->values[i]) != 0))
+      return FC_MATCH_NO_MATCH;
+  }
+
+  return FC_MATCH_MATCHES;
+}
+
+static int test_match_describe(void *user_data, fc_match_info_t *info) {
+  test_match_t *m = user_data;
+  char const **fields[FC_FIELDS_NUM] = {&info->host, &info->plugin,
+                                        &info->plugin_instance, &info->type,
+                                        &info->type_instance};
+
+  info->exact = true;
+  info->identifier_only = true;
+  for (int i = 0; i < FC_FIELDS_NUM; i++) {
+    if (m->prefix[i])
+      info->exact = false;
+    else
+      *fields[i] = m->values[i];
+  }
+
+  return 0;
+}
+
+/* The "set" target overwrites the type instance, so rules after it must see
+ * the new value. */
+static int test_set_create(const oconfig_item_t *ci, void **user_data) {
+  *user_data = strdup(ci->children[0].values[0].value.string);
+  return (*user_data != NULL) ? 0 : ENOMEM;
+}
+
+static int test_set_destroy(void **user_data) {
+  sfree(*user_data);
+  return 0;
+}
+
+static int test_set_invoke(const data_set_t *ds, value_list_t *vl,
+                           notification_meta_t **meta, void **user_data) {
+  sstrncpy(vl->type_instance, *user_data, sizeof(vl->type_instance));
+  return FC_TARGET_CONTINUE;
+}
+
+static oconfig_item_t *test_child(oconfig_item_t *parent, char const *key,
+                                  char const *value) {
+  oconfig_item_t *tmp = realloc(parent->children, (parent->children_num + 1) *
+                                                      sizeof(*tmp));
+  assert(tmp != NULL);
+  parent->children = tmp;
+
+  oconfig_item_t *ci = parent->children + parent->children_num;
+  parent->children_num++;
+
+  *ci = (oconfig_item_t){.key = strdup(key), .parent = parent};
+  if (value != NULL) {
+    ci->values = calloc(1, sizeof(*ci->values));
+    assert(ci->values != NULL);
+    ci->values[0].type = OCONFIG_TYPE_STRING;
+    ci->values[0].value.string = strdup(value);
+    ci->values_num = 1;
+  }
+  return ci;
+}
+
+static void test_item_free(oconfig_item_t *ci) {
+  for (int i = 0; i < ci->children_num; i++)
+    test_item_free(ci->children + i);
+  for (int i = 0; i < ci->values_num; i++)
+    sfree(ci->values[i].value.string);
+  sfree(ci->values);
+  sfree(ci->children);
+  sfree(ci->key);
+}
+
+/* Appends <Rule><Match "test">key value</Match><Target "write">Plugin "name"
+ * </Target></Rule> to "chain" and returns the rule. */
+static oconfig_item_t *test_rule(oconfig_item_t *chain, char const *name,
+                                 char const *key, char const *value) {
+  oconfig_item_t *rule = test_child(chain, "Rule", NULL);
+  if (key != NULL) {
+    oconfig_item_t *match = test_child(rule, "Match", "test");
+    test_child(match, key, value);
+  }
+  oconfig_item_t *target = test_child(rule, "Target", "write");
+  test_child(target, "Plugin", name);
+  return rule;
+}
+
+static void test_register(void) {
+  static bool done;
+  if (done)
+    return;
+
+  fc_register_match("test", (match_proc_t){.create = test_match_create,
+                                           .destroy = test_match_destroy,
+                                           .match = test_match_match,
+                                           .describe = test_match_describe});
+  fc_register_target("set", (target_proc_t){.create = test_set_create,
+                                            .destroy = test_set_destroy,
+                                            .invoke = test_set_invoke});
+  done = true;
+}
+
+static void test_value_list(value_list_t *vl, size_t n) {
+  *vl = (value_list_t){.values_len = 1};
+  ssnprintf(vl->host, sizeof(vl->host), "host%zu", n % 4);
+  ssnprintf(vl->plugin, sizeof(vl->plugin), "plugin%zu", (n / 4) % 21);
+  ssnprintf(vl->type, sizeof(vl->type), "type%zu", (n / 84) % 5);
+  ssnprintf(vl->type_instance, sizeof(vl->type_instance), "ti%zu",
+            (n / 420) % 4);
+}
+
+#define EQUIVALENCE_VALUES 1680
+
+/* Runs all value lists through "chain" and stores the written plugins. With
+ * "idents", each value list gets a distinct (fake) interned identifier. */
+static void test_run_chain(fc_chain_t *chain, char **results, bool idents) {
+  static char fake_idents[EQUIVALENCE_VALUES];
+
+  for (size_t i = 0; i < EQUIVALENCE_VALUES; i++) {
+    value_list_t vl;
+    test_value_list(&vl, i);
+    if (idents)
+      vl.ident = (uc_ident_t *)(fake_idents + i);
+
+    written[0] = 0;
+    fc_process_chain(&(data_set_t){"test"}, &vl, chain);
+
+    sfree(results[i]);
+    results[i] = strdup(written);
+  }
+}
+
+static int test_differences(char **want, char **got) {
+  int differences = 0;
+  for (size_t i = 0; i < EQUIVALENCE_VALUES; i++) {
+    if (strcmp(want[i], got[i]) != 0) {
+      printf("# value list %zu: want \"%s\", got \"%s\"\n", i, want[i],
+             got[i]);
+      differences++;
+    }
+  }
+  return differences;
+}
+
+DEF_TEST(compiled_equivalence) {
+  test_register();
+
+  oconfig_item_t ci = {.key = "Chain"};
+  ci.values = &(oconfig_value_t){.type = OCONFIG_TYPE_STRING,
+                                 .value.string = "equivalence"};
+  ci.values_num = 1;
+
+  char name[32];
+  for (size_t i = 0; i < 120; i++) {
+    char value[32];
+    ssnprintf(name, sizeof(name), "r%zu", i);
+
+    switch (i % 6) {
+    case 0: /* exact plugin */
+      ssnprintf(value, sizeof(value), "plugin%zu", i % 21);
+      test_rule(&ci, name, "Plugin", value);
+      break;
+    case 1: { /* exact plugin and type in two matches */
+      ssnprintf(value, sizeof(value), "plugin%zu", i % 21);
+      oconfig_item_t *rule = test_rule(&ci, name, "Plugin", value);
+      oconfig_item_t *match = test_child(rule, "Match", "test");
+      ssnprintf(value, sizeof(value), "type%zu", i % 5);
+      test_child(match, "Type", value);
+      break;
+    }
+    case 2: { /* exact plugin, type instance prefix */
+      ssnprintf(value, sizeof(value), "plugin%zu", i % 21);
+      oconfig_item_t *rule = test_rule(&ci, name, "Plugin", value);
+      ssnprintf(value, sizeof(value), "ti%zu*", i % 3);
+      test_child(rule->children + 0, "TypeInstance", value);
+      break;
+    }
+    case 3: /* prefix only */
+      ssnprintf(value, sizeof(value), "host%zu*", i % 4);
+      test_rule(&ci, name, "Host", value);
+      break;
+    case 4: { /* contradicting matches */
+      oconfig_item_t *rule = test_rule(&ci, name, "Plugin", "plugin1");
+      oconfig_item_t *match = test_child(rule, "Match", "test");
+      test_child(match, "Plugin", "plugin2");
+      break;
+    }
+    default: { /* modifying target */
+      ssnprintf(value, sizeof(value), "plugin%zu", i % 21);
+      oconfig_item_t *target =
+          test_child(test_rule(&ci, name, "Plugin", value), "Target", "set");
+      test_child(target, "TypeInstance", "ti1");
+      break;
+    }
+    }
+
+    /* A rule without matches and one which stops processing. */
+    if (i == 60) {
+      test_rule(&ci, "all", NULL, NULL);
+      oconfig_item_t *rule = test_rule(&ci, "stop", "Plugin", "plugin7");
+      test_child(rule, "Target", "stop");
+    }
+  }
+
+  CHECK_ZERO(fc_configure_test(&ci));
+  ci.values = NULL;
+  ci.values_num = 0;
+  ci.key = NULL;
+  test_item_free(&ci);
+
+  fc_chain_t *chain = fc_chain_get_by_name("equivalence");
+  CHECK_NOT_NULL(chain);
+  CHECK_NOT_NULL(chain->rule_array);
+  EXPECT_EQ_INT(1, chain->index_field);
+  CHECK_NOT_NULL(chain->memo);
+
+  char *want[EQUIVALENCE_VALUES] = {NULL};
+  char *got[EQUIVALENCE_VALUES] = {NULL};
+
+  fc_chain_uncompile(chain);
+  match_calls = 0;
+  test_run_chain(chain, want, false);
+  size_t uncompiled_calls = match_calls;
+
+  CHECK_ZERO(fc_chain_compile(chain));
+  match_calls = 0;
+  test_run_chain(chain, got, false);
+  size_t compiled_calls = match_calls;
+  EXPECT_EQ_INT(0, test_differences(want, got));
+
+  /* The first run fills the memo, the second one uses it. */
+  for (int run = 0; run < 2; run++) {
+    match_calls = 0;
+    test_run_chain(chain, got, true);
+    EXPECT_EQ_INT(0, test_differences(want, got));
+  }
+  size_t memo_calls = match_calls;
+
+  OK(compiled_calls < uncompiled_calls);
+  OK(memo_calls < compiled_calls);
+
+  for (size_t i = 0; i < EQUIVALENCE_VALUES; i++) {
+    sfree(want[i]);
+    sfree(got[i]);
+  }
+  return 0;
+}
+
+/* memo_eviction stores more identifiers in the memo than it can hold and
+ * checks that entries are replaced one at a time, keeping those in use. */
+DEF_TEST(memo_eviction) {
+  test_register();
+
+  oconfig_item_t ci = {.key = "Chain"};
+  ci.values = &(oconfig_value_t){.type = OCONFIG_TYPE_STRING,
+                                 .value.string = "eviction"};
+  ci.values_num = 1;
+  test_rule(&ci, "prefix", "Host", "host*");
+
+  CHECK_ZERO(fc_configure_test(&ci));
+  ci.values = NULL;
+  ci.values_num = 0;
+  ci.key = NULL;
+  test_item_free(&ci);
+
+  fc_chain_t *chain = fc_chain_get_by_name("eviction");
+  CHECK_NOT_NULL(chain);
+  CHECK_NOT_NULL(chain->memo);
+
+  size_t capacity = FC_MEMO_STRIPES * FC_MEMO_STRIPE_SIZE;
+  static char fake_idents[2 * FC_MEMO_STRIPES * FC_MEMO_STRIPE_SIZE];
+  uc_ident_t *hot = (uc_ident_t *)fake_idents;
+
+  value_list_t vl = {.values_len = 1};
+  sstrncpy(vl.host, "host1", sizeof(vl.host));
+
+  size_t hot_misses = 0;
+  for (size_t i = 0; i < sizeof(fake_idents); i++) {
+    fc_memo_state_t state;
+    vl.ident = (uc_ident_t *)(fake_idents + i);
+    fc_memo_state_init(chain, &vl, &state);
+    state.bits[0] |= 1;
+    state.bits[chain->memo_words] |= 1;
+    state.dirty = true;
+    fc_memo_state_store(chain, &vl, &state);
+
+    /* The first identifier is looked up regularly and must not be evicted. */
+    if ((i % 64) == 0) {
+      vl.ident = hot;
+      fc_memo_state_init(chain, &vl, &state);
+      if ((state.bits[0] & 1) == 0)
+        hot_misses++;
+    }
+  }
+  EXPECT_EQ_INT(0, (int)hot_misses);
+
+  size_t entries_num = 0;
+  for (size_t i = 0; i < FC_MEMO_STRIPES; i++)
+    entries_num += chain->memo[i].entries_num;
+  EXPECT_EQ_INT((int)capacity, (int)entries_num);
+
+  /* The most recent identifier is remembered. */
+  fc_memo_state_t state;
+  vl.ident = (uc_ident_t *)(fake_idents + sizeof(fake_idents) - 1);
+  fc_memo_state_init(chain, &vl, &state);
+  EXPECT_EQ_INT(1, (int)(state.bits[0] & 1));
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(compiled_equivalence);
+  RUN_TEST(memo_eviction);
+
+  END_TEST;
+}
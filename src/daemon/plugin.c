@@ -36,6 +36,7 @@
 #include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils/heap/heap.h"
+#include "utils/latency/latency.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
 #include "utils_llist.h"
@@ -69,6 +70,7 @@ typedef struct callback_func_s callback_func_t;
 #define RF_SIMPLE 0
 #define RF_COMPLEX 1
 #define RF_REMOVE 65535
+
 struct read_func_s {
 /* `read_func_t' "inherits" from `callback_func_t'.
  * The `rf_super' member MUST be the first one in this structure! */
@@ -82,9 +84,53 @@ struct read_func_s {
   cdtime_t rf_interval;
   cdtime_t rf_effective_interval;
   cdtime_t rf_next_read;
+  /* Protected by `read_lock'. Created with the first recorded call and reset
+   * by plugin_update_read_statistics(). */
+  latency_counter_t *rf_lateness;
+  latency_counter_t *rf_duration;
 };
 typedef struct read_func_s read_func_t;
 
+/* Every read thread owns a heap of read functions, sorted by the time they are
+ * due next, and only sleeps on its own condition variable. New read functions
+ * go to the thread with the fewest functions. A thread without due work steals
+ * overdue functions from the heaps of busy threads and keeps them afterwards,
+ * so long-running functions spread out over the threads. Idle threads wake up
+ * when a function queued behind a running call becomes due, however long that
+ * call has been running. */
+struct read_worker_s {
+  pthread_t thread;
+  size_t index;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  c_heap_t *heap;
+  /* number of read functions owned, including the one being called */
+  size_t num;
+  /* Start of the call in progress, zero if none. Accessed atomically. */
+  cdtime_t busy_since;
+  bool idle;
+  /* While idle: time at which the thread wakes up, zero if not before it is
+   * signalled. */
+  cdtime_t wake_at;
+  derive_t steals;
+};
+typedef struct read_worker_s read_worker_t;
+
+struct write_func_s {
+/* `write_func_t' "inherits" from `callback_func_t'.
+ * The `wf_super' member MUST be the first one in this structure! */
+#define wf_callback wf_super.cf_callback
+#define wf_udata wf_super.cf_udata
+#define wf_ctx wf_super.cf_ctx
+  callback_func_t wf_super;
+  /* If true, `wf_callback' is a `plugin_write_batch_cb'. */
+  bool wf_batch;
+  /* Failures of batch callbacks, which are called after plugin_write()
+   * returned. */
+  c_complain_t wf_complaint;
+};
+typedef struct write_func_s write_func_t;
+
 struct cache_event_func_s {
   plugin_cache_event_cb callback;
   char *name;
@@ -93,14 +139,65 @@ struct cache_event_func_s {
 };
 typedef struct cache_event_func_s cache_event_func_t;
 
+/* Queue entries embed the value list and, for the common case of few data
+ * sources, the values themselves, so that enqueueing requires (at most) a
+ * single allocation. Entries are recycled via per-shard free lists. */
+#define WRITE_QUEUE_INLINE_VALUES 4
 struct write_queue_s;
 typedef struct write_queue_s write_queue_t;
 struct write_queue_s {
-  value_list_t *vl;
+  value_list_t vl;
+  value_t values[WRITE_QUEUE_INLINE_VALUES];
   plugin_ctx_t ctx;
   write_queue_t *next;
 };
 
+/* The write queue is split into shards, one per write thread. Value lists are
+ * assigned to a shard based on a hash of their identifier and a shard is only
+ * ever drained by one thread at a time ("busy"), so values with the same
+ * identifier are written in the order they were dispatched. Idle write threads
+ * steal batches from shards whose owner is busy elsewhere; producers wake up
+ * an idle thread ("poked") when nobody is waiting on the shard they fill. */
+#define WRITE_QUEUE_SHARDS_MAX 64
+#define WRITE_QUEUE_FREE_MAX 1024
+struct write_queue_shard_s {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  write_queue_t *head;
+  write_queue_t *tail;
+  long length;
+  bool busy;
+  size_t waiting;
+  bool poked;
+
+  /* recycled entries */
+  write_queue_t *free_list;
+  long free_length;
+  derive_t alloc_reused;
+  derive_t alloc_new;
+};
+typedef struct write_queue_shard_s write_queue_shard_t;
+
+/* Value lists collected by a write thread for the batch write callbacks. The
+ * pointers reference write queue entries, which are kept alive until the
+ * batch has been passed on. Values written by the post-cache chain are copied
+ * instead ("copying"), since targets may still modify the value list after it
+ * has been written. */
+#define WRITE_BATCH_SIZE_MAX 1024
+struct write_batch_s {
+  const data_set_t **ds;
+  const value_list_t **vl;
+  size_t num;
+  size_t size;
+  bool recording;
+  bool copying;
+
+  /* copies referenced by the batch and cleared copies for reuse */
+  write_queue_t *copies;
+  write_queue_t *spare;
+};
+typedef struct write_batch_s write_batch_t;
+
 struct flush_callback_s {
   char *name;
   cdtime_t timeout;
@@ -133,23 +230,25 @@ static char *plugindir;
 #ifndef DEFAULT_MAX_READ_INTERVAL
 #define DEFAULT_MAX_READ_INTERVAL TIME_T_TO_CDTIME_T_STATIC(86400)
 #endif
+/* Read functions are held by "read_heap" until the read threads are started
+ * and after they have been stopped. In between, they live in the heaps of
+ * "read_workers". */
 static c_heap_t *read_heap;
 static llist_t *read_list;
 static int read_loop = 1;
 static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t read_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t *read_threads;
-static size_t read_threads_num;
+static read_worker_t *read_workers;
+static size_t read_workers_num;
 static cdtime_t max_read_interval = DEFAULT_MAX_READ_INTERVAL;
 
-static write_queue_t *write_queue_head;
-static write_queue_t *write_queue_tail;
-static long write_queue_length;
+static write_queue_shard_t write_queue_shards[WRITE_QUEUE_SHARDS_MAX];
+static size_t write_queue_shards_num = 1;
+static pthread_once_t write_queue_once = PTHREAD_ONCE_INIT;
+static pthread_key_t write_batch_key;
 static bool write_loop = true;
-static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t write_cond = PTHREAD_COND_INITIALIZER;
 static pthread_t *write_threads;
 static size_t write_threads_num;
+static size_t write_threads_idle;
 
 static pthread_key_t plugin_ctx_key;
 static bool plugin_ctx_key_initialized;
@@ -165,6 +264,7 @@ static bool record_statistics;
  * Static functions
  */
 static int plugin_dispatch_values_internal(value_list_t *vl);
+static int plugin_compare_read_func(const void *arg0, const void *arg1);
 
 static const char *plugin_get_dir(void) {
   if (plugindir == NULL)
@@ -173,8 +273,148 @@ static const char *plugin_get_dir(void) {
     return plugindir;
 }
 
+static void write_queue_shards_init(void) /* {{{ */
+{
+  for (size_t i = 0; i < WRITE_QUEUE_SHARDS_MAX; i++) {
+    write_queue_shard_t *shard = write_queue_shards + i;
+
+    pthread_mutex_init(&shard->lock, /* attr = */ NULL);
+    pthread_cond_init(&shard->cond, /* attr = */ NULL);
+    shard->head = NULL;
+    shard->tail = NULL;
+    shard->length = 0;
+    shard->busy = false;
+    shard->waiting = 0;
+    shard->poked = false;
+    shard->free_list = NULL;
+    shard->free_length = 0;
+    shard->alloc_reused = 0;
+    shard->alloc_new = 0;
+  }
+
+  pthread_key_create(&write_batch_key, /* destructor = */ NULL);
+} /* }}} void write_queue_shards_init */
+
+/* Returns the number of queued value lists summed over all shards. The
+ * per-shard lengths are read without locking; the result is only used for
+ * statistics and the WriteQueueLimit{High,Low} heuristics. */
+static long write_queue_length_get(void) /* {{{ */
+{
+  long length = 0;
+
+  for (size_t i = 0; i < write_queue_shards_num; i++)
+    length += write_queue_shards[i].length;
+
+  return length;
+} /* }}} long write_queue_length_get */
+
+/* Percentiles of the lateness and duration of read functions which are
+ * submitted by plugin_update_read_statistics(). */
+static double const read_statistics_percents[] = {50.0, 90.0, 99.0};
+#define READ_STATISTICS_PERCENTS_NUM STATIC_ARRAY_SIZE(read_statistics_percents)
+
+/* Relative error of the lateness and duration percentiles. */
+#define READ_STATISTICS_RELATIVE_ERROR 0.01
+
+typedef struct {
+  cdtime_t average;
+  cdtime_t max;
+  cdtime_t percentiles[READ_STATISTICS_PERCENTS_NUM];
+} read_summary_t;
+
+static void read_summary_get(read_summary_t *s, latency_counter_t *lc) /* {{{ */
+{
+  s->average = latency_counter_get_average(lc);
+  s->max = latency_counter_get_max(lc);
+  for (size_t i = 0; i < READ_STATISTICS_PERCENTS_NUM; i++)
+    s->percentiles[i] =
+        latency_counter_get_percentile(lc, read_statistics_percents[i]);
+  latency_counter_reset(lc);
+} /* }}} void read_summary_get */
+
+static void read_summary_dispatch(value_list_t *vl, /* {{{ */
+                                  char const *prefix,
+                                  read_summary_t const *s) {
+  ssnprintf(vl->type_instance, sizeof(vl->type_instance), "%s-average",
+            prefix);
+  vl->values = &(value_t){.gauge = CDTIME_T_TO_DOUBLE(s->average)};
+  plugin_dispatch_values(vl);
+
+  ssnprintf(vl->type_instance, sizeof(vl->type_instance), "%s-max", prefix);
+  vl->values = &(value_t){.gauge = CDTIME_T_TO_DOUBLE(s->max)};
+  plugin_dispatch_values(vl);
+
+  for (size_t i = 0; i < READ_STATISTICS_PERCENTS_NUM; i++) {
+    ssnprintf(vl->type_instance, sizeof(vl->type_instance), "%s-p%.0f",
+              prefix, read_statistics_percents[i]);
+    vl->values = &(value_t){.gauge = CDTIME_T_TO_DOUBLE(s->percentiles[i])};
+    plugin_dispatch_values(vl);
+  }
+} /* }}} void read_summary_dispatch */
+
+/* Submits the scheduling statistics of the read threads: the number of read
+ * functions stolen from other threads and, for each read function called
+ * since the last submission, the average, maximum and percentiles of the time
+ * it was called late and of the time it took. */
+static void plugin_update_read_statistics(value_list_t *vl) /* {{{ */
+{
+  struct {
+    char name[DATA_MAX_NAME_LEN];
+    read_summary_t lateness;
+    read_summary_t duration;
+  } *stats = NULL;
+  size_t stats_num = 0;
+  derive_t steals = 0;
+
+  pthread_mutex_lock(&read_lock);
+
+  for (size_t i = 0; i < read_workers_num; i++) {
+    pthread_mutex_lock(&read_workers[i].lock);
+    steals += read_workers[i].steals;
+    pthread_mutex_unlock(&read_workers[i].lock);
+  }
+
+  int num = (read_list != NULL) ? llist_size(read_list) : 0;
+  if (num > 0)
+    stats = calloc((size_t)num, sizeof(*stats));
+
+  for (llentry_t *le = (stats != NULL) ? llist_head(read_list) : NULL;
+       le != NULL; le = le->next) {
+    read_func_t *rf = le->value;
+
+    if ((rf->rf_lateness == NULL) || (rf->rf_duration == NULL) ||
+        (latency_counter_get_num(rf->rf_duration) == 0))
+      continue;
+
+    sstrncpy(stats[stats_num].name, rf->rf_name,
+             sizeof(stats[stats_num].name));
+    read_summary_get(&stats[stats_num].lateness, rf->rf_lateness);
+    read_summary_get(&stats[stats_num].duration, rf->rf_duration);
+    stats_num++;
+  }
+
+  pthread_mutex_unlock(&read_lock);
+
+  sstrncpy(vl->plugin_instance, "read_threads", sizeof(vl->plugin_instance));
+  vl->values = &(value_t){.derive = steals};
+  vl->values_len = 1;
+  sstrncpy(vl->type, "derive", sizeof(vl->type));
+  sstrncpy(vl->type_instance, "steals", sizeof(vl->type_instance));
+  plugin_dispatch_values(vl);
+
+  sstrncpy(vl->type, "duration", sizeof(vl->type));
+  for (size_t i = 0; i < stats_num; i++) {
+    ssnprintf(vl->plugin_instance, sizeof(vl->plugin_instance), "read-%s",
+              stats[i].name);
+    read_summary_dispatch(vl, "lateness", &stats[i].lateness);
+    read_summary_dispatch(vl, "duration", &stats[i].duration);
+  }
+
+  sfree(stats);
+} /* }}} void plugin_update_read_statistics */
+
 static int plugin_update_internal_statistics(void) { /* {{{ */
-  gauge_t copy_write_queue_length = (gauge_t)write_queue_length;
+  gauge_t copy_write_queue_length = (gauge_t)write_queue_length_get();
 
   /* Initialize `vl' */
   value_list_t vl = VALUE_LIST_INIT;
@@ -198,6 +438,21 @@ static int plugin_update_internal_statistics(void) { /* {{{ */
   sstrncpy(vl.type_instance, "dropped", sizeof(vl.type_instance));
   plugin_dispatch_values(&vl);
 
+  /* Write queue : Entries taken from the free lists / newly allocated */
+  derive_t alloc_reused = 0;
+  derive_t alloc_new = 0;
+  for (size_t i = 0; i < write_queue_shards_num; i++) {
+    alloc_reused += write_queue_shards[i].alloc_reused;
+    alloc_new += write_queue_shards[i].alloc_new;
+  }
+  vl.values = &(value_t){.derive = alloc_reused};
+  sstrncpy(vl.type_instance, "alloc_reused", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = alloc_new};
+  sstrncpy(vl.type_instance, "alloc_new", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
   /* Cache */
   sstrncpy(vl.plugin_instance, "cache", sizeof(vl.plugin_instance));
 
@@ -208,6 +463,8 @@ static int plugin_update_internal_statistics(void) { /* {{{ */
   vl.type_instance[0] = 0;
   plugin_dispatch_values(&vl);
 
+  plugin_update_read_statistics(&vl);
+
   return 0;
 } /* }}} int plugin_update_internal_statistics */
 
@@ -253,6 +510,14 @@ static void destroy_all_callbacks(llist_t **list) /* {{{ */
   *list = NULL;
 } /* }}} void destroy_all_callbacks */
 
+static void destroy_read_callback(read_func_t *rf) /* {{{ */
+{
+  sfree(rf->rf_name);
+  latency_counter_destroy(rf->rf_lateness);
+  latency_counter_destroy(rf->rf_duration);
+  destroy_callback((callback_func_t *)rf);
+} /* }}} void destroy_read_callback */
+
 static void destroy_read_heap(void) /* {{{ */
 {
   if (read_heap == NULL)
@@ -264,8 +529,7 @@ static void destroy_read_heap(void) /* {{{ */
     rf = c_heap_get_root(read_heap);
     if (rf == NULL)
       break;
-    sfree(rf->rf_name);
-    destroy_callback((callback_func_t *)rf);
+    destroy_read_callback(rf);
   }
 
   c_heap_destroy(read_heap);
@@ -447,29 +711,224 @@ static int plugin_load_file(char const *file, bool global) {
   return 0;
 }
 
-static void *plugin_read_thread(void __attribute__((unused)) * args) {
+/* Returns the read thread owning the fewest read functions. */
+static read_worker_t *read_worker_least_loaded(void) /* {{{ */
+{
+  read_worker_t *ret = NULL;
+  size_t ret_num = 0;
+
+  for (size_t i = 0; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + i;
+
+    pthread_mutex_lock(&w->lock);
+    size_t num = w->num;
+    pthread_mutex_unlock(&w->lock);
+
+    if ((ret == NULL) || (num < ret_num)) {
+      ret = w;
+      ret_num = num;
+    }
+  }
+
+  return ret;
+} /* }}} read_worker_t *read_worker_least_loaded */
+
+/* Makes sure an idle read thread other than "self" is awake at "due", when
+ * the next function of "self" may have to be stolen. A thread already waking
+ * up by then is left alone. */
+static void read_worker_kick(read_worker_t const *self, /* {{{ */
+                             cdtime_t due) {
+  for (size_t i = 1; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + ((self->index + i) % read_workers_num);
+
+    pthread_mutex_lock(&w->lock);
+    bool idle = w->idle;
+    if (idle && ((w->wake_at == 0) || (w->wake_at > due))) {
+      w->idle = false;
+      pthread_cond_signal(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (idle)
+      return;
+  }
+} /* }}} void read_worker_kick */
+
+/* Returns the earliest time at which a function of another read thread is due
+ * while that thread is busy calling a function, zero if there is none. */
+static cdtime_t read_worker_watch(read_worker_t const *self) /* {{{ */
+{
+  cdtime_t ret = 0;
+
+  for (size_t i = 1; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + ((self->index + i) % read_workers_num);
+
+    if (__atomic_load_n(&w->busy_since, __ATOMIC_RELAXED) == 0)
+      continue;
+
+    pthread_mutex_lock(&w->lock);
+    read_func_t *rf = c_heap_peek_root(w->heap);
+    if ((rf != NULL) && ((ret == 0) || (rf->rf_next_read < ret)))
+      ret = rf->rf_next_read;
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  return ret;
+} /* }}} cdtime_t read_worker_watch */
+
+/* Marks "w" as busy calling a function from "now" on. If another of its
+ * functions is waiting, an idle thread is woken up when that one is due, so it
+ * is stolen if the call is still running by then. */
+static void read_worker_begin(read_worker_t *w, cdtime_t now) /* {{{ */
+{
+  pthread_mutex_lock(&w->lock);
+  __atomic_store_n(&w->busy_since, now, __ATOMIC_RELAXED);
+  read_func_t *next = c_heap_peek_root(w->heap);
+  cdtime_t due = (next != NULL) ? next->rf_next_read : 0;
+  pthread_mutex_unlock(&w->lock);
+
+  if (next != NULL)
+    read_worker_kick(w, due);
+} /* }}} void read_worker_begin */
+
+/* Adds a read function to the heap of "w". If "w" is busy calling another
+ * function, an idle thread is woken up in time to steal the new one. */
+static int read_worker_insert(read_worker_t *w, read_func_t *rf) /* {{{ */
+{
+  pthread_mutex_lock(&w->lock);
+  int status = c_heap_insert(w->heap, rf);
+  if (status == 0) {
+    w->num++;
+    pthread_cond_signal(&w->cond);
+  }
+  bool busy = (__atomic_load_n(&w->busy_since, __ATOMIC_RELAXED) != 0);
+  read_func_t *next = c_heap_peek_root(w->heap);
+  cdtime_t due = (next != NULL) ? next->rf_next_read : 0;
+  pthread_mutex_unlock(&w->lock);
+
+  if ((status == 0) && busy)
+    read_worker_kick(w, due);
+
+  return status;
+} /* }}} int read_worker_insert */
+
+/* Takes a read function that is due at "now" from another thread's heap.
+ * Returns NULL when the read threads are being stopped. */
+static read_func_t *read_worker_steal(read_worker_t *self, /* {{{ */
+                                      cdtime_t now) {
+  for (size_t i = 1; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + ((self->index + i) % read_workers_num);
+    read_func_t *rf = NULL;
+
+    if (__atomic_load_n(&read_loop, __ATOMIC_RELAXED) == 0)
+      return NULL;
+
+    pthread_mutex_lock(&w->lock);
+    read_func_t *root = c_heap_peek_root(w->heap);
+    if ((root != NULL) && (root->rf_next_read <= now)) {
+      rf = c_heap_get_root(w->heap);
+      w->num--;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (rf == NULL)
+      continue;
+
+    pthread_mutex_lock(&self->lock);
+    self->num++;
+    self->steals++;
+    pthread_mutex_unlock(&self->lock);
+
+    DEBUG("plugin_read_thread: Read thread %" PRIsz " took `%s' from read "
+          "thread %" PRIsz ".",
+          self->index, rf->rf_name, w->index);
+    return rf;
+  }
+
+  return NULL;
+} /* }}} read_func_t *read_worker_steal */
+
+/* Blocks until a read function is due, either in the thread's own heap or,
+ * if there is none, in another thread's heap. Returns NULL when the read
+ * threads are being stopped. */
+static read_func_t *read_worker_next(read_worker_t *w) /* {{{ */
+{
+  __atomic_store_n(&w->busy_since, 0, __ATOMIC_RELAXED);
+
+  pthread_mutex_lock(&w->lock);
+  while (read_loop != 0) {
+    cdtime_t now = cdtime();
+    read_func_t *rf = c_heap_peek_root(w->heap);
+
+    if ((rf != NULL) && (rf->rf_next_read <= now)) {
+      c_heap_get_root(w->heap);
+      pthread_mutex_unlock(&w->lock);
+
+      read_worker_begin(w, now);
+      return rf;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    rf = read_worker_steal(w, now);
+    if (rf != NULL) {
+      read_worker_begin(w, now);
+      return rf;
+    }
+
+    cdtime_t wake_at = read_worker_watch(w);
+
+    pthread_mutex_lock(&w->lock);
+    rf = c_heap_peek_root(w->heap);
+    if ((read_loop == 0) || ((rf != NULL) && (rf->rf_next_read <= cdtime())))
+      continue;
+    if ((rf != NULL) && ((wake_at == 0) || (rf->rf_next_read < wake_at)))
+      wake_at = rf->rf_next_read;
+
+    /* In pthread_cond_timedwait, spurious wakeups are possible
+     * (and really happen, at least on NetBSD with > 1 CPU), thus
+     * we need to re-evaluate the condition every time
+     * pthread_cond_timedwait returns. */
+    w->idle = true;
+    w->wake_at = wake_at;
+    if (wake_at == 0)
+      pthread_cond_wait(&w->cond, &w->lock);
+    else
+      pthread_cond_timedwait(&w->cond, &w->lock,
+                             &CDTIME_T_TO_TIMESPEC(wake_at));
+    w->idle = false;
+    w->wake_at = 0;
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+} /* }}} read_func_t *read_worker_next */
+
+static void *plugin_read_thread(void *args) {
+  read_worker_t *w = args;
+
   while (read_loop != 0) {
     read_func_t *rf;
     plugin_ctx_t old_ctx;
     cdtime_t start;
     cdtime_t now;
     cdtime_t elapsed;
+    cdtime_t lateness;
     int status;
     int rf_type;
-    int rc;
 
-    /* Get the read function that needs to be read next.
-     * We don't need to hold "read_lock" for the heap, but we need
-     * to call c_heap_get_root() and pthread_cond_wait() in the
-     * same protected block. */
-    pthread_mutex_lock(&read_lock);
-    rf = c_heap_get_root(read_heap);
-    if (rf == NULL) {
-      pthread_cond_wait(&read_cond, &read_lock);
-      pthread_mutex_unlock(&read_lock);
-      continue;
+    rf = read_worker_next(w);
+    if (rf == NULL)
+      break;
+
+    /* Don't start another read function once shutdown has begun. "num"
+     * already accounts for "rf", so return it to this thread's heap, from
+     * which stop_read_threads() collects it. */
+    if (__atomic_load_n(&read_loop, __ATOMIC_RELAXED) == 0) {
+      pthread_mutex_lock(&w->lock);
+      c_heap_insert(w->heap, rf);
+      pthread_mutex_unlock(&w->lock);
+      break;
     }
-    pthread_mutex_unlock(&read_lock);
 
     if (rf->rf_interval == 0) {
       /* this should not happen, because the interval is set
@@ -481,31 +940,11 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
       rf->rf_next_read = cdtime();
     }
 
-    /* sleep until this entry is due,
-     * using pthread_cond_timedwait */
-    pthread_mutex_lock(&read_lock);
-    /* In pthread_cond_timedwait, spurious wakeups are possible
-     * (and really happen, at least on NetBSD with > 1 CPU), thus
-     * we need to re-evaluate the condition every time
-     * pthread_cond_timedwait returns. */
-    rc = 0;
-    while ((read_loop != 0) && (cdtime() < rf->rf_next_read) && rc == 0) {
-      rc = pthread_cond_timedwait(&read_cond, &read_lock,
-                                  &CDTIME_T_TO_TIMESPEC(rf->rf_next_read));
-    }
-
     /* Must hold `read_lock' when accessing `rf->rf_type'. */
+    pthread_mutex_lock(&read_lock);
     rf_type = rf->rf_type;
     pthread_mutex_unlock(&read_lock);
 
-    /* Check if we're supposed to stop.. This may have interrupted
-     * the sleep, too. */
-    if (read_loop == 0) {
-      /* Insert `rf' again, so it can be free'd correctly */
-      c_heap_insert(read_heap, rf);
-      break;
-    }
-
     /* The entry has been marked for deletion. The linked list
      * entry has already been removed by `plugin_unregister_read'.
      * All we have to do here is free the `read_func_t' and
@@ -514,15 +953,19 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
       DEBUG("plugin_read_thread: Destroying the `%s' "
             "callback.",
             rf->rf_name);
-      sfree(rf->rf_name);
-      destroy_callback((callback_func_t *)rf);
+      destroy_read_callback(rf);
       rf = NULL;
+
+      pthread_mutex_lock(&w->lock);
+      w->num--;
+      pthread_mutex_unlock(&w->lock);
       continue;
     }
 
     DEBUG("plugin_read_thread: Handling `%s'.", rf->rf_name);
 
     start = cdtime();
+    lateness = (start > rf->rf_next_read) ? (start - rf->rf_next_read) : 0;
 
     old_ctx = plugin_set_ctx(rf->rf_ctx);
 
@@ -562,6 +1005,22 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
 
     /* calculate the time spent in the read function */
     elapsed = (now - start);
+    __atomic_store_n(&w->busy_since, 0, __ATOMIC_RELAXED);
+
+    if (record_statistics) {
+      pthread_mutex_lock(&read_lock);
+      if (rf->rf_lateness == NULL)
+        rf->rf_lateness =
+            latency_counter_create_sketch(READ_STATISTICS_RELATIVE_ERROR);
+      if (rf->rf_duration == NULL)
+        rf->rf_duration =
+            latency_counter_create_sketch(READ_STATISTICS_RELATIVE_ERROR);
+      /* latency_counter_add() ignores zero, so calls on time are recorded as
+       * late by the smallest cdtime_t unit. */
+      latency_counter_add(rf->rf_lateness, lateness + 1);
+      latency_counter_add(rf->rf_duration, elapsed + 1);
+      pthread_mutex_unlock(&read_lock);
+    }
 
     if (elapsed > rf->rf_effective_interval)
       WARNING(
@@ -594,8 +1053,11 @@ static void *plugin_read_thread(void __attribute__((unused)) * args) {
     DEBUG("plugin_read_thread: Next read of the `%s' plugin at %.3f.",
           rf->rf_name, CDTIME_T_TO_DOUBLE(rf->rf_next_read));
 
-    /* Re-insert this read function into the heap again. */
-    c_heap_insert(read_heap, rf);
+    /* Re-insert this read function into the heap again. "num" already
+     * accounts for it. */
+    pthread_mutex_lock(&w->lock);
+    c_heap_insert(w->heap, rf);
+    pthread_mutex_unlock(&w->lock);
   } /* while (read_loop) */
 
   pthread_exit(NULL);
@@ -632,56 +1094,107 @@ static void set_thread_name(pthread_t tid, char const *name) {
 
 static void start_read_threads(size_t num) /* {{{ */
 {
-  if (read_threads != NULL)
+  if (read_workers != NULL)
     return;
 
-  read_threads = calloc(num, sizeof(*read_threads));
-  if (read_threads == NULL) {
+  read_workers = calloc(num, sizeof(*read_workers));
+  if (read_workers == NULL) {
     ERROR("plugin: start_read_threads: calloc failed.");
     return;
   }
 
-  read_threads_num = 0;
   for (size_t i = 0; i < num; i++) {
-    int status = pthread_create(read_threads + read_threads_num,
-                                /* attr = */ NULL, plugin_read_thread,
-                                /* arg = */ NULL);
+    read_worker_t *w = read_workers + i;
+
+    w->index = i;
+    pthread_mutex_init(&w->lock, /* attr = */ NULL);
+    pthread_cond_init(&w->cond, /* attr = */ NULL);
+    w->heap = c_heap_create(plugin_compare_read_func);
+    if (w->heap == NULL) {
+      ERROR("plugin: start_read_threads: c_heap_create failed.");
+      for (size_t j = 0; j < i; j++)
+        c_heap_destroy(read_workers[j].heap);
+      sfree(read_workers);
+      return;
+    }
+  }
+
+  /* Hand the registered read functions out to the threads. */
+  pthread_mutex_lock(&read_lock);
+  read_workers_num = num;
+  for (size_t i = 0;; i++) {
+    read_func_t *rf = c_heap_get_root(read_heap);
+    if (rf == NULL)
+      break;
+    read_worker_insert(read_workers + (i % num), rf);
+  }
+  pthread_mutex_unlock(&read_lock);
+
+  for (size_t i = 0; i < num; i++) {
+    read_worker_t *w = read_workers + i;
+
+    int status = pthread_create(&w->thread, /* attr = */ NULL,
+                                plugin_read_thread, /* arg = */ w);
     if (status != 0) {
       ERROR("plugin: start_read_threads: pthread_create failed with status %i "
             "(%s).",
             status, STRERROR(status));
-      return;
+      /* The read functions of this thread are stolen by the others. */
+      w->thread = (pthread_t)0;
+      continue;
     }
 
     char name[THREAD_NAME_MAX];
-    ssnprintf(name, sizeof(name), "reader#%" PRIu64,
-              (uint64_t)read_threads_num);
-    set_thread_name(read_threads[read_threads_num], name);
-
-    read_threads_num++;
+    ssnprintf(name, sizeof(name), "reader#%" PRIu64, (uint64_t)i);
+    set_thread_name(w->thread, name);
   } /* for (i) */
 } /* }}} void start_read_threads */
 
 static void stop_read_threads(void) {
-  if (read_threads == NULL)
+  if (read_workers == NULL)
     return;
 
-  INFO("collectd: Stopping %" PRIsz " read threads.", read_threads_num);
+  INFO("collectd: Stopping %" PRIsz " read threads.", read_workers_num);
 
   pthread_mutex_lock(&read_lock);
-  read_loop = 0;
-  DEBUG("plugin: stop_read_threads: Signalling `read_cond'");
-  pthread_cond_broadcast(&read_cond);
+  __atomic_store_n(&read_loop, 0, __ATOMIC_RELAXED);
   pthread_mutex_unlock(&read_lock);
 
-  for (size_t i = 0; i < read_threads_num; i++) {
-    if (pthread_join(read_threads[i], NULL) != 0) {
+  for (size_t i = 0; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + i;
+
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  for (size_t i = 0; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + i;
+
+    if (w->thread == (pthread_t)0)
+      continue;
+    if (pthread_join(w->thread, NULL) != 0) {
       ERROR("plugin: stop_read_threads: pthread_join failed.");
     }
-    read_threads[i] = (pthread_t)0;
+    w->thread = (pthread_t)0;
   }
-  sfree(read_threads);
-  read_threads_num = 0;
+
+  /* Move the read functions back to "read_heap", so they can be freed. */
+  pthread_mutex_lock(&read_lock);
+  for (size_t i = 0; i < read_workers_num; i++) {
+    read_worker_t *w = read_workers + i;
+    read_func_t *rf;
+
+    while ((rf = c_heap_get_root(w->heap)) != NULL)
+      c_heap_insert(read_heap, rf);
+
+    c_heap_destroy(w->heap);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+  }
+  sfree(read_workers);
+  read_workers_num = 0;
+  pthread_mutex_unlock(&read_lock);
 } /* void stop_read_threads */
 
 static void plugin_value_list_free(value_list_t *vl) /* {{{ */
@@ -709,6 +1222,7 @@ plugin_value_list_clone(value_list_t const *vl_orig) /* {{{ */
 
   if (vl->host[0] == 0)
     sstrncpy(vl->host, hostname_g, sizeof(vl->host));
+  vl->ident = NULL;
 
   vl->values = calloc(vl_orig->values_len, sizeof(*vl->values));
   if (vl->values == NULL) {
@@ -734,19 +1248,141 @@ plugin_value_list_clone(value_list_t const *vl_orig) /* {{{ */
   return vl;
 } /* }}} value_list_t *plugin_value_list_clone */
 
+/* FNV-1a hash of the value list's identifier. Used to select the write queue
+ * shard, so all values of one identifier end up in the same shard. */
+static uint64_t write_queue_hash(value_list_t const *vl) /* {{{ */
+{
+  /* The host is filled in when the value list is copied into the queue. */
+  char const *fields[] = {(vl->host[0] != 0) ? vl->host : hostname_g,
+                          vl->plugin, vl->plugin_instance, vl->type,
+                          vl->type_instance};
+  uint64_t hash = FNV1A_INIT;
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fields); i++) {
+    hash = fnv1a_append(hash, fields[i]);
+    /* separator, so that "ab"/"c" and "a"/"bc" hash differently. */
+    hash = fnv1a_append(hash, "/");
+  }
+
+  return hash;
+} /* }}} uint64_t write_queue_hash */
+
+/* Releases the memory referenced by the entry's value list, but not the entry
+ * itself. */
+static void write_queue_entry_clear(write_queue_t *q) /* {{{ */
+{
+  meta_data_destroy(q->vl.meta);
+  q->vl.meta = NULL;
+  uc_ident_release(q->vl.ident);
+  q->vl.ident = NULL;
+  if (q->vl.values != q->values)
+    sfree(q->vl.values);
+  q->vl.values = NULL;
+} /* }}} void write_queue_entry_clear */
+
+/* Copies "vl_orig" into the queue entry "q". Does the same as
+ * plugin_value_list_clone(), but uses the entry's inline value storage if
+ * possible. */
+static int write_queue_entry_fill(write_queue_t *q, /* {{{ */
+                                  value_list_t const *vl_orig) {
+  value_list_t *vl = &q->vl;
+
+  memcpy(vl, vl_orig, sizeof(*vl));
+
+  if (vl->host[0] == 0)
+    sstrncpy(vl->host, hostname_g, sizeof(vl->host));
+
+  if (vl_orig->values_len <= STATIC_ARRAY_SIZE(q->values))
+    vl->values = q->values;
+  else
+    vl->values = calloc(vl_orig->values_len, sizeof(*vl->values));
+  vl->meta = NULL;
+  vl->ident = NULL;
+  if (vl->values == NULL)
+    return ENOMEM;
+  memcpy(vl->values, vl_orig->values,
+         vl_orig->values_len * sizeof(*vl->values));
+
+  vl->meta = meta_data_clone(vl_orig->meta);
+  if ((vl_orig->meta != NULL) && (vl->meta == NULL)) {
+    write_queue_entry_clear(q);
+    return ENOMEM;
+  }
+
+  if (vl->time == 0)
+    vl->time = cdtime();
+
+  /* Fill in the interval from the thread context, if it is zero. */
+  if (vl->interval == 0)
+    vl->interval = plugin_get_interval();
+
+  return 0;
+} /* }}} int write_queue_entry_fill */
+
+/* Returns true if values queued on "shard" may not be picked up soon, because
+ * the shard's owner is busy draining another shard. Must be called with the
+ * shard's lock held. */
+static bool write_queue_shard_unattended(write_queue_shard_t *shard) /* {{{ */
+{
+  return !shard->busy && (shard->head != NULL) && (shard->waiting == 0);
+} /* }}} bool write_queue_shard_unattended */
+
+/* Wakes up one idle write thread waiting on a shard other than "skip", so it
+ * steals the values queued on "skip". */
+static void write_queue_wake_idle(write_queue_shard_t *skip) /* {{{ */
+{
+  if (__atomic_load_n(&write_threads_idle, __ATOMIC_RELAXED) == 0)
+    return;
+
+  for (size_t i = 0; i < write_queue_shards_num; i++) {
+    write_queue_shard_t *shard = write_queue_shards + i;
+    if (shard == skip)
+      continue;
+
+    pthread_mutex_lock(&shard->lock);
+    bool found = (shard->waiting > 0);
+    if (found) {
+      shard->poked = true;
+      pthread_cond_signal(&shard->cond);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (found)
+      return;
+  }
+} /* }}} void write_queue_wake_idle */
+
 static int plugin_write_enqueue(value_list_t const *vl) /* {{{ */
 {
   write_queue_t *q;
 
-  q = malloc(sizeof(*q));
-  if (q == NULL)
-    return ENOMEM;
+  pthread_once(&write_queue_once, write_queue_shards_init);
+
+  write_queue_shard_t *shard =
+      write_queue_shards + (write_queue_hash(vl) % write_queue_shards_num);
+
+  pthread_mutex_lock(&shard->lock);
+  q = shard->free_list;
+  if (q != NULL) {
+    shard->free_list = q->next;
+    shard->free_length--;
+    shard->alloc_reused++;
+  } else {
+    shard->alloc_new++;
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  if (q == NULL) {
+    q = malloc(sizeof(*q));
+    if (q == NULL)
+      return ENOMEM;
+  }
   q->next = NULL;
 
-  q->vl = plugin_value_list_clone(vl);
-  if (q->vl == NULL) {
+  int status = write_queue_entry_fill(q, vl);
+  if (status != 0) {
     sfree(q);
-    return ENOMEM;
+    return status;
   }
 
   /* Store context of caller (read plugin); otherwise, it would not be
@@ -754,66 +1390,377 @@ static int plugin_write_enqueue(value_list_t const *vl) /* {{{ */
    * value-list later on. */
   q->ctx = plugin_get_ctx();
 
-  pthread_mutex_lock(&write_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (write_queue_tail == NULL) {
-    write_queue_head = q;
-    write_queue_tail = q;
-    write_queue_length = 1;
+  if (shard->tail == NULL) {
+    shard->head = q;
+    shard->tail = q;
+    shard->length = 1;
   } else {
-    write_queue_tail->next = q;
-    write_queue_tail = q;
-    write_queue_length += 1;
+    shard->tail->next = q;
+    shard->tail = q;
+    shard->length += 1;
   }
 
-  pthread_cond_signal(&write_cond);
-  pthread_mutex_unlock(&write_lock);
+  bool unattended = write_queue_shard_unattended(shard);
+  pthread_cond_signal(&shard->cond);
+  pthread_mutex_unlock(&shard->lock);
+
+  if (unattended)
+    write_queue_wake_idle(shard);
 
   return 0;
 } /* }}} int plugin_write_enqueue */
 
-static value_list_t *plugin_write_dequeue(void) /* {{{ */
-{
-  write_queue_t *q;
-  value_list_t *vl;
+/* Queues "num" value lists, taking each shard's lock at most twice: once to
+ * take recycled entries from the free list and once to append the new
+ * entries. Values selected for dropping have their "shard" set to SIZE_MAX by
+ * the caller. */
+static int plugin_write_enqueue_batch(value_list_t const *vl, /* {{{ */
+                                      size_t const *shard_idx, size_t num) {
+  write_queue_t *head[WRITE_QUEUE_SHARDS_MAX] = {NULL};
+  write_queue_t *tail[WRITE_QUEUE_SHARDS_MAX] = {NULL};
+  write_queue_t *free_list[WRITE_QUEUE_SHARDS_MAX] = {NULL};
+  long length[WRITE_QUEUE_SHARDS_MAX] = {0};
+  plugin_ctx_t ctx = plugin_get_ctx();
+  int ret = 0;
+
+  for (size_t i = 0; i < num; i++)
+    if (shard_idx[i] != SIZE_MAX)
+      length[shard_idx[i]]++;
+
+  for (size_t i = 0; i < write_queue_shards_num; i++) {
+    write_queue_shard_t *shard = write_queue_shards + i;
+    if (length[i] == 0)
+      continue;
+
+    pthread_mutex_lock(&shard->lock);
+    for (long j = 0; (j < length[i]) && (shard->free_list != NULL); j++) {
+      write_queue_t *q = shard->free_list;
+      shard->free_list = q->next;
+      shard->free_length--;
+      shard->alloc_reused++;
+      length[i]--;
+
+      q->next = free_list[i];
+      free_list[i] = q;
+    }
+    shard->alloc_new += length[i];
+    pthread_mutex_unlock(&shard->lock);
+    length[i] = 0;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    size_t idx = shard_idx[i];
+    if (idx == SIZE_MAX)
+      continue;
+
+    write_queue_t *q = free_list[idx];
+    if (q != NULL)
+      free_list[idx] = q->next;
+    else
+      q = malloc(sizeof(*q));
+    if (q == NULL) {
+      ret = ENOMEM;
+      continue;
+    }
+    q->next = NULL;
+
+    int status = write_queue_entry_fill(q, vl + i);
+    if (status != 0) {
+      sfree(q);
+      ret = status;
+      continue;
+    }
+    q->ctx = ctx;
+
+    if (tail[idx] == NULL)
+      head[idx] = q;
+    else
+      tail[idx]->next = q;
+    tail[idx] = q;
+    length[idx]++;
+  }
+
+  for (size_t i = 0; i < write_queue_shards_num; i++) {
+    write_queue_shard_t *shard = write_queue_shards + i;
+    if ((head[i] == NULL) && (free_list[i] == NULL))
+      continue;
+
+    bool unattended = false;
+    pthread_mutex_lock(&shard->lock);
+    if (head[i] != NULL) {
+      if (shard->tail == NULL)
+        shard->head = head[i];
+      else
+        shard->tail->next = head[i];
+      shard->tail = tail[i];
+      shard->length += length[i];
+      unattended = write_queue_shard_unattended(shard);
+      pthread_cond_signal(&shard->cond);
+    }
+    /* Return entries which were not needed after all (allocation failures). */
+    while (free_list[i] != NULL) {
+      write_queue_t *q = free_list[i];
+      free_list[i] = q->next;
+      q->next = shard->free_list;
+      shard->free_list = q;
+      shard->free_length++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (unattended)
+      write_queue_wake_idle(shard);
+  }
 
-  pthread_mutex_lock(&write_lock);
+  return ret;
+} /* }}} int plugin_write_enqueue_batch */
 
-  while (write_loop && (write_queue_head == NULL))
-    pthread_cond_wait(&write_cond, &write_lock);
+static write_batch_t *write_batch_get(void) /* {{{ */
+{
+  pthread_once(&write_queue_once, write_queue_shards_init);
+  return pthread_getspecific(write_batch_key);
+} /* }}} write_batch_t *write_batch_get */
+
+/* Returns a copy of "vl" owned by the batch. */
+static const value_list_t *write_batch_copy(write_batch_t *wb, /* {{{ */
+                                            const value_list_t *vl) {
+  write_queue_t *q = wb->spare;
+  if (q != NULL)
+    wb->spare = q->next;
+  else
+    q = malloc(sizeof(*q));
+  if (q == NULL)
+    return NULL;
 
-  if (write_queue_head == NULL) {
-    pthread_mutex_unlock(&write_lock);
+  if (write_queue_entry_fill(q, vl) != 0) {
+    sfree(q);
     return NULL;
   }
+  if (vl->ident != NULL) {
+    uc_ident_ref(vl->ident);
+    q->vl.ident = vl->ident;
+  }
+
+  q->next = wb->copies;
+  wb->copies = q;
+  return &q->vl;
+} /* }}} const value_list_t *write_batch_copy */
+
+static int write_batch_append(write_batch_t *wb, /* {{{ */
+                              const data_set_t *ds, const value_list_t *vl) {
+  if (wb->num >= wb->size) {
+    size_t size = (wb->size == 0) ? 64 : 2 * wb->size;
 
-  q = write_queue_head;
-  write_queue_head = q->next;
-  write_queue_length -= 1;
-  if (write_queue_head == NULL) {
-    write_queue_tail = NULL;
-    assert(0 == write_queue_length);
+    const data_set_t **tmp_ds = realloc(wb->ds, size * sizeof(*wb->ds));
+    if (tmp_ds == NULL)
+      return ENOMEM;
+    wb->ds = tmp_ds;
+
+    const value_list_t **tmp_vl = realloc(wb->vl, size * sizeof(*wb->vl));
+    if (tmp_vl == NULL)
+      return ENOMEM;
+    wb->vl = tmp_vl;
+
+    wb->size = size;
   }
 
-  pthread_mutex_unlock(&write_lock);
+  if (wb->copying) {
+    vl = write_batch_copy(wb, vl);
+    if (vl == NULL)
+      return ENOMEM;
+  }
 
-  (void)plugin_set_ctx(q->ctx);
+  wb->ds[wb->num] = ds;
+  wb->vl[wb->num] = vl;
+  wb->num++;
+  return 0;
+} /* }}} int write_batch_append */
 
-  vl = q->vl;
-  sfree(q);
-  return vl;
-} /* }}} value_list_t *plugin_write_dequeue */
+/* Passes the collected values to all batch write callbacks. */
+static void write_batch_flush(write_batch_t *wb) /* {{{ */
+{
+  if (wb->num == 0)
+    return;
+
+  for (llentry_t *le = llist_head(list_write); le != NULL; le = le->next) {
+    write_func_t *wf = le->value;
+    if (!wf->wf_batch)
+      continue;
+
+    plugin_ctx_t old_ctx = plugin_get_ctx();
+    plugin_ctx_t ctx = old_ctx;
+    ctx.name = wf->wf_ctx.name;
+    plugin_set_ctx(ctx);
+
+    DEBUG("plugin: write_batch_flush: Writing %" PRIsz " values via %s.",
+          wb->num, le->key);
+    plugin_write_batch_cb callback = wf->wf_callback;
+    int status = (*callback)(wb->ds, wb->vl, wb->num, &wf->wf_udata);
+    if (status != 0)
+      c_complain(LOG_ERR, &wf->wf_complaint,
+                 "plugin: Writing %" PRIsz " values via %s failed with "
+                 "status %i.",
+                 wb->num, le->key, status);
+    else
+      c_release(LOG_INFO, &wf->wf_complaint,
+                "plugin: Writing values via %s succeeded again.", le->key);
 
-static void *plugin_write_thread(void __attribute__((unused)) * args) /* {{{ */
+    plugin_set_ctx(old_ctx);
+  }
+
+  wb->num = 0;
+
+  while (wb->copies != NULL) {
+    write_queue_t *q = wb->copies;
+    wb->copies = q->next;
+    write_queue_entry_clear(q);
+    q->next = wb->spare;
+    wb->spare = q;
+  }
+} /* }}} void write_batch_flush */
+
+/* Claims "shard" and detaches all queued entries. Returns NULL if the shard is
+ * empty or already being drained by another thread. Must be called with the
+ * shard's lock held. */
+static write_queue_t *write_queue_shard_claim(write_queue_shard_t *shard) /* {{{ */
 {
+  if (shard->busy || (shard->head == NULL))
+    return NULL;
+
+  write_queue_t *batch = shard->head;
+  shard->head = NULL;
+  shard->tail = NULL;
+  shard->length = 0;
+  shard->busy = true;
+
+  return batch;
+} /* }}} write_queue_t *write_queue_shard_claim */
+
+/* Returns a batch of queued values, claiming the shard they were taken from
+ * (returned in "ret_shard"). Prefers the thread's own shard, then tries to
+ * steal from other shards and blocks if there is nothing to do. Returns NULL
+ * when the write threads are shutting down. */
+static write_queue_t *plugin_write_dequeue(size_t home, /* {{{ */
+                                           write_queue_shard_t **ret_shard) {
+  write_queue_shard_t *shard = write_queue_shards + home;
+  write_queue_t *batch;
+
   while (write_loop) {
-    value_list_t *vl = plugin_write_dequeue();
-    if (vl == NULL)
+    pthread_mutex_lock(&shard->lock);
+    batch = write_queue_shard_claim(shard);
+    pthread_mutex_unlock(&shard->lock);
+    if (batch != NULL) {
+      *ret_shard = shard;
+      return batch;
+    }
+
+    for (size_t i = 1; i < write_queue_shards_num; i++) {
+      write_queue_shard_t *victim =
+          write_queue_shards + ((home + i) % write_queue_shards_num);
+
+      pthread_mutex_lock(&victim->lock);
+      batch = write_queue_shard_claim(victim);
+      pthread_mutex_unlock(&victim->lock);
+      if (batch != NULL) {
+        *ret_shard = victim;
+        return batch;
+      }
+    }
+
+    /* Sleep until the own shard has work or a producer pokes this thread to
+     * steal from a shard whose owner is busy. */
+    pthread_mutex_lock(&shard->lock);
+    shard->waiting++;
+    __atomic_add_fetch(&write_threads_idle, 1, __ATOMIC_RELAXED);
+    while (write_loop && !shard->poked &&
+           (shard->busy || (shard->head == NULL)))
+      pthread_cond_wait(&shard->cond, &shard->lock);
+    __atomic_sub_fetch(&write_threads_idle, 1, __ATOMIC_RELAXED);
+    shard->waiting--;
+    shard->poked = false;
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  return NULL;
+} /* }}} write_queue_t *plugin_write_dequeue */
+
+static void *plugin_write_thread(void *args) /* {{{ */
+{
+  size_t home = (size_t)args;
+  write_batch_t wb = {0};
+
+  pthread_once(&write_queue_once, write_queue_shards_init);
+  pthread_setspecific(write_batch_key, &wb);
+
+  while (write_loop) {
+    write_queue_shard_t *shard = NULL;
+    write_queue_t *q = plugin_write_dequeue(home, &shard);
+    if (q == NULL)
       continue;
 
-    plugin_dispatch_values_internal(vl);
+    write_queue_t *batch = q;
+    write_queue_t *unflushed = q;
+    write_queue_t *last = NULL;
+    long batch_length = 0;
+    while (q != NULL) {
+      (void)plugin_set_ctx(q->ctx);
+      plugin_dispatch_values_internal(&q->vl);
+
+      last = q;
+      batch_length++;
+      q = q->next;
+
+      /* The batch callbacks reference the queue entries, so clear them only
+       * after the batch has been written. */
+      if ((q == NULL) || (wb.num >= WRITE_BATCH_SIZE_MAX)) {
+        write_batch_flush(&wb);
+        for (write_queue_t *c = unflushed; c != q; c = c->next)
+          write_queue_entry_clear(c);
+        unflushed = q;
+      }
+    }
 
-    plugin_value_list_free(vl);
+    /* Release the shard. If more values arrived in the meantime, wake up a
+     * thread waiting on this shard, since the signal sent by the producer may
+     * have been ignored while the shard was busy. */
+    pthread_mutex_lock(&shard->lock);
+    shard->busy = false;
+    if (shard->head != NULL)
+      pthread_cond_signal(&shard->cond);
+    /* Hand as many entries back to the shard's free list as fit, the rest is
+     * freed below. */
+    long room = WRITE_QUEUE_FREE_MAX - shard->free_length;
+    if (room >= batch_length) {
+      last->next = shard->free_list;
+      shard->free_list = batch;
+      shard->free_length += batch_length;
+      batch = NULL;
+    } else {
+      for (long i = 0; i < room; i++) {
+        write_queue_t *next = batch->next;
+        batch->next = shard->free_list;
+        shard->free_list = batch;
+        shard->free_length++;
+        batch = next;
+      }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    while (batch != NULL) {
+      write_queue_t *next = batch->next;
+      sfree(batch);
+      batch = next;
+    }
+  }
+
+  pthread_setspecific(write_batch_key, NULL);
+  sfree(wb.ds);
+  sfree(wb.vl);
+  while (wb.spare != NULL) {
+    write_queue_t *q = wb.spare;
+    wb.spare = q->next;
+    sfree(q);
   }
 
   pthread_exit(NULL);
@@ -833,9 +1780,10 @@ static void start_write_threads(size_t num) /* {{{ */
 
   write_threads_num = 0;
   for (size_t i = 0; i < num; i++) {
-    int status = pthread_create(write_threads + write_threads_num,
-                                /* attr = */ NULL, plugin_write_thread,
-                                /* arg = */ NULL);
+    int status = pthread_create(
+        write_threads + write_threads_num,
+        /* attr = */ NULL, plugin_write_thread,
+        /* arg = */ (void *)(write_threads_num % write_queue_shards_num));
     if (status != 0) {
       ERROR("plugin: start_write_threads: pthread_create failed with status %i "
             "(%s).",
@@ -854,42 +1802,55 @@ static void start_write_threads(size_t num) /* {{{ */
 
 static void stop_write_threads(void) /* {{{ */
 {
-  write_queue_t *q;
-  size_t i;
+  size_t i = 0;
 
   if (write_threads == NULL)
     return;
 
   INFO("collectd: Stopping %" PRIsz " write threads.", write_threads_num);
 
-  pthread_mutex_lock(&write_lock);
   write_loop = false;
-  DEBUG("plugin: stop_write_threads: Signalling `write_cond'");
-  pthread_cond_broadcast(&write_cond);
-  pthread_mutex_unlock(&write_lock);
+  DEBUG("plugin: stop_write_threads: Signalling write queue shards");
+  for (size_t j = 0; j < write_queue_shards_num; j++) {
+    write_queue_shard_t *shard = write_queue_shards + j;
+    pthread_mutex_lock(&shard->lock);
+    pthread_cond_broadcast(&shard->cond);
+    pthread_mutex_unlock(&shard->lock);
+  }
 
-  for (i = 0; i < write_threads_num; i++) {
-    if (pthread_join(write_threads[i], NULL) != 0) {
+  for (size_t j = 0; j < write_threads_num; j++) {
+    if (pthread_join(write_threads[j], NULL) != 0) {
       ERROR("plugin: stop_write_threads: pthread_join failed.");
     }
-    write_threads[i] = (pthread_t)0;
+    write_threads[j] = (pthread_t)0;
   }
   sfree(write_threads);
   write_threads_num = 0;
 
-  pthread_mutex_lock(&write_lock);
-  i = 0;
-  for (q = write_queue_head; q != NULL;) {
-    write_queue_t *q1 = q;
-    plugin_value_list_free(q->vl);
-    q = q->next;
-    sfree(q1);
-    i++;
+  for (size_t j = 0; j < write_queue_shards_num; j++) {
+    write_queue_shard_t *shard = write_queue_shards + j;
+
+    pthread_mutex_lock(&shard->lock);
+    for (write_queue_t *q = shard->head; q != NULL;) {
+      write_queue_t *q1 = q;
+      write_queue_entry_clear(q);
+      q = q->next;
+      sfree(q1);
+      i++;
+    }
+    shard->head = NULL;
+    shard->tail = NULL;
+    shard->length = 0;
+
+    for (write_queue_t *q = shard->free_list; q != NULL;) {
+      write_queue_t *q1 = q;
+      q = q->next;
+      sfree(q1);
+    }
+    shard->free_list = NULL;
+    shard->free_length = 0;
+    pthread_mutex_unlock(&shard->lock);
   }
-  write_queue_head = NULL;
-  write_queue_tail = NULL;
-  write_queue_length = 0;
-  pthread_mutex_unlock(&write_lock);
 
   if (i > 0) {
     WARNING("plugin: %" PRIsz " value list%s left after shutting down "
@@ -1131,7 +2092,12 @@ static int plugin_insert_read(read_func_t *rf) {
     return -1;
   }
 
-  status = c_heap_insert(read_heap, rf);
+  /* Once the read threads are running, the function goes straight to the
+   * thread with the least work. */
+  if (read_workers != NULL)
+    status = read_worker_insert(read_worker_least_loaded(), rf);
+  else
+    status = c_heap_insert(read_heap, rf);
   if (status != 0) {
     pthread_mutex_unlock(&read_lock);
     ERROR("plugin_insert_read: c_heap_insert failed.");
@@ -1142,8 +2108,6 @@ static int plugin_insert_read(read_func_t *rf) {
   /* This does not fail. */
   llist_append(read_list, le);
 
-  /* Wake up all the read threads. */
-  pthread_cond_broadcast(&read_cond);
   pthread_mutex_unlock(&read_lock);
   return 0;
 } /* int plugin_insert_read */
@@ -1221,11 +2185,48 @@ EXPORT int plugin_register_complex_read(const char *group, const char *name,
   return status;
 } /* int plugin_register_complex_read */
 
+static int create_register_write_callback(const char *name, /* {{{ */
+                                          void *callback, bool batch,
+                                          user_data_t const *ud) {
+  if (name == NULL || callback == NULL)
+    return EINVAL;
+
+  write_func_t *wf = calloc(1, sizeof(*wf));
+  if (wf == NULL) {
+    free_userdata(ud);
+    ERROR("plugin: create_register_write_callback: calloc failed.");
+    return ENOMEM;
+  }
+
+  wf->wf_callback = callback;
+  if (ud == NULL) {
+    wf->wf_udata = (user_data_t){
+        .data = NULL,
+        .free_func = NULL,
+    };
+  } else {
+    wf->wf_udata = *ud;
+  }
+  wf->wf_ctx = plugin_get_ctx();
+  wf->wf_batch = batch;
+  C_COMPLAIN_INIT(&wf->wf_complaint);
+
+  return register_callback(&list_write, name, (callback_func_t *)wf);
+} /* }}} int create_register_write_callback */
+
 EXPORT int plugin_register_write(const char *name, plugin_write_cb callback,
                                  user_data_t const *ud) {
-  return create_register_callback(&list_write, name, (void *)callback, ud);
+  return create_register_write_callback(name, (void *)callback,
+                                        /* batch = */ false, ud);
 } /* int plugin_register_write */
 
+EXPORT int plugin_register_write_batch(const char *name,
+                                       plugin_write_batch_cb callback,
+                                       user_data_t const *ud) {
+  return create_register_write_callback(name, (void *)callback,
+                                        /* batch = */ true, ud);
+} /* int plugin_register_write_batch */
+
 static int plugin_flush_timeout_callback(user_data_t *ud) {
   flush_callback_t *cb = ud->data;
 
@@ -1676,6 +2677,13 @@ EXPORT int plugin_init_all(void) {
     write_threads_num = 5;
   }
 
+  /* Values dispatched before this point all went to the first shard, which
+   * stays within range. */
+  pthread_once(&write_queue_once, write_queue_shards_init);
+  write_queue_shards_num = (write_threads_num < WRITE_QUEUE_SHARDS_MAX)
+                               ? write_threads_num
+                               : WRITE_QUEUE_SHARDS_MAX;
+
   if ((list_init == NULL) && (read_heap == NULL))
     return ret;
 
@@ -1774,13 +2782,25 @@ EXPORT int plugin_read_all_once(void) {
       return_status = -1;
     }
 
-    sfree(rf->rf_name);
-    destroy_callback((void *)rf);
+    destroy_read_callback(rf);
   }
 
   return return_status;
 } /* int plugin_read_all_once */
 
+/* Passes a single value to the write callback "wf", wrapping it in a batch of
+ * one for batch callbacks. */
+static int plugin_write_single(write_func_t *wf, /* {{{ */
+                               const data_set_t *ds, const value_list_t *vl) {
+  if (wf->wf_batch) {
+    plugin_write_batch_cb callback = wf->wf_callback;
+    return (*callback)(&ds, &vl, 1, &wf->wf_udata);
+  }
+
+  plugin_write_cb callback = wf->wf_callback;
+  return (*callback)(ds, vl, &wf->wf_udata);
+} /* }}} int plugin_write_single */
+
 EXPORT int plugin_write(const char *plugin, /* {{{ */
                         const data_set_t *ds, const value_list_t *vl) {
   llentry_t *le;
@@ -1804,21 +2824,31 @@ EXPORT int plugin_write(const char *plugin, /* {{{ */
     int success = 0;
     int failure = 0;
 
+    /* When called from a write thread's default action, the value is
+     * collected and passed to the batch callbacks later on. */
+    write_batch_t *wb = write_batch_get();
+    bool batched = (wb != NULL) && wb->recording &&
+                   (write_batch_append(wb, ds, vl) == 0);
+
     le = llist_head(list_write);
     while (le != NULL) {
-      callback_func_t *cf = le->value;
-      plugin_write_cb callback;
+      write_func_t *wf = le->value;
+
+      if (wf->wf_batch && batched) {
+        success++;
+        le = le->next;
+        continue;
+      }
 
       /* Keep the read plugin's interval and flush information but update the
        * plugin name. */
       plugin_ctx_t old_ctx = plugin_get_ctx();
       plugin_ctx_t ctx = old_ctx;
-      ctx.name = cf->cf_ctx.name;
+      ctx.name = wf->wf_ctx.name;
       plugin_set_ctx(ctx);
 
       DEBUG("plugin: plugin_write: Writing values via %s.", le->key);
-      callback = cf->cf_callback;
-      status = (*callback)(ds, vl, &cf->cf_udata);
+      status = plugin_write_single(wf, ds, vl);
       if (status != 0)
         failure++;
       else
@@ -1834,9 +2864,6 @@ EXPORT int plugin_write(const char *plugin, /* {{{ */
       status = 0;
   } else /* plugin != NULL */
   {
-    callback_func_t *cf;
-    plugin_write_cb callback;
-
     le = llist_head(list_write);
     while (le != NULL) {
       if (strcasecmp(plugin, le->key) == 0)
@@ -1848,19 +2875,29 @@ EXPORT int plugin_write(const char *plugin, /* {{{ */
     if (le == NULL)
       return ENOENT;
 
-    cf = le->value;
-
     /* do not switch plugin context; rather keep the context (interval)
      * information of the calling read plugin */
 
     DEBUG("plugin: plugin_write: Writing values via %s.", le->key);
-    callback = cf->cf_callback;
-    status = (*callback)(ds, vl, &cf->cf_udata);
+    status = plugin_write_single(le->value, ds, vl);
   }
 
   return status;
 } /* }}} int plugin_write */
 
+EXPORT int plugin_format_name_vl(char *ret, size_t ret_len, /* {{{ */
+                                 const value_list_t *vl) {
+  const char *name = uc_ident_name(vl->ident);
+  if (name == NULL)
+    return FORMAT_VL(ret, ret_len, vl);
+
+  size_t len = strlen(name);
+  if (len >= ret_len)
+    return ENOBUFS;
+  memcpy(ret, name, len + 1);
+  return 0;
+} /* }}} int plugin_format_name_vl */
+
 EXPORT int plugin_flush(const char *plugin, cdtime_t timeout,
                         const char *identifier) {
   llentry_t *le;
@@ -2019,7 +3056,7 @@ void plugin_dispatch_cache_event(enum cache_event_type_e event_type,
           DEBUG(
               "plugin_dispatch_cache_event: Callback \"%s\" subscribed to %s.",
               cef->name, name);
-          callbacks_mask |= (1 << (i));
+          callbacks_mask |= (1UL << i);
         } else {
           DEBUG("plugin_dispatch_cache_event: Callback \"%s\" ignores %s.",
                 cef->name, name);
@@ -2040,7 +3077,7 @@ void plugin_dispatch_cache_event(enum cache_event_type_e event_type,
       if (!callback)
         continue;
 
-      if (callbacks_mask && (1 << (i)) == 0)
+      if ((callbacks_mask & (1UL << i)) == 0)
         continue;
 
       cache_event_t event = (cache_event_t){.type = event_type,
@@ -2160,19 +3197,43 @@ static int plugin_dispatch_values_internal(value_list_t *vl) {
       return 0;
   }
 
-  /* Update the value cache */
-  uc_update(ds, vl);
+  /* Update the value cache. This also attaches the interned identifier to the
+   * value list, so write plugins don't need to format it again. */
+  uc_update_ident(ds, vl);
 
   if (post_cache_chain != NULL) {
+    write_batch_t *wb = write_batch_get();
+
+    if (wb != NULL) {
+      wb->recording = true;
+      wb->copying = true;
+    }
     status = fc_process_chain(ds, vl, post_cache_chain);
+    if (wb != NULL) {
+      wb->recording = false;
+      wb->copying = false;
+    }
     if (status < 0) {
       WARNING("plugin_dispatch_values: Running the "
               "post-cache chain failed with "
               "status %i (%#x).",
               status, status);
     }
-  } else
+  } else {
+    write_batch_t *wb = write_batch_get();
+    size_t batch_num = (wb != NULL) ? wb->num : 0;
+
+    if (wb != NULL)
+      wb->recording = true;
     fc_default_action(ds, vl);
+    if (wb != NULL) {
+      wb->recording = false;
+      /* The value list is still referenced by the batch; the meta data is
+       * freed together with the write queue entry. */
+      if (wb->num != batch_num)
+        free_meta_data = false;
+    }
+  }
 
   if ((free_meta_data == true) && (vl->meta != NULL)) {
     meta_data_destroy(vl->meta);
@@ -2188,9 +3249,7 @@ static double get_drop_probability(void) /* {{{ */
   long size;
   long wql;
 
-  pthread_mutex_lock(&write_lock);
-  wql = write_queue_length;
-  pthread_mutex_unlock(&write_lock);
+  wql = write_queue_length_get();
 
   if (wql < write_limit_low)
     return 0.0;
@@ -2266,6 +3325,45 @@ EXPORT int plugin_dispatch_values(value_list_t const *vl) {
   return 0;
 }
 
+EXPORT int plugin_dispatch_values_batch(value_list_t const *vl, /* {{{ */
+                                        size_t num) {
+  if ((vl == NULL) || (num == 0))
+    return EINVAL;
+
+  pthread_once(&write_queue_once, write_queue_shards_init);
+
+  size_t *shard_idx = calloc(num, sizeof(*shard_idx));
+  if (shard_idx == NULL)
+    return ENOMEM;
+
+  derive_t dropped = 0;
+  for (size_t i = 0; i < num; i++) {
+    if (check_drop_value()) {
+      shard_idx[i] = SIZE_MAX;
+      dropped++;
+      continue;
+    }
+    shard_idx[i] = write_queue_hash(vl + i) % write_queue_shards_num;
+  }
+
+  if ((dropped > 0) && record_statistics) {
+    pthread_mutex_lock(&statistics_lock);
+    stats_values_dropped += dropped;
+    pthread_mutex_unlock(&statistics_lock);
+  }
+
+  int status = plugin_write_enqueue_batch(vl, shard_idx, num);
+  sfree(shard_idx);
+  if (status != 0) {
+    ERROR("plugin_dispatch_values_batch: plugin_write_enqueue_batch failed "
+          "with status %i (%s).",
+          status, STRERROR(status));
+    return status;
+  }
+
+  return 0;
+} /* }}} int plugin_dispatch_values_batch */
+
 __attribute__((sentinel)) int
 plugin_dispatch_multivalue(value_list_t const *template, /* {{{ */
                            bool store_percentage, int store_type, ...) {
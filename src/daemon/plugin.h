@@ -87,6 +87,10 @@ struct identifier_s {
 };
 typedef struct identifier_s identifier_t;
 
+/* Interned identifier owned by the value cache, see utils_cache.h. */
+struct uc_ident_s;
+typedef struct uc_ident_s uc_ident_t;
+
 typedef unsigned long long counter_t;
 typedef double gauge_t;
 typedef int64_t derive_t;
@@ -111,11 +115,15 @@ struct value_list_s {
   char type[DATA_MAX_NAME_LEN];
   char type_instance[DATA_MAX_NAME_LEN];
   meta_data_t *meta;
+  /* Set by the daemon when the value list passes the cache and reset when a
+   * target may have changed the identifier. Plugins must not set it; use
+   * plugin_format_name_vl() to make use of it. */
+  uc_ident_t *ident;
 };
 typedef struct value_list_s value_list_t;
 
 #define VALUE_LIST_INIT                                                        \
-  { .values = NULL, .meta = NULL }
+  { .values = NULL, .meta = NULL, .ident = NULL }
 
 struct data_source_s {
   char name[DATA_MAX_NAME_LEN];
@@ -195,6 +203,11 @@ typedef int (*plugin_init_cb)(void);
 typedef int (*plugin_read_cb)(user_data_t *);
 typedef int (*plugin_write_cb)(const data_set_t *, const value_list_t *,
                                user_data_t *);
+/* "write batch" callback. Receives "num" data set / value list pairs at once,
+ * "ds[i]" belonging to "vl[i]". */
+typedef int (*plugin_write_batch_cb)(const data_set_t *const *ds,
+                                     const value_list_t *const *vl, size_t num,
+                                     user_data_t *);
 typedef int (*plugin_flush_cb)(cdtime_t timeout, const char *identifier,
                                user_data_t *);
 /* "missing" callback. Returns less than zero on failure, zero if other
@@ -286,6 +299,17 @@ int plugin_write(const char *plugin, const data_set_t *ds,
 
 int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier);
 
+/*
+ * NAME
+ *  plugin_format_name_vl
+ *
+ * DESCRIPTION
+ *  Same as FORMAT_VL(), but copies the identifier interned by the value cache
+ *  instead of formatting it, if available. Only use this with value lists
+ *  passed to a write or missing callback by the daemon.
+ */
+int plugin_format_name_vl(char *ret, size_t ret_len, const value_list_t *vl);
+
 /*
  * The `plugin_register_*' functions are used to make `config', `init',
  * `read', `write' and `shutdown' functions known to the plugin
@@ -305,6 +329,12 @@ int plugin_register_complex_read(const char *group, const char *name,
                                  user_data_t const *user_data);
 int plugin_register_write(const char *name, plugin_write_cb callback,
                           user_data_t const *user_data);
+/* Like "plugin_register_write", but the callback is passed all values handled
+ * by a write thread in one go, rather than being called once per value. Batch
+ * callbacks are unregistered with "plugin_unregister_write". */
+int plugin_register_write_batch(const char *name,
+                                plugin_write_batch_cb callback,
+                                user_data_t const *user_data);
 int plugin_register_flush(const char *name, plugin_flush_cb callback,
                           user_data_t const *user_data);
 int plugin_register_missing(const char *name, plugin_missing_cb callback,
@@ -362,6 +392,22 @@ void plugin_log_available_writers(void);
  */
 int plugin_dispatch_values(value_list_t const *vl);
 
+/*
+ * NAME
+ *  plugin_dispatch_values_batch
+ *
+ * DESCRIPTION
+ *  Dispatches "num" value lists, stored consecutively in "vl", as if
+ *  `plugin_dispatch_values' was called for each of them, but takes the write
+ *  queue locks only once per batch. Meant for plugins which produce many
+ *  value lists at once, e.g. when parsing a network packet.
+ *
+ * RETURNS
+ *  Zero on success, an error code if at least one value list could not be
+ *  queued.
+ */
+int plugin_dispatch_values_batch(value_list_t const *vl, size_t num);
+
 /*
  * NAME
  *  plugin_dispatch_multivalue
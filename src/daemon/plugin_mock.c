@@ -25,6 +25,7 @@
  */
 
 #include "plugin.h"
+#include "utils/common/common.h"
 
 #if HAVE_KSTAT_H
 #include <kstat.h>
@@ -69,6 +70,13 @@ int plugin_register_write(__attribute__((unused)) const char *name,
   return ENOTSUP;
 }
 
+int plugin_register_write_batch(__attribute__((unused)) const char *name,
+                                __attribute__((unused))
+                                plugin_write_batch_cb callback,
+                                __attribute__((unused)) user_data_t const *ud) {
+  return ENOTSUP;
+}
+
 int plugin_register_flush(__attribute__((unused)) const char *name,
                           __attribute__((unused)) plugin_flush_cb callback,
                           __attribute__((unused))
@@ -121,6 +129,15 @@ DECLARE_UNREGISTER(notification)
 
 int plugin_dispatch_values(value_list_t const *vl) { return ENOTSUP; }
 
+int plugin_format_name_vl(char *ret, size_t ret_len, const value_list_t *vl) {
+  return FORMAT_VL(ret, ret_len, vl);
+}
+
+int plugin_dispatch_values_batch(__attribute__((unused)) value_list_t const *vl,
+                                 __attribute__((unused)) size_t num) {
+  return ENOTSUP;
+}
+
 int plugin_dispatch_notification(__attribute__((unused))
                                  const notification_t *notif) {
   return ENOTSUP;
@@ -0,0 +1,296 @@
+/**
+ * collectd - src/daemon/plugin_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "plugin.c" /* sic */
+#include "testing.h"
+
+#define TEST_VALUES 500
+
+/* Counters updated by the write callbacks, which run in the write threads. */
+static pthread_mutex_t test_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t batch_values;
+static size_t batch_calls;
+static size_t batch_max;
+static size_t single_values;
+static size_t bad_values;
+static int batch_status;
+static size_t batch_errors;
+
+static void test_check_value(const value_list_t *vl) {
+  char want[DATA_MAX_NAME_LEN];
+  ssnprintf(want, sizeof(want), "%.0f", vl->values[0].gauge);
+  if ((strcmp(want, vl->plugin_instance) != 0) ||
+      (strcmp("test", vl->type_instance) != 0))
+    bad_values++;
+}
+
+static int test_write_batch(const data_set_t *const *ds,
+                            const value_list_t *const *vl, size_t num,
+                            user_data_t *ud) {
+  pthread_mutex_lock(&test_lock);
+  for (size_t i = 0; i < num; i++)
+    test_check_value(vl[i]);
+  batch_values += num;
+  batch_calls++;
+  if (batch_max < num)
+    batch_max = num;
+  int status = batch_status;
+  pthread_mutex_unlock(&test_lock);
+  return status;
+}
+
+static int test_write(const data_set_t *ds, const value_list_t *vl,
+                      user_data_t *ud) {
+  pthread_mutex_lock(&test_lock);
+  test_check_value(vl);
+  single_values++;
+  pthread_mutex_unlock(&test_lock);
+  return 0;
+}
+
+/* Counts the errors reported for the batch callback. */
+static void test_log(int severity, const char *msg, user_data_t *ud) {
+  if ((severity != LOG_ERR) || (strstr(msg, "test_batch") == NULL))
+    return;
+  pthread_mutex_lock(&test_lock);
+  batch_errors++;
+  pthread_mutex_unlock(&test_lock);
+}
+
+/* The "mangle" target modifies value lists after they have been written. */
+static int test_mangle(const data_set_t *ds, value_list_t *vl,
+                       notification_meta_t **meta, void **user_data) {
+  sstrncpy(vl->type_instance, "mangled", sizeof(vl->type_instance));
+  return FC_TARGET_CONTINUE;
+}
+
+static void test_reset(void) {
+  pthread_mutex_lock(&test_lock);
+  batch_values = 0;
+  batch_calls = 0;
+  batch_max = 0;
+  single_values = 0;
+  bad_values = 0;
+  pthread_mutex_unlock(&test_lock);
+}
+
+/* Dispatches TEST_VALUES values with time "t" in one batch and waits until both write
+ * callbacks have received all of them. */
+static int test_dispatch(cdtime_t t) {
+  value_t values[TEST_VALUES];
+  value_list_t vl[TEST_VALUES];
+
+  for (size_t i = 0; i < TEST_VALUES; i++) {
+    values[i].gauge = (gauge_t)i;
+    vl[i] = (value_list_t)VALUE_LIST_INIT;
+    vl[i].values = values + i;
+    vl[i].values_len = 1;
+    vl[i].time = t;
+    vl[i].interval = TIME_T_TO_CDTIME_T(10);
+    sstrncpy(vl[i].host, "example.com", sizeof(vl[i].host));
+    sstrncpy(vl[i].plugin, "test", sizeof(vl[i].plugin));
+    ssnprintf(vl[i].plugin_instance, sizeof(vl[i].plugin_instance), "%zu", i);
+    sstrncpy(vl[i].type, "gauge", sizeof(vl[i].type));
+    sstrncpy(vl[i].type_instance, "test", sizeof(vl[i].type_instance));
+  }
+
+  int status = plugin_dispatch_values_batch(vl, TEST_VALUES);
+  if (status != 0)
+    return status;
+
+  for (int i = 0; i < 1000; i++) {
+    pthread_mutex_lock(&test_lock);
+    bool done =
+        (batch_values >= TEST_VALUES) && (single_values >= TEST_VALUES);
+    pthread_mutex_unlock(&test_lock);
+    if (done)
+      return 0;
+    usleep(10000);
+  }
+  return ETIMEDOUT;
+}
+
+DEF_TEST(dispatch_batch) {
+  data_source_t dsrc = {"value", DS_TYPE_GAUGE, NAN, NAN};
+  data_set_t ds = {"gauge", 1, &dsrc};
+
+  plugin_init_ctx();
+  CHECK_ZERO(plugin_register_data_set(&ds));
+  CHECK_ZERO(plugin_register_write_batch("test_batch", test_write_batch,
+                                         &(user_data_t){0}));
+  CHECK_ZERO(plugin_register_write("test_single", test_write,
+                                   &(user_data_t){0}));
+  CHECK_ZERO(uc_init());
+
+  write_queue_shards_num = 2;
+  start_write_threads(2);
+
+  /* Without a post-cache chain, values are written straight from the queue. */
+  test_reset();
+  CHECK_ZERO(test_dispatch(TIME_T_TO_CDTIME_T(10)));
+  EXPECT_EQ_INT(TEST_VALUES, (int)batch_values);
+  EXPECT_EQ_INT(TEST_VALUES, (int)single_values);
+  EXPECT_EQ_INT(0, (int)bad_values);
+  OK1(batch_max > 1, "batch callback received more than one value");
+
+  /* With a post-cache chain, the "write" target writes copies that are not
+   * affected by targets running afterwards. */
+  oconfig_value_t chain_name = {.value.string = "PostCache",
+                                .type = OCONFIG_TYPE_STRING};
+  oconfig_value_t write_name = {.value.string = "write",
+                                .type = OCONFIG_TYPE_STRING};
+  oconfig_value_t mangle_name = {.value.string = "mangle",
+                                 .type = OCONFIG_TYPE_STRING};
+  oconfig_item_t targets[] = {
+      {.key = "Target", .values = &write_name, .values_num = 1},
+      {.key = "Target", .values = &mangle_name, .values_num = 1},
+  };
+  oconfig_item_t chain = {.key = "Chain",
+                          .values = &chain_name,
+                          .values_num = 1,
+                          .children = targets,
+                          .children_num = STATIC_ARRAY_SIZE(targets)};
+
+  CHECK_ZERO(fc_register_target("mangle", (target_proc_t){
+                                              .invoke = test_mangle,
+                                          }));
+  CHECK_ZERO(fc_configure(&chain));
+  post_cache_chain = fc_chain_get_by_name("PostCache");
+  CHECK_NOT_NULL(post_cache_chain);
+
+  test_reset();
+  CHECK_ZERO(test_dispatch(TIME_T_TO_CDTIME_T(20)));
+  EXPECT_EQ_INT(TEST_VALUES, (int)batch_values);
+  EXPECT_EQ_INT(TEST_VALUES, (int)single_values);
+  EXPECT_EQ_INT(0, (int)bad_values);
+  OK1(batch_max > 1, "post-cache chain values are written in batches");
+
+  /* Batch callbacks run after plugin_write() returned, so their failures are
+   * logged by the write thread. */
+  CHECK_ZERO(plugin_register_log("test_log", test_log, &(user_data_t){0}));
+  test_reset();
+  pthread_mutex_lock(&test_lock);
+  batch_status = -1;
+  batch_errors = 0;
+  pthread_mutex_unlock(&test_lock);
+  CHECK_ZERO(test_dispatch(TIME_T_TO_CDTIME_T(30)));
+  bool logged = false;
+  for (int i = 0; (i < 100) && !logged; i++) {
+    pthread_mutex_lock(&test_lock);
+    logged = (batch_errors > 0);
+    pthread_mutex_unlock(&test_lock);
+    if (!logged)
+      usleep(10000);
+  }
+  OK1(logged, "failing batch callback is logged as error");
+
+  pthread_mutex_lock(&test_lock);
+  batch_status = 0;
+  pthread_mutex_unlock(&test_lock);
+  plugin_unregister_log("test_log");
+
+  stop_write_threads();
+  post_cache_chain = NULL;
+  return 0;
+}
+
+/* State of the read callbacks, which run in the read threads. */
+static pthread_cond_t hang_cond = PTHREAD_COND_INITIALIZER;
+static int hang_started;
+static bool hang_release;
+
+/* Blocks until released, like a plugin stuck in its first read. */
+static int test_read_hang(user_data_t *ud) {
+  pthread_mutex_lock(&test_lock);
+  hang_started = 1;
+  while (!hang_release)
+    pthread_cond_wait(&hang_cond, &test_lock);
+  pthread_mutex_unlock(&test_lock);
+  return 0;
+}
+
+static int test_read_count(user_data_t *ud) {
+  pthread_mutex_lock(&test_lock);
+  (*(int *)ud->data)++;
+  pthread_mutex_unlock(&test_lock);
+  return 0;
+}
+
+/* Waits up to two seconds for "*flag" to become non-zero. */
+static bool test_wait(int const *flag) {
+  for (int i = 0; i < 200; i++) {
+    pthread_mutex_lock(&test_lock);
+    bool done = (*flag != 0);
+    pthread_mutex_unlock(&test_lock);
+    if (done)
+      return true;
+    usleep(10000);
+  }
+  return false;
+}
+
+/* A function queued behind a call that hangs in its very first run, i.e.
+ * without any previous duration to go by, is stolen once it is due. */
+DEF_TEST(read_steal_first_run) {
+  cdtime_t interval = TIME_T_TO_CDTIME_T(10);
+  int filler_calls = 0;
+  int fast_calls = 0;
+
+  start_read_threads(2);
+
+  /* The first read thread gets "hang", the second one "filler". */
+  CHECK_ZERO(plugin_register_complex_read(NULL, "hang", test_read_hang,
+                                          interval, &(user_data_t){0}));
+  OK1(test_wait(&hang_started), "the hanging read function has been called");
+
+  CHECK_ZERO(plugin_register_complex_read(
+      NULL, "filler", test_read_count, interval,
+      &(user_data_t){.data = &filler_calls}));
+  OK1(test_wait(&filler_calls), "the second read thread is running");
+
+  /* Both threads own one function, so "fast" queues up behind "hang". The
+   * second thread sleeps until "filler" is due again, ten seconds from now,
+   * unless it is woken up to steal "fast". */
+  CHECK_ZERO(plugin_register_complex_read(
+      NULL, "fast", test_read_count, interval,
+      &(user_data_t){.data = &fast_calls}));
+  OK1(test_wait(&fast_calls), "the function behind the hanging one is called");
+  pthread_mutex_lock(&read_workers[1].lock);
+  OK(read_workers[1].steals > 0);
+  pthread_mutex_unlock(&read_workers[1].lock);
+
+  pthread_mutex_lock(&test_lock);
+  hang_release = true;
+  pthread_cond_broadcast(&hang_cond);
+  pthread_mutex_unlock(&test_lock);
+
+  stop_read_threads();
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(dispatch_batch);
+  RUN_TEST(read_steal_first_run);
+
+  END_TEST;
+}
@@ -29,15 +29,28 @@
 #include "collectd.h"
 
 #include "plugin.h"
-#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 #include "utils/metadata/meta_data.h"
 #include "utils_cache.h"
 
 #include <assert.h>
 
+/* Interned identifier. Cache entries and the value lists which passed the
+ * cache (see uc_update_ident()) each hold a reference, so identifiers of
+ * expired entries are freed once the last value list using them has been
+ * written. The identifier never changes after its creation and the reference
+ * count is modified atomically, so writers drop their references without
+ * taking the shard lock. */
+struct uc_ident_s {
+  /* FNV-1a hash of `name', see uc_hash_vl(). */
+  uint64_t hash;
+  size_t refs;
+  /* Allocated to the length of the name, see uc_insert(). */
+  char name[];
+};
+
 typedef struct cache_entry_s {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uc_ident_t *ident;
   size_t values_num;
   gauge_t *values_gauge;
   value_t *values_raw;
@@ -68,24 +81,258 @@ typedef struct cache_entry_s {
 
   meta_data_t *meta;
   unsigned long callbacks_mask;
+
+  struct cache_entry_s *next;
+
+  /* Time at which the entry expires unless it is updated, and its place in
+   * the expiry wheel of its shard. */
+  cdtime_t expires;
+  struct cache_entry_s *wheel_next;
+  struct cache_entry_s **wheel_pprev;
 } cache_entry_t;
 
+/* The cache is a hash table split into shards, each protected by its own
+ * lock, so that concurrent updates of different values rarely contend. The
+ * shard is selected by the upper bits of the hash, the bucket within the shard
+ * by the lower bits. Collisions are resolved by chaining. */
+#define UC_SHARDS_BITS 6
+#define UC_SHARDS_NUM (1 << UC_SHARDS_BITS)
+#define UC_BUCKETS_MIN 64
+
+/* Each shard also keeps its entries in a timing wheel, a ring of lists of the
+ * entries expiring in the same second, so that uc_check_timeout() only visits
+ * the lists which are due instead of the whole cache. Entries are moved to
+ * their new list when they are updated. Entries expiring more than
+ * UC_WHEEL_SIZE seconds ahead wrap around and are skipped until their lap. */
+#define UC_WHEEL_BITS 10
+#define UC_WHEEL_SIZE (1 << UC_WHEEL_BITS)
+#define UC_WHEEL_SHIFT 30 /* one second in cdtime_t */
+
+typedef struct cache_shard_s {
+  pthread_mutex_t lock;
+  cache_entry_t **buckets;
+  size_t buckets_num; /* power of two */
+  size_t entries_num;
+
+  cache_entry_t **wheel; /* UC_WHEEL_SIZE lists, allocated with the buckets */
+  uint64_t wheel_slot;   /* first second not checked for expired entries */
+} cache_shard_t;
+
 struct uc_iter_s {
-  c_avl_iterator_t *iter;
+  size_t shard;
+  size_t bucket;
 
   char *name;
   cache_entry_t *entry;
 };
 
-static c_avl_tree_t *cache_tree;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_shard_t cache_shards[UC_SHARDS_NUM];
+static pthread_once_t cache_shards_once = PTHREAD_ONCE_INIT;
+
+static void cache_shards_init(void) {
+  for (size_t i = 0; i < UC_SHARDS_NUM; i++) {
+    pthread_mutex_init(&cache_shards[i].lock, /* attr = */ NULL);
+    cache_shards[i].buckets = NULL;
+    cache_shards[i].buckets_num = 0;
+    cache_shards[i].entries_num = 0;
+    cache_shards[i].wheel = NULL;
+    cache_shards[i].wheel_slot = 0;
+  }
+} /* void cache_shards_init */
+
+/* Computes the FNV-1a hash of the name FORMAT_VL() would produce for "vl",
+ * without actually formatting the name. */
+static uint64_t uc_hash_vl(const value_list_t *vl) {
+  uint64_t hash = FNV1A_INIT;
+
+  hash = fnv1a_append(hash, vl->host);
+  hash = fnv1a_append(hash, "/");
+  hash = fnv1a_append(hash, vl->plugin);
+  if (vl->plugin_instance[0] != 0) {
+    hash = fnv1a_append(hash, "-");
+    hash = fnv1a_append(hash, vl->plugin_instance);
+  }
+  hash = fnv1a_append(hash, "/");
+  hash = fnv1a_append(hash, vl->type);
+  if (vl->type_instance[0] != 0) {
+    hash = fnv1a_append(hash, "-");
+    hash = fnv1a_append(hash, vl->type_instance);
+  }
+
+  return hash;
+} /* uint64_t uc_hash_vl */
+
+static uint64_t uc_hash_name(const char *name) {
+  return fnv1a_append(FNV1A_INIT, name);
+} /* uint64_t uc_hash_name */
+
+/* Returns a pointer behind "prefix" in "str", or NULL if "str" does not start
+ * with "prefix". */
+static const char *uc_skip_prefix(const char *str, const char *prefix) {
+  while (*prefix != 0) {
+    if (*str != *prefix)
+      return NULL;
+    str++;
+    prefix++;
+  }
+  return str;
+} /* const char *uc_skip_prefix */
+
+/* Checks whether "name" equals FORMAT_VL(vl), without formatting the name. */
+static bool uc_name_equals_vl(const char *name, const value_list_t *vl) {
+  const char *ptr = name;
+
+  if ((ptr = uc_skip_prefix(ptr, vl->host)) == NULL ||
+      (ptr = uc_skip_prefix(ptr, "/")) == NULL ||
+      (ptr = uc_skip_prefix(ptr, vl->plugin)) == NULL)
+    return false;
+  if (vl->plugin_instance[0] != 0) {
+    if ((ptr = uc_skip_prefix(ptr, "-")) == NULL ||
+        (ptr = uc_skip_prefix(ptr, vl->plugin_instance)) == NULL)
+      return false;
+  }
+  if ((ptr = uc_skip_prefix(ptr, "/")) == NULL ||
+      (ptr = uc_skip_prefix(ptr, vl->type)) == NULL)
+    return false;
+  if (vl->type_instance[0] != 0) {
+    if ((ptr = uc_skip_prefix(ptr, "-")) == NULL ||
+        (ptr = uc_skip_prefix(ptr, vl->type_instance)) == NULL)
+      return false;
+  }
+
+  return *ptr == 0;
+} /* bool uc_name_equals_vl */
+
+static cache_shard_t *uc_shard(uint64_t hash) {
+  pthread_once(&cache_shards_once, cache_shards_init);
+  return cache_shards + (hash >> (64 - UC_SHARDS_BITS));
+} /* cache_shard_t *uc_shard */
+
+/* The following functions must be called with the shard's lock held. */
+static cache_entry_t *uc_shard_get_vl(cache_shard_t *shard, uint64_t hash,
+                                      const value_list_t *vl) {
+  if (shard->buckets == NULL)
+    return NULL;
+
+  for (cache_entry_t *ce = shard->buckets[hash & (shard->buckets_num - 1)];
+       ce != NULL; ce = ce->next)
+    if ((ce->ident->hash == hash) && uc_name_equals_vl(ce->ident->name, vl))
+      return ce;
+
+  return NULL;
+} /* cache_entry_t *uc_shard_get_vl */
+
+static cache_entry_t *uc_shard_get(cache_shard_t *shard, uint64_t hash,
+                                   const char *name) {
+  if (shard->buckets == NULL)
+    return NULL;
+
+  for (cache_entry_t *ce = shard->buckets[hash & (shard->buckets_num - 1)];
+       ce != NULL; ce = ce->next)
+    if ((ce->ident->hash == hash) && (strcmp(ce->ident->name, name) == 0))
+      return ce;
+
+  return NULL;
+} /* cache_entry_t *uc_shard_get */
+
+static void uc_wheel_unlink(cache_entry_t *ce) {
+  if (ce->wheel_pprev == NULL)
+    return;
+
+  *ce->wheel_pprev = ce->wheel_next;
+  if (ce->wheel_next != NULL)
+    ce->wheel_next->wheel_pprev = ce->wheel_pprev;
+  ce->wheel_next = NULL;
+  ce->wheel_pprev = NULL;
+} /* void uc_wheel_unlink */
+
+/* Computes when "ce" expires and moves it to the corresponding list of the
+ * shard's wheel. Entries which are already due go to the first list that has
+ * not been checked yet. */
+static void uc_wheel_link(cache_shard_t *shard, cache_entry_t *ce) {
+  cdtime_t expires = ce->last_update + ce->interval * timeout_g;
+  uint64_t slot = expires >> UC_WHEEL_SHIFT;
+  if (slot < shard->wheel_slot)
+    slot = shard->wheel_slot;
+
+  if ((ce->wheel_pprev != NULL) &&
+      ((ce->expires >> UC_WHEEL_SHIFT) == (expires >> UC_WHEEL_SHIFT))) {
+    ce->expires = expires;
+    return;
+  }
+  ce->expires = expires;
+
+  uc_wheel_unlink(ce);
+
+  cache_entry_t **head = &shard->wheel[slot & (UC_WHEEL_SIZE - 1)];
+  ce->wheel_next = *head;
+  if (*head != NULL)
+    (*head)->wheel_pprev = &ce->wheel_next;
+  *head = ce;
+  ce->wheel_pprev = head;
+} /* void uc_wheel_link */
+
+static int uc_shard_insert(cache_shard_t *shard, cache_entry_t *ce) {
+  if (shard->wheel == NULL) {
+    shard->wheel = calloc(UC_WHEEL_SIZE, sizeof(*shard->wheel));
+    if (shard->wheel == NULL)
+      return ENOMEM;
+    shard->wheel_slot = cdtime() >> UC_WHEEL_SHIFT;
+  }
+
+  /* Grow the table when the average chain length exceeds one. */
+  if (shard->entries_num >= shard->buckets_num) {
+    size_t buckets_num =
+        (shard->buckets_num == 0) ? UC_BUCKETS_MIN : 2 * shard->buckets_num;
+    cache_entry_t **buckets = calloc(buckets_num, sizeof(*buckets));
+    if (buckets == NULL)
+      return ENOMEM;
+
+    for (size_t i = 0; i < shard->buckets_num; i++) {
+      cache_entry_t *next;
+      for (cache_entry_t *e = shard->buckets[i]; e != NULL; e = next) {
+        next = e->next;
+        size_t idx = e->ident->hash & (buckets_num - 1);
+        e->next = buckets[idx];
+        buckets[idx] = e;
+      }
+    }
 
-static int cache_compare(const cache_entry_t *a, const cache_entry_t *b) {
-#if COLLECT_DEBUG
-  assert((a != NULL) && (b != NULL));
-#endif
-  return strcmp(a->name, b->name);
-} /* int cache_compare */
+    sfree(shard->buckets);
+    shard->buckets = buckets;
+    shard->buckets_num = buckets_num;
+  }
+
+  size_t idx = ce->ident->hash & (shard->buckets_num - 1);
+  ce->next = shard->buckets[idx];
+  shard->buckets[idx] = ce;
+  shard->entries_num++;
+
+  uc_wheel_link(shard, ce);
+  return 0;
+} /* int uc_shard_insert */
+
+static cache_entry_t *uc_shard_remove(cache_shard_t *shard, uint64_t hash,
+                                      const char *name) {
+  if (shard->buckets == NULL)
+    return NULL;
+
+  cache_entry_t **ptr = &shard->buckets[hash & (shard->buckets_num - 1)];
+  for (; *ptr != NULL; ptr = &(*ptr)->next) {
+    cache_entry_t *ce = *ptr;
+    if ((ce->ident->hash != hash) || (strcmp(ce->ident->name, name) != 0))
+      continue;
+
+    *ptr = ce->next;
+    ce->next = NULL;
+    shard->entries_num--;
+
+    uc_wheel_unlink(ce);
+    return ce;
+  }
+
+  return NULL;
+} /* cache_entry_t *uc_shard_remove */
 
 static cache_entry_t *cache_alloc(size_t values_num) {
   cache_entry_t *ce;
@@ -139,24 +386,44 @@ static void uc_check_range(const data_set_t *ds, cache_entry_t *ce) {
   }
 } /* void uc_check_range */
 
-static int uc_insert(const data_set_t *ds, const value_list_t *vl,
-                     const char *key) {
-  /* `cache_lock' has been locked by `uc_update' */
+static void uc_ident_incref(uc_ident_t *ident) {
+  __atomic_add_fetch(&ident->refs, 1, __ATOMIC_RELAXED);
+} /* void uc_ident_incref */
 
-  char *key_copy = strdup(key);
-  if (key_copy == NULL) {
-    ERROR("uc_insert: strdup failed.");
+/* Drops a reference to "ident" and frees it with the last one. */
+static void uc_ident_unref(uc_ident_t *ident) {
+  size_t refs = __atomic_sub_fetch(&ident->refs, 1, __ATOMIC_ACQ_REL);
+  assert(refs != SIZE_MAX);
+  if (refs == 0)
+    sfree(ident);
+} /* void uc_ident_unref */
+
+static int uc_insert(cache_shard_t *shard, const data_set_t *ds,
+                     const value_list_t *vl, uint64_t hash) {
+  /* The shard's lock has been locked by `uc_update' */
+
+  char name[6 * DATA_MAX_NAME_LEN];
+  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
+    ERROR("uc_insert: FORMAT_VL failed.");
     return -1;
   }
 
   cache_entry_t *ce = cache_alloc(ds->ds_num);
   if (ce == NULL) {
-    sfree(key_copy);
     ERROR("uc_insert: cache_alloc (%" PRIsz ") failed.", ds->ds_num);
     return -1;
   }
 
-  sstrncpy(ce->name, key, sizeof(ce->name));
+  size_t name_size = strlen(name) + 1;
+  ce->ident = malloc(offsetof(uc_ident_t, name) + name_size);
+  if (ce->ident == NULL) {
+    ERROR("uc_insert: malloc failed.");
+    cache_free(ce);
+    return -1;
+  }
+  memcpy(ce->ident->name, name, name_size);
+  ce->ident->hash = hash;
+  ce->ident->refs = 1;
 
   for (size_t i = 0; i < ds->ds_num; i++) {
     switch (ds->ds[i].type) {
@@ -187,7 +454,7 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
       /* This shouldn't happen. */
       ERROR("uc_insert: Don't know how to handle data source type %i.",
             ds->ds[i].type);
-      sfree(key_copy);
+      sfree(ce->ident);
       cache_free(ce);
       return -1;
     } /* switch (ds->ds[i].type) */
@@ -205,67 +472,84 @@ static int uc_insert(const data_set_t *ds, const value_list_t *vl,
     ce->meta = meta_data_clone(vl->meta);
   }
 
-  if (c_avl_insert(cache_tree, key_copy, ce) != 0) {
-    sfree(key_copy);
-    ERROR("uc_insert: c_avl_insert failed.");
+  if (uc_shard_insert(shard, ce) != 0) {
+    ERROR("uc_insert: uc_shard_insert failed.");
+    sfree(ce->ident);
+    cache_free(ce);
     return -1;
   }
 
-  DEBUG("uc_insert: Added %s to the cache.", key);
+  DEBUG("uc_insert: Added %s to the cache.", ce->ident->name);
   return 0;
 } /* int uc_insert */
 
 int uc_init(void) {
-  if (cache_tree == NULL)
-    cache_tree =
-        c_avl_create((int (*)(const void *, const void *))cache_compare);
-
+  pthread_once(&cache_shards_once, cache_shards_init);
   return 0;
 } /* int uc_init */
 
 int uc_check_timeout(void) {
   struct {
-    char *key;
+    uc_ident_t *ident;
     cdtime_t time;
     cdtime_t interval;
     unsigned long callbacks_mask;
   } *expired = NULL;
   size_t expired_num = 0;
+  size_t expired_size = 0;
 
-  pthread_mutex_lock(&cache_lock);
   cdtime_t now = cdtime();
+  uint64_t now_slot = now >> UC_WHEEL_SHIFT;
 
-  /* Build a list of entries to be flushed */
-  c_avl_iterator_t *iter = c_avl_get_iterator(cache_tree);
-  char *key = NULL;
-  cache_entry_t *ce = NULL;
-  while (c_avl_iterator_next(iter, (void *)&key, (void *)&ce) == 0) {
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
+  /* Build a list of entries to be flushed. Only the lists of the wheels up to
+   * the current second are visited; a reference to the identifier keeps the
+   * name of each entry valid without copying it. */
+  for (size_t i = 0; i < UC_SHARDS_NUM; i++) {
+    cache_shard_t *shard = uc_shard((uint64_t)i << (64 - UC_SHARDS_BITS));
 
-    void *tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
-    if (tmp == NULL) {
-      ERROR("uc_check_timeout: realloc failed.");
+    pthread_mutex_lock(&shard->lock);
+    if (shard->wheel == NULL) {
+      pthread_mutex_unlock(&shard->lock);
       continue;
     }
-    expired = tmp;
 
-    expired[expired_num].key = strdup(key);
-    expired[expired_num].time = ce->last_time;
-    expired[expired_num].interval = ce->interval;
-    expired[expired_num].callbacks_mask = ce->callbacks_mask;
-
-    if (expired[expired_num].key == NULL) {
-      ERROR("uc_check_timeout: strdup failed.");
-      continue;
+    uint64_t slots_num = now_slot - shard->wheel_slot + 1;
+    if ((now_slot < shard->wheel_slot) || (slots_num > UC_WHEEL_SIZE))
+      slots_num = UC_WHEEL_SIZE;
+
+    for (uint64_t j = 0; j < slots_num; j++) {
+      size_t idx = (shard->wheel_slot + j) & (UC_WHEEL_SIZE - 1);
+      for (cache_entry_t *ce = shard->wheel[idx]; ce != NULL;
+           ce = ce->wheel_next) {
+        /* Entries of the current second, or of a later lap of the wheel. */
+        if (ce->expires > now)
+          continue;
+
+        if (expired_num >= expired_size) {
+          size_t size = (expired_size == 0) ? 64 : 2 * expired_size;
+          void *tmp = realloc(expired, size * sizeof(*expired));
+          if (tmp == NULL) {
+            ERROR("uc_check_timeout: realloc failed.");
+            break;
+          }
+          expired = tmp;
+          expired_size = size;
+        }
+
+        uc_ident_incref(ce->ident);
+        expired[expired_num].ident = ce->ident;
+        expired[expired_num].time = ce->last_time;
+        expired[expired_num].interval = ce->interval;
+        expired[expired_num].callbacks_mask = ce->callbacks_mask;
+        expired_num++;
+      }
     }
 
-    expired_num++;
-  } /* while (c_avl_iterator_next) */
-
-  c_avl_iterator_destroy(iter);
-  pthread_mutex_unlock(&cache_lock);
+    /* The current second is checked again next time. */
+    if (now_slot > shard->wheel_slot)
+      shard->wheel_slot = now_slot;
+    pthread_mutex_unlock(&shard->lock);
+  }
 
   if (expired_num == 0) {
     sfree(expired);
@@ -283,76 +567,100 @@ int uc_check_timeout(void) {
         .interval = expired[i].interval,
     };
 
-    if (parse_identifier_vl(expired[i].key, &vl) != 0) {
+    if (parse_identifier_vl(expired[i].ident->name, &vl) != 0) {
       ERROR("uc_check_timeout: parse_identifier_vl (\"%s\") failed.",
-            expired[i].key);
+            expired[i].ident->name);
       continue;
     }
+    /* "expired" holds a reference until the values are removed below. */
+    vl.ident = expired[i].ident;
 
     plugin_dispatch_missing(&vl);
 
     if (expired[i].callbacks_mask)
       plugin_dispatch_cache_event(CE_VALUE_EXPIRED, expired[i].callbacks_mask,
-                                  expired[i].key, &vl);
+                                  expired[i].ident->name, &vl);
   } /* for (i = 0; i < expired_num; i++) */
 
-  /* Now actually remove all the values from the cache. We don't re-evaluate
-   * the timestamp again, so in theory it is possible we remove a value after
-   * it is updated here. */
-  pthread_mutex_lock(&cache_lock);
+  /* Now actually remove all the values from the cache. Values which have been
+   * updated in the meantime are kept. */
   for (size_t i = 0; i < expired_num; i++) {
-    char *key = NULL;
-    cache_entry_t *value = NULL;
-
-    if (c_avl_remove(cache_tree, expired[i].key, (void *)&key,
-                     (void *)&value) != 0) {
-      ERROR("uc_check_timeout: c_avl_remove (\"%s\") failed.", expired[i].key);
-      sfree(expired[i].key);
-      continue;
+    uc_ident_t *ident = expired[i].ident;
+    cache_shard_t *shard = uc_shard(ident->hash);
+
+    pthread_mutex_lock(&shard->lock);
+    cache_entry_t *value = uc_shard_get(shard, ident->hash, ident->name);
+    if ((value != NULL) && (value->ident == ident) && (value->expires <= now)) {
+      uc_shard_remove(shard, ident->hash, ident->name);
+      uc_ident_unref(value->ident);
+    } else {
+      value = NULL;
     }
-    sfree(key);
-    cache_free(value);
+    pthread_mutex_unlock(&shard->lock);
 
-    sfree(expired[i].key);
+    uc_ident_unref(ident);
+
+    cache_free(value);
   } /* for (i = 0; i < expired_num; i++) */
-  pthread_mutex_unlock(&cache_lock);
 
   sfree(expired);
   return 0;
 } /* int uc_check_timeout */
 
-int uc_update(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
-
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_update: FORMAT_VL failed.");
-    return -1;
-  }
-
-  pthread_mutex_lock(&cache_lock);
-
-  cache_entry_t *ce = NULL;
-  int status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) /* entry does not yet exist */
+/* Updates the cache entry of "vl". If "ret_ident" is not NULL, a reference to
+ * the entry's identifier is returned, even if the update itself fails. The
+ * caller must release it with uc_ident_release(). */
+static int uc_update_internal(const data_set_t *ds, const value_list_t *vl,
+                              uc_ident_t **ret_ident) {
+  /* Where the name is needed after unlocking the shard, i.e. for new entries,
+   * log messages and registered cache event callbacks, a reference to the
+   * identifier is held instead of copying the name. */
+  uc_ident_t *ident = NULL;
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+
+  cache_entry_t *ce = uc_shard_get_vl(shard, hash, vl);
+  if (ce == NULL) /* entry does not yet exist */
   {
-    status = uc_insert(ds, vl, name);
-    pthread_mutex_unlock(&cache_lock);
+    int status = uc_insert(shard, ds, vl, hash);
+    if (status == 0) {
+      ce = uc_shard_get_vl(shard, hash, vl);
+      ident = ce->ident;
+      uc_ident_incref(ident);
+      if (ret_ident != NULL) {
+        uc_ident_incref(ident);
+        *ret_ident = ident;
+      }
+    }
+    pthread_mutex_unlock(&shard->lock);
 
-    if (status == 0)
-      plugin_dispatch_cache_event(CE_VALUE_NEW, 0 /* mask */, name, vl);
+    if (status == 0) {
+      plugin_dispatch_cache_event(CE_VALUE_NEW, 0 /* mask */, ident->name, vl);
+      uc_ident_unref(ident);
+    }
 
     return status;
   }
 
-  assert(ce != NULL);
   assert(ce->values_num == ds->ds_num);
 
+  if (ret_ident != NULL) {
+    uc_ident_incref(ce->ident);
+    *ret_ident = ce->ident;
+  }
+
   if (ce->last_time >= vl->time) {
-    pthread_mutex_unlock(&cache_lock);
+    cdtime_t last_time = ce->last_time;
+    ident = ce->ident;
+    uc_ident_incref(ident);
+    pthread_mutex_unlock(&shard->lock);
     NOTICE("uc_update: Value too old: name = %s; value time = %.3f; "
            "last cache update = %.3f;",
-           name, CDTIME_T_TO_DOUBLE(vl->time),
-           CDTIME_T_TO_DOUBLE(ce->last_time));
+           ident->name, CDTIME_T_TO_DOUBLE(vl->time),
+           CDTIME_T_TO_DOUBLE(last_time));
+    uc_ident_unref(ident);
     return -1;
   }
 
@@ -387,13 +695,14 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
 
     default:
       /* This shouldn't happen. */
-      pthread_mutex_unlock(&cache_lock);
+      pthread_mutex_unlock(&shard->lock);
       ERROR("uc_update: Don't know how to handle data source type %i.",
             ds->ds[i].type);
       return -1;
     } /* switch (ds->ds[i].type) */
 
-    DEBUG("uc_update: %s: ds[%" PRIsz "] = %lf", name, i, ce->values_gauge[i]);
+    DEBUG("uc_update: %s: ds[%" PRIsz "] = %lf", ce->ident->name, i,
+          ce->values_gauge[i]);
   } /* for (i) */
 
   /* Update the history if it exists. */
@@ -414,30 +723,65 @@ int uc_update(const data_set_t *ds, const value_list_t *vl) {
   ce->last_time = vl->time;
   ce->last_update = cdtime();
   ce->interval = vl->interval;
+  uc_wheel_link(shard, ce);
 
   /* Check if cache entry has registered callbacks */
   unsigned long callbacks_mask = ce->callbacks_mask;
+  if (callbacks_mask) {
+    ident = ce->ident;
+    uc_ident_incref(ident);
+  }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
-  if (callbacks_mask)
-    plugin_dispatch_cache_event(CE_VALUE_UPDATE, callbacks_mask, name, vl);
+  if (callbacks_mask) {
+    plugin_dispatch_cache_event(CE_VALUE_UPDATE, callbacks_mask, ident->name,
+                                vl);
+    uc_ident_unref(ident);
+  }
 
   return 0;
+} /* int uc_update_internal */
+
+int uc_update(const data_set_t *ds, const value_list_t *vl) {
+  return uc_update_internal(ds, vl, /* ret_ident = */ NULL);
 } /* int uc_update */
 
+int uc_update_ident(const data_set_t *ds, value_list_t *vl) {
+  uc_ident_release(vl->ident);
+  vl->ident = NULL;
+
+  return uc_update_internal(ds, vl, &vl->ident);
+} /* int uc_update_ident */
+
+void uc_ident_ref(uc_ident_t *ident) {
+  if (ident != NULL)
+    uc_ident_incref(ident);
+} /* void uc_ident_ref */
+
+void uc_ident_release(uc_ident_t *ident) {
+  if (ident != NULL)
+    uc_ident_unref(ident);
+} /* void uc_ident_release */
+
+const char *uc_ident_name(const uc_ident_t *ident) {
+  return (ident != NULL) ? ident->name : NULL;
+} /* const char *uc_ident_name */
+
 int uc_set_callbacks_mask(const char *name, unsigned long mask) {
-  pthread_mutex_lock(&cache_lock);
-  cache_entry_t *ce = NULL;
-  int status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) { /* Ouch, just created entry disappeared ?! */
+  uint64_t hash = uc_hash_name(name);
+  cache_shard_t *shard = uc_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  cache_entry_t *ce = uc_shard_get(shard, hash, name);
+  if (ce == NULL) { /* Ouch, just created entry disappeared ?! */
     ERROR("uc_set_callbacks_mask: Couldn't find %s entry!", name);
-    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&shard->lock);
     return -1;
   }
   DEBUG("uc_set_callbacks_mask: set mask for \"%s\" to %lu.", name, mask);
   ce->callbacks_mask = mask;
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
   return 0;
 }
 
@@ -447,11 +791,12 @@ int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
   size_t ret_num = 0;
   cache_entry_t *ce = NULL;
   int status = 0;
+  uint64_t hash = uc_hash_name(name);
+  cache_shard_t *shard = uc_shard(hash);
 
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = uc_shard_get(shard, hash, name)) != NULL) {
 
     /* remove missing values from getval */
     if (ce->state == STATE_MISSING) {
@@ -474,7 +819,7 @@ int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
     status = -1;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   if (status == 0) {
     *ret_values = ret;
@@ -485,18 +830,22 @@ int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
 } /* gauge_t *uc_get_rate_by_name */
 
 gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
   gauge_t *ret = NULL;
   size_t ret_num = 0;
-  int status;
-
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("utils_cache: uc_get_rate: FORMAT_VL failed.");
-    return NULL;
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  cache_entry_t *ce = uc_shard_get_vl(shard, hash, vl);
+  if ((ce != NULL) && (ce->state != STATE_MISSING)) {
+    ret_num = ce->values_num;
+    ret = malloc(ret_num * sizeof(*ret));
+    if (ret != NULL)
+      memcpy(ret, ce->values_gauge, ret_num * sizeof(*ret));
   }
+  pthread_mutex_unlock(&shard->lock);
 
-  status = uc_get_rate_by_name(name, &ret, &ret_num);
-  if (status != 0)
+  if (ret == NULL)
     return NULL;
 
   /* This is important - the caller has no other way of knowing how many
@@ -512,17 +861,38 @@ gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl) {
   return ret;
 } /* gauge_t *uc_get_rate */
 
+int uc_get_rate_values(const value_list_t *vl, gauge_t *ret_values,
+                       size_t ret_values_num) {
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
+  int status = 0;
+
+  pthread_mutex_lock(&shard->lock);
+  cache_entry_t *ce = uc_shard_get_vl(shard, hash, vl);
+  if ((ce == NULL) || (ce->state == STATE_MISSING))
+    status = ENOENT;
+  else if (ce->values_num != ret_values_num)
+    status = EINVAL;
+  else
+    memcpy(ret_values, ce->values_gauge,
+           ret_values_num * sizeof(*ret_values));
+  pthread_mutex_unlock(&shard->lock);
+
+  return status;
+} /* int uc_get_rate_values */
+
 int uc_get_value_by_name(const char *name, value_t **ret_values,
                          size_t *ret_values_num) {
   value_t *ret = NULL;
   size_t ret_num = 0;
   cache_entry_t *ce = NULL;
   int status = 0;
+  uint64_t hash = uc_hash_name(name);
+  cache_shard_t *shard = uc_shard(hash);
 
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = uc_shard_get(shard, hash, name)) != NULL) {
 
     /* remove missing values from getval */
     if (ce->state == STATE_MISSING) {
@@ -542,7 +912,7 @@ int uc_get_value_by_name(const char *name, value_t **ret_values,
     status = -1;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   if (status == 0) {
     *ret_values = ret;
@@ -552,19 +922,51 @@ int uc_get_value_by_name(const char *name, value_t **ret_values,
   return (status);
 } /* int uc_get_value_by_name */
 
+int uc_get_value_list_by_name(const char *name, value_list_t *vl) {
+  uint64_t hash = uc_hash_name(name);
+  cache_shard_t *shard = uc_shard(hash);
+  int status = 0;
+
+  pthread_mutex_lock(&shard->lock);
+  cache_entry_t *ce = uc_shard_get(shard, hash, name);
+  if (ce == NULL) {
+    status = ENOENT;
+  } else if (ce->state == STATE_MISSING) {
+    status = EAGAIN;
+  } else {
+    vl->values = calloc(ce->values_num, sizeof(*vl->values));
+    if (vl->values == NULL) {
+      status = ENOMEM;
+    } else {
+      memcpy(vl->values, ce->values_raw, ce->values_num * sizeof(*vl->values));
+      vl->values_len = ce->values_num;
+      vl->time = ce->last_time;
+      vl->interval = ce->interval;
+      vl->meta = meta_data_clone(ce->meta);
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  return status;
+} /* int uc_get_value_list_by_name */
+
 value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
   value_t *ret = NULL;
   size_t ret_num = 0;
-  int status;
-
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("utils_cache: uc_get_value: FORMAT_VL failed.");
-    return (NULL);
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
+
+  pthread_mutex_lock(&shard->lock);
+  cache_entry_t *ce = uc_shard_get_vl(shard, hash, vl);
+  if ((ce != NULL) && (ce->state != STATE_MISSING)) {
+    ret_num = ce->values_num;
+    ret = malloc(ret_num * sizeof(*ret));
+    if (ret != NULL)
+      memcpy(ret, ce->values_raw, ret_num * sizeof(*ret));
   }
+  pthread_mutex_unlock(&shard->lock);
 
-  status = uc_get_value_by_name(name, &ret, &ret_num);
-  if (status != 0)
+  if (ret == NULL)
     return (NULL);
 
   /* This is important - the caller has no other way of knowing how many
@@ -583,20 +985,29 @@ value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl) {
 size_t uc_get_size(void) {
   size_t size_arrays = 0;
 
-  pthread_mutex_lock(&cache_lock);
-  size_arrays = (size_t)c_avl_size(cache_tree);
-  pthread_mutex_unlock(&cache_lock);
+  for (size_t i = 0; i < UC_SHARDS_NUM; i++) {
+    cache_shard_t *shard = uc_shard((uint64_t)i << (64 - UC_SHARDS_BITS));
+
+    pthread_mutex_lock(&shard->lock);
+    size_arrays += shard->entries_num;
+    pthread_mutex_unlock(&shard->lock);
+  }
 
   return size_arrays;
 }
 
-int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
-  c_avl_iterator_t *iter;
-  char *key;
-  cache_entry_t *value;
+typedef struct {
+  char *name;
+  cdtime_t time;
+} uc_name_time_t;
 
-  char **names = NULL;
-  cdtime_t *times = NULL;
+static int uc_name_time_compare(const void *a, const void *b) {
+  return strcmp(((const uc_name_time_t *)a)->name,
+                ((const uc_name_time_t *)b)->name);
+} /* int uc_name_time_compare */
+
+int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
+  uc_name_time_t *entries = NULL;
   size_t number = 0;
   size_t size_arrays = 0;
 
@@ -605,60 +1016,83 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   if ((ret_names == NULL) || (ret_number == NULL))
     return -1;
 
-  pthread_mutex_lock(&cache_lock);
+  for (size_t i = 0; (i < UC_SHARDS_NUM) && (status == 0); i++) {
+    cache_shard_t *shard = uc_shard((uint64_t)i << (64 - UC_SHARDS_BITS));
 
-  size_arrays = (size_t)c_avl_size(cache_tree);
-  if (size_arrays < 1) {
-    /* Handle the "no values" case here, to avoid the error message when
-     * calloc() returns NULL. */
-    pthread_mutex_unlock(&cache_lock);
-    return 0;
-  }
+    pthread_mutex_lock(&shard->lock);
 
-  names = calloc(size_arrays, sizeof(*names));
-  times = calloc(size_arrays, sizeof(*times));
-  if ((names == NULL) || (times == NULL)) {
-    ERROR("uc_get_names: calloc failed.");
-    sfree(names);
-    sfree(times);
-    pthread_mutex_unlock(&cache_lock);
-    return ENOMEM;
-  }
+    if (size_arrays < number + shard->entries_num) {
+      size_t new_size = number + shard->entries_num;
+      uc_name_time_t *tmp = realloc(entries, new_size * sizeof(*entries));
+      if (tmp == NULL) {
+        ERROR("uc_get_names: realloc failed.");
+        pthread_mutex_unlock(&shard->lock);
+        status = ENOMEM;
+        break;
+      }
+      entries = tmp;
+      size_arrays = new_size;
+    }
 
-  iter = c_avl_get_iterator(cache_tree);
-  while (c_avl_iterator_next(iter, (void *)&key, (void *)&value) == 0) {
-    /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
-      continue;
+    for (size_t j = 0; (j < shard->buckets_num) && (status == 0); j++) {
+      for (cache_entry_t *ce = shard->buckets[j]; ce != NULL; ce = ce->next) {
+        /* remove missing values when list values */
+        if (ce->state == STATE_MISSING)
+          continue;
 
-    /* c_avl_size does not return a number smaller than the number of elements
-     * returned by c_avl_iterator_next. */
-    assert(number < size_arrays);
+        assert(number < size_arrays);
 
-    if (ret_times != NULL)
-      times[number] = value->last_time;
+        entries[number].time = ce->last_time;
+        entries[number].name = strdup(ce->ident->name);
+        if (entries[number].name == NULL) {
+          status = -1;
+          break;
+        }
 
-    names[number] = strdup(key);
-    if (names[number] == NULL) {
-      status = -1;
-      break;
+        number++;
+      }
     }
 
-    number++;
-  } /* while (c_avl_iterator_next) */
-
-  c_avl_iterator_destroy(iter);
-  pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&shard->lock);
+  }
 
   if (status != 0) {
     for (size_t i = 0; i < number; i++) {
-      sfree(names[i]);
+      sfree(entries[i].name);
     }
+    sfree(entries);
+
+    return -1;
+  }
+
+  if (number == 0) {
+    /* Handle the "no values" case here, to avoid the error message when
+     * calloc() returns NULL. */
+    sfree(entries);
+    *ret_number = 0;
+    return 0;
+  }
+
+  /* The hash table is unordered, but users expect a sorted list. */
+  qsort(entries, number, sizeof(*entries), uc_name_time_compare);
+
+  char **names = calloc(number, sizeof(*names));
+  cdtime_t *times = calloc(number, sizeof(*times));
+  if ((names == NULL) || (times == NULL)) {
+    ERROR("uc_get_names: calloc failed.");
+    for (size_t i = 0; i < number; i++)
+      sfree(entries[i].name);
+    sfree(entries);
     sfree(names);
     sfree(times);
+    return ENOMEM;
+  }
 
-    return -1;
+  for (size_t i = 0; i < number; i++) {
+    names[i] = entries[i].name;
+    times[i] = entries[i].time;
   }
+  sfree(entries);
 
   *ret_names = names;
   if (ret_times != NULL)
@@ -671,65 +1105,55 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
 } /* int uc_get_names */
 
 int uc_get_state(const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_get_state: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = uc_shard_get_vl(shard, hash, vl)) != NULL) {
     ret = ce->state;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_get_state */
 
 int uc_set_state(const value_list_t *vl, int state) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_set_state: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = uc_shard_get_vl(shard, hash, vl)) != NULL) {
     ret = ce->state;
     ce->state = state;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_set_state */
 
 int uc_get_history_by_name(const char *name, gauge_t *ret_history,
                            size_t num_steps, size_t num_ds) {
-  cache_entry_t *ce = NULL;
-  int status = 0;
+  uint64_t hash = uc_hash_name(name);
+  cache_shard_t *shard = uc_shard(hash);
 
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) {
-    pthread_mutex_unlock(&cache_lock);
+  cache_entry_t *ce = uc_shard_get(shard, hash, name);
+  if (ce == NULL) {
+    pthread_mutex_unlock(&shard->lock);
     return -ENOENT;
   }
 
   if (((size_t)ce->values_num) != num_ds) {
-    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&shard->lock);
     return -EINVAL;
   }
 
@@ -741,7 +1165,7 @@ int uc_get_history_by_name(const char *name, gauge_t *ret_history,
     tmp =
         realloc(ce->history, sizeof(*ce->history) * num_steps * ce->values_num);
     if (tmp == NULL) {
-      pthread_mutex_unlock(&cache_lock);
+      pthread_mutex_unlock(&shard->lock);
       return -ENOMEM;
     }
 
@@ -770,75 +1194,60 @@ int uc_get_history_by_name(const char *name, gauge_t *ret_history,
            sizeof(*ret_history) * num_ds);
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return 0;
 } /* int uc_get_history_by_name */
 
 int uc_get_hits(const value_list_t *vl) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_get_hits: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = uc_shard_get_vl(shard, hash, vl)) != NULL) {
     ret = ce->hits;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_get_hits */
 
 int uc_set_hits(const value_list_t *vl, int hits) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_set_hits: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = uc_shard_get_vl(shard, hash, vl)) != NULL) {
     ret = ce->hits;
     ce->hits = hits;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_set_hits */
 
 int uc_inc_hits(const value_list_t *vl, int step) {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL(name, sizeof(name), vl) != 0) {
-    ERROR("uc_inc_hits: FORMAT_VL failed.");
-    return STATE_ERROR;
-  }
-
-  pthread_mutex_lock(&cache_lock);
+  pthread_mutex_lock(&shard->lock);
 
-  if (c_avl_get(cache_tree, name, (void *)&ce) == 0) {
-    assert(ce != NULL);
+  if ((ce = uc_shard_get_vl(shard, hash, vl)) != NULL) {
     ret = ce->hits;
     ce->hits = ret + step;
   }
 
-  pthread_mutex_unlock(&cache_lock);
+  pthread_mutex_unlock(&shard->lock);
 
   return ret;
 } /* int uc_inc_hits */
@@ -851,35 +1260,41 @@ uc_iter_t *uc_get_iterator(void) {
   if (iter == NULL)
     return NULL;
 
-  pthread_mutex_lock(&cache_lock);
-
-  iter->iter = c_avl_get_iterator(cache_tree);
-  if (iter->iter == NULL) {
-    free(iter);
-    return NULL;
-  }
+  /* Lock all shards, always in the same order. */
+  for (size_t i = 0; i < UC_SHARDS_NUM; i++)
+    pthread_mutex_lock(&uc_shard((uint64_t)i << (64 - UC_SHARDS_BITS))->lock);
 
   return iter;
 } /* uc_iter_t *uc_get_iterator */
 
 int uc_iterator_next(uc_iter_t *iter, char **ret_name) {
-  int status;
-
   if (iter == NULL)
     return -1;
 
-  while ((status = c_avl_iterator_next(iter->iter, (void *)&iter->name,
-                                       (void *)&iter->entry)) == 0) {
-    if (iter->entry->state == STATE_MISSING)
-      continue;
+  cache_entry_t *ce = (iter->entry != NULL) ? iter->entry->next : NULL;
+  while (true) {
+    while ((ce == NULL) && (iter->shard < UC_SHARDS_NUM)) {
+      cache_shard_t *shard = cache_shards + iter->shard;
+      if (iter->bucket < shard->buckets_num) {
+        ce = shard->buckets[iter->bucket];
+        iter->bucket++;
+      } else {
+        iter->shard++;
+        iter->bucket = 0;
+      }
+    }
 
-    break;
+    if ((ce == NULL) || (ce->state != STATE_MISSING))
+      break;
+    ce = ce->next;
   }
-  if (status != 0) {
+
+  iter->entry = ce;
+  if (ce == NULL) {
     iter->name = NULL;
-    iter->entry = NULL;
     return -1;
   }
+  iter->name = ce->ident->name;
 
   if (ret_name != NULL)
     *ret_name = iter->name;
@@ -891,8 +1306,8 @@ void uc_iterator_destroy(uc_iter_t *iter) {
   if (iter == NULL)
     return;
 
-  c_avl_iterator_destroy(iter->iter);
-  pthread_mutex_unlock(&cache_lock);
+  for (size_t i = UC_SHARDS_NUM; i > 0; i--)
+    pthread_mutex_unlock(&cache_shards[i - 1].lock);
 
   free(iter);
 } /* void uc_iterator_destroy */
@@ -942,34 +1357,28 @@ int uc_iterator_get_meta(uc_iter_t *iter, meta_data_t **ret_meta) {
 /*
  * Meta data interface
  */
-/* XXX: This function will acquire `cache_lock' but will not free it! */
-static meta_data_t *uc_get_meta(const value_list_t *vl) /* {{{ */
-{
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
-  int status;
+/* XXX: This function will acquire the shard's lock but will not free it! The
+ * lock is returned in `ret_lock'. */
+static meta_data_t *uc_get_meta(const value_list_t *vl, /* {{{ */
+                                pthread_mutex_t **ret_lock) {
+  uint64_t hash = uc_hash_vl(vl);
+  cache_shard_t *shard = uc_shard(hash);
 
-  status = FORMAT_VL(name, sizeof(name), vl);
-  if (status != 0) {
-    ERROR("utils_cache: uc_get_meta: FORMAT_VL failed.");
-    return NULL;
-  }
+  pthread_mutex_lock(&shard->lock);
 
-  pthread_mutex_lock(&cache_lock);
-
-  status = c_avl_get(cache_tree, name, (void *)&ce);
-  if (status != 0) {
-    pthread_mutex_unlock(&cache_lock);
+  cache_entry_t *ce = uc_shard_get_vl(shard, hash, vl);
+  if (ce == NULL) {
+    pthread_mutex_unlock(&shard->lock);
     return NULL;
   }
-  assert(ce != NULL);
 
   if (ce->meta == NULL)
     ce->meta = meta_data_create();
 
   if (ce->meta == NULL)
-    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&shard->lock);
 
+  *ret_lock = &shard->lock;
   return ce->meta;
 } /* }}} meta_data_t *uc_get_meta */
 
@@ -978,12 +1387,13 @@ static meta_data_t *uc_get_meta(const value_list_t *vl) /* {{{ */
 #define UC_WRAP(wrap_function)                                                 \
   {                                                                            \
     meta_data_t *meta;                                                         \
+    pthread_mutex_t *lock;                                                     \
     int status;                                                                \
-    meta = uc_get_meta(vl);                                                    \
+    meta = uc_get_meta(vl, &lock);                                             \
     if (meta == NULL)                                                          \
       return -1;                                                               \
     status = wrap_function(meta, key);                                         \
-    pthread_mutex_unlock(&cache_lock);                                         \
+    pthread_mutex_unlock(lock);                                                \
     return status;                                                             \
   }
 int uc_meta_data_exists(const value_list_t *vl, const char *key)
@@ -1004,12 +1414,13 @@ int uc_meta_data_exists(const value_list_t *vl, const char *key)
 #define UC_WRAP(wrap_function)                                                 \
   {                                                                            \
     meta_data_t *meta;                                                         \
+    pthread_mutex_t *lock;                                                     \
     int status;                                                                \
-    meta = uc_get_meta(vl);                                                    \
+    meta = uc_get_meta(vl, &lock);                                             \
     if (meta == NULL)                                                          \
       return -1;                                                               \
     status = wrap_function(meta, key, value);                                  \
-    pthread_mutex_unlock(&cache_lock);                                         \
+    pthread_mutex_unlock(lock);                                                \
     return status;                                                             \
   }
         int uc_meta_data_add_string(const value_list_t *vl, const char *key,
@@ -40,12 +40,33 @@
 int uc_init(void);
 int uc_check_timeout(void);
 int uc_update(const data_set_t *ds, const value_list_t *vl);
+/* Same as uc_update(), but additionally stores a reference to the interned
+ * identifier of the cache entry in vl->ident. The reference must be dropped
+ * with uc_ident_release(). */
+int uc_update_ident(const data_set_t *ds, value_list_t *vl);
+/* Acquires an additional reference to "ident", which must be dropped with
+ * uc_ident_release(). */
+void uc_ident_ref(uc_ident_t *ident);
+void uc_ident_release(uc_ident_t *ident);
+/* Returns the identifier as formatted by FORMAT_VL(). */
+const char *uc_ident_name(const uc_ident_t *ident);
 int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
                         size_t *ret_values_num);
 gauge_t *uc_get_rate(const data_set_t *ds, const value_list_t *vl);
+/* Copies the rates of "vl" into "ret_values", which has room for
+ * "ret_values_num" values, without allocating memory. Returns ENOENT if there
+ * is no such entry or its value is missing and EINVAL if the number of values
+ * differs. */
+int uc_get_rate_values(const value_list_t *vl, gauge_t *ret_values,
+                       size_t ret_values_num);
 int uc_get_value_by_name(const char *name, value_t **ret_values,
                          size_t *ret_values_num);
 value_t *uc_get_value(const data_set_t *ds, const value_list_t *vl);
+/* Copies the raw values, time, interval and meta data of the entry "name" into
+ * "vl", leaving its identifier untouched. Only the shard holding the entry is
+ * locked. The caller must free "vl->values" and "vl->meta". Returns ENOENT if
+ * there is no such entry and EAGAIN if its value is missing. */
+int uc_get_value_list_by_name(const char *name, value_list_t *vl);
 
 size_t uc_get_size(void);
 int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
@@ -72,7 +93,7 @@ typedef struct uc_iter_s uc_iter_t;
  *   uc_get_iterator
  *
  * DESCRIPTION
- *   Create an iterator for the cache. It will hold the cache lock until it's
+ *   Create an iterator for the cache. It will hold the cache locks until it's
  *   destroyed.
  *
  * RETURN VALUE
@@ -35,11 +35,20 @@ gauge_t *uc_get_rate(__attribute__((unused)) data_set_t const *ds,
   return NULL;
 }
 
+void uc_ident_ref(__attribute__((unused)) uc_ident_t *ident) {}
+
+void uc_ident_release(__attribute__((unused)) uc_ident_t *ident) {}
+
 int uc_get_rate_by_name(const char *name, gauge_t **ret_values,
                         size_t *ret_values_num) {
   return ENOTSUP;
 }
 
+int uc_get_rate_values(const value_list_t *vl, gauge_t *ret_values,
+                       size_t ret_values_num) {
+  return ENOTSUP;
+}
+
 int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   return ENOTSUP;
 }
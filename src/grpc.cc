@@ -29,9 +29,15 @@
 #include <google/protobuf/util/time_util.h>
 #include <grpc++/grpc++.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <iostream>
-#include <queue>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
 #include <vector>
 
 #include "collectd.grpc.pb.h"
@@ -53,6 +59,8 @@ using collectd::PutValuesRequest;
 using collectd::PutValuesResponse;
 using collectd::QueryValuesRequest;
 using collectd::QueryValuesResponse;
+using collectd::SubscribeValuesRequest;
+using collectd::SubscribeValuesResponse;
 
 using google::protobuf::util::TimeUtil;
 
@@ -72,6 +80,9 @@ struct Listener {
 static std::vector<Listener> listeners;
 static grpc::string default_addr("0.0.0.0:50051");
 
+/* Number of value lists queued for each subscriber before dropping values. */
+static size_t subscription_queue_size = 1024;
+
 /*
  * helper functions
  */
@@ -93,6 +104,167 @@ static bool ident_matches(const value_list_t *vl, const value_list_t *matcher) {
   return true;
 } /* ident_matches */
 
+/*
+ * value index
+ *
+ * The names of all cache entries by host, plugin and type, maintained from
+ * cache events, so that queries only look at the entries whose host, plugin
+ * and type match instead of every entry in the cache.
+ */
+typedef std::set<grpc::string> index_names_t;
+typedef std::map<grpc::string, index_names_t> index_types_t;
+typedef std::map<grpc::string, index_types_t> index_plugins_t;
+
+static std::mutex index_lock;
+static std::map<grpc::string, index_plugins_t> value_index;
+
+static void index_insert(const value_list_t *vl, const char *name) {
+  std::lock_guard<std::mutex> lock(index_lock);
+  value_index[vl->host][vl->plugin][vl->type].insert(name);
+} /* index_insert */
+
+static void index_remove(const value_list_t *vl, const char *name) {
+  std::lock_guard<std::mutex> lock(index_lock);
+
+  auto host = value_index.find(vl->host);
+  if (host == value_index.end())
+    return;
+  auto plugin = host->second.find(vl->plugin);
+  if (plugin == host->second.end())
+    return;
+  auto type = plugin->second.find(vl->type);
+  if (type == plugin->second.end())
+    return;
+
+  type->second.erase(name);
+  if (!type->second.empty())
+    return;
+  plugin->second.erase(type);
+  if (!plugin->second.empty())
+    return;
+  host->second.erase(plugin);
+  if (host->second.empty())
+    value_index.erase(host);
+} /* index_remove */
+
+/* Calls "f" for each element of "m" whose key matches the fnmatch(3)
+ * pattern. Literal patterns are looked up directly. */
+template <typename M, typename F>
+static void index_match(M &m, const char *pattern, F f) {
+  if (pattern[strcspn(pattern, "*?[\\")] == '\0') {
+    auto it = m.find(pattern);
+    if (it != m.end())
+      f(it->second);
+    return;
+  }
+
+  for (auto &e : m)
+    if (fnmatch(pattern, e.first.c_str(), 0) == 0)
+      f(e.second);
+} /* index_match */
+
+/* Copies the names of all entries whose host, plugin and type match
+ * "matcher" into "names". */
+static void index_lookup(const value_list_t *matcher,
+                         std::vector<grpc::string> *names) {
+  std::lock_guard<std::mutex> lock(index_lock);
+  index_match(value_index, matcher->host, [&](index_plugins_t &plugins) {
+    index_match(plugins, matcher->plugin, [&](index_types_t &types) {
+      index_match(types, matcher->type, [&](index_names_t &n) {
+        names->insert(names->end(), n.begin(), n.end());
+      });
+    });
+  });
+} /* index_lookup */
+
+/*
+ * subscriptions
+ */
+class Subscription {
+public:
+  Subscription(const value_list_t *matcher) : matcher_(*matcher) {}
+
+  ~Subscription() {
+    for (auto &vl : queue_)
+      value_list_free(&vl);
+  }
+
+  const value_list_t *Matcher() const { return &matcher_; }
+
+  /* Called by the cache event callback. Never blocks on the client: if the queue
+   * is full, the value is dropped. */
+  void Push(const value_list_t *vl) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (queue_.size() >= subscription_queue_size) {
+      dropped_++;
+      return;
+    }
+
+    value_list_t copy = *vl;
+    copy.values = (value_t *)calloc(vl->values_len, sizeof(*copy.values));
+    if (copy.values == NULL) {
+      dropped_++;
+      return;
+    }
+    memcpy(copy.values, vl->values, vl->values_len * sizeof(*copy.values));
+    copy.meta = meta_data_clone(vl->meta);
+    copy.ident = NULL;
+
+    queue_.push_back(copy);
+    cond_.notify_one();
+  }
+
+  /* Waits up to one second for values and moves them into "values", adding
+   * the number of dropped values to "dropped". Returns false once the
+   * subscription has been stopped. */
+  bool Pop(std::deque<value_list_t> *values, uint64_t *dropped) {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (queue_.empty() && !stopped_)
+      cond_.wait_for(lock, std::chrono::seconds(1));
+
+    values->swap(queue_);
+    *dropped += dropped_;
+    dropped_ = 0;
+    return !stopped_;
+  }
+
+  void Stop() {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopped_ = true;
+    cond_.notify_one();
+  }
+
+  static void value_list_free(value_list_t *vl) {
+    sfree(vl->values);
+    meta_data_destroy(vl->meta);
+    vl->meta = NULL;
+  }
+
+private:
+  value_list_t matcher_;
+
+  std::mutex lock_;
+  std::condition_variable cond_;
+  std::deque<value_list_t> queue_;
+  uint64_t dropped_ = 0;
+  bool stopped_ = false;
+}; /* class Subscription */
+
+static std::mutex subscriptions_lock;
+static std::list<Subscription *> subscriptions;
+static std::atomic<size_t> subscriptions_num(0);
+static bool subscriptions_stopped = false;
+
+static void subscriptions_publish(const value_list_t *vl) {
+  if (subscriptions_num.load() == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(subscriptions_lock);
+  for (auto sub : subscriptions)
+    if (ident_matches(vl, sub->Matcher()))
+      sub->Push(vl);
+} /* subscriptions_publish */
+
 static grpc::string read_file(const char *filename) {
   std::ifstream f;
   grpc::string s, content;
@@ -407,19 +579,68 @@ public:
       return status;
     }
 
-    std::queue<value_list_t> value_lists;
-    status = this->queryValuesRead(&match, &value_lists);
-    if (status.ok()) {
-      status = this->queryValuesWrite(ctx, writer, &value_lists);
+    /* Only the candidate names are copied up front. Each entry is then
+     * fetched on its own, so neither the index nor the cache is locked while
+     * writing to the client. */
+    std::vector<grpc::string> names;
+    index_lookup(&match, &names);
+
+    for (auto const &name : names) {
+      status = this->queryValue(name, &match, writer);
+      if (!status.ok())
+        return status;
+    }
+
+    return grpc::Status::OK;
+  }
+
+  grpc::Status
+  SubscribeValues(grpc::ServerContext *ctx, SubscribeValuesRequest const *req,
+                  grpc::ServerWriter<SubscribeValuesResponse> *writer) override {
+    value_list_t match;
+    auto status = unmarshal_ident(req->identifier(), &match, false);
+    if (!status.ok()) {
+      return status;
+    }
+
+    Subscription sub(&match);
+    {
+      std::lock_guard<std::mutex> lock(subscriptions_lock);
+      if (subscriptions_stopped)
+        return grpc::Status(grpc::StatusCode::UNAVAILABLE,
+                            grpc::string("server is shutting down"));
+      subscriptions.push_back(&sub);
+      subscriptions_num++;
     }
 
-    while (!value_lists.empty()) {
-      auto vl = value_lists.front();
-      value_lists.pop();
-      sfree(vl.values);
-      meta_data_destroy(vl.meta);
+    std::deque<value_list_t> values;
+    uint64_t dropped = 0;
+    while (status.ok() && sub.Pop(&values, &dropped) && !ctx->IsCancelled()) {
+      while (!values.empty()) {
+        auto vl = values.front();
+        values.pop_front();
+
+        if (status.ok()) {
+          SubscribeValuesResponse res;
+          status = marshal_value_list(&vl, res.mutable_value_list());
+          res.set_dropped(dropped);
+          if (status.ok() && !writer->Write(res))
+            status = grpc::Status::CANCELLED;
+          dropped = 0;
+        }
+
+        Subscription::value_list_free(&vl);
+      }
     }
 
+    {
+      std::lock_guard<std::mutex> lock(subscriptions_lock);
+      subscriptions.remove(&sub);
+      subscriptions_num--;
+    }
+    for (auto &vl : values)
+      Subscription::value_list_free(&vl);
+
     return status;
   }
 
@@ -445,76 +666,39 @@ public:
   }
 
 private:
-  grpc::Status queryValuesRead(value_list_t const *match,
-                               std::queue<value_list_t> *value_lists) {
-    uc_iter_t *iter;
-    if ((iter = uc_get_iterator()) == NULL) {
-      return grpc::Status(
-          grpc::StatusCode::INTERNAL,
-          grpc::string("failed to query values: cannot create iterator"));
+  grpc::Status queryValue(const grpc::string &name, value_list_t const *match,
+                          grpc::ServerWriter<QueryValuesResponse> *writer) {
+    value_list_t vl = {0};
+    if (parse_identifier_vl(name.c_str(), &vl) != 0) {
+      return grpc::Status(grpc::StatusCode::INTERNAL,
+                          grpc::string("failed to parse identifier"));
     }
 
-    grpc::Status status = grpc::Status::OK;
-    char *name = NULL;
-    while (uc_iterator_next(iter, &name) == 0) {
-      value_list_t vl;
-      if (parse_identifier_vl(name, &vl) != 0) {
-        status = grpc::Status(grpc::StatusCode::INTERNAL,
-                              grpc::string("failed to parse identifier"));
-        break;
-      }
-
-      if (!ident_matches(&vl, match))
-        continue;
-      if (uc_iterator_get_time(iter, &vl.time) < 0) {
-        status =
-            grpc::Status(grpc::StatusCode::INTERNAL,
-                         grpc::string("failed to retrieve value timestamp"));
-        break;
-      }
-      if (uc_iterator_get_interval(iter, &vl.interval) < 0) {
-        status =
-            grpc::Status(grpc::StatusCode::INTERNAL,
-                         grpc::string("failed to retrieve value interval"));
-        break;
-      }
-      if (uc_iterator_get_values(iter, &vl.values, &vl.values_len) < 0) {
-        status = grpc::Status(grpc::StatusCode::INTERNAL,
-                              grpc::string("failed to retrieve values"));
-        break;
-      }
-      if (uc_iterator_get_meta(iter, &vl.meta) < 0) {
-        status =
-            grpc::Status(grpc::StatusCode::INTERNAL,
-                         grpc::string("failed to retrieve value metadata"));
-      }
-
-      value_lists->push(vl);
-    } // while (uc_iterator_next(iter, &name) == 0)
-
-    uc_iterator_destroy(iter);
-    return status;
-  }
-
-  grpc::Status queryValuesWrite(grpc::ServerContext *ctx,
-                                grpc::ServerWriter<QueryValuesResponse> *writer,
-                                std::queue<value_list_t> *value_lists) {
-    while (!value_lists->empty()) {
-      auto vl = value_lists->front();
-      QueryValuesResponse res;
-      res.Clear();
-
-      auto status = marshal_value_list(&vl, res.mutable_value_list());
-      if (!status.ok()) {
-        return status;
-      }
+    if (!ident_matches(&vl, match))
+      return grpc::Status::OK;
+
+    int status = uc_get_value_list_by_name(name.c_str(), &vl);
+    if (status == ENOENT) {
+      /* Entries which existed before the plugin was initialized are not
+       * reported as expired. */
+      index_remove(&vl, name.c_str());
+      return grpc::Status::OK;
+    } else if (status == EAGAIN) {
+      return grpc::Status::OK;
+    } else if (status != 0) {
+      return grpc::Status(grpc::StatusCode::INTERNAL,
+                          grpc::string("failed to retrieve values"));
+    }
 
-      if (!writer->Write(res)) {
-        return grpc::Status::CANCELLED;
-      }
+    QueryValuesResponse res;
+    auto rpc_status = marshal_value_list(&vl, res.mutable_value_list());
+    Subscription::value_list_free(&vl);
+    if (!rpc_status.ok()) {
+      return rpc_status;
+    }
 
-      value_lists->pop();
-      sfree(vl.values);
+    if (!writer->Write(res)) {
+      return grpc::Status::CANCELLED;
     }
 
     return grpc::Status::OK;
@@ -767,6 +951,14 @@ static int c_grpc_config(oconfig_item_t *ci) {
     } else if (!strcasecmp("Server", child->key)) {
       if (c_grpc_config_server(child))
         return -1;
+    } else if (!strcasecmp("SubscriptionQueueSize", child->key)) {
+      int size = 0;
+      if (cf_util_get_int(child, &size) || (size < 1)) {
+        ERROR("grpc: Option `%s` expects a positive integer value",
+              child->key);
+        return -1;
+      }
+      subscription_queue_size = (size_t)size;
     }
 
     else {
@@ -777,7 +969,42 @@ static int c_grpc_config(oconfig_item_t *ci) {
   return 0;
 } /* c_grpc_config() */
 
+static int c_grpc_cache_event(cache_event_t *event,
+                              __attribute__((unused)) user_data_t *ud) {
+  switch (event->type) {
+  case CE_VALUE_NEW:
+    index_insert(event->value_list, event->value_list_name);
+    /* Subscribe to updates and expiry of this value. */
+    event->ret = 1;
+    subscriptions_publish(event->value_list);
+    break;
+  case CE_VALUE_UPDATE:
+    subscriptions_publish(event->value_list);
+    break;
+  case CE_VALUE_EXPIRED:
+    index_remove(event->value_list, event->value_list_name);
+    break;
+  }
+
+  return 0;
+} /* c_grpc_cache_event() */
+
 static int c_grpc_init(void) {
+  plugin_register_cache_event("grpc", c_grpc_cache_event, NULL);
+
+  /* Values which entered the cache before the callback was registered. */
+  char **names = NULL;
+  size_t names_num = 0;
+  if (uc_get_names(&names, NULL, &names_num) == 0) {
+    for (size_t i = 0; i < names_num; i++) {
+      value_list_t vl = {0};
+      if (parse_identifier_vl(names[i], &vl) == 0)
+        index_insert(&vl, names[i]);
+      sfree(names[i]);
+    }
+    sfree(names);
+  }
+
   server = new CollectdServer();
   if (!server) {
     ERROR("grpc: Failed to create server");
@@ -789,9 +1016,19 @@ static int c_grpc_init(void) {
 } /* c_grpc_init() */
 
 static int c_grpc_shutdown(void) {
+  plugin_unregister_cache_event("grpc");
+
   if (!server)
     return 0;
 
+  /* Streaming calls only return once their subscription is stopped. */
+  {
+    std::lock_guard<std::mutex> lock(subscriptions_lock);
+    subscriptions_stopped = true;
+    for (auto sub : subscriptions)
+      sub->Stop();
+  }
+
   server->Shutdown();
 
   delete server;
@@ -53,6 +53,8 @@ typedef struct mr_regex_s mr_regex_t;
 struct mr_regex_s {
   regex_t re;
   char *re_str;
+  /* If the regex is of the form "^literal$", the literal. */
+  char *literal;
 
   mr_regex_t *next;
 };
@@ -80,6 +82,7 @@ static void mr_free_regex(mr_regex_t *r) /* {{{ */
   regfree(&r->re);
   memset(&r->re, 0, sizeof(r->re));
   sfree(r->re_str);
+  sfree(r->literal);
 
   if (r->next != NULL)
     mr_free_regex(r->next);
@@ -128,6 +131,24 @@ static int mr_match_regexen(mr_regex_t *re_head, /* {{{ */
   return FC_MATCH_MATCHES;
 } /* }}} int mr_match_regexen */
 
+/* Returns the string matched by an anchored regex without any special
+ * characters, e.g. "^cpu$", or NULL if the regex matches any other string. */
+static char *mr_regex_literal(const char *re_str) /* {{{ */
+{
+  size_t len = strlen(re_str);
+  if ((len < 2) || (re_str[0] != '^') || (re_str[len - 1] != '$'))
+    return NULL;
+
+  if (strcspn(re_str + 1, ".[]()*+?{}|^$\\") != len - 2)
+    return NULL;
+
+  char *literal = strdup(re_str + 1);
+  if (literal != NULL)
+    literal[len - 2] = 0;
+
+  return literal;
+} /* }}} char *mr_regex_literal */
+
 static int mr_add_regex(mr_regex_t **re_head, const char *re_str, /* {{{ */
                         const char *option) {
   mr_regex_t *re;
@@ -159,6 +180,8 @@ static int mr_add_regex(mr_regex_t **re_head, const char *re_str, /* {{{ */
     return -1;
   }
 
+  re->literal = mr_regex_literal(re->re_str);
+
   if (*re_head == NULL) {
     *re_head = re;
   } else {
@@ -357,11 +380,52 @@ static int mr_match(const data_set_t __attribute__((unused)) * ds, /* {{{ */
   return match_value;
 } /* }}} int mr_match */
 
+/* Sets "*ret_value" to the literal a field has to be equal to, if any.
+ * Returns false if the field's regexen cannot be reduced to a comparison. */
+static bool mr_describe_field(mr_regex_t *re_head, /* {{{ */
+                              char const **ret_value) {
+  *ret_value = NULL;
+  if (re_head == NULL)
+    return true;
+
+  if ((re_head->next != NULL) || (re_head->literal == NULL))
+    return false;
+
+  *ret_value = re_head->literal;
+  return true;
+} /* }}} bool mr_describe_field */
+
+static int mr_describe(void *user_data, fc_match_info_t *info) /* {{{ */
+{
+  mr_match_t *m = user_data;
+  if (m == NULL)
+    return -1;
+
+  info->identifier_only = (m->meta == NULL);
+  if (m->invert) {
+    info->exact = false;
+    return 0;
+  }
+
+  /* Literals of a field with several regexen are not reported, so "exact"
+   * is only set if every field could be described. */
+  info->exact =
+      mr_describe_field(m->host, &info->host) &
+      mr_describe_field(m->plugin, &info->plugin) &
+      mr_describe_field(m->plugin_instance, &info->plugin_instance) &
+      mr_describe_field(m->type, &info->type) &
+      mr_describe_field(m->type_instance, &info->type_instance) &
+      (m->meta == NULL);
+
+  return 0;
+} /* }}} int mr_describe */
+
 void module_register(void) {
   match_proc_t mproc = {0};
 
   mproc.create = mr_create;
   mproc.destroy = mr_destroy;
   mproc.match = mr_match;
+  mproc.describe = mr_describe;
   fc_register_match("regex", mproc);
 } /* module_register */
@@ -24,6 +24,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For recvmmsg(2) and sendmmsg(2) */
 
 #include "collectd.h"
 
@@ -114,6 +115,19 @@ struct sockent_client {
   cdtime_t next_resolve_reconnect;
   cdtime_t resolve_interval;
   struct sockaddr_storage *bind_addr;
+
+  /* Ring of packets waiting to be sent by the send thread. Packets are
+   * removed from the ring only after they have been prepared for sending, so
+   * the send thread reads the first `queue_num' slots without holding the
+   * lock. */
+  char *queue;
+  size_t *queue_len;
+  size_t queue_head;
+  size_t queue_num;
+  pthread_cond_t queue_cond;
+  pthread_t send_thread_id;
+  bool send_thread_running;
+  bool send_thread_stop;
 };
 
 struct sockent_server {
@@ -252,14 +266,55 @@ struct part_encryption_aes256_s {
 };
 typedef struct part_encryption_aes256_s part_encryption_aes256_t;
 
-struct receive_list_entry_s {
-  char *data;
-  int data_len;
-  int fd;
-  struct sockaddr_storage sender;
-  struct receive_list_entry_s *next;
+/* Maximum number of datagrams read with one recvmmsg(2) call. */
+#define RECEIVE_BATCH_SIZE 64
+
+/* Maximum number of packets sent with one sendmmsg(2) call. */
+#define SEND_BATCH_SIZE 64
+
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+typedef struct mmsghdr network_msg_t;
+#else
+/* Same layout as `struct mmsghdr', which comes with recvmmsg(2). */
+typedef struct {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+} network_msg_t;
+#endif
+
+#ifdef SO_RXQ_OVFL
+#define RECEIVE_CMSG_SIZE CMSG_SPACE(sizeof(uint32_t))
+#else
+#define RECEIVE_CMSG_SIZE 1
+#endif
+
+/* A receive worker owns a set of listening sockets and parses the datagrams it
+ * reads from them itself. With `ReceiveThreads' greater than one, every
+ * unicast address is bound once per worker using SO_REUSEPORT, so the kernel
+ * spreads the senders across the workers. */
+struct receive_worker_s {
+  size_t index;
+  pthread_t thread_id;
+  bool running;
+
+  struct pollfd *pollfd;
+  sockent_t **sockent;
+  /* Datagrams dropped by the kernel, per socket, as reported by SO_RXQ_OVFL. */
+  uint32_t *drops;
+  size_t fds_num;
+
+  /* Receive buffers, allocated by the worker thread itself. */
+  char *buffer;
+  network_msg_t *msgs;
+  struct iovec *iov;
+  struct sockaddr_storage *sender;
+  char *cmsg;
+
+  /* Only written by the worker thread, read like the stats_* counters. */
+  derive_t octets_rx;
+  derive_t packets_rx;
 };
-typedef struct receive_list_entry_s receive_list_entry_t;
+typedef struct receive_worker_s receive_worker_t;
 
 /*
  * Private variables
@@ -269,26 +324,17 @@ static int network_config_ttl;
 static size_t network_config_packet_size = 1452;
 static bool network_config_forward;
 static bool network_config_stats;
+static size_t network_config_receive_threads = 1;
+static size_t network_config_send_queue_length = 128;
 
 static sockent_t *sending_sockets;
 
-static receive_list_entry_t *receive_list_head;
-static receive_list_entry_t *receive_list_tail;
-static pthread_mutex_t receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t receive_list_length;
-
 static sockent_t *listen_sockets;
-static struct pollfd *listen_sockets_pollfd;
 static size_t listen_sockets_num;
 
-/* The receive and dispatch threads will run as long as `listen_loop' is set to
- * zero. */
+/* The receive threads will run as long as `listen_loop' is set to zero. */
 static int listen_loop;
-static int receive_thread_running;
-static pthread_t receive_thread_id;
-static int dispatch_thread_running;
-static pthread_t dispatch_thread_id;
+static receive_worker_t *receive_workers;
 
 /* Buffer in which to-be-sent network packets are constructed. */
 static char *send_buffer;
@@ -299,15 +345,15 @@ static value_list_t send_buffer_vl = VALUE_LIST_INIT;
 static pthread_mutex_t send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* XXX: These counters are incremented from one place only. The spot in which
- * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
+ * the values are incremented is either only reachable by one thread (a
+ * receive worker, for example) or locked by some lock (send_buffer_lock for
  * example). Only if neither is true, the stats_lock is acquired. The counters
  * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
-static derive_t stats_octets_rx;
+ * memory is an atomic operation. The received octets and packets are counted
+ * per receive worker. */
 static derive_t stats_octets_tx;
-static derive_t stats_packets_rx;
 static derive_t stats_packets_tx;
+static derive_t stats_packets_tx_dropped;
 static derive_t stats_values_dispatched;
 static derive_t stats_values_not_dispatched;
 static derive_t stats_values_sent;
@@ -393,51 +439,39 @@ static bool check_send_notify_okay(const notification_t *n) /* {{{ */
   return !received;
 } /* }}} bool check_send_notify_okay */
 
-static int network_dispatch_values(value_list_t *vl, /* {{{ */
-                                   const char *username,
-                                   struct sockaddr_storage *address) {
-  int status;
-
-  if ((vl->time == 0) || (strlen(vl->host) == 0) || (strlen(vl->plugin) == 0) ||
-      (strlen(vl->type) == 0))
-    return -EINVAL;
-
-  if (!check_receive_okay(vl)) {
-#if COLLECT_DEBUG
-    char name[6 * DATA_MAX_NAME_LEN];
-    FORMAT_VL(name, sizeof(name), vl);
-    name[sizeof(name) - 1] = '\0';
-    DEBUG("network plugin: network_dispatch_values: "
-          "NOT dispatching %s.",
-          name);
-#endif
-    stats_values_not_dispatched++;
-    return 0;
-  }
-
-  assert(vl->meta == NULL);
-
-  vl->meta = meta_data_create();
-  if (vl->meta == NULL) {
+/* Value lists received in one packet. They are passed to
+ * plugin_dispatch_values_batch() together and share their meta data. */
+#define NETWORK_BATCH_SIZE 64
+typedef struct {
+  value_list_t vl[NETWORK_BATCH_SIZE];
+  size_t num;
+  meta_data_t *meta;
+  const char *username;
+  struct sockaddr_storage *address;
+} network_batch_t;
+
+/* Creates the meta data attached to all values received in one packet. */
+static meta_data_t *network_meta_create(const char *username, /* {{{ */
+                                        struct sockaddr_storage *address) {
+  meta_data_t *meta = meta_data_create();
+  if (meta == NULL) {
     ERROR("network plugin: meta_data_create failed.");
-    return -ENOMEM;
+    return NULL;
   }
 
-  status = meta_data_add_boolean(vl->meta, "network:received", 1);
+  int status = meta_data_add_boolean(meta, "network:received", 1);
   if (status != 0) {
     ERROR("network plugin: meta_data_add_boolean failed.");
-    meta_data_destroy(vl->meta);
-    vl->meta = NULL;
-    return status;
+    meta_data_destroy(meta);
+    return NULL;
   }
 
   if (username != NULL) {
-    status = meta_data_add_string(vl->meta, "network:username", username);
+    status = meta_data_add_string(meta, "network:username", username);
     if (status != 0) {
       ERROR("network plugin: meta_data_add_string failed.");
-      meta_data_destroy(vl->meta);
-      vl->meta = NULL;
-      return status;
+      meta_data_destroy(meta);
+      return NULL;
     }
   }
 
@@ -457,28 +491,79 @@ static int network_dispatch_values(value_list_t *vl, /* {{{ */
                          NULL, 0, NI_NUMERICHOST | NI_NUMERICSERV);
     if (status != 0) {
       ERROR("network plugin: getnameinfo failed: %s", gai_strerror(status));
-      meta_data_destroy(vl->meta);
-      vl->meta = NULL;
-      return status;
+      meta_data_destroy(meta);
+      return NULL;
     }
 
-    status = meta_data_add_string(vl->meta, "network:ip_address", host);
+    status = meta_data_add_string(meta, "network:ip_address", host);
     if (status != 0) {
       ERROR("network plugin: meta_data_add_string failed.");
-      meta_data_destroy(vl->meta);
-      vl->meta = NULL;
-      return status;
+      meta_data_destroy(meta);
+      return NULL;
     }
   }
 
-  plugin_dispatch_values(vl);
-  stats_values_dispatched++;
+  return meta;
+} /* }}} meta_data_t *network_meta_create */
+
+/* Dispatches the values collected from a packet. */
+static void network_batch_flush(network_batch_t *b) /* {{{ */
+{
+  if (b->num == 0)
+    return;
 
-  meta_data_destroy(vl->meta);
-  vl->meta = NULL;
+  plugin_dispatch_values_batch(b->vl, b->num);
+  pthread_mutex_lock(&stats_lock);
+  stats_values_dispatched += b->num;
+  pthread_mutex_unlock(&stats_lock);
+
+  for (size_t i = 0; i < b->num; i++)
+    sfree(b->vl[i].values);
+  b->num = 0;
+} /* }}} void network_batch_flush */
+
+/* Adds a received value list to the batch. On success, the batch takes over
+ * "vl->values". */
+static int network_batch_add(network_batch_t *b, /* {{{ */
+                             value_list_t *vl) {
+  if ((vl->time == 0) || (strlen(vl->host) == 0) || (strlen(vl->plugin) == 0) ||
+      (strlen(vl->type) == 0))
+    return -EINVAL;
+
+  if (!check_receive_okay(vl)) {
+#if COLLECT_DEBUG
+    char name[6 * DATA_MAX_NAME_LEN];
+    FORMAT_VL(name, sizeof(name), vl);
+    name[sizeof(name) - 1] = '\0';
+    DEBUG("network plugin: network_batch_add: "
+          "NOT dispatching %s.",
+          name);
+#endif
+    pthread_mutex_lock(&stats_lock);
+    stats_values_not_dispatched++;
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+  }
+
+  assert(vl->meta == NULL);
+
+  /* All values of a packet share the same meta data. */
+  if (b->meta == NULL) {
+    b->meta = network_meta_create(b->username, b->address);
+    if (b->meta == NULL)
+      return -ENOMEM;
+  }
+
+  b->vl[b->num] = *vl;
+  b->vl[b->num].meta = b->meta;
+  b->num++;
+  vl->values = NULL;
+
+  if (b->num == STATIC_ARRAY_SIZE(b->vl))
+    network_batch_flush(b);
 
   return 0;
-} /* }}} int network_dispatch_values */
+} /* }}} int network_batch_add */
 
 static int network_dispatch_notification(notification_t *n) /* {{{ */
 {
@@ -1250,8 +1335,11 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
   assert(buffer_offset ==
          (username_len + PART_ENCRYPTION_AES256_SIZE - sizeof(pea.hash)));
 
+  /* The cypher handle is shared by all receive workers. */
+  pthread_mutex_lock(&se->lock);
   cypher = network_get_aes256_cypher(se, pea.iv, sizeof(pea.iv), pea.username);
   if (cypher == NULL) {
+    pthread_mutex_unlock(&se->lock);
     ERROR("network plugin: Failed to get cypher. Username: %s", pea.username);
     sfree(pea.username);
     return -1;
@@ -1264,6 +1352,7 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
   err = gcry_cipher_decrypt(cypher, buffer + buffer_offset,
                             part_size - buffer_offset,
                             /* in = */ NULL, /* in len = */ 0);
+  pthread_mutex_unlock(&se->lock);
   if (err != 0) {
     ERROR("network plugin: gcry_cipher_decrypt returned: %s. Username: %s",
           gcry_strerror(err), pea.username);
@@ -1353,6 +1442,12 @@ static int parse_packet(sockent_t *se, /* {{{ */
 
   value_list_t vl = VALUE_LIST_INIT;
   notification_t n = {0};
+  /* Not zero-initialized: only the first "num" value lists are used. */
+  network_batch_t batch;
+  batch.num = 0;
+  batch.meta = NULL;
+  batch.username = username;
+  batch.address = address;
 
 #if HAVE_GCRYPT_H
   int packet_was_signed = (flags & PP_SIGNED);
@@ -1435,7 +1530,7 @@ static int parse_packet(sockent_t *se, /* {{{ */
       if (status != 0)
         break;
 
-      network_dispatch_values(&vl, username, address);
+      network_batch_add(&batch, &vl);
 
       sfree(vl.values);
     } else if (pkg_type == TYPE_TIME) {
@@ -1525,6 +1620,9 @@ static int parse_packet(sockent_t *se, /* {{{ */
     }
   } /* while (buffer_size > sizeof (part_header_t)) */
 
+  network_batch_flush(&batch);
+  meta_data_destroy(batch.meta);
+
   if (status == 0 && buffer_size > 0)
     WARNING("network plugin: parse_packet: Received truncated "
             "packet, try increasing `MaxPacketSize'");
@@ -1540,6 +1638,9 @@ static void free_sockent_client(struct sockent_client *sec) /* {{{ */
   }
   sfree(sec->addr);
   sfree(sec->bind_addr);
+  sfree(sec->queue);
+  sfree(sec->queue_len);
+  pthread_cond_destroy(&sec->queue_cond);
 #if HAVE_GCRYPT_H
   sfree(sec->username);
   sfree(sec->password);
@@ -1913,6 +2014,7 @@ static sockent_t *sockent_create(int type) /* {{{ */
     se->data.client.bind_addr = NULL;
     se->data.client.resolve_interval = 0;
     se->data.client.next_resolve_reconnect = 0;
+    pthread_cond_init(&se->data.client.queue_cond, /* attr = */ NULL);
 #if HAVE_GCRYPT_H
     se->data.client.security_level = SECURITY_LEVEL_NONE;
     se->data.client.username = NULL;
@@ -2086,6 +2188,28 @@ static int sockent_client_connect(sockent_t *se) /* {{{ */
   return 0;
 } /* }}} int sockent_client_connect */
 
+/* Returns the number of sockets to bind to `ai'. Multicast groups are only
+ * joined once, because every socket of an SO_REUSEPORT group would receive a
+ * copy of each datagram. */
+static size_t network_receive_sockets_num(const struct addrinfo *ai) /* {{{ */
+{
+#ifdef SO_REUSEPORT
+  if (ai->ai_family == AF_INET) {
+    struct sockaddr_in *addr = (struct sockaddr_in *)ai->ai_addr;
+    if (IN_MULTICAST(ntohl(addr->sin_addr.s_addr)))
+      return 1;
+  } else if (ai->ai_family == AF_INET6) {
+    struct sockaddr_in6 *addr = (struct sockaddr_in6 *)ai->ai_addr;
+    if (IN6_IS_ADDR_MULTICAST(&addr->sin6_addr))
+      return 1;
+  }
+
+  return network_config_receive_threads;
+#else
+  return 1;
+#endif
+} /* }}} size_t network_receive_sockets_num */
+
 /* Open the file descriptors for a initialized sockent structure. */
 static int sockent_server_listen(sockent_t *se) /* {{{ */
 {
@@ -2125,32 +2249,54 @@ static int sockent_server_listen(sockent_t *se) /* {{{ */
 
   for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
        ai_ptr = ai_ptr->ai_next) {
-    int *tmp;
+    size_t sockets_num = network_receive_sockets_num(ai_ptr);
 
-    tmp = realloc(se->data.server.fd,
-                  sizeof(*tmp) * (se->data.server.fd_num + 1));
-    if (tmp == NULL) {
-      ERROR("network plugin: realloc failed.");
-      continue;
-    }
-    se->data.server.fd = tmp;
-    tmp = se->data.server.fd + se->data.server.fd_num;
+    for (size_t i = 0; i < sockets_num; i++) {
+      int *tmp;
 
-    *tmp = socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
-    if (*tmp < 0) {
-      ERROR("network plugin: socket(2) failed: %s", STRERRNO);
-      continue;
-    }
+      tmp = realloc(se->data.server.fd,
+                    sizeof(*tmp) * (se->data.server.fd_num + 1));
+      if (tmp == NULL) {
+        ERROR("network plugin: realloc failed.");
+        continue;
+      }
+      se->data.server.fd = tmp;
+      tmp = se->data.server.fd + se->data.server.fd_num;
 
-    status = network_bind_socket(*tmp, ai_ptr, se->interface);
-    if (status != 0) {
-      close(*tmp);
-      *tmp = -1;
-      continue;
-    }
+      *tmp =
+          socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+      if (*tmp < 0) {
+        ERROR("network plugin: socket(2) failed: %s", STRERRNO);
+        continue;
+      }
+
+#ifdef SO_REUSEPORT
+      /* let the kernel balance the datagrams between the receive workers */
+      if ((sockets_num > 1) && (setsockopt(*tmp, SOL_SOCKET, SO_REUSEPORT,
+                                           &(int){1}, sizeof(int)) == -1)) {
+        ERROR("network plugin: setsockopt (reuseport): %s", STRERRNO);
+        close(*tmp);
+        *tmp = -1;
+        continue;
+      }
+#endif
+
+#ifdef SO_RXQ_OVFL
+      /* report the number of dropped datagrams with each received one */
+      if (setsockopt(*tmp, SOL_SOCKET, SO_RXQ_OVFL, &(int){1}, sizeof(int)) ==
+          -1)
+        DEBUG("network plugin: setsockopt (rxq-ovfl): %s", STRERRNO);
+#endif
+
+      status = network_bind_socket(*tmp, ai_ptr, se->interface);
+      if (status != 0) {
+        close(*tmp);
+        *tmp = -1;
+        continue;
+      }
 
-    se->data.server.fd_num++;
-    continue;
+      se->data.server.fd_num++;
+    }
   } /* for (ai_list) */
 
   freeaddrinfo(ai_list);
@@ -2160,6 +2306,62 @@ static int sockent_server_listen(sockent_t *se) /* {{{ */
   return 0;
 } /* }}} int sockent_server_listen */
 
+/* Adds the listening socket `fd' of `se' to the sockets read by `w'. */
+static int receive_worker_add(receive_worker_t *w, sockent_t *se, /* {{{ */
+                              int fd) {
+  struct pollfd *pollfd =
+      realloc(w->pollfd, sizeof(*w->pollfd) * (w->fds_num + 1));
+  if (pollfd == NULL) {
+    ERROR("network plugin: realloc failed.");
+    return -1;
+  }
+  w->pollfd = pollfd;
+
+  sockent_t **sockent =
+      realloc(w->sockent, sizeof(*w->sockent) * (w->fds_num + 1));
+  if (sockent == NULL) {
+    ERROR("network plugin: realloc failed.");
+    return -1;
+  }
+  w->sockent = sockent;
+
+  uint32_t *drops = realloc(w->drops, sizeof(*w->drops) * (w->fds_num + 1));
+  if (drops == NULL) {
+    ERROR("network plugin: realloc failed.");
+    return -1;
+  }
+  w->drops = drops;
+
+  w->pollfd[w->fds_num] = (struct pollfd){
+      .fd = fd,
+      .events = POLLIN | POLLPRI,
+  };
+  w->sockent[w->fds_num] = se;
+  w->drops[w->fds_num] = 0;
+  w->fds_num++;
+
+  return 0;
+} /* }}} int receive_worker_add */
+
+/* Removes all sockets of `se' from the receive workers. */
+static void receive_workers_remove(const sockent_t *se) /* {{{ */
+{
+  for (size_t i = 0; i < network_config_receive_threads; i++) {
+    receive_worker_t *w = receive_workers + i;
+    size_t j = 0;
+
+    for (size_t k = 0; k < w->fds_num; k++) {
+      if (w->sockent[k] == se)
+        continue;
+      w->pollfd[j] = w->pollfd[k];
+      w->sockent[j] = w->sockent[k];
+      w->drops[j] = w->drops[k];
+      j++;
+    }
+    w->fds_num = j;
+  }
+} /* }}} void receive_workers_remove */
+
 /* Add a sockent to the global list of sockets */
 static int sockent_add(sockent_t *se) /* {{{ */
 {
@@ -2169,22 +2371,28 @@ static int sockent_add(sockent_t *se) /* {{{ */
     return -1;
 
   if (se->type == SOCKENT_TYPE_SERVER) {
-    struct pollfd *tmp;
-
-    tmp = realloc(listen_sockets_pollfd,
-                  sizeof(*tmp) * (listen_sockets_num + se->data.server.fd_num));
-    if (tmp == NULL) {
-      ERROR("network plugin: realloc failed.");
-      return -1;
+    if (receive_workers == NULL) {
+      receive_workers =
+          calloc(network_config_receive_threads, sizeof(*receive_workers));
+      if (receive_workers == NULL) {
+        ERROR("network plugin: calloc failed.");
+        return -1;
+      }
+      for (size_t i = 0; i < network_config_receive_threads; i++)
+        receive_workers[i].index = i;
     }
-    listen_sockets_pollfd = tmp;
-    tmp = listen_sockets_pollfd + listen_sockets_num;
 
+    /* The sockets bound to one address are consecutive, so they end up with
+     * different workers. */
     for (size_t i = 0; i < se->data.server.fd_num; i++) {
-      memset(tmp + i, 0, sizeof(*tmp));
-      tmp[i].fd = se->data.server.fd[i];
-      tmp[i].events = POLLIN | POLLPRI;
-      tmp[i].revents = 0;
+      receive_worker_t *w = receive_workers + ((listen_sockets_num + i) %
+                                               network_config_receive_threads);
+
+      int status = receive_worker_add(w, se, se->data.server.fd[i]);
+      if (status != 0) {
+        receive_workers_remove(se);
+        return status;
+      }
     }
 
     listen_sockets_num += se->data.server.fd_num;
@@ -2210,191 +2418,127 @@ static int sockent_add(sockent_t *se) /* {{{ */
   return 0;
 } /* }}} int sockent_add */
 
-static void *dispatch_thread(void __attribute__((unused)) * arg) /* {{{ */
+static int receive_worker_alloc(receive_worker_t *w) /* {{{ */
 {
-  while (42) {
-    receive_list_entry_t *ent;
-    sockent_t *se;
-
-    /* Lock and wait for more data to come in */
-    pthread_mutex_lock(&receive_list_lock);
-    while ((listen_loop == 0) && (receive_list_head == NULL))
-      pthread_cond_wait(&receive_list_cond, &receive_list_lock);
-
-    /* Remove the head entry and unlock */
-    ent = receive_list_head;
-    if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock(&receive_list_lock);
-
-    /* Check whether we are supposed to exit. We do NOT check `listen_loop'
-     * because we dispatch all missing packets before shutting down. */
-    if (ent == NULL)
-      break;
-
-    /* Look for the correct `sockent_t' */
-    se = listen_sockets;
-    while (se != NULL) {
-      size_t i;
-
-      for (i = 0; i < se->data.server.fd_num; i++)
-        if (se->data.server.fd[i] == ent->fd)
-          break;
-
-      if (i < se->data.server.fd_num)
-        break;
-
-      se = se->next;
-    }
-
-    if (se == NULL) {
-      ERROR("network plugin: Got packet from FD %i, but can't "
-            "find an appropriate socket entry.",
-            ent->fd);
-      sfree(ent->data);
-      sfree(ent);
-      continue;
-    }
+  w->buffer = calloc(RECEIVE_BATCH_SIZE, network_config_packet_size);
+  w->msgs = calloc(RECEIVE_BATCH_SIZE, sizeof(*w->msgs));
+  w->iov = calloc(RECEIVE_BATCH_SIZE, sizeof(*w->iov));
+  w->sender = calloc(RECEIVE_BATCH_SIZE, sizeof(*w->sender));
+  w->cmsg = calloc(RECEIVE_BATCH_SIZE, RECEIVE_CMSG_SIZE);
+  if ((w->buffer == NULL) || (w->msgs == NULL) || (w->iov == NULL) ||
+      (w->sender == NULL) || (w->cmsg == NULL)) {
+    ERROR("network plugin: calloc failed.");
+    return ENOMEM;
+  }
 
-    parse_packet(se, ent->data, ent->data_len, /* flags = */ 0,
-                 /* username = */ NULL, &ent->sender);
-    sfree(ent->data);
-    sfree(ent);
-  } /* while (42) */
+  for (size_t i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+    w->iov[i].iov_base = w->buffer + (i * network_config_packet_size);
+    w->iov[i].iov_len = network_config_packet_size;
+    w->msgs[i].msg_hdr.msg_iov = w->iov + i;
+    w->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
 
-  return NULL;
-} /* }}} void *dispatch_thread */
+  return 0;
+} /* }}} int receive_worker_alloc */
 
-static int network_receive(void) /* {{{ */
+static void receive_worker_free(receive_worker_t *w) /* {{{ */
 {
-  char buffer[network_config_packet_size];
-  int buffer_len;
+  sfree(w->buffer);
+  sfree(w->msgs);
+  sfree(w->iov);
+  sfree(w->sender);
+  sfree(w->cmsg);
+} /* }}} void receive_worker_free */
+
+/* Reads up to RECEIVE_BATCH_SIZE datagrams from the `idx'th socket of `w'.
+ * Returns the number of datagrams read or -1 on error, with errno set. */
+static int receive_worker_read(receive_worker_t *w, size_t idx) /* {{{ */
+{
+  /* The kernel updates the name and control lengths, reset them. */
+  for (size_t i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+    struct msghdr *hdr = &w->msgs[i].msg_hdr;
 
-  int status = 0;
+    hdr->msg_name = w->sender + i;
+    hdr->msg_namelen = sizeof(*w->sender);
+    hdr->msg_control = w->cmsg + (i * RECEIVE_CMSG_SIZE);
+    hdr->msg_controllen = RECEIVE_CMSG_SIZE;
+    hdr->msg_flags = 0;
+  }
 
-  receive_list_entry_t *private_list_head;
-  receive_list_entry_t *private_list_tail;
-  uint64_t private_list_length;
+#if HAVE_RECVMMSG
+  return recvmmsg(w->pollfd[idx].fd, w->msgs, RECEIVE_BATCH_SIZE,
+                  MSG_DONTWAIT, /* timeout = */ NULL);
+#else
+  ssize_t status = recvmsg(w->pollfd[idx].fd, &w->msgs[0].msg_hdr,
+                           MSG_DONTWAIT);
+  if (status < 0)
+    return -1;
+  w->msgs[0].msg_len = (unsigned int)status;
+  return 1;
+#endif
+} /* }}} int receive_worker_read */
 
-  assert(listen_sockets_num > 0);
+#ifdef SO_RXQ_OVFL
+static void receive_worker_update_drops(receive_worker_t *w, /* {{{ */
+                                        size_t idx, struct msghdr *hdr) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL))
+      memcpy(w->drops + idx, CMSG_DATA(cmsg), sizeof(*w->drops));
+  }
+} /* }}} void receive_worker_update_drops */
+#endif
 
-  private_list_head = NULL;
-  private_list_tail = NULL;
-  private_list_length = 0;
+static void *receive_worker_thread(void *arg) /* {{{ */
+{
+  receive_worker_t *w = arg;
+  int status = receive_worker_alloc(w);
 
-  while (listen_loop == 0) {
-    status = poll(listen_sockets_pollfd, listen_sockets_num, -1);
-    if (status <= 0) {
+  while ((status == 0) && (listen_loop == 0)) {
+    int fds_ready = poll(w->pollfd, w->fds_num, -1);
+    if (fds_ready <= 0) {
       if (errno == EINTR)
         continue;
       ERROR("network plugin: poll(2) failed: %s", STRERRNO);
+      status = (errno != 0) ? errno : -1;
       break;
     }
 
-    for (size_t i = 0; (i < listen_sockets_num) && (status > 0); i++) {
-      receive_list_entry_t *ent;
-
-      if ((listen_sockets_pollfd[i].revents & (POLLIN | POLLPRI)) == 0)
+    for (size_t i = 0; (i < w->fds_num) && (fds_ready > 0); i++) {
+      if ((w->pollfd[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
-      status--;
-
-      struct sockaddr_storage address;
-      socklen_t length = sizeof(address);
-      memset(&address, 0, length);
-      buffer_len =
-          recvfrom(listen_sockets_pollfd[i].fd, buffer, sizeof(buffer),
-                   0 /* no flags */, (struct sockaddr *)&address, &length);
-      if (buffer_len < 0) {
+      fds_ready--;
+
+      int msgs_num = receive_worker_read(w, i);
+      if (msgs_num < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+          continue;
         status = (errno != 0) ? errno : -1;
         ERROR("network plugin: recv(2) failed: %s", STRERRNO);
         break;
       }
 
-      stats_octets_rx += ((uint64_t)buffer_len);
-      stats_packets_rx++;
+      /* Parse the datagrams in place, the buffers are reused by the next
+       * read. */
+      for (int j = 0; j < msgs_num; j++) {
+        network_msg_t *msg = w->msgs + j;
 
-      /* TODO: Possible performance enhancement: Do not free
-       * these entries in the dispatch thread but put them in
-       * another list, so we don't have to allocate more and
-       * more of these structures. */
-      ent = calloc(1, sizeof(*ent));
-      if (ent == NULL) {
-        ERROR("network plugin: calloc failed.");
-        status = ENOMEM;
-        break;
-      }
+        w->octets_rx += (derive_t)msg->msg_len;
+        w->packets_rx++;
+#ifdef SO_RXQ_OVFL
+        receive_worker_update_drops(w, i, &msg->msg_hdr);
+#endif
 
-      ent->data = malloc(network_config_packet_size);
-      if (ent->data == NULL) {
-        sfree(ent);
-        ERROR("network plugin: malloc failed.");
-        status = ENOMEM;
-        break;
-      }
-      ent->fd = listen_sockets_pollfd[i].fd;
-      ent->next = NULL;
-
-      memcpy(ent->data, buffer, buffer_len);
-      ent->data_len = buffer_len;
-      memcpy(&ent->sender, &address, sizeof(ent->sender));
-
-      if (private_list_head == NULL)
-        private_list_head = ent;
-      else
-        private_list_tail->next = ent;
-      private_list_tail = ent;
-      private_list_length++;
-
-      /* Do not block here. Blocking here has led to
-       * insufficient performance in the past. */
-      if (pthread_mutex_trylock(&receive_list_lock) == 0) {
-        assert(((receive_list_head == NULL) && (receive_list_length == 0)) ||
-               ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-        if (receive_list_head == NULL)
-          receive_list_head = private_list_head;
-        else
-          receive_list_tail->next = private_list_head;
-        receive_list_tail = private_list_tail;
-        receive_list_length += private_list_length;
-
-        pthread_cond_signal(&receive_list_cond);
-        pthread_mutex_unlock(&receive_list_lock);
-
-        private_list_head = NULL;
-        private_list_tail = NULL;
-        private_list_length = 0;
+        parse_packet(w->sockent[i], w->iov[j].iov_base, msg->msg_len,
+                     /* flags = */ 0, /* username = */ NULL, w->sender + j);
       }
-
-      status = 0;
-    } /* for (listen_sockets_pollfd) */
-
-    if (status != 0)
-      break;
+    } /* for (w->pollfd) */
   } /* while (listen_loop == 0) */
 
-  /* Make sure everything is dispatched before exiting. */
-  if (private_list_head != NULL) {
-    pthread_mutex_lock(&receive_list_lock);
+  receive_worker_free(w);
 
-    if (receive_list_head == NULL)
-      receive_list_head = private_list_head;
-    else
-      receive_list_tail->next = private_list_head;
-    receive_list_tail = private_list_tail;
-    receive_list_length += private_list_length;
-
-    pthread_cond_signal(&receive_list_cond);
-    pthread_mutex_unlock(&receive_list_lock);
-  }
-
-  return status;
-} /* }}} int network_receive */
-
-static void *receive_thread(void __attribute__((unused)) * arg) {
-  return network_receive() ? (void *)1 : (void *)0;
-} /* void *receive_thread */
+  return status ? (void *)1 : (void *)0;
+} /* }}} void *receive_worker_thread */
 
 static void network_init_buffer(void) {
   memset(send_buffer, 0, network_config_packet_size);
@@ -2405,31 +2549,46 @@ static void network_init_buffer(void) {
   memset(&send_buffer_vl, 0, sizeof(send_buffer_vl));
 } /* int network_init_buffer */
 
-static void network_send_buffer_plain(sockent_t *se, /* {{{ */
-                                      const char *buffer, size_t buffer_size) {
-  int status;
+/* Sends the packets in `msgs' to the server of `se'. */
+static void network_send_msgs(sockent_t *se, /* {{{ */
+                              network_msg_t *msgs, size_t msgs_num) {
+  size_t sent = 0;
 
-  while (42) {
-    status = sockent_client_connect(se);
+  while (sent < msgs_num) {
+    int status = sockent_client_connect(se);
     if (status != 0)
       return;
 
-    status = sendto(se->data.client.fd, buffer, buffer_size,
-                    /* flags = */ 0, (struct sockaddr *)se->data.client.addr,
-                    se->data.client.addrlen);
+    /* The address changes when the socket is reconnected. */
+    for (size_t i = sent; i < msgs_num; i++) {
+      msgs[i].msg_hdr.msg_name = se->data.client.addr;
+      msgs[i].msg_hdr.msg_namelen = se->data.client.addrlen;
+    }
+
+#if HAVE_SENDMMSG
+    char const *func = "sendmmsg";
+    status = sendmmsg(se->data.client.fd, msgs + sent,
+                      (unsigned int)(msgs_num - sent), /* flags = */ 0);
+#else
+    char const *func = "sendmsg";
+    status = (sendmsg(se->data.client.fd, &msgs[sent].msg_hdr,
+                      /* flags = */ 0) < 0)
+                 ? -1
+                 : 1;
+#endif
     if (status < 0) {
       if ((errno == EINTR) || (errno == EAGAIN))
         continue;
 
-      ERROR("network plugin: sendto failed: %s. Closing sending socket.",
+      ERROR("network plugin: %s failed: %s. Closing sending socket.", func,
             STRERRNO);
       sockent_client_disconnect(se);
       return;
     }
 
-    break;
-  } /* while (42) */
-} /* }}} void network_send_buffer_plain */
+    sent += (size_t)status;
+  } /* while (sent < msgs_num) */
+} /* }}} void network_send_msgs */
 
 #if HAVE_GCRYPT_H
 #define BUFFER_ADD(p, s)                                                       \
@@ -2438,10 +2597,8 @@ static void network_send_buffer_plain(sockent_t *se, /* {{{ */
     buffer_offset += (s);                                                      \
   } while (0)
 
-static void network_send_buffer_signed(sockent_t *se, /* {{{ */
-                                       const char *in_buffer,
-                                       size_t in_buffer_size) {
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
+static int network_sign_buffer(sockent_t *se, char *buffer, /* {{{ */
+                               const char *in_buffer, size_t in_buffer_size) {
   size_t buffer_offset;
   size_t username_len;
 
@@ -2454,7 +2611,7 @@ static void network_send_buffer_signed(sockent_t *se, /* {{{ */
   if (err != 0) {
     ERROR("network plugin: Creating HMAC object failed: %s",
           gcry_strerror(err));
-    return;
+    return -1;
   }
 
   err = gcry_md_setkey(hd, se->data.client.password,
@@ -2462,13 +2619,14 @@ static void network_send_buffer_signed(sockent_t *se, /* {{{ */
   if (err != 0) {
     ERROR("network plugin: gcry_md_setkey failed: %s", gcry_strerror(err));
     gcry_md_close(hd);
-    return;
+    return -1;
   }
 
   username_len = strlen(se->data.client.username);
   if (username_len > (BUFF_SIG_SIZE - PART_SIGNATURE_SHA256_SIZE)) {
     ERROR("network plugin: Username too long: %s", se->data.client.username);
-    return;
+    gcry_md_close(hd);
+    return -1;
   }
 
   memcpy(buffer + PART_SIGNATURE_SHA256_SIZE, se->data.client.username,
@@ -2488,7 +2646,7 @@ static void network_send_buffer_signed(sockent_t *se, /* {{{ */
   if (hash == NULL) {
     ERROR("network plugin: gcry_md_read failed.");
     gcry_md_close(hd);
-    return;
+    return -1;
   }
   memcpy(ps.hash, hash, sizeof(ps.hash));
 
@@ -2504,14 +2662,12 @@ static void network_send_buffer_signed(sockent_t *se, /* {{{ */
   gcry_md_close(hd);
   hd = NULL;
 
-  buffer_offset = PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
-  network_send_buffer_plain(se, buffer, buffer_offset);
-} /* }}} void network_send_buffer_signed */
+  return (int)(PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size);
+} /* }}} int network_sign_buffer */
 
-static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
-                                          const char *in_buffer,
-                                          size_t in_buffer_size) {
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
+static int network_encrypt_buffer(sockent_t *se, char *buffer, /* {{{ */
+                                  const char *in_buffer,
+                                  size_t in_buffer_size) {
   size_t buffer_size;
   size_t buffer_offset;
   size_t header_size;
@@ -2526,14 +2682,14 @@ static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
   username_len = strlen(pea.username);
   if ((PART_ENCRYPTION_AES256_SIZE + username_len) > BUFF_SIG_SIZE) {
     ERROR("network plugin: Username too long: %s", pea.username);
-    return;
+    return -1;
   }
 
   buffer_size = PART_ENCRYPTION_AES256_SIZE + username_len + in_buffer_size;
   header_size = PART_ENCRYPTION_AES256_SIZE + username_len - sizeof(pea.hash);
 
-  assert(buffer_size <= sizeof(buffer));
-  DEBUG("network plugin: network_send_buffer_encrypted: "
+  assert(buffer_size <= BUFF_SIG_SIZE + in_buffer_size);
+  DEBUG("network plugin: network_encrypt_buffer: "
         "buffer_size = %" PRIsz ";",
         buffer_size);
 
@@ -2549,7 +2705,7 @@ static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
 
   /* Initialize the buffer */
   buffer_offset = 0;
-  memset(buffer, 0, sizeof(buffer));
+  memset(buffer, 0, buffer_size);
 
   BUFFER_ADD(&pea.head.type, sizeof(pea.head.type));
   BUFFER_ADD(&pea.head.length, sizeof(pea.head.length));
@@ -2565,7 +2721,7 @@ static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
   cypher = network_get_aes256_cypher(se, pea.iv, sizeof(pea.iv),
                                      se->data.client.password);
   if (cypher == NULL)
-    return;
+    return -1;
 
   /* Encrypt the buffer in-place */
   err = gcry_cipher_encrypt(cypher, buffer + header_size,
@@ -2574,34 +2730,191 @@ static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
   if (err != 0) {
     ERROR("network plugin: gcry_cipher_encrypt returned: %s",
           gcry_strerror(err));
-    return;
+    return -1;
   }
 
-  /* Send it out without further modifications */
-  network_send_buffer_plain(se, buffer, buffer_size);
-} /* }}} void network_send_buffer_encrypted */
+  return (int)buffer_size;
+} /* }}} int network_encrypt_buffer */
 #undef BUFFER_ADD
 #endif /* HAVE_GCRYPT_H */
 
+/* Signs or encrypts `in_buffer' according to the security level of `se'.
+ * `buffer' must have room for BUFF_SIG_SIZE + `in_buffer_size' bytes. Returns
+ * the size of the resulting packet or less than zero on error. */
+static int network_prepare_buffer(sockent_t *se, char *buffer, /* {{{ */
+                                  const char *in_buffer,
+                                  size_t in_buffer_size) {
+#if HAVE_GCRYPT_H
+  if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
+    return network_encrypt_buffer(se, buffer, in_buffer, in_buffer_size);
+  else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
+    return network_sign_buffer(se, buffer, in_buffer, in_buffer_size);
+#endif /* HAVE_GCRYPT_H */
+
+  memcpy(buffer, in_buffer, in_buffer_size);
+  return (int)in_buffer_size;
+} /* }}} int network_prepare_buffer */
+
+/* Sends the queued packets of `se'. Each send thread serves one server, so a
+ * slow or encrypted destination does not hold up the others. */
+static void *network_send_thread(void *arg) /* {{{ */
+{
+  sockent_t *se = arg;
+  struct sockent_client *client = &se->data.client;
+  size_t slot_size = network_config_packet_size + BUFF_SIG_SIZE;
+
+  char *buffer = calloc(SEND_BATCH_SIZE, slot_size);
+  network_msg_t *msgs = calloc(SEND_BATCH_SIZE, sizeof(*msgs));
+  struct iovec *iov = calloc(SEND_BATCH_SIZE, sizeof(*iov));
+  if ((buffer == NULL) || (msgs == NULL) || (iov == NULL)) {
+    ERROR("network plugin: calloc failed.");
+    sfree(buffer);
+    sfree(msgs);
+    sfree(iov);
+    return (void *)1;
+  }
+
+  pthread_mutex_lock(&se->lock);
+  while (42) {
+    while (!client->send_thread_stop && (client->queue_num == 0))
+      pthread_cond_wait(&client->queue_cond, &se->lock);
+
+    /* Exit only after everything has been sent. */
+    if (client->queue_num == 0)
+      break;
+
+    size_t head = client->queue_head;
+    size_t num = client->queue_num;
+    if (num > SEND_BATCH_SIZE)
+      num = SEND_BATCH_SIZE;
+    pthread_mutex_unlock(&se->lock);
+
+    size_t msgs_num = 0;
+    for (size_t i = 0; i < num; i++) {
+      size_t slot = (head + i) % network_config_send_queue_length;
+      char *out = buffer + (msgs_num * slot_size);
+
+      int status = network_prepare_buffer(
+          se, out, client->queue + (slot * network_config_packet_size),
+          client->queue_len[slot]);
+      if (status < 0)
+        continue;
+
+      iov[msgs_num] = (struct iovec){.iov_base = out, .iov_len = status};
+      msgs[msgs_num] = (network_msg_t){.msg_hdr.msg_iov = iov + msgs_num,
+                                       .msg_hdr.msg_iovlen = 1};
+      msgs_num++;
+    }
+
+    pthread_mutex_lock(&se->lock);
+    client->queue_head = (head + num) % network_config_send_queue_length;
+    client->queue_num -= num;
+    pthread_mutex_unlock(&se->lock);
+
+    network_send_msgs(se, msgs, msgs_num);
+
+    pthread_mutex_lock(&se->lock);
+  } /* while (42) */
+  pthread_mutex_unlock(&se->lock);
+
+  sfree(buffer);
+  sfree(msgs);
+  sfree(iov);
+  return (void *)0;
+} /* }}} void *network_send_thread */
+
 static void network_send_buffer(char *buffer, size_t buffer_len) /* {{{ */
 {
   DEBUG("network plugin: network_send_buffer: buffer_len = %" PRIsz,
         buffer_len);
 
   for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
+    struct sockent_client *client = &se->data.client;
+
     pthread_mutex_lock(&se->lock);
-#if HAVE_GCRYPT_H
-    if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
-      network_send_buffer_encrypted(se, buffer, buffer_len);
-    else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
-      network_send_buffer_signed(se, buffer, buffer_len);
-    else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
-#endif   /* HAVE_GCRYPT_H */
-      network_send_buffer_plain(se, buffer, buffer_len);
+    if (client->send_thread_running) {
+      if (client->queue_num < network_config_send_queue_length) {
+        size_t slot = (client->queue_head + client->queue_num) %
+                      network_config_send_queue_length;
+
+        memcpy(client->queue + (slot * network_config_packet_size), buffer,
+               buffer_len);
+        client->queue_len[slot] = buffer_len;
+        client->queue_num++;
+        pthread_cond_signal(&client->queue_cond);
+        pthread_mutex_unlock(&se->lock);
+      } else {
+        pthread_mutex_unlock(&se->lock);
+
+        pthread_mutex_lock(&stats_lock);
+        stats_packets_tx_dropped++;
+        pthread_mutex_unlock(&stats_lock);
+      }
+      continue;
+    }
+
+    /* No send thread, send the packet right away. */
+    char out[BUFF_SIG_SIZE + buffer_len];
+    int status = network_prepare_buffer(se, out, buffer, buffer_len);
+    if (status >= 0) {
+      struct iovec iov = {.iov_base = out, .iov_len = (size_t)status};
+      network_msg_t msg = {.msg_hdr.msg_iov = &iov, .msg_hdr.msg_iovlen = 1};
+      network_send_msgs(se, &msg, 1);
+    }
     pthread_mutex_unlock(&se->lock);
   } /* for (sending_sockets) */
 } /* }}} void network_send_buffer */
 
+/* Starts the send thread of `se'. If that fails, packets are sent by the
+ * thread flushing the send buffer. */
+static void sockent_client_start(sockent_t *se) /* {{{ */
+{
+  struct sockent_client *client = &se->data.client;
+
+  client->queue =
+      calloc(network_config_send_queue_length, network_config_packet_size);
+  client->queue_len =
+      calloc(network_config_send_queue_length, sizeof(*client->queue_len));
+  if ((client->queue == NULL) || (client->queue_len == NULL)) {
+    ERROR("network plugin: calloc failed.");
+    sfree(client->queue);
+    sfree(client->queue_len);
+    return;
+  }
+
+  int status = plugin_thread_create(&client->send_thread_id,
+                                    network_send_thread, se, "network send");
+  if (status != 0) {
+    ERROR("network: pthread_create failed: %s", STRERRNO);
+    return;
+  }
+
+  pthread_mutex_lock(&se->lock);
+  client->send_thread_running = true;
+  pthread_mutex_unlock(&se->lock);
+} /* }}} void sockent_client_start */
+
+/* Stops the send thread of `se' after it has sent all queued packets. */
+static void sockent_client_stop(sockent_t *se) /* {{{ */
+{
+  struct sockent_client *client = &se->data.client;
+
+  pthread_mutex_lock(&se->lock);
+  if (!client->send_thread_running) {
+    pthread_mutex_unlock(&se->lock);
+    return;
+  }
+  client->send_thread_stop = true;
+  pthread_cond_broadcast(&client->queue_cond);
+  pthread_mutex_unlock(&se->lock);
+
+  pthread_join(client->send_thread_id, /* retval = */ NULL);
+
+  pthread_mutex_lock(&se->lock);
+  client->send_thread_running = false;
+  pthread_mutex_unlock(&se->lock);
+} /* }}} void sockent_client_stop */
+
 static int add_to_buffer(char *buffer, size_t buffer_size, /* {{{ */
                          value_list_t *vl_def, const data_set_t *ds,
                          const value_list_t *vl) {
@@ -2677,21 +2990,17 @@ static void flush_buffer(void) {
   network_init_buffer();
 }
 
-static int network_write(const data_set_t *ds, const value_list_t *vl,
-                         user_data_t __attribute__((unused)) * user_data) {
+/* Appends "vl" to the send buffer, sending the buffer when it is full. Must be
+ * called with "send_buffer_lock" held. */
+static int network_write_value(const data_set_t *ds, const value_list_t *vl) {
   int status;
 
-  /* listen_loop is set to non-zero in the shutdown callback, which is
-   * guaranteed to be called *after* all the write threads have been shut
-   * down. */
-  assert(listen_loop == 0);
-
   if (!check_send_okay(vl)) {
 #if COLLECT_DEBUG
     char name[6 * DATA_MAX_NAME_LEN];
     FORMAT_VL(name, sizeof(name), vl);
     name[sizeof(name) - 1] = '\0';
-    DEBUG("network plugin: network_write: "
+    DEBUG("network plugin: network_write_value: "
           "NOT sending %s.",
           name);
 #endif
@@ -2705,8 +3014,6 @@ static int network_write(const data_set_t *ds, const value_list_t *vl,
 
   uc_meta_data_add_unsigned_int(vl, "network:time_sent", (uint64_t)vl->time);
 
-  pthread_mutex_lock(&send_buffer_lock);
-
   status = add_to_buffer(send_buffer_ptr,
                          network_config_packet_size -
                              (send_buffer_fill + BUFF_SIG_SIZE),
@@ -2742,9 +3049,27 @@ static int network_write(const data_set_t *ds, const value_list_t *vl,
     flush_buffer();
   }
 
+  return (status < 0) ? -1 : 0;
+} /* int network_write_value */
+
+static int network_write(const data_set_t *const *ds,
+                         const value_list_t *const *vl, size_t num,
+                         user_data_t __attribute__((unused)) * user_data) {
+  int status = 0;
+
+  /* listen_loop is set to non-zero in the shutdown callback, which is
+   * guaranteed to be called *after* all the write threads have been shut
+   * down. */
+  assert(listen_loop == 0);
+
+  pthread_mutex_lock(&send_buffer_lock);
+  for (size_t i = 0; i < num; i++) {
+    if (network_write_value(ds[i], vl[i]) != 0)
+      status = -1;
+  }
   pthread_mutex_unlock(&send_buffer_lock);
 
-  return (status < 0) ? -1 : 0;
+  return status;
 } /* int network_write */
 
 static int network_config_set_ttl(const oconfig_item_t *ci) /* {{{ */
@@ -2843,6 +3168,51 @@ static int network_config_set_buffer_size(const oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int network_config_set_buffer_size */
 
+static int network_config_set_send_queue_length(/* {{{ */
+                                                const oconfig_item_t *ci) {
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if (tmp >= 1)
+    network_config_send_queue_length = (size_t)tmp;
+  else {
+    WARNING("network plugin: The `SendQueueLength' must be at least 1.");
+    return -1;
+  }
+
+  return 0;
+} /* }}} int network_config_set_send_queue_length */
+
+static int network_config_set_receive_threads(/* {{{ */
+                                              const oconfig_item_t *ci) {
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+
+  if (receive_workers != NULL) {
+    WARNING("network plugin: The `ReceiveThreads' option must be set before "
+            "the first `Listen' block. Ignoring it.");
+    return -1;
+  } else if ((tmp >= 1) && (tmp <= 256))
+    network_config_receive_threads = (size_t)tmp;
+  else {
+    WARNING("network plugin: The `ReceiveThreads' must be between 1 and 256.");
+    return -1;
+  }
+
+#ifndef SO_REUSEPORT
+  if (network_config_receive_threads > 1)
+    WARNING("network plugin: SO_REUSEPORT is not available on this system, "
+            "only one of the %" PRIsz " receive threads will be used per "
+            "address.",
+            network_config_receive_threads);
+#endif
+
+  return 0;
+} /* }}} int network_config_set_receive_threads */
+
 #if HAVE_GCRYPT_H
 static int network_config_set_security_level(oconfig_item_t *ci, /* {{{ */
                                              int *retval) {
@@ -3034,6 +3404,8 @@ static int network_config(oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp("TimeToLive", child->key) == 0)
       network_config_set_ttl(child);
+    else if (strcasecmp("ReceiveThreads", child->key) == 0)
+      network_config_set_receive_threads(child);
   }
 
   for (int i = 0; i < ci->children_num; i++) {
@@ -3043,10 +3415,13 @@ static int network_config(oconfig_item_t *ci) /* {{{ */
       network_config_add_listen(child);
     else if (strcasecmp("Server", child->key) == 0)
       network_config_add_server(child);
-    else if (strcasecmp("TimeToLive", child->key) == 0) {
+    else if ((strcasecmp("TimeToLive", child->key) == 0) ||
+             (strcasecmp("ReceiveThreads", child->key) == 0)) {
       /* Handled earlier */
     } else if (strcasecmp("MaxPacketSize", child->key) == 0)
       network_config_set_buffer_size(child);
+    else if (strcasecmp("SendQueueLength", child->key) == 0)
+      network_config_set_send_queue_length(child);
     else if (strcasecmp("Forward", child->key) == 0)
       cf_util_get_boolean(child, &network_config_forward);
     else if (strcasecmp("ReportStats", child->key) == 0)
@@ -3130,23 +3505,23 @@ static int network_notification(const notification_t *n,
 static int network_shutdown(void) {
   listen_loop++;
 
-  /* Kill the listening thread */
-  if (receive_thread_running != 0) {
-    INFO("network plugin: Stopping receive thread.");
-    pthread_kill(receive_thread_id, SIGTERM);
-    pthread_join(receive_thread_id, NULL /* no return value */);
-    memset(&receive_thread_id, 0, sizeof(receive_thread_id));
-    receive_thread_running = 0;
-  }
-
-  /* Shutdown the dispatching thread */
-  if (dispatch_thread_running != 0) {
-    INFO("network plugin: Stopping dispatch thread.");
-    pthread_mutex_lock(&receive_list_lock);
-    pthread_cond_broadcast(&receive_list_cond);
-    pthread_mutex_unlock(&receive_list_lock);
-    pthread_join(dispatch_thread_id, /* ret = */ NULL);
-    dispatch_thread_running = 0;
+  /* Kill the listening threads. Each of them parses the datagrams it has
+   * already read before exiting. */
+  if (receive_workers != NULL) {
+    INFO("network plugin: Stopping receive threads.");
+    for (size_t i = 0; i < network_config_receive_threads; i++) {
+      receive_worker_t *w = receive_workers + i;
+
+      if (w->running) {
+        pthread_kill(w->thread_id, SIGTERM);
+        pthread_join(w->thread_id, NULL /* no return value */);
+        w->running = false;
+      }
+      sfree(w->pollfd);
+      sfree(w->sockent);
+      sfree(w->drops);
+    }
+    sfree(receive_workers);
   }
 
   sockent_destroy(listen_sockets);
@@ -3156,8 +3531,10 @@ static int network_shutdown(void) {
 
   sfree(send_buffer);
 
-  for (sockent_t *se = sending_sockets; se != NULL; se = se->next)
+  for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
+    sockent_client_stop(se);
     sockent_client_disconnect(se);
+  }
   sockent_destroy(sending_sockets);
 
   plugin_unregister_config("network");
@@ -3168,29 +3545,64 @@ static int network_shutdown(void) {
   return 0;
 } /* int network_shutdown */
 
+/* Dispatches the statistics of one receive worker. */
+static void receive_worker_stats_read(const receive_worker_t *w) /* {{{ */
+{
+  derive_t drops = 0;
+  value_list_t vl = VALUE_LIST_INIT;
+
+  for (size_t i = 0; i < w->fds_num; i++)
+    drops += (derive_t)w->drops[i];
+
+  vl.values = &(value_t){.derive = w->packets_rx};
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "network", sizeof(vl.plugin));
+  snprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "receive-%" PRIsz,
+           w->index);
+
+  sstrncpy(vl.type, "if_rx_packets", sizeof(vl.type));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = w->octets_rx};
+  sstrncpy(vl.type, "if_rx_octets", sizeof(vl.type));
+  plugin_dispatch_values(&vl);
+
+  vl.values = &(value_t){.derive = drops};
+  sstrncpy(vl.type, "if_rx_dropped", sizeof(vl.type));
+  plugin_dispatch_values(&vl);
+} /* }}} void receive_worker_stats_read */
+
 static int network_stats_read(void) /* {{{ */
 {
-  derive_t copy_octets_rx;
+  derive_t copy_octets_rx = 0;
   derive_t copy_octets_tx;
-  derive_t copy_packets_rx;
+  derive_t copy_packets_rx = 0;
   derive_t copy_packets_tx;
   derive_t copy_values_dispatched;
   derive_t copy_values_not_dispatched;
   derive_t copy_values_sent;
   derive_t copy_values_not_sent;
-  derive_t copy_receive_list_length;
+  derive_t copy_packets_rx_dropped = 0;
+  derive_t copy_packets_tx_dropped;
   value_list_t vl = VALUE_LIST_INIT;
   value_t values[2];
 
-  copy_octets_rx = stats_octets_rx;
+  for (size_t i = 0;
+       (receive_workers != NULL) && (i < network_config_receive_threads); i++) {
+    receive_worker_t *w = receive_workers + i;
+
+    copy_octets_rx += w->octets_rx;
+    copy_packets_rx += w->packets_rx;
+    for (size_t j = 0; j < w->fds_num; j++)
+      copy_packets_rx_dropped += (derive_t)w->drops[j];
+  }
   copy_octets_tx = stats_octets_tx;
-  copy_packets_rx = stats_packets_rx;
   copy_packets_tx = stats_packets_tx;
+  copy_packets_tx_dropped = stats_packets_tx_dropped;
   copy_values_dispatched = stats_values_dispatched;
   copy_values_not_dispatched = stats_values_not_dispatched;
   copy_values_sent = stats_values_sent;
   copy_values_not_sent = stats_values_not_sent;
-  copy_receive_list_length = receive_list_length;
 
   /* Initialize `vl' */
   vl.values = values;
@@ -3210,6 +3622,12 @@ static int network_stats_read(void) /* {{{ */
   sstrncpy(vl.type, "if_packets", sizeof(vl.type));
   plugin_dispatch_values(&vl);
 
+  /* Packets dropped by the kernel / because the send queue was full */
+  vl.values[0].derive = copy_packets_rx_dropped;
+  vl.values[1].derive = copy_packets_tx_dropped;
+  sstrncpy(vl.type, "if_dropped", sizeof(vl.type));
+  plugin_dispatch_values(&vl);
+
   /* Values (not) dispatched and (not) send */
   sstrncpy(vl.type, "total_values", sizeof(vl.type));
   vl.values_len = 1;
@@ -3230,11 +3648,10 @@ static int network_stats_read(void) /* {{{ */
   sstrncpy(vl.type_instance, "send-rejected", sizeof(vl.type_instance));
   plugin_dispatch_values(&vl);
 
-  /* Receive queue length */
-  vl.values[0].gauge = (gauge_t)copy_receive_list_length;
-  sstrncpy(vl.type, "queue_length", sizeof(vl.type));
-  vl.type_instance[0] = 0;
-  plugin_dispatch_values(&vl);
+  /* Per receive worker statistics */
+  for (size_t i = 0;
+       (receive_workers != NULL) && (i < network_config_receive_threads); i++)
+    receive_worker_stats_read(receive_workers + i);
 
   return 0;
 } /* }}} int network_stats_read */
@@ -3262,36 +3679,33 @@ static int network_init(void) {
 
   /* setup socket(s) and so on */
   if (sending_sockets != NULL) {
-    plugin_register_write("network", network_write,
-                          /* user_data = */ NULL);
+    plugin_register_write_batch("network", network_write,
+                                /* user_data = */ NULL);
     plugin_register_notification("network", network_notification,
                                  /* user_data = */ NULL);
   }
 
+  for (sockent_t *se = sending_sockets; se != NULL; se = se->next)
+    sockent_client_start(se);
+
   /* If no threads need to be started, return here. */
-  if ((listen_sockets_num == 0) ||
-      ((dispatch_thread_running != 0) && (receive_thread_running != 0)))
+  if (listen_sockets_num == 0)
     return 0;
 
-  if (dispatch_thread_running == 0) {
-    int status;
-    status = plugin_thread_create(&dispatch_thread_id, dispatch_thread,
-                                  NULL /* no argument */, "network disp");
-    if (status != 0) {
-      ERROR("network: pthread_create failed: %s", STRERRNO);
-    } else {
-      dispatch_thread_running = 1;
-    }
-  }
+  for (size_t i = 0; i < network_config_receive_threads; i++) {
+    receive_worker_t *w = receive_workers + i;
+    char name[32];
+
+    if (w->running || (w->fds_num == 0))
+      continue;
 
-  if (receive_thread_running == 0) {
-    int status;
-    status = plugin_thread_create(&receive_thread_id, receive_thread,
-                                  NULL /* no argument */, "network recv");
+    ssnprintf(name, sizeof(name), "network recv%" PRIsz, i);
+    int status =
+        plugin_thread_create(&w->thread_id, receive_worker_thread, w, name);
     if (status != 0) {
       ERROR("network: pthread_create failed: %s", STRERRNO);
     } else {
-      receive_thread_running = 1;
+      w->running = true;
     }
   }
 
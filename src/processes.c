@@ -40,6 +40,7 @@
 
 #include "plugin.h"
 #include "utils/common/common.h"
+#include "utils/worker_pool/worker_pool.h"
 
 #if HAVE_LIBTASKSTATS
 #include "utils/taskstats/taskstats.h"
@@ -99,6 +100,13 @@
 #ifndef CONFIG_HZ
 #define CONFIG_HZ 100
 #endif
+#if HAVE_LIBTASKSTATS
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -322,8 +330,121 @@ static mach_msg_type_number_t pset_list_len;
 /* #endif HAVE_THREAD_INFO */
 
 #elif KERNEL_LINUX
+/* ps_pid_t caches which processes a PID has been accounted to. The command
+ * line is only read and matched against the configured processes when a PID
+ * is seen for the first time or when its start time or name changed, i.e. the
+ * PID has been reused or the process called exec(). */
+typedef struct ps_pid_s {
+  long pid;
+  unsigned long long starttime;
+  char name[16]; /* TASK_COMM_LEN */
+  uint64_t round;
+  /* set when the process called exec() or changed its name */
+  bool stale;
+
+  procstat_t **groups;
+  procstat_entry_t **instances;
+  size_t groups_num;
+  process_entry_t *entry;
+
+  struct ps_pid_s *next;
+} ps_pid_t;
+
+/* The PID space is split into one partition per read thread. Thread i reads
+ * the PIDs with (pid % ps_parts_num == i) and owns the cache entries of these
+ * PIDs, so the cache needs no locking. */
+typedef struct {
+  ps_pid_t **buckets;
+  size_t buckets_num;
+  size_t entries_num;
+
+  /* cache entries read in this round which belong to at least one process */
+  ps_pid_t **matched;
+  size_t matched_num;
+  size_t matched_size;
+
+  int sleeping;
+  int zombies;
+  int stopped;
+  int paging;
+  int blocked;
+} ps_part_t;
+
 static long pagesize_g;
 static void ps_fill_details(const procstat_t *ps, process_entry_t *entry);
+static int ps_init_threads(void);
+
+/* /proc is opened once; the per-process files are opened relative to it. */
+static DIR *ps_proc_dir;
+static int ps_proc_fd = -1;
+
+static long *ps_pids;
+static size_t ps_pids_num;
+static size_t ps_pids_size;
+
+static ps_part_t *ps_parts;
+static size_t ps_parts_num;
+
+/* Worker pool reading the PID partitions in parallel, one partition per
+ * participant. ps_round counts the reads to expire the PID cache. */
+static size_t ps_threads_num = 1;
+static worker_pool_t *ps_pool;
+static uint64_t ps_round;
+
+#if HAVE_LIBTASKSTATS
+/* the taskstats handle is shared by all read threads */
+static pthread_mutex_t ps_taskstats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Event driven mode: a thread receives fork and exec events from the proc
+ * connector and the accounting information of exited tasks from taskstats.
+ * Reads then only visit the matched processes and the processes which changed
+ * since the last read, and account the usage of processes which exited in
+ * between. */
+typedef struct {
+  long pid;
+  size_t seq;
+  bool exec;
+  /* command line at the time of the event, if it could be read */
+  char *cmdline;
+  /* number of reads the event has been kept for, see ps_events_keep() */
+  unsigned age;
+  /* the process' exit has been accounted */
+  bool done;
+} ps_event_t;
+
+/* upper bound of queued events; more are treated as lost events */
+#define PS_EVENTS_MAX 1048576
+
+/* Number of reads to keep the events of a forked process which has neither
+ * been read nor reported as exited. Its exit record may only arrive after the
+ * next read, when the process is already gone from /proc. */
+#define PS_EVENTS_KEEP 2
+
+static bool ps_events_enabled;
+static bool ps_events_started;
+static bool ps_events_running;
+static bool ps_events_shutdown;
+static pthread_t ps_events_thread;
+static pthread_mutex_t ps_events_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ps_cn_fd = -1;
+static ts_t *ps_exit_handle;
+
+/* protected by ps_events_lock */
+static ps_event_t *ps_events;
+static size_t ps_events_num;
+static size_t ps_events_size;
+static size_t ps_events_seq;
+static ts_exit_t *ps_exits;
+static size_t ps_exits_num;
+static size_t ps_exits_size;
+static bool ps_events_lost = true;
+
+/* events kept from earlier reads; only accessed by the read callback */
+static ps_event_t *ps_events_pending;
+static size_t ps_events_pending_num;
+
+static int ps_init_events(void);
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -525,99 +646,113 @@ static void ps_update_delay(procstat_t *out, procstat_entry_t *prev,
 }
 #endif
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add(const char *name, const char *cmdline,
-                        process_entry_t *entry) {
+/* returns the instance of 'ps' for the process 'entry', creating it if
+ * necessary */
+static procstat_entry_t *ps_list_get_entry(procstat_t *ps, const char *name,
+                                           const process_entry_t *entry) {
   procstat_entry_t *pse;
 
-  if (entry->id == 0)
-    return;
+  for (pse = ps->instances; pse != NULL; pse = pse->next)
+    if ((pse->id == entry->id) || (pse->next == NULL))
+      break;
 
-  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
-    if ((ps_list_match(name, cmdline, ps)) == 0)
-      continue;
+  if ((pse == NULL) || (pse->id != entry->id) ||
+      (pse->starttime != entry->starttime)) {
+    if (pse != NULL && pse->id == entry->id) {
+      WARNING("pid %lu reused between two reads, ignoring existing "
+              "procstat_entry for %s",
+              pse->id, name);
+    }
+    procstat_entry_t *new;
 
-#if KERNEL_LINUX
-    ps_fill_details(ps, entry);
-#endif
+    new = calloc(1, sizeof(*new));
+    if (new == NULL)
+      return NULL;
+    new->id = entry->id;
+    new->starttime = entry->starttime;
 
-    for (pse = ps->instances; pse != NULL; pse = pse->next)
-      if ((pse->id == entry->id) || (pse->next == NULL))
-        break;
+    if (pse == NULL)
+      ps->instances = new;
+    else
+      pse->next = new;
 
-    if ((pse == NULL) || (pse->id != entry->id) ||
-        (pse->starttime != entry->starttime)) {
-      if (pse != NULL && pse->id == entry->id) {
-        WARNING("pid %lu reused between two reads, ignoring existing "
-                "procstat_entry for %s",
-                pse->id, name);
-      }
-      procstat_entry_t *new;
+    pse = new;
+  }
 
-      new = calloc(1, sizeof(*new));
-      if (new == NULL)
-        return;
-      new->id = entry->id;
-      new->starttime = entry->starttime;
+  return pse;
+} /* procstat_entry_t *ps_list_get_entry */
+
+/* add the counters of process 'entry' to 'ps' and refresh its instance */
+static void ps_list_account(procstat_t *ps, procstat_entry_t *pse,
+                            process_entry_t *entry) {
+  pse->age = 0;
+
+  ps->num_proc += entry->num_proc;
+  ps->num_lwp += entry->num_lwp;
+  ps->num_fd += entry->num_fd;
+  ps->num_maps += entry->num_maps;
+  ps->vmem_size += entry->vmem_size;
+  ps->vmem_rss += entry->vmem_rss;
+  ps->vmem_data += entry->vmem_data;
+  ps->vmem_code += entry->vmem_code;
+  ps->stack_size += entry->stack_size;
+
+  if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
+    ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
+    ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
+  }
 
-      if (pse == NULL)
-        ps->instances = new;
-      else
-        pse->next = new;
+  if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
+    ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
+    ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
+  }
 
-      pse = new;
-    }
+  if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
+    ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
+    ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
+  }
 
-    pse->age = 0;
-
-    ps->num_proc += entry->num_proc;
-    ps->num_lwp += entry->num_lwp;
-    ps->num_fd += entry->num_fd;
-    ps->num_maps += entry->num_maps;
-    ps->vmem_size += entry->vmem_size;
-    ps->vmem_rss += entry->vmem_rss;
-    ps->vmem_data += entry->vmem_data;
-    ps->vmem_code += entry->vmem_code;
-    ps->stack_size += entry->stack_size;
-
-    if ((entry->io_rchar != -1) && (entry->io_wchar != -1)) {
-      ps_update_counter(&ps->io_rchar, &pse->io_rchar, entry->io_rchar);
-      ps_update_counter(&ps->io_wchar, &pse->io_wchar, entry->io_wchar);
-    }
+  if ((entry->cswitch_vol != -1) && (entry->cswitch_invol != -1)) {
+    ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol, entry->cswitch_vol);
+    ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
+                      entry->cswitch_invol);
+  }
 
-    if ((entry->io_syscr != -1) && (entry->io_syscw != -1)) {
-      ps_update_counter(&ps->io_syscr, &pse->io_syscr, entry->io_syscr);
-      ps_update_counter(&ps->io_syscw, &pse->io_syscw, entry->io_syscw);
-    }
+  ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
+                    entry->vmem_minflt_counter);
+  ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
+                    entry->vmem_majflt_counter);
 
-    if ((entry->io_diskr != -1) && (entry->io_diskw != -1)) {
-      ps_update_counter(&ps->io_diskr, &pse->io_diskr, entry->io_diskr);
-      ps_update_counter(&ps->io_diskw, &pse->io_diskw, entry->io_diskw);
-    }
+  ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
+                    entry->cpu_user_counter);
+  ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
+                    entry->cpu_system_counter);
 
-    if ((entry->cswitch_vol != -1) && (entry->cswitch_invol != -1)) {
-      ps_update_counter(&ps->cswitch_vol, &pse->cswitch_vol,
-                        entry->cswitch_vol);
-      ps_update_counter(&ps->cswitch_invol, &pse->cswitch_invol,
-                        entry->cswitch_invol);
-    }
+#if HAVE_LIBTASKSTATS
+  if (entry->has_delay)
+    ps_update_delay(ps, pse, entry);
+#endif
+} /* void ps_list_account */
 
-    ps_update_counter(&ps->vmem_minflt_counter, &pse->vmem_minflt_counter,
-                      entry->vmem_minflt_counter);
-    ps_update_counter(&ps->vmem_majflt_counter, &pse->vmem_majflt_counter,
-                      entry->vmem_majflt_counter);
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it) */
+static void ps_list_add(const char *name, const char *cmdline,
+                        process_entry_t *entry) {
+  if (entry->id == 0)
+    return;
 
-    ps_update_counter(&ps->cpu_user_counter, &pse->cpu_user_counter,
-                      entry->cpu_user_counter);
-    ps_update_counter(&ps->cpu_system_counter, &pse->cpu_system_counter,
-                      entry->cpu_system_counter);
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+    if ((ps_list_match(name, cmdline, ps)) == 0)
+      continue;
 
-#if HAVE_LIBTASKSTATS
-    if (entry->has_delay)
-      ps_update_delay(ps, pse, entry);
-#endif
+    procstat_entry_t *pse = ps_list_get_entry(ps, name, entry);
+    if (pse == NULL)
+      return;
+
+    ps_list_account(ps, pse, entry);
   }
 }
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset(void) {
@@ -757,6 +892,27 @@ static int ps_config(oconfig_item_t *ci) {
       cf_util_get_boolean(c, &report_sys_ctxt_switch);
     } else if (strcasecmp(c->key, "SkipNonRunningProcess") == 0) {
       cf_util_get_boolean(c, &skip_non_running_procs);
+    } else if (strcasecmp(c->key, "ReadThreads") == 0) {
+#if KERNEL_LINUX
+      int tmp = 0;
+      if (cf_util_get_int(c, &tmp) != 0)
+        continue;
+      if (tmp < 1) {
+        ERROR("processes plugin: ReadThreads must be at least 1.");
+        continue;
+      }
+      ps_threads_num = (size_t)tmp;
+#else
+      WARNING("processes plugin: The \"ReadThreads\" option is only "
+              "supported on Linux.");
+#endif
+    } else if (strcasecmp(c->key, "EventDriven") == 0) {
+#if KERNEL_LINUX && HAVE_LIBTASKSTATS
+      cf_util_get_boolean(c, &ps_events_enabled);
+#else
+      WARNING("processes plugin: The plugin has been compiled without support "
+              "for the \"EventDriven\" option.");
+#endif
     } else {
       ERROR("processes plugin: The `%s' configuration option is not "
             "understood and will be ignored.",
@@ -803,6 +959,19 @@ static int ps_init(void) {
     }
   }
 #endif
+
+  if (ps_parts == NULL) {
+    int status = ps_init_threads();
+    if (status != 0)
+      return status;
+
+#if HAVE_LIBTASKSTATS
+    if (ps_events_enabled && (ps_init_events() != 0)) {
+      WARNING("processes plugin: Falling back to reading all processes.");
+      ps_events_enabled = false;
+    }
+#endif
+  }
   /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS &&                                                  \
@@ -1018,8 +1187,64 @@ static void ps_submit_global_stat(const char *type_name, derive_t value) {
 
 /* ------- additional functions for KERNEL_LINUX/HAVE_THREAD_INFO ------- */
 #if KERNEL_LINUX
+/* Opens "<pid>/<file>" relative to the /proc directory held in ps_proc_fd. */
+static int ps_openat(long pid, const char *file, int flags) {
+  char path[64];
+
+  snprintf(path, sizeof(path), "%li/%s", pid, file);
+  return openat(ps_proc_fd, path, flags | O_CLOEXEC);
+} /* int ps_openat */
+
+static FILE *ps_fopenat(long pid, const char *file) {
+  int fd = ps_openat(pid, file, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  FILE *fh = fdopen(fd, "r");
+  if (fh == NULL)
+    close(fd);
+  return fh;
+} /* FILE *ps_fopenat */
+
+static DIR *ps_opendirat(long pid, const char *dir) {
+  int fd = ps_openat(pid, dir, O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return NULL;
+
+  DIR *dh = fdopendir(fd);
+  if (dh == NULL)
+    close(fd);
+  return dh;
+} /* DIR *ps_opendirat */
+
+/* Reads "<pid>/<file>" into buf and null-terminates it. Returns the number of
+ * bytes read or -1 on error. */
+static ssize_t ps_read_file(long pid, const char *file, char *buf,
+                            size_t buf_size) {
+  int fd = ps_openat(pid, file, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  size_t n = 0;
+  while (n < buf_size - 1) {
+    ssize_t status = read(fd, buf + n, buf_size - 1 - n);
+    if (status < 0) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+        continue;
+      close(fd);
+      return -1;
+    }
+    if (status == 0)
+      break;
+    n += (size_t)status;
+  }
+  close(fd);
+
+  buf[n] = 0;
+  return (ssize_t)n;
+} /* ssize_t ps_read_file */
+
 static int ps_read_tasks_status(process_entry_t *ps) {
-  char dirname[64];
   DIR *dh;
   char filename[64];
   FILE *fh;
@@ -1030,10 +1255,8 @@ static int ps_read_tasks_status(process_entry_t *ps) {
   char *fields[8];
   int numfields;
 
-  snprintf(dirname, sizeof(dirname), "/proc/%li/task", ps->id);
-
-  if ((dh = opendir(dirname)) == NULL) {
-    DEBUG("Failed to open directory `%s'", dirname);
+  if ((dh = ps_opendirat(ps->id, "task")) == NULL) {
+    DEBUG("Failed to open directory `/proc/%li/task'", ps->id);
     return -1;
   }
 
@@ -1045,15 +1268,17 @@ static int ps_read_tasks_status(process_entry_t *ps) {
 
     tpid = ent->d_name;
 
-    int r = snprintf(filename, sizeof(filename), "/proc/%li/task/%s/status",
-                     ps->id, tpid);
+    int r = snprintf(filename, sizeof(filename), "%s/status", tpid);
     if ((size_t)r >= sizeof(filename)) {
       DEBUG("Filename too long: `%s'", filename);
       continue;
     }
 
-    if ((fh = fopen(filename, "r")) == NULL) {
-      DEBUG("Failed to open file `%s'", filename);
+    int fd = openat(dirfd(dh), filename, O_RDONLY | O_CLOEXEC);
+    if ((fd < 0) || ((fh = fdopen(fd, "r")) == NULL)) {
+      DEBUG("Failed to open file `/proc/%li/task/%s'", ps->id, filename);
+      if (fd >= 0)
+        close(fd);
       continue;
     }
 
@@ -1098,7 +1323,6 @@ static int ps_read_tasks_status(process_entry_t *ps) {
 static int ps_read_status(long pid, process_entry_t *ps) {
   FILE *fh;
   char buffer[1024];
-  char filename[64];
   unsigned long lib = 0;
   unsigned long exe = 0;
   unsigned long data = 0;
@@ -1106,8 +1330,7 @@ static int ps_read_status(long pid, process_entry_t *ps) {
   char *fields[8];
   int numfields;
 
-  snprintf(filename, sizeof(filename), "/proc/%li/status", pid);
-  if ((fh = fopen(filename, "r")) == NULL)
+  if ((fh = ps_fopenat(pid, "status")) == NULL)
     return -1;
 
   while (fgets(buffer, sizeof(buffer), fh) != NULL) {
@@ -1153,14 +1376,12 @@ static int ps_read_status(long pid, process_entry_t *ps) {
 static int ps_read_io(process_entry_t *ps) {
   FILE *fh;
   char buffer[1024];
-  char filename[64];
 
   char *fields[8];
   int numfields;
 
-  snprintf(filename, sizeof(filename), "/proc/%li/io", ps->id);
-  if ((fh = fopen(filename, "r")) == NULL) {
-    DEBUG("ps_read_io: Failed to open file `%s'", filename);
+  if ((fh = ps_fopenat(ps->id, "io")) == NULL) {
+    DEBUG("ps_read_io: Failed to open file `/proc/%li/io'", ps->id);
     return -1;
   }
 
@@ -1204,15 +1425,13 @@ static int ps_read_io(process_entry_t *ps) {
   return 0;
 } /* int ps_read_io (...) */
 
-static int ps_count_maps(pid_t pid) {
+static int ps_count_maps(long pid) {
   FILE *fh;
   char buffer[1024];
-  char filename[64];
   int count = 0;
 
-  snprintf(filename, sizeof(filename), "/proc/%d/maps", pid);
-  if ((fh = fopen(filename, "r")) == NULL) {
-    DEBUG("ps_count_maps: Failed to open file `%s'", filename);
+  if ((fh = ps_fopenat(pid, "maps")) == NULL) {
+    DEBUG("ps_count_maps: Failed to open file `/proc/%li/maps'", pid);
     return -1;
   }
 
@@ -1228,16 +1447,13 @@ static int ps_count_maps(pid_t pid) {
   return count;
 } /* int ps_count_maps (...) */
 
-static int ps_count_fd(int pid) {
-  char dirname[64];
+static int ps_count_fd(long pid) {
   DIR *dh;
   struct dirent *ent;
   int count = 0;
 
-  snprintf(dirname, sizeof(dirname), "/proc/%i/fd", pid);
-
-  if ((dh = opendir(dirname)) == NULL) {
-    DEBUG("Failed to open directory `%s'", dirname);
+  if ((dh = ps_opendirat(pid, "fd")) == NULL) {
+    DEBUG("Failed to open directory `/proc/%li/fd'", pid);
     return -1;
   }
   while ((ent = readdir(dh)) != NULL) {
@@ -1333,7 +1549,10 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
 
 #if HAVE_LIBTASKSTATS
   if (ps->report_delay && !entry->has_delay) {
-    if (ps_delay(entry) == 0) {
+    pthread_mutex_lock(&ps_taskstats_lock);
+    int status = ps_delay(entry);
+    pthread_mutex_unlock(&ps_taskstats_lock);
+    if (status == 0) {
       entry->has_delay = true;
     }
   }
@@ -1342,7 +1561,6 @@ static void ps_fill_details(const procstat_t *ps, process_entry_t *entry) {
 
 /* ps_read_process reads process counters on Linux. */
 static int ps_read_process(long pid, process_entry_t *ps, char *state) {
-  char filename[64];
   char buffer[1024];
 
   char *fields[64];
@@ -1363,9 +1581,7 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
 
   ssize_t status;
 
-  snprintf(filename, sizeof(filename), "/proc/%li/stat", pid);
-
-  status = read_text_file_contents(filename, buffer, sizeof(buffer));
+  status = ps_read_file(pid, "stat", buffer, sizeof(buffer));
   if (status <= 0)
     return -1;
   buffer_len = (size_t)status;
@@ -1405,8 +1621,8 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
   fields_len = strsplit(buffer_ptr, fields, STATIC_ARRAY_SIZE(fields));
   if (fields_len < 22) {
     DEBUG("processes plugin: ps_read_process (pid = %li):"
-          " `%s' has only %i fields..",
-          pid, filename, fields_len);
+          " `/proc/%li/stat' has only %i fields..",
+          pid, pid, fields_len);
     return -1;
   }
 
@@ -1478,21 +1694,20 @@ static int ps_read_process(long pid, process_entry_t *ps, char *state) {
   return 0;
 } /* int ps_read_process (...) */
 
-static int procs_running(const char *buffer) {
-  char id[] = "procs_running "; /* white space terminated */
+static int procs_count(const char *buffer, const char *id) {
   char *running;
   char *endptr = NULL;
   long result = 0L;
 
   /* the data contains :
-   * the literal string 'procs_running',
+   * the literal string 'id', e.g. 'procs_running',
    * a whitespace
-   * the number of running processes.
+   * the number of processes.
    * The parser does include the white-space character.
    */
   running = strstr(buffer, id);
   if (!running) {
-    WARNING("'procs_running ' not found in /proc/stat");
+    WARNING("'%s' not found in /proc/stat", id);
     return -1;
   }
   running += strlen(id);
@@ -1509,7 +1724,6 @@ static char *ps_get_cmdline(long pid, char *name, char *buf, size_t buf_len) {
   char *buf_ptr;
   size_t len;
 
-  char file[PATH_MAX];
   int fd;
 
   size_t n;
@@ -1517,15 +1731,14 @@ static char *ps_get_cmdline(long pid, char *name, char *buf, size_t buf_len) {
   if ((pid < 1) || (NULL == buf) || (buf_len < 2))
     return NULL;
 
-  snprintf(file, sizeof(file), "/proc/%li/cmdline", pid);
-
   errno = 0;
-  fd = open(file, O_RDONLY);
+  fd = ps_openat(pid, "cmdline", O_RDONLY);
   if (fd < 0) {
     /* ENOENT means the process exited while we were handling it.
      * Don't complain about this, it only fills the logs. */
     if (errno != ENOENT)
-      WARNING("processes plugin: Failed to open `%s': %s.", file, STRERRNO);
+      WARNING("processes plugin: Failed to open `/proc/%li/cmdline': %s.",
+              pid, STRERRNO);
     return NULL;
   }
 
@@ -1544,8 +1757,8 @@ static char *ps_get_cmdline(long pid, char *name, char *buf, size_t buf_len) {
       if ((EAGAIN == errno) || (EINTR == errno))
         continue;
 
-      WARNING("processes plugin: Failed to read from `%s': %s.", file,
-              STRERRNO);
+      WARNING("processes plugin: Failed to read from `/proc/%li/cmdline': %s.",
+              pid, STRERRNO);
       close(fd);
       return NULL;
     }
@@ -1595,6 +1808,960 @@ static char *ps_get_cmdline(long pid, char *name, char *buf, size_t buf_len) {
   return buf;
 } /* char *ps_get_cmdline (...) */
 
+static void ps_pid_free(ps_pid_t *p) {
+  if (p == NULL)
+    return;
+
+  sfree(p->groups);
+  sfree(p->instances);
+  sfree(p->entry);
+  sfree(p);
+} /* void ps_pid_free */
+
+static size_t ps_pid_hash(const ps_part_t *part, long pid) {
+  /* all PIDs of a partition are congruent modulo ps_parts_num */
+  return ((size_t)pid / ps_parts_num) & (part->buckets_num - 1);
+} /* size_t ps_pid_hash */
+
+static int ps_pid_grow(ps_part_t *part) {
+  size_t buckets_num = (part->buckets_num == 0) ? 256 : 2 * part->buckets_num;
+  ps_pid_t **buckets = calloc(buckets_num, sizeof(*buckets));
+  if (buckets == NULL)
+    return ENOMEM;
+
+  ps_pid_t **old = part->buckets;
+  size_t old_num = part->buckets_num;
+  part->buckets = buckets;
+  part->buckets_num = buckets_num;
+
+  for (size_t i = 0; i < old_num; i++) {
+    while (old[i] != NULL) {
+      ps_pid_t *p = old[i];
+      old[i] = p->next;
+
+      size_t h = ps_pid_hash(part, p->pid);
+      p->next = buckets[h];
+      buckets[h] = p;
+    }
+  }
+  sfree(old);
+
+  return 0;
+} /* int ps_pid_grow */
+
+/* Matches the process against all configured processes and remembers the
+ * result in 'p'. */
+static int ps_pid_classify(ps_pid_t *p, const process_entry_t *pse,
+                           char *cmdline, size_t cmdline_size) {
+  p->starttime = pse->starttime;
+  sstrncpy(p->name, pse->name, sizeof(p->name));
+  p->stale = false;
+  p->groups_num = 0;
+
+  char *cmd = ps_get_cmdline(p->pid, (char *)pse->name, cmdline, cmdline_size);
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+    if (ps_list_match(pse->name, cmd, ps) == 0)
+      continue;
+
+    procstat_t **groups =
+        realloc(p->groups, (p->groups_num + 1) * sizeof(*p->groups));
+    if (groups == NULL)
+      return ENOMEM;
+    p->groups = groups;
+
+    procstat_entry_t **instances =
+        realloc(p->instances, (p->groups_num + 1) * sizeof(*p->instances));
+    if (instances == NULL)
+      return ENOMEM;
+    p->instances = instances;
+
+    p->groups[p->groups_num] = ps;
+    p->instances[p->groups_num] = NULL;
+    p->groups_num++;
+  }
+
+  if ((p->groups_num > 0) && (p->entry == NULL)) {
+    p->entry = calloc(1, sizeof(*p->entry));
+    if (p->entry == NULL)
+      return ENOMEM;
+  }
+
+  return 0;
+} /* int ps_pid_classify */
+
+static ps_pid_t *ps_pid_lookup(const ps_part_t *part, long pid) {
+  if (part->buckets_num == 0)
+    return NULL;
+
+  for (ps_pid_t *p = part->buckets[ps_pid_hash(part, pid)]; p != NULL;
+       p = p->next)
+    if (p->pid == pid)
+      return p;
+
+  return NULL;
+} /* ps_pid_t *ps_pid_lookup */
+
+/* Returns the cache entry of the process read into 'pse', classifying the
+ * process if the PID is new or has changed since the last read. */
+static ps_pid_t *ps_pid_get(ps_part_t *part, const process_entry_t *pse,
+                            char *cmdline, size_t cmdline_size) {
+  long pid = (long)pse->id;
+  ps_pid_t *p = ps_pid_lookup(part, pid);
+
+  if (p != NULL) {
+    if (!p->stale && (p->starttime == pse->starttime) &&
+        (strncmp(p->name, pse->name, sizeof(p->name) - 1) == 0))
+      return p;
+  } else {
+    if ((part->entries_num >= part->buckets_num) && (ps_pid_grow(part) != 0))
+      return NULL;
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+      return NULL;
+    p->pid = pid;
+
+    size_t h = ps_pid_hash(part, pid);
+    p->next = part->buckets[h];
+    part->buckets[h] = p;
+    part->entries_num++;
+  }
+
+  /* on failure, the entry expires at the end of this round */
+  if (ps_pid_classify(p, pse, cmdline, cmdline_size) != 0)
+    return NULL;
+
+  return p;
+} /* ps_pid_t *ps_pid_get */
+
+/* Removes the cache entries of PIDs which have not been read in this round.
+ * Their procstat_entry_t instances are removed by the next ps_list_reset(). */
+static void ps_pid_expire(ps_part_t *part) {
+  for (size_t i = 0; i < part->buckets_num; i++) {
+    ps_pid_t **pp = part->buckets + i;
+    while (*pp != NULL) {
+      ps_pid_t *p = *pp;
+      if (p->round == ps_round) {
+        pp = &p->next;
+        continue;
+      }
+
+      *pp = p->next;
+      ps_pid_free(p);
+      part->entries_num--;
+    }
+  }
+} /* void ps_pid_expire */
+
+/* Drops the cached instances of all PIDs. Used when a read fails after
+ * ps_list_reset(): nothing is accounted in that round, so the next reset
+ * frees every instance. The instances are looked up again when the PIDs are
+ * read next. */
+static void ps_pid_forget_instances(void) {
+  for (size_t i = 0; i < ps_parts_num; i++) {
+    ps_part_t *part = ps_parts + i;
+    for (size_t j = 0; j < part->buckets_num; j++)
+      for (ps_pid_t *p = part->buckets[j]; p != NULL; p = p->next)
+        for (size_t k = 0; k < p->groups_num; k++)
+          p->instances[k] = NULL;
+  }
+} /* void ps_pid_forget_instances */
+
+static int ps_part_add_matched(ps_part_t *part, ps_pid_t *p) {
+  if (part->matched_num >= part->matched_size) {
+    size_t size = (part->matched_size == 0) ? 64 : 2 * part->matched_size;
+    ps_pid_t **matched = realloc(part->matched, size * sizeof(*matched));
+    if (matched == NULL)
+      return ENOMEM;
+    part->matched = matched;
+    part->matched_size = size;
+  }
+
+  part->matched[part->matched_num] = p;
+  part->matched_num++;
+  return 0;
+} /* int ps_part_add_matched */
+
+/* Reads all processes of partition 'idx'. Only the cache of this partition is
+ * modified; accounting to the configured processes happens in ps_read(). */
+static void ps_read_part(size_t idx,
+                         __attribute__((unused)) void *user_data) {
+  ps_part_t *part = ps_parts + idx;
+  char cmdline[CMDLINE_BUFFER_SIZE];
+
+  part->matched_num = 0;
+  part->sleeping = part->zombies = part->stopped = 0;
+  part->paging = part->blocked = 0;
+
+  for (size_t i = 0; i < ps_pids_num; i++) {
+    long pid = ps_pids[i];
+    if ((size_t)pid % ps_parts_num != idx)
+      continue;
+
+    process_entry_t pse = {.id = (unsigned long)pid};
+    char state;
+
+    int status = ps_read_process(pid, &pse, &state);
+    if (status != 0) {
+      DEBUG("ps_read_process failed: %i", status);
+      continue;
+    }
+
+    switch (state) {
+    case 'S':
+      part->sleeping++;
+      break;
+    case 'D':
+      part->blocked++;
+      break;
+    case 'Z':
+      part->zombies++;
+      break;
+    case 'T':
+      part->stopped++;
+      break;
+    case 'W':
+      part->paging++;
+      break;
+    }
+
+    ps_pid_t *p = ps_pid_get(part, &pse, cmdline, sizeof(cmdline));
+    if (p == NULL)
+      continue;
+
+    if (p->groups_num > 0) {
+      /* Entries which are not accounted in this round must expire, because
+       * ps_list_reset() frees their instances. */
+      if (ps_part_add_matched(part, p) != 0)
+        continue;
+
+      *p->entry = pse;
+      for (size_t j = 0; j < p->groups_num; j++)
+        ps_fill_details(p->groups[j], p->entry);
+    }
+
+    p->round = ps_round;
+  }
+
+  ps_pid_expire(part);
+} /* void ps_read_part */
+
+static int ps_open_proc(void) {
+  if (ps_proc_dir != NULL)
+    return 0;
+
+  if ((ps_proc_dir = opendir("/proc")) == NULL) {
+    ERROR("Cannot open `/proc': %s", STRERRNO);
+    return -1;
+  }
+  ps_proc_fd = dirfd(ps_proc_dir);
+  return 0;
+} /* int ps_open_proc */
+
+/* Lists the PIDs in /proc into ps_pids. */
+static int ps_read_pids(void) {
+  struct dirent *ent;
+
+  if (ps_open_proc() != 0)
+    return -1;
+  rewinddir(ps_proc_dir);
+
+  ps_pids_num = 0;
+  while ((ent = readdir(ps_proc_dir)) != NULL) {
+    long pid;
+
+    if (!isdigit(ent->d_name[0]))
+      continue;
+
+    if ((pid = atol(ent->d_name)) < 1)
+      continue;
+
+    if (ps_pids_num >= ps_pids_size) {
+      size_t size = (ps_pids_size == 0) ? 1024 : 2 * ps_pids_size;
+      long *pids = realloc(ps_pids, size * sizeof(*pids));
+      if (pids == NULL) {
+        ERROR("processes plugin: realloc failed.");
+        return ENOMEM;
+      }
+      ps_pids = pids;
+      ps_pids_size = size;
+    }
+
+    ps_pids[ps_pids_num] = pid;
+    ps_pids_num++;
+  }
+
+  return 0;
+} /* int ps_read_pids */
+
+static int ps_init_threads(void) {
+  ps_pool = worker_pool_create(ps_threads_num, ps_read_part, NULL,
+                               "processes read");
+  if (ps_pool == NULL) {
+    ERROR("processes plugin: Creating the worker pool failed.");
+    return ENOMEM;
+  }
+
+  ps_parts_num = worker_pool_size(ps_pool);
+  ps_parts = calloc(ps_parts_num, sizeof(*ps_parts));
+  if (ps_parts == NULL) {
+    ERROR("processes plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  return 0;
+} /* int ps_init_threads */
+
+#if HAVE_LIBTASKSTATS
+static int ps_compare_pid(const void *a, const void *b) {
+  long pa = *(const long *)a;
+  long pb = *(const long *)b;
+  return (pa > pb) - (pa < pb);
+} /* int ps_compare_pid */
+
+static int ps_compare_event(const void *a, const void *b) {
+  const ps_event_t *ea = a;
+  const ps_event_t *eb = b;
+
+  if (ea->pid != eb->pid)
+    return (ea->pid > eb->pid) ? 1 : -1;
+  return (ea->seq > eb->seq) - (ea->seq < eb->seq);
+} /* int ps_compare_event */
+
+/* kernels which don't report the thread group report the leader only */
+#define PS_EXIT_TGID(ex) ((long)(((ex)->tgid != 0) ? (ex)->tgid : (ex)->pid))
+
+static int ps_compare_exit(const void *a, const void *b) {
+  long ta = PS_EXIT_TGID((const ts_exit_t *)a);
+  long tb = PS_EXIT_TGID((const ts_exit_t *)b);
+  return (ta > tb) - (ta < tb);
+} /* int ps_compare_exit */
+
+static void ps_events_add(long pid, bool exec) {
+  char buffer[CMDLINE_BUFFER_SIZE];
+  char *cmdline = ps_get_cmdline(pid, NULL, buffer, sizeof(buffer));
+  if (cmdline != NULL)
+    cmdline = strdup(cmdline);
+
+  pthread_mutex_lock(&ps_events_lock);
+  if ((ps_events_num >= ps_events_size) && (ps_events_size < PS_EVENTS_MAX)) {
+    size_t size = (ps_events_size == 0) ? 1024 : 2 * ps_events_size;
+    ps_event_t *events = realloc(ps_events, size * sizeof(*events));
+    if (events != NULL) {
+      ps_events = events;
+      ps_events_size = size;
+    }
+  }
+  if (ps_events_num >= ps_events_size) {
+    ps_events_lost = true;
+    pthread_mutex_unlock(&ps_events_lock);
+    sfree(cmdline);
+    return;
+  }
+
+  ps_events[ps_events_num] = (ps_event_t){
+      .pid = pid,
+      .seq = ps_events_seq++,
+      .exec = exec,
+      .cmdline = cmdline,
+  };
+  ps_events_num++;
+  pthread_mutex_unlock(&ps_events_lock);
+} /* void ps_events_add */
+
+static void ps_events_exit(const ts_exit_t *ex,
+                           __attribute__((unused)) void *user_data) {
+  pthread_mutex_lock(&ps_events_lock);
+  if ((ps_exits_num >= ps_exits_size) && (ps_exits_size < PS_EVENTS_MAX)) {
+    size_t size = (ps_exits_size == 0) ? 1024 : 2 * ps_exits_size;
+    ts_exit_t *exits = realloc(ps_exits, size * sizeof(*exits));
+    if (exits != NULL) {
+      ps_exits = exits;
+      ps_exits_size = size;
+    }
+  }
+  if (ps_exits_num >= ps_exits_size) {
+    ps_events_lost = true;
+  } else {
+    ps_exits[ps_exits_num] = *ex;
+    ps_exits_num++;
+  }
+  pthread_mutex_unlock(&ps_events_lock);
+} /* void ps_events_exit */
+
+/* Subscribes to (or unsubscribes from) the proc connector's events. */
+static int ps_cn_listen(bool enable) {
+  uint8_t msg[sizeof(struct nlmsghdr) + sizeof(struct cn_msg) +
+              sizeof(enum proc_cn_mcast_op)] = {0};
+
+  memcpy(msg,
+         &(struct nlmsghdr){
+             .nlmsg_len = sizeof(msg),
+             .nlmsg_type = NLMSG_DONE,
+         },
+         sizeof(struct nlmsghdr));
+  memcpy(msg + sizeof(struct nlmsghdr),
+         &(struct cn_msg){
+             .id.idx = CN_IDX_PROC,
+             .id.val = CN_VAL_PROC,
+             .len = sizeof(enum proc_cn_mcast_op),
+         },
+         sizeof(struct cn_msg));
+  memcpy(msg + sizeof(struct nlmsghdr) + sizeof(struct cn_msg),
+         &(enum proc_cn_mcast_op){enable ? PROC_CN_MCAST_LISTEN
+                                         : PROC_CN_MCAST_IGNORE},
+         sizeof(enum proc_cn_mcast_op));
+
+  if (send(ps_cn_fd, msg, sizeof(msg), 0) < 0) {
+    ERROR("processes plugin: Subscribing to process events failed: %s",
+          STRERRNO);
+    return -1;
+  }
+
+  return 0;
+} /* int ps_cn_listen */
+
+static int ps_cn_open(void) {
+  struct sockaddr_nl sa = {
+      .nl_family = AF_NETLINK,
+      .nl_groups = CN_IDX_PROC,
+  };
+
+  ps_cn_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (ps_cn_fd < 0) {
+    ERROR("processes plugin: Opening the proc connector failed: %s",
+          STRERRNO);
+    return -1;
+  }
+
+  if (bind(ps_cn_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    ERROR("processes plugin: Binding to the proc connector failed: %s",
+          STRERRNO);
+    close(ps_cn_fd);
+    ps_cn_fd = -1;
+    return -1;
+  }
+
+  /* fork storms easily overflow the default socket buffer */
+  int rcvbuf = 4 * 1024 * 1024;
+  if (setsockopt(ps_cn_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) !=
+      0)
+    WARNING("processes plugin: setsockopt(SO_RCVBUF) failed: %s", STRERRNO);
+
+  if (ps_cn_listen(true) != 0) {
+    close(ps_cn_fd);
+    ps_cn_fd = -1;
+    return -1;
+  }
+
+  return 0;
+} /* int ps_cn_open */
+
+static void ps_cn_read(void) {
+  char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+  while (42) {
+    ssize_t status = recv(ps_cn_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return;
+      if (errno == ENOBUFS) {
+        pthread_mutex_lock(&ps_events_lock);
+        ps_events_lost = true;
+        pthread_mutex_unlock(&ps_events_lock);
+        continue;
+      }
+      ERROR("processes plugin: Receiving process events failed: %s",
+            STRERRNO);
+      return;
+    } else if (status == 0) {
+      return;
+    }
+
+    int len = (int)status;
+    for (struct nlmsghdr *nlh = (void *)buffer; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      struct cn_msg *cn = NLMSG_DATA(nlh);
+      if ((nlh->nlmsg_type != NLMSG_DONE) ||
+          (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*cn) +
+                                         sizeof(struct proc_event))) ||
+          (cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+        continue;
+
+      struct proc_event *ev = (void *)cn->data;
+      switch (ev->what) {
+      case PROC_EVENT_FORK:
+        /* new threads are accounted to their process */
+        if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+          ps_events_add(ev->event_data.fork.child_tgid, /* exec = */ false);
+        break;
+      case PROC_EVENT_EXEC:
+        ps_events_add(ev->event_data.exec.process_tgid, /* exec = */ true);
+        break;
+      case PROC_EVENT_COMM:
+        if (ev->event_data.comm.process_pid ==
+            ev->event_data.comm.process_tgid)
+          ps_events_add(ev->event_data.comm.process_tgid, /* exec = */ true);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+} /* void ps_cn_read */
+
+static void *ps_events_loop(__attribute__((unused)) void *arg) {
+  struct pollfd fds[] = {
+      {.fd = ps_cn_fd, .events = POLLIN},
+      {.fd = ts_fd(ps_exit_handle), .events = POLLIN},
+  };
+
+  while (42) {
+    pthread_mutex_lock(&ps_events_lock);
+    bool shutdown = ps_events_shutdown;
+    pthread_mutex_unlock(&ps_events_lock);
+    if (shutdown)
+      break;
+
+    int status = poll(fds, STATIC_ARRAY_SIZE(fds), /* timeout = */ 1000);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("processes plugin: poll failed: %s", STRERRNO);
+      break;
+    }
+
+    if (fds[0].revents != 0)
+      ps_cn_read();
+
+    if (fds[1].revents != 0) {
+      status = ts_read_exits(ps_exit_handle, ps_events_exit, NULL);
+      if (status == ENOBUFS) {
+        pthread_mutex_lock(&ps_events_lock);
+        ps_events_lost = true;
+        pthread_mutex_unlock(&ps_events_lock);
+      }
+    }
+  }
+
+  /* reads fall back to scanning /proc */
+  pthread_mutex_lock(&ps_events_lock);
+  ps_events_running = false;
+  pthread_mutex_unlock(&ps_events_lock);
+  return NULL;
+} /* void *ps_events_loop */
+
+static int ps_init_events(void) {
+  if (ps_open_proc() != 0)
+    return -1;
+
+  ps_exit_handle = ts_create_exit_listener();
+  if (ps_exit_handle == NULL) {
+    ERROR("processes plugin: Registering for taskstats exit notifications "
+          "failed.");
+    return -1;
+  }
+
+  if (ps_cn_open() != 0) {
+    ts_destroy(ps_exit_handle);
+    ps_exit_handle = NULL;
+    return -1;
+  }
+
+  ps_events_running = true;
+  int status = plugin_thread_create(&ps_events_thread, ps_events_loop, NULL,
+                                    "processes events");
+  if (status != 0) {
+    ERROR("processes plugin: Starting the events thread failed: %s",
+          STRERROR(status));
+    ps_events_running = false;
+    return -1;
+  }
+  ps_events_started = true;
+
+  return 0;
+} /* int ps_init_events */
+
+static void ps_events_free(ps_event_t *events, size_t events_num) {
+  for (size_t i = 0; i < events_num; i++)
+    sfree(events[i].cmdline);
+  sfree(events);
+} /* void ps_events_free */
+
+static void ps_shutdown_events(void) {
+  pthread_mutex_lock(&ps_events_lock);
+  ps_events_shutdown = true;
+  pthread_mutex_unlock(&ps_events_lock);
+
+  if (ps_events_started) {
+    pthread_join(ps_events_thread, NULL);
+    ps_events_started = false;
+  }
+
+  if (ps_cn_fd >= 0) {
+    ps_cn_listen(false);
+    close(ps_cn_fd);
+    ps_cn_fd = -1;
+  }
+
+  ts_destroy(ps_exit_handle);
+  ps_exit_handle = NULL;
+
+  ps_events_free(ps_events, ps_events_num);
+  ps_events = NULL;
+  ps_events_num = ps_events_size = 0;
+  ps_events_free(ps_events_pending, ps_events_pending_num);
+  ps_events_pending = NULL;
+  ps_events_pending_num = 0;
+  sfree(ps_exits);
+  ps_exits_num = ps_exits_size = 0;
+} /* void ps_shutdown_events */
+
+/* Builds the process entry of an exited process from the sum of its tasks'
+ * accounting information. 'last' is the entry of the last read, if any; the
+ * counters never go backwards from it. */
+static void ps_exit_entry(process_entry_t *entry, const ts_exit_t *ex,
+                          const process_entry_t *last) {
+  *entry = (process_entry_t){
+      .id = (unsigned long)ex->pid,
+      .cpu_user_counter = (derive_t)ex->utime_us,
+      .cpu_system_counter = (derive_t)ex->stime_us,
+      .vmem_minflt_counter = (derive_t)ex->minflt,
+      .vmem_majflt_counter = (derive_t)ex->majflt,
+      .io_rchar = (derive_t)ex->read_char,
+      .io_wchar = (derive_t)ex->write_char,
+      .io_syscr = (derive_t)ex->read_syscalls,
+      .io_syscw = (derive_t)ex->write_syscalls,
+      .io_diskr = (derive_t)ex->read_bytes,
+      .io_diskw = (derive_t)ex->write_bytes,
+      .cswitch_vol = (derive_t)ex->nvcsw,
+      .cswitch_invol = (derive_t)ex->nivcsw,
+  };
+  sstrncpy(entry->name, ex->comm, sizeof(entry->name));
+
+  if (last == NULL)
+    return;
+
+  entry->starttime = last->starttime;
+
+  derive_t *counters[] = {
+      &entry->cpu_user_counter,    &entry->cpu_system_counter,
+      &entry->vmem_minflt_counter, &entry->vmem_majflt_counter,
+      &entry->io_rchar,            &entry->io_wchar,
+      &entry->io_syscr,            &entry->io_syscw,
+      &entry->io_diskr,            &entry->io_diskw,
+      &entry->cswitch_vol,         &entry->cswitch_invol,
+  };
+  const derive_t *last_counters[] = {
+      &last->cpu_user_counter,    &last->cpu_system_counter,
+      &last->vmem_minflt_counter, &last->vmem_majflt_counter,
+      &last->io_rchar,            &last->io_wchar,
+      &last->io_syscr,            &last->io_syscw,
+      &last->io_diskr,            &last->io_diskw,
+      &last->cswitch_vol,         &last->cswitch_invol,
+  };
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(counters); i++) {
+    /* -1 means not read: keep it that way, so the counter is skipped */
+    if ((*last_counters[i] == -1) || (*counters[i] < *last_counters[i]))
+      *counters[i] = *last_counters[i];
+  }
+} /* void ps_exit_entry */
+
+/* Accounts the final usage of the thread group 'tgid', the sum of its tasks'
+ * accounting information being in 'sum'. */
+static void ps_account_exit(long tgid, const ts_exit_t *sum, size_t tasks,
+                            ps_event_t *events, size_t events_num) {
+  process_entry_t entry;
+
+  /* The events of the process are done with, whichever way it is accounted.
+   */
+  const char *cmdline = NULL;
+  bool forked = false;
+  size_t lo = 0;
+  size_t hi = events_num;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (events[mid].pid < tgid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (size_t i = lo; (i < events_num) && (events[i].pid == tgid); i++) {
+    if (!events[i].exec)
+      forked = true;
+    if (events[i].cmdline != NULL)
+      cmdline = events[i].cmdline;
+    events[i].done = true;
+  }
+
+  ps_pid_t *p = ps_pid_lookup(ps_parts + (size_t)tgid % ps_parts_num, tgid);
+  if (p != NULL) {
+    /* The process has been read before and its remaining usage is the
+     * difference to the last read. This is only known for processes with a
+     * single task, because the counters of a task don't include the tasks
+     * which exited before. */
+    if ((p->groups_num == 0) || (p->entry == NULL) || (tasks != 1) ||
+        (p->entry->num_lwp > 1))
+      return;
+
+    ps_exit_entry(&entry, sum, p->entry);
+    for (size_t i = 0; i < p->groups_num; i++)
+      if (p->instances[i] != NULL)
+        ps_list_account(p->groups[i], p->instances[i], &entry);
+    return;
+  }
+
+  /* Otherwise, account processes started since they were last read. */
+  if (!forked)
+    return;
+
+  ps_exit_entry(&entry, sum, NULL);
+  for (procstat_t *ps = list_head_g; ps != NULL; ps = ps->next) {
+    if (ps_list_match(entry.name, cmdline, ps) == 0)
+      continue;
+
+    /* the whole lifetime of the process is new */
+    procstat_entry_t pse = {0};
+    ps_list_account(ps, &pse, &entry);
+  }
+} /* void ps_account_exit */
+
+static void ps_account_exits(ts_exit_t *exits, size_t exits_num,
+                             ps_event_t *events, size_t events_num) {
+  if (exits_num == 0)
+    return;
+
+  qsort(exits, exits_num, sizeof(*exits), ps_compare_exit);
+
+  size_t i = 0;
+  while (i < exits_num) {
+    long tgid = PS_EXIT_TGID(exits + i);
+    ts_exit_t sum = {.pid = (uint32_t)tgid};
+    size_t tasks = 0;
+
+    sstrncpy(sum.comm, exits[i].comm, sizeof(sum.comm));
+    for (; (i < exits_num) && (PS_EXIT_TGID(exits + i) == tgid); i++) {
+      const ts_exit_t *ex = exits + i;
+
+      if ((long)ex->pid == tgid)
+        sstrncpy(sum.comm, ex->comm, sizeof(sum.comm));
+      sum.group_dead |= ex->group_dead;
+      sum.utime_us += ex->utime_us;
+      sum.stime_us += ex->stime_us;
+      sum.minflt += ex->minflt;
+      sum.majflt += ex->majflt;
+      sum.read_char += ex->read_char;
+      sum.write_char += ex->write_char;
+      sum.read_syscalls += ex->read_syscalls;
+      sum.write_syscalls += ex->write_syscalls;
+      sum.read_bytes += ex->read_bytes;
+      sum.write_bytes += ex->write_bytes;
+      sum.nvcsw += ex->nvcsw;
+      sum.nivcsw += ex->nivcsw;
+      tasks++;
+    }
+
+    /* Tasks of running processes are part of the process' counters. */
+    if (sum.group_dead)
+      ps_account_exit(tgid, &sum, tasks, events, events_num);
+  }
+} /* void ps_account_exits */
+
+/* Lists the PIDs which need to be read in event driven mode into ps_pids:
+ * the processes matched in the last read and the processes which have been
+ * started or changed since. */
+static int ps_read_pids_changed(const ps_event_t *events, size_t events_num) {
+  size_t num = events_num;
+  for (size_t i = 0; i < ps_parts_num; i++)
+    num += ps_parts[i].matched_num;
+
+  if (num > ps_pids_size) {
+    long *pids = realloc(ps_pids, num * sizeof(*pids));
+    if (pids == NULL) {
+      ERROR("processes plugin: realloc failed.");
+      return ENOMEM;
+    }
+    ps_pids = pids;
+    ps_pids_size = num;
+  }
+
+  ps_pids_num = 0;
+  for (size_t i = 0; i < ps_parts_num; i++)
+    for (size_t j = 0; j < ps_parts[i].matched_num; j++)
+      ps_pids[ps_pids_num++] = ps_parts[i].matched[j]->pid;
+  for (size_t i = 0; i < events_num; i++)
+    ps_pids[ps_pids_num++] = events[i].pid;
+
+  if (ps_pids_num > 0)
+    qsort(ps_pids, ps_pids_num, sizeof(*ps_pids), ps_compare_pid);
+
+  size_t unique = 0;
+  for (size_t i = 0; i < ps_pids_num; i++)
+    if ((unique == 0) || (ps_pids[unique - 1] != ps_pids[i]))
+      ps_pids[unique++] = ps_pids[i];
+  ps_pids_num = unique;
+
+  return 0;
+} /* int ps_read_pids_changed */
+
+/* Appends the events kept from earlier reads to 'events'. Events of processes
+ * which have been read since are dropped: their exit is accounted from the
+ * PID cache. */
+static ps_event_t *ps_events_merge(ps_event_t *events, size_t *events_num) {
+  if (ps_events_pending_num == 0)
+    return events;
+
+  ps_event_t *merged = realloc(
+      events, (*events_num + ps_events_pending_num) * sizeof(*merged));
+  if (merged == NULL) {
+    ERROR("processes plugin: realloc failed.");
+    ps_events_free(ps_events_pending, ps_events_pending_num);
+    ps_events_pending = NULL;
+    ps_events_pending_num = 0;
+    return events;
+  }
+
+  for (size_t i = 0; i < ps_events_pending_num; i++) {
+    ps_event_t *e = ps_events_pending + i;
+    if (ps_pid_lookup(ps_parts + (size_t)e->pid % ps_parts_num, e->pid) !=
+        NULL) {
+      sfree(e->cmdline);
+      continue;
+    }
+    merged[*events_num] = *e;
+    (*events_num)++;
+  }
+
+  sfree(ps_events_pending);
+  ps_events_pending_num = 0;
+  return merged;
+} /* ps_event_t *ps_events_merge */
+
+/* Keeps the events of forked processes whose exit has not been accounted for
+ * up to PS_EVENTS_KEEP reads and frees the others. 'events' is sorted by PID.
+ */
+static void ps_events_keep(ps_event_t *events, size_t events_num) {
+  size_t num = 0;
+
+  size_t i = 0;
+  while (i < events_num) {
+    size_t end = i;
+    bool forked = false;
+    bool drop = false;
+    for (; (end < events_num) && (events[end].pid == events[i].pid); end++) {
+      if (!events[end].exec)
+        forked = true;
+      if (events[end].done || (events[end].age >= PS_EVENTS_KEEP))
+        drop = true;
+    }
+
+    if (forked && !drop) {
+      for (; i < end; i++) {
+        events[i].age++;
+        events[num++] = events[i];
+      }
+    } else {
+      for (; i < end; i++)
+        sfree(events[i].cmdline);
+    }
+  }
+
+  if (num == 0) {
+    sfree(events);
+    return;
+  }
+
+  ps_events_pending = events;
+  ps_events_pending_num = num;
+} /* void ps_events_keep */
+
+/* Takes the events received since the last read, accounts exited processes
+ * and lists the PIDs to read. */
+static int ps_read_events(void) {
+  static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+
+  pthread_mutex_lock(&ps_events_lock);
+  ps_event_t *events = ps_events;
+  size_t events_num = ps_events_num;
+  ts_exit_t *exits = ps_exits;
+  size_t exits_num = ps_exits_num;
+  bool lost = ps_events_lost || !ps_events_running;
+  ps_events = NULL;
+  ps_events_num = ps_events_size = 0;
+  ps_exits = NULL;
+  ps_exits_num = ps_exits_size = 0;
+  ps_events_lost = false;
+  pthread_mutex_unlock(&ps_events_lock);
+
+  if (lost && (ps_round > 0))
+    c_complain(LOG_WARNING, &complaint,
+               "processes plugin: Process events have been lost. Reading all "
+               "processes; the usage of exited processes may be incomplete.");
+  else if (!lost)
+    c_release(LOG_INFO, &complaint,
+              "processes plugin: Receiving process events again.");
+
+  events = ps_events_merge(events, &events_num);
+  if (events_num > 0)
+    qsort(events, events_num, sizeof(*events), ps_compare_event);
+
+  ps_account_exits(exits, exits_num, events, events_num);
+  sfree(exits);
+
+  /* reclassify processes which called exec() or changed their name */
+  for (size_t i = 0; i < events_num; i++) {
+    if (!events[i].exec)
+      continue;
+
+    ps_pid_t *p = ps_pid_lookup(
+        ps_parts + (size_t)events[i].pid % ps_parts_num, events[i].pid);
+    if (p != NULL)
+      p->stale = true;
+  }
+
+  int status = lost ? ps_read_pids() : ps_read_pids_changed(events, events_num);
+  ps_events_keep(events, events_num);
+  return status;
+} /* int ps_read_events */
+#endif /* HAVE_LIBTASKSTATS */
+
+static int ps_shutdown_threads(void) {
+#if HAVE_LIBTASKSTATS
+  ps_shutdown_events();
+#endif
+
+  worker_pool_destroy(ps_pool);
+  ps_pool = NULL;
+
+  for (size_t i = 0; i < ps_parts_num; i++) {
+    ps_part_t *part = ps_parts + i;
+    for (size_t j = 0; j < part->buckets_num; j++) {
+      while (part->buckets[j] != NULL) {
+        ps_pid_t *p = part->buckets[j];
+        part->buckets[j] = p->next;
+        ps_pid_free(p);
+      }
+    }
+    sfree(part->buckets);
+    sfree(part->matched);
+  }
+  sfree(ps_parts);
+  ps_parts_num = 0;
+
+  sfree(ps_pids);
+  ps_pids_num = ps_pids_size = 0;
+
+  if (ps_proc_dir != NULL) {
+    closedir(ps_proc_dir);
+    ps_proc_dir = NULL;
+    ps_proc_fd = -1;
+  }
+
+  return 0;
+} /* int ps_shutdown_threads */
+
 static int read_fork_rate(const char *buffer) {
   value_t value;
   char id[] = "processes ";
@@ -2115,66 +3282,51 @@ static int ps_read(void) {
   int stopped = 0;
   int paging = 0;
   int blocked = 0;
-
-  struct dirent *ent;
-  DIR *proc;
-  long pid;
+  int status;
 
   char buffer[65536] = {};
-  char cmdline[CMDLINE_BUFFER_SIZE];
-
-  int status;
-  process_entry_t pse;
-  char state;
 
-  running = sleeping = zombies = stopped = paging = blocked = 0;
   ps_list_reset();
 
-  if ((proc = opendir("/proc")) == NULL) {
-    ERROR("Cannot open `/proc': %s", STRERRNO);
+#if HAVE_LIBTASKSTATS
+  if (ps_events_enabled)
+    status = ps_read_events();
+  else
+#endif
+    status = ps_read_pids();
+  if (status != 0) {
+    ps_pid_forget_instances();
     return -1;
   }
 
-  while ((ent = readdir(proc)) != NULL) {
-    if (!isdigit(ent->d_name[0]))
-      continue;
+  /* Published to the workers by worker_pool_run(). */
+  ps_round++;
+  worker_pool_run(ps_pool);
 
-    if ((pid = atol(ent->d_name)) < 1)
-      continue;
+  for (size_t i = 0; i < ps_parts_num; i++) {
+    ps_part_t *part = ps_parts + i;
 
-    memset(&pse, 0, sizeof(pse));
-    pse.id = pid;
+    sleeping += part->sleeping;
+    zombies += part->zombies;
+    stopped += part->stopped;
+    paging += part->paging;
+    blocked += part->blocked;
 
-    status = ps_read_process(pid, &pse, &state);
-    if (status != 0) {
-      DEBUG("ps_read_process failed: %i", status);
-      continue;
-    }
+    for (size_t j = 0; j < part->matched_num; j++) {
+      ps_pid_t *p = part->matched[j];
 
-    switch (state) {
-    case 'S':
-      sleeping++;
-      break;
-    case 'D':
-      blocked++;
-      break;
-    case 'Z':
-      zombies++;
-      break;
-    case 'T':
-      stopped++;
-      break;
-    case 'W':
-      paging++;
-      break;
-    }
+      for (size_t k = 0; k < p->groups_num; k++) {
+        if (p->instances[k] == NULL)
+          p->instances[k] =
+              ps_list_get_entry(p->groups[k], p->entry->name, p->entry);
+        if (p->instances[k] == NULL)
+          continue;
 
-    ps_list_add(pse.name,
-                ps_get_cmdline(pid, pse.name, cmdline, sizeof(cmdline)), &pse);
+        ps_list_account(p->groups[k], p->instances[k], p->entry);
+      }
+    }
   }
 
-  closedir(proc);
-
   if (read_file_contents("/proc/stat", buffer, sizeof(buffer) - 1) <= 0) {
     ERROR("Cannot read `/proc/stat`");
     return -1;
@@ -2187,14 +3339,24 @@ static int ps_read(void) {
    * stat(s).
    * The 'procs_running' number in /proc/stat on the other hand is more
    * accurate, and can be retrieved in a single 'read' call. */
-  running = procs_running(buffer);
+  running = procs_count(buffer, "procs_running ");
 
-  ps_submit_state("running", running);
-  ps_submit_state("sleeping", sleeping);
-  ps_submit_state("zombies", zombies);
-  ps_submit_state("stopped", stopped);
-  ps_submit_state("paging", paging);
-  ps_submit_state("blocked", blocked);
+#if HAVE_LIBTASKSTATS
+  /* Only the processes of interest have been read; the kernel counts the
+   * running and blocked ones, the other states are unknown. */
+  if (ps_events_enabled) {
+    ps_submit_state("running", running);
+    ps_submit_state("blocked", procs_count(buffer, "procs_blocked "));
+  } else
+#endif
+  {
+    ps_submit_state("running", running);
+    ps_submit_state("sleeping", sleeping);
+    ps_submit_state("zombies", zombies);
+    ps_submit_state("stopped", stopped);
+    ps_submit_state("paging", paging);
+    ps_submit_state("blocked", blocked);
+  }
 
   for (procstat_t *ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
     ps_submit_proc_list(ps_ptr);
@@ -2931,4 +4093,7 @@ void module_register(void) {
   plugin_register_complex_config("processes", ps_config);
   plugin_register_init("processes", ps_init);
   plugin_register_read("processes", ps_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown("processes", ps_shutdown_threads);
+#endif
 } /* void module_register */
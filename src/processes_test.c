@@ -0,0 +1,134 @@
+/**
+ * collectd - src/processes_test.c
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the license is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "processes.c" /* sic */
+#include "testing.h"
+
+/* PIDs above the default pid_max, so no process of the host is matched. */
+#define TEST_PID 4194400
+
+static procstat_t *test_ps;
+
+static void test_exit(long pid, uint64_t utime_us) {
+  ts_exit_t ex = {
+      .pid = (uint32_t)pid,
+      .tgid = (uint32_t)pid,
+      .group_dead = true,
+      .comm = "test",
+      .utime_us = utime_us,
+  };
+  ps_events_exit(&ex, NULL);
+}
+
+static derive_t test_cpu_user(void) {
+  return (test_ps->cpu_user_counter == -1) ? 0 : test_ps->cpu_user_counter;
+}
+
+static int test_setup(void) {
+  want_init = false;
+  ps_events_running = true;
+  ps_events_lost = false;
+
+  ps_parts_num = 1;
+  ps_parts = calloc(ps_parts_num, sizeof(*ps_parts));
+  test_ps = ps_list_register("test", NULL);
+  if ((ps_parts == NULL) || (test_ps == NULL))
+    return -1;
+  return 0;
+}
+
+DEF_TEST(account_exits) {
+  ps_event_t events[] = {
+      {.pid = TEST_PID, .seq = 0, .exec = false},
+      {.pid = TEST_PID, .seq = 1, .exec = true},
+  };
+  ts_exit_t exits[] = {
+      {.pid = TEST_PID + 1, .tgid = TEST_PID, .comm = "test", .utime_us = 10},
+      {.pid = TEST_PID,
+       .tgid = TEST_PID,
+       .group_dead = true,
+       .comm = "test",
+       .utime_us = 1000},
+      /* not forked since the last read: ignored */
+      {.pid = TEST_PID + 2,
+       .tgid = TEST_PID + 2,
+       .group_dead = true,
+       .comm = "test",
+       .utime_us = 100000},
+  };
+  derive_t before = test_cpu_user();
+
+  ps_account_exits(exits, STATIC_ARRAY_SIZE(exits), events,
+                   STATIC_ARRAY_SIZE(events));
+
+  /* The tasks of the thread group are summed up. */
+  EXPECT_EQ_INT(1010, test_cpu_user() - before);
+  OK(events[0].done);
+  OK(events[1].done);
+
+  return 0;
+}
+
+/* The process forks before one read, is gone from /proc at that read and its
+ * exit record only arrives afterwards. */
+DEF_TEST(exit_after_read) {
+  derive_t before = test_cpu_user();
+
+  ps_events_add(TEST_PID, /* exec = */ false);
+  CHECK_ZERO(ps_read_events());
+  EXPECT_EQ_INT(1, ps_events_pending_num);
+  EXPECT_EQ_INT(0, test_cpu_user() - before);
+
+  test_exit(TEST_PID, 500);
+  CHECK_ZERO(ps_read_events());
+  EXPECT_EQ_INT(500, test_cpu_user() - before);
+  EXPECT_EQ_INT(0, ps_events_pending_num);
+
+  return 0;
+}
+
+DEF_TEST(keep_timeout) {
+  derive_t before = test_cpu_user();
+
+  ps_events_add(TEST_PID, /* exec = */ false);
+  /* Exec events alone are not kept. */
+  ps_events_add(TEST_PID + 1, /* exec = */ true);
+  for (int i = 0; i < PS_EVENTS_KEEP; i++) {
+    CHECK_ZERO(ps_read_events());
+    EXPECT_EQ_INT(1, ps_events_pending_num);
+  }
+  CHECK_ZERO(ps_read_events());
+  EXPECT_EQ_INT(0, ps_events_pending_num);
+
+  /* Too late: the fork event has been dropped. */
+  test_exit(TEST_PID, 500);
+  CHECK_ZERO(ps_read_events());
+  EXPECT_EQ_INT(0, test_cpu_user() - before);
+
+  return 0;
+}
+
+int main(void) {
+  CHECK_ZERO(test_setup());
+
+  RUN_TEST(account_exits);
+  RUN_TEST(exit_after_read);
+  RUN_TEST(keep_timeout);
+
+  ps_shutdown_threads();
+  END_TEST;
+}
@@ -30,10 +30,50 @@
 #include "utils/common/common.h"
 #include "utils/rrdcreate/rrdcreate.h"
 
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+#define RC_DEFAULT_PORT "42217"
+
+/*
+ * Private types
+ */
+/* When "BatchSize" is set, updates are buffered per connection and sent to
+ * RRDCacheD using its "BATCH" command. Each connection has a thread which
+ * sends the batches, so writers never wait for the daemon. While a batch is
+ * being sent, writers fill the other buffer. */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;      /* signals "flush_requested" and "shutdown" */
+  pthread_cond_t done_cond; /* signals "flush_done" */
+  pthread_t thread;
+  bool thread_started;
+  bool shutdown;
+
+  /* only used by the thread */
+  int fd;
+  FILE *fh; /* reading end of "fd" */
+  char *send_buffer;
+  size_t send_buffer_size;
+
+  /* updates which have not been handed to the thread yet */
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_len;
+  size_t updates;
+  cdtime_t first_update;
+
+  /* flush requests; the thread sets "flush_done" to "flush_requested" once
+   * the updates buffered at the time of the request have been sent */
+  uint64_t flush_requested;
+  uint64_t flush_done;
+} rc_batch_t;
+
 /*
  * Private variables
  */
@@ -41,6 +81,9 @@ static char *datadir;
 static char *daemon_address;
 static bool config_create_files = true;
 static bool config_collect_stats = true;
+static int config_batch_size;
+static cdtime_t config_batch_timeout;
+static int config_connections = 1;
 static rrdcreate_config_t rrdcreate_config = {.stepsize = 0,
                                               .heartbeat = 0,
                                               .rrarows = 1200,
@@ -51,11 +94,14 @@ static rrdcreate_config_t rrdcreate_config = {.stepsize = 0,
                                               .consolidation_functions_num = 0,
                                               .async = 0};
 
+static rc_batch_t *batches;
+static size_t batches_num;
+
 /*
  * Prototypes.
  */
-static int rc_write(const data_set_t *ds, const value_list_t *vl,
-                    __attribute__((unused)) user_data_t *ud);
+static int rc_write(const data_set_t *const *ds, const value_list_t *const *vl,
+                    size_t num, __attribute__((unused)) user_data_t *ud);
 static int rc_flush(__attribute__((unused)) cdtime_t timeout,
                     const char *identifier,
                     __attribute__((unused)) user_data_t *ud);
@@ -120,7 +166,7 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
     buffer_size -= datadir_len;
   }
 
-  int status = FORMAT_VL(buffer, buffer_size, vl);
+  int status = plugin_format_name_vl(buffer, buffer_size, vl);
   if (status != 0)
     return status;
 
@@ -213,7 +259,15 @@ static int rc_config(oconfig_item_t *ci) {
       status = cf_util_get_boolean(child, &rrdcreate_config.async);
     else if (strcasecmp("CollectStatistics", key) == 0)
       status = cf_util_get_boolean(child, &config_collect_stats);
-    else if (strcasecmp("StepSize", key) == 0) {
+    else if (strcasecmp("BatchSize", key) == 0)
+      status = rc_config_get_int_positive(child, &config_batch_size);
+    else if (strcasecmp("BatchTimeout", key) == 0)
+      status = cf_util_get_cdtime(child, &config_batch_timeout);
+    else if (strcasecmp("Connections", key) == 0) {
+      status = rc_config_get_int_positive(child, &config_connections);
+      if ((status == 0) && (config_connections < 1))
+        status = EINVAL;
+    } else if (strcasecmp("StepSize", key) == 0) {
       int tmp = -1;
 
       status = rc_config_get_int_positive(child, &tmp);
@@ -240,7 +294,7 @@ static int rc_config(oconfig_item_t *ci) {
   }
 
   if (daemon_address != NULL) {
-    plugin_register_write("rrdcached", rc_write, /* user_data = */ NULL);
+    plugin_register_write_batch("rrdcached", rc_write, /* user_data = */ NULL);
     plugin_register_flush("rrdcached", rc_flush, /* user_data = */ NULL);
   }
   return 0;
@@ -362,26 +416,468 @@ static int rc_read(void) {
   return 0;
 } /* int rc_read */
 
+/* rc_batch_index returns the index of the batch connection that is responsible
+ * for "filename". Updates of one file always use the same connection, so they
+ * reach RRDCacheD in order. */
+static size_t rc_batch_index(char const *filename) {
+  return (size_t)(fnv1a_append(FNV1A_INIT, filename) % batches_num);
+} /* size_t rc_batch_index */
+
+static void rc_batch_disconnect(rc_batch_t *b) {
+  if (b->fh != NULL)
+    fclose(b->fh); /* closes b->fd, too */
+  else if (b->fd >= 0)
+    close(b->fd);
+
+  b->fh = NULL;
+  b->fd = -1;
+} /* void rc_batch_disconnect */
+
+static int rc_batch_connect_unix(char const *path) {
+  struct sockaddr_un sa = {.sun_family = AF_UNIX};
+  sstrncpy(sa.sun_path, path, sizeof(sa.sun_path));
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    ERROR("rrdcached plugin: socket failed: %s", STRERRNO);
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    ERROR("rrdcached plugin: connect (%s) failed: %s", path, STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+} /* int rc_batch_connect_unix */
+
+static int rc_batch_connect_inet(char const *address) {
+  char node[NI_MAXHOST];
+  char const *service = RC_DEFAULT_PORT;
+
+  sstrncpy(node, address, sizeof(node));
+
+  char *host = node;
+  if (node[0] == '[') { /* "[address]:port" */
+    char *end = strchr(node, ']');
+    if (end == NULL) {
+      ERROR("rrdcached plugin: Invalid daemon address: %s", address);
+      return -1;
+    }
+    *end = 0;
+    host = node + 1;
+    if (end[1] == ':')
+      service = end + 2;
+  } else {
+    /* "host:port", but not a plain IPv6 address */
+    char *colon = strchr(node, ':');
+    if ((colon != NULL) && (strchr(colon + 1, ':') == NULL)) {
+      *colon = 0;
+      service = colon + 1;
+    }
+  }
+
+  struct addrinfo ai_hints = {
+      .ai_family = AF_UNSPEC,
+      .ai_flags = AI_ADDRCONFIG,
+      .ai_socktype = SOCK_STREAM,
+  };
+  struct addrinfo *ai_list = NULL;
+
+  int status = getaddrinfo(host, service, &ai_hints, &ai_list);
+  if (status != 0) {
+    ERROR("rrdcached plugin: getaddrinfo (%s, %s) failed: %s", host, service,
+          gai_strerror(status));
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo *ai = ai_list; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(ai_list);
+
+  if (fd < 0)
+    ERROR("rrdcached plugin: Unable to connect to %s.", address);
+  return fd;
+} /* int rc_batch_connect_inet */
+
+static int rc_batch_connect(rc_batch_t *b) {
+  if (b->fh != NULL)
+    return 0;
+
+  if (strncmp("unix:", daemon_address, strlen("unix:")) == 0)
+    b->fd = rc_batch_connect_unix(daemon_address + strlen("unix:"));
+  else if (daemon_address[0] == '/')
+    b->fd = rc_batch_connect_unix(daemon_address);
+  else
+    b->fd = rc_batch_connect_inet(daemon_address);
+
+  if (b->fd < 0)
+    return -1;
+
+  b->fh = fdopen(b->fd, "r");
+  if (b->fh == NULL) {
+    ERROR("rrdcached plugin: fdopen failed: %s", STRERRNO);
+    rc_batch_disconnect(b);
+    return -1;
+  }
+
+  return 0;
+} /* int rc_batch_connect */
+
+/* rc_batch_response reads one response line and returns its status, i.e. the
+ * leading number. "message" receives the remainder of the line. */
+static int rc_batch_response(rc_batch_t *b, char *message, size_t size) {
+  char line[1024];
+
+  if (fgets(line, sizeof(line), b->fh) == NULL) {
+    ERROR("rrdcached plugin: Reading from RRDCacheD failed: %s",
+          feof(b->fh) ? "connection closed" : STRERRNO);
+    return -1;
+  }
+
+  char *endptr = NULL;
+  errno = 0;
+  long status = strtol(line, &endptr, 10);
+  if ((errno != 0) || (endptr == line)) {
+    ERROR("rrdcached plugin: Unexpected response from RRDCacheD: %s", line);
+    return -1;
+  }
+
+  while (isspace((int)*endptr))
+    endptr++;
+  sstrncpy(message, endptr, size);
+  size_t len = strlen(message);
+  while ((len > 0) && isspace((int)message[len - 1]))
+    message[--len] = 0;
+
+  return (int)status;
+} /* int rc_batch_response */
+
+/* rc_batch_submit sends a batch of "updates" and reads the reply. Updates
+ * rejected by RRDCacheD are logged but not considered a failure, since
+ * sending them again would not help. */
+static int rc_batch_submit(rc_batch_t *b, char const *buffer, size_t len,
+                           size_t updates) {
+  char message[1024];
+
+  if (swrite(b->fd, buffer, len) != 0) {
+    ERROR("rrdcached plugin: Sending batch to RRDCacheD failed: %s", STRERRNO);
+    return -1;
+  }
+
+  /* "0 Go ahead.  End with dot '.' on its own line." */
+  int status = rc_batch_response(b, message, sizeof(message));
+  if (status != 0) {
+    if (status > 0)
+      ERROR("rrdcached plugin: RRDCacheD refused the batch: %s", message);
+    return -1;
+  }
+
+  /* "<num> errors", followed by one "<command> <message>" line each. */
+  int errors = rc_batch_response(b, message, sizeof(message));
+  if (errors < 0)
+    return -1;
+
+  for (int i = 0; i < errors; i++) {
+    status = rc_batch_response(b, message, sizeof(message));
+    if (status < 0)
+      return -1;
+
+    if (i == 0) {
+      WARNING("rrdcached plugin: %d of %" PRIsz " updates failed. "
+              "First error: %s",
+              errors, updates, message);
+    } else {
+      DEBUG("rrdcached plugin: Update #%d failed: %s", status, message);
+    }
+  }
+
+  return 0;
+} /* int rc_batch_submit */
+
+/* rc_batch_send sends the "updates" in "buffer", which rc_batch_append()
+ * filled. Only called by the thread of "b", without holding "b->lock". */
+static int rc_batch_send(rc_batch_t *b, char *buffer, size_t len,
+                         size_t updates) {
+  /* The buffer always has room for the terminating line. */
+  memcpy(buffer + len, ".\n", strlen(".\n"));
+  len += strlen(".\n");
+
+  bool retried = false;
+  int status;
+  while (42) {
+    status = rc_batch_connect(b);
+    if (status == 0)
+      status = rc_batch_submit(b, buffer, len, updates);
+    if (status == 0)
+      break;
+
+    /* Like with rrdc_update(), there is no way of checking the connection
+     * other than using it. Reconnect and try once more. */
+    rc_batch_disconnect(b);
+    if (!retried) {
+      retried = true;
+      continue;
+    }
+
+    ERROR("rrdcached plugin: Sending %" PRIsz " updates to RRDCacheD at %s "
+          "failed. Dropping them.",
+          updates, daemon_address);
+    break;
+  }
+
+  DEBUG("rrdcached plugin: Sent a batch of %" PRIsz " updates in %" PRIsz
+        " bytes.",
+        updates, len);
+
+  return status;
+} /* int rc_batch_send */
+
+/* rc_batch_thread sends the buffered updates of "b" whenever a flush is
+ * requested. The buffers are swapped, so writers can go on appending while
+ * the batch is sent. */
+static void *rc_batch_thread(void *arg) {
+  rc_batch_t *b = arg;
+
+  pthread_mutex_lock(&b->lock);
+  while (42) {
+    while (!b->shutdown && (b->flush_done == b->flush_requested))
+      pthread_cond_wait(&b->cond, &b->lock);
+
+    uint64_t requested = b->flush_requested;
+    if (b->updates > 0) {
+      char *buffer = b->buffer;
+      size_t buffer_size = b->buffer_size;
+      size_t len = b->buffer_len;
+      size_t updates = b->updates;
+
+      b->buffer = b->send_buffer;
+      b->buffer_size = b->send_buffer_size;
+      b->buffer_len = 0;
+      b->updates = 0;
+      pthread_mutex_unlock(&b->lock);
+
+      rc_batch_send(b, buffer, len, updates);
+
+      pthread_mutex_lock(&b->lock);
+      b->send_buffer = buffer;
+      b->send_buffer_size = buffer_size;
+    }
+
+    b->flush_done = requested;
+    pthread_cond_broadcast(&b->done_cond);
+
+    if (b->shutdown && (b->updates == 0))
+      break;
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  rc_batch_disconnect(b);
+  return NULL;
+} /* void *rc_batch_thread */
+
+/* rc_batch_request asks the thread of "b" to send the buffered updates and,
+ * if "wait" is set, waits until they have been sent. The caller must hold
+ * "b->lock". */
+static void rc_batch_request(rc_batch_t *b, bool wait) {
+  uint64_t request = ++b->flush_requested;
+  pthread_cond_signal(&b->cond);
+
+  while (wait && !b->shutdown && (b->flush_done < request))
+    pthread_cond_wait(&b->done_cond, &b->lock);
+} /* void rc_batch_request */
+
+/* rc_batch_append adds an "UPDATE" command to the buffer of "b". Spaces and
+ * backslashes in the file name are escaped, like librrd's client does. */
+static int rc_batch_append(rc_batch_t *b, char const *filename,
+                           char const *values) {
+  char const batch[] = "BATCH\n";
+  char const update[] = "UPDATE ";
+
+  /* worst case: the whole file name is escaped, plus ".\n" to end the batch */
+  size_t need = strlen(batch) + strlen(update) + 2 * strlen(filename) + 1 +
+                strlen(values) + 1 + strlen(".\n");
+
+  if (b->buffer_size - b->buffer_len < need) {
+    size_t size = (b->buffer_size == 0) ? 4096 : 2 * b->buffer_size;
+    while (size - b->buffer_len < need)
+      size *= 2;
+
+    char *tmp = realloc(b->buffer, size);
+    if (tmp == NULL) {
+      ERROR("rrdcached plugin: realloc failed.");
+      return ENOMEM;
+    }
+    b->buffer = tmp;
+    b->buffer_size = size;
+  }
+
+  char *ptr = b->buffer + b->buffer_len;
+  if (b->updates == 0) {
+    memcpy(ptr, batch, strlen(batch));
+    ptr += strlen(batch);
+    b->first_update = cdtime();
+  }
+
+  memcpy(ptr, update, strlen(update));
+  ptr += strlen(update);
+  for (char const *src = filename; *src != 0; src++) {
+    if ((*src == ' ') || (*src == '\\'))
+      *(ptr++) = '\\';
+    *(ptr++) = *src;
+  }
+  *(ptr++) = ' ';
+  size_t values_len = strlen(values);
+  memcpy(ptr, values, values_len);
+  ptr += values_len;
+  *(ptr++) = '\n';
+
+  b->buffer_len = (size_t)(ptr - b->buffer);
+  b->updates++;
+  return 0;
+} /* int rc_batch_append */
+
+static int rc_batch_write(char const *filename, char const *values) {
+  char const *path = filename;
+  char resolved[PATH_MAX];
+
+  /* When talking to a local daemon, librrd sends absolute file names. */
+  if ((strncmp("unix:", daemon_address, strlen("unix:")) == 0) ||
+      (daemon_address[0] == '/')) {
+    if (realpath(filename, resolved) == NULL) {
+      ERROR("rrdcached plugin: realpath (%s) failed: %s", filename, STRERRNO);
+      return -1;
+    }
+    path = resolved;
+  }
+
+  rc_batch_t *b = batches + rc_batch_index(filename);
+
+  pthread_mutex_lock(&b->lock);
+  int status = rc_batch_append(b, path, values);
+  /* While the thread is busy sending the previous batch, this one keeps
+   * growing and is sent right after. */
+  if ((status == 0) &&
+      ((b->updates >= (size_t)config_batch_size) ||
+       (cdtime() - b->first_update >= config_batch_timeout)))
+    rc_batch_request(b, /* wait = */ false);
+  pthread_mutex_unlock(&b->lock);
+
+  return status;
+} /* int rc_batch_write */
+
+/* rc_batch_flush sends all batches that are at least "timeout" old. If "wait"
+ * is set, it returns once they have been sent. */
+static void rc_batch_flush(cdtime_t timeout, bool wait) {
+  cdtime_t now = cdtime();
+
+  for (size_t i = 0; i < batches_num; i++) {
+    rc_batch_t *b = batches + i;
+
+    pthread_mutex_lock(&b->lock);
+    /* Waiting includes a batch which is being sent right now. */
+    if (wait || ((b->updates > 0) && (now - b->first_update >= timeout)))
+      rc_batch_request(b, wait);
+    pthread_mutex_unlock(&b->lock);
+  }
+} /* void rc_batch_flush */
+
+static int rc_batch_read(__attribute__((unused)) user_data_t *ud) {
+  rc_batch_flush(config_batch_timeout, /* wait = */ false);
+  return 0;
+} /* int rc_batch_read */
+
+/* rc_batch_destroy stops the threads, which send the remaining updates
+ * first. */
+static void rc_batch_destroy(void) {
+  for (size_t i = 0; i < batches_num; i++) {
+    rc_batch_t *b = batches + i;
+
+    pthread_mutex_lock(&b->lock);
+    b->shutdown = true;
+    pthread_cond_broadcast(&b->cond);
+    pthread_cond_broadcast(&b->done_cond);
+    pthread_mutex_unlock(&b->lock);
+
+    if (b->thread_started)
+      pthread_join(b->thread, NULL);
+
+    sfree(b->buffer);
+    sfree(b->send_buffer);
+    pthread_cond_destroy(&b->done_cond);
+    pthread_cond_destroy(&b->cond);
+    pthread_mutex_destroy(&b->lock);
+  }
+
+  sfree(batches);
+  batches_num = 0;
+} /* void rc_batch_destroy */
+
 static int rc_init(void) {
   if (config_collect_stats)
     plugin_register_read("rrdcached", rc_read);
 
+  if ((daemon_address == NULL) || (config_batch_size <= 0))
+    return 0;
+
+  batches = calloc((size_t)config_connections, sizeof(*batches));
+  if (batches == NULL) {
+    ERROR("rrdcached plugin: calloc failed.");
+    return -1;
+  }
+  batches_num = (size_t)config_connections;
+
+  for (size_t i = 0; i < batches_num; i++) {
+    rc_batch_t *b = batches + i;
+
+    pthread_mutex_init(&b->lock, /* attr = */ NULL);
+    pthread_cond_init(&b->cond, /* attr = */ NULL);
+    pthread_cond_init(&b->done_cond, /* attr = */ NULL);
+    b->fd = -1;
+  }
+
+  for (size_t i = 0; i < batches_num; i++) {
+    rc_batch_t *b = batches + i;
+
+    int status =
+        plugin_thread_create(&b->thread, rc_batch_thread, b, "rrdcached batch");
+    if (status != 0) {
+      ERROR("rrdcached plugin: Starting a batch thread failed: %s",
+            STRERROR(status));
+      rc_batch_destroy();
+      return -1;
+    }
+    b->thread_started = true;
+  }
+
+  if (config_batch_timeout == 0)
+    config_batch_timeout = plugin_get_interval();
+
+  /* Sends batches that did not fill up in time. */
+  plugin_register_complex_read(/* group = */ NULL, "rrdcached_batch",
+                               rc_batch_read, config_batch_timeout,
+                               /* user_data = */ NULL);
+
   return 0;
 } /* int rc_init */
 
-static int rc_write(const data_set_t *ds, const value_list_t *vl,
-                    user_data_t __attribute__((unused)) * user_data) {
+static int rc_write_value(const data_set_t *ds, const value_list_t *vl) {
   char filename[PATH_MAX];
   char values[512];
   int status;
   bool retried = false;
 
-  if (daemon_address == NULL) {
-    ERROR("rrdcached plugin: daemon_address == NULL.");
-    plugin_unregister_write("rrdcached");
-    return -1;
-  }
-
   if (strcmp(ds->type, vl->type) != 0) {
     ERROR("rrdcached plugin: DS type does not match value list type");
     return -1;
@@ -416,6 +912,9 @@ static int rc_write(const data_set_t *ds, const value_list_t *vl,
     }
   }
 
+  if (batches != NULL)
+    return rc_batch_write(filename, values);
+
   rrd_clear_error();
   status = rrdc_connect(daemon_address);
   if (status != 0) {
@@ -451,12 +950,35 @@ static int rc_write(const data_set_t *ds, const value_list_t *vl,
   }
 
   return 0;
+} /* int rc_write_value */
+
+static int rc_write(const data_set_t *const *ds, const value_list_t *const *vl,
+                    size_t num,
+                    user_data_t __attribute__((unused)) * user_data) {
+  int status = 0;
+
+  if (daemon_address == NULL) {
+    ERROR("rrdcached plugin: daemon_address == NULL.");
+    plugin_unregister_write("rrdcached");
+    return -1;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    if (rc_write_value(ds[i], vl[i]) != 0)
+      status = -1;
+  }
+
+  return status;
 } /* int rc_write */
 
 static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
                     const char *identifier,
                     __attribute__((unused)) user_data_t *ud) {
-  if (identifier == NULL)
+  if ((identifier == NULL) && (batches != NULL)) {
+    rc_batch_flush(/* timeout = */ 0, /* wait = */ true);
+    return 0;
+  }
+  else if (identifier == NULL)
     return EINVAL;
 
   char filename[PATH_MAX + 1];
@@ -466,6 +988,15 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
   else
     ssnprintf(filename, sizeof(filename), "%s.rrd", identifier);
 
+  /* Buffered updates have to reach the daemon before it can flush them. */
+  if (batches != NULL) {
+    rc_batch_t *b = batches + rc_batch_index(filename);
+
+    pthread_mutex_lock(&b->lock);
+    rc_batch_request(b, /* wait = */ true);
+    pthread_mutex_unlock(&b->lock);
+  }
+
   rrd_clear_error();
   int status = rrdc_connect(daemon_address);
   if (status != 0) {
@@ -502,6 +1033,7 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
 } /* }}} int rc_flush */
 
 static int rc_shutdown(void) {
+  rc_batch_destroy();
   rrdc_disconnect();
   return 0;
 } /* int rc_shutdown */
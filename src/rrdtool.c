@@ -54,13 +54,37 @@ struct rrd_queue_s {
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* Each update thread owns the RRD files whose name hashes to its index. All
+ * updates of one file are therefore written by the same thread, in order. */
+struct rrd_worker_s {
+  size_t index;
+  pthread_t thread;
+  bool running;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  rrd_queue_t *queue_head;
+  rrd_queue_t *queue_tail;
+  rrd_queue_t *flushq_head;
+  rrd_queue_t *flushq_tail;
+  size_t queue_length;
+
+  /* Statistics, protected by "lock". The interval_* members are reset by
+   * rrd_read(). */
+  uint64_t updates;
+  uint64_t interval_updates;
+  cdtime_t interval_latency;
+};
+typedef struct rrd_worker_s rrd_worker_t;
+
 /*
  * Private variables
  */
 static const char *config_keys[] = {
     "CacheTimeout", "CacheFlush",      "CreateFilesAsync", "DataDir",
     "StepSize",     "HeartBeat",       "RRARows",          "RRATimespan",
-    "XFF",          "WritesPerSecond", "RandomTimeout"};
+    "XFF",          "WritesPerSecond", "RandomTimeout",    "UpdateThreads",
+    "CollectStatistics"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 /* If datadir is zero, the daemon's basedir is used. If stepsize or heartbeat
@@ -82,8 +106,8 @@ static rrdcreate_config_t rrdcreate_config = {
 
     /* async = */ 0};
 
-/* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
- * ALWAYS lock `cache_lock' first! */
+/* XXX: If you need to lock both, cache_lock and a worker's lock, at the same
+ * time, ALWAYS lock `cache_lock' first! */
 static cdtime_t cache_timeout;
 static cdtime_t cache_flush_timeout;
 static cdtime_t random_timeout;
@@ -91,14 +115,10 @@ static cdtime_t cache_flush_last;
 static c_avl_tree_t *cache;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static rrd_queue_t *queue_head;
-static rrd_queue_t *queue_tail;
-static rrd_queue_t *flushq_head;
-static rrd_queue_t *flushq_tail;
-static pthread_t queue_thread;
-static int queue_thread_running = 1;
-static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static rrd_worker_t *workers;
+static size_t workers_num;
+static size_t update_threads = 1;
+static bool collect_statistics;
 
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -263,7 +283,7 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
     buffer_size -= datadir_len;
   }
 
-  status = FORMAT_VL(buffer, buffer_size, vl);
+  status = plugin_format_name_vl(buffer, buffer_size, vl);
   if (status != 0)
     return status;
 
@@ -279,10 +299,15 @@ static int value_list_to_filename(char *buffer, size_t buffer_size,
   return 0;
 } /* int value_list_to_filename */
 
-static void *rrd_queue_thread(void __attribute__((unused)) * data) {
+static void *rrd_queue_thread(void *data) {
+  rrd_worker_t *w = data;
   struct timeval tv_next_update;
   struct timeval tv_now;
 
+  /* "WritesPerSecond" is the limit for the plugin as a whole, so each of the
+   * update threads gets its share of it. */
+  double worker_write_rate = write_rate * (double)workers_num;
+
   gettimeofday(&tv_next_update, /* timezone = */ NULL);
 
   while (42) {
@@ -295,20 +320,20 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
     values = NULL;
     values_num = 0;
 
-    pthread_mutex_lock(&queue_lock);
+    pthread_mutex_lock(&w->lock);
     /* Wait for values to arrive */
     while (42) {
       struct timespec ts_wait;
 
-      while ((flushq_head == NULL) && (queue_head == NULL) &&
+      while ((w->flushq_head == NULL) && (w->queue_head == NULL) &&
              (do_shutdown == 0))
-        pthread_cond_wait(&queue_cond, &queue_lock);
+        pthread_cond_wait(&w->cond, &w->lock);
 
-      if ((flushq_head == NULL) && (queue_head == NULL))
+      if ((w->flushq_head == NULL) && (w->queue_head == NULL))
         break;
 
       /* Don't delay if there's something to flush */
-      if (flushq_head != NULL)
+      if (w->flushq_head != NULL)
         break;
 
       /* Don't delay if we're shutting down */
@@ -316,7 +341,7 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
         break;
 
       /* Don't delay if no delay was configured. */
-      if (write_rate <= 0.0)
+      if (worker_write_rate <= 0.0)
         break;
 
       gettimeofday(&tv_now, /* timezone = */ NULL);
@@ -331,39 +356,40 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
       ts_wait.tv_sec = tv_next_update.tv_sec;
       ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
 
-      status = pthread_cond_timedwait(&queue_cond, &queue_lock, &ts_wait);
+      status = pthread_cond_timedwait(&w->cond, &w->lock, &ts_wait);
       if (status == ETIMEDOUT)
         break;
     } /* while (42) */
 
-    /* XXX: If you need to lock both, cache_lock and queue_lock, at
+    /* XXX: If you need to lock both, cache_lock and a worker's lock, at
      * the same time, ALWAYS lock `cache_lock' first! */
 
     /* We're in the shutdown phase */
-    if ((flushq_head == NULL) && (queue_head == NULL)) {
-      pthread_mutex_unlock(&queue_lock);
+    if ((w->flushq_head == NULL) && (w->queue_head == NULL)) {
+      pthread_mutex_unlock(&w->lock);
       break;
     }
 
-    if (flushq_head != NULL) {
+    if (w->flushq_head != NULL) {
       /* Dequeue the first flush entry */
-      queue_entry = flushq_head;
-      if (flushq_head == flushq_tail)
-        flushq_head = flushq_tail = NULL;
+      queue_entry = w->flushq_head;
+      if (w->flushq_head == w->flushq_tail)
+        w->flushq_head = w->flushq_tail = NULL;
       else
-        flushq_head = flushq_head->next;
-    } else /* if (queue_head != NULL) */
+        w->flushq_head = w->flushq_head->next;
+    } else /* if (w->queue_head != NULL) */
     {
       /* Dequeue the first regular entry */
-      queue_entry = queue_head;
-      if (queue_head == queue_tail)
-        queue_head = queue_tail = NULL;
+      queue_entry = w->queue_head;
+      if (w->queue_head == w->queue_tail)
+        w->queue_head = w->queue_tail = NULL;
       else
-        queue_head = queue_head->next;
+        w->queue_head = w->queue_head->next;
     }
+    w->queue_length--;
 
     /* Unlock the queue again */
-    pthread_mutex_unlock(&queue_lock);
+    pthread_mutex_unlock(&w->lock);
 
     /* We now need the cache lock so the entry isn't updated while
      * we make a copy of its values */
@@ -389,11 +415,11 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
     }
 
     /* Update `tv_next_update' */
-    if (write_rate > 0.0) {
+    if (worker_write_rate > 0.0) {
       gettimeofday(&tv_now, /* timezone = */ NULL);
       tv_next_update.tv_sec = tv_now.tv_sec;
       tv_next_update.tv_usec =
-          tv_now.tv_usec + ((suseconds_t)(1000000 * write_rate));
+          tv_now.tv_usec + ((suseconds_t)(1000000 * worker_write_rate));
       while (tv_next_update.tv_usec > 1000000) {
         tv_next_update.tv_sec++;
         tv_next_update.tv_usec -= 1000000;
@@ -401,9 +427,18 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
     }
 
     /* Write the values to the RRD-file */
+    cdtime_t start = cdtime();
     srrd_update(queue_entry->filename, NULL, values_num, (const char **)values);
-    DEBUG("rrdtool plugin: queue thread: Wrote %i value%s to %s", values_num,
-          (values_num == 1) ? "" : "s", queue_entry->filename);
+    cdtime_t latency = cdtime() - start;
+    DEBUG("rrdtool plugin: queue thread #%" PRIsz ": Wrote %i value%s to %s",
+          w->index, values_num, (values_num == 1) ? "" : "s",
+          queue_entry->filename);
+
+    pthread_mutex_lock(&w->lock);
+    w->updates++;
+    w->interval_updates++;
+    w->interval_latency += latency;
+    pthread_mutex_unlock(&w->lock);
 
     for (int i = 0; i < values_num; i++) {
       sfree(values[i]);
@@ -417,8 +452,17 @@ static void *rrd_queue_thread(void __attribute__((unused)) * data) {
   return (void *)0;
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue(const char *filename, rrd_queue_t **head,
-                             rrd_queue_t **tail) {
+/* rrd_queue_worker returns the update thread responsible for "filename". The
+ * FNV-1a hash spreads the files of one host evenly over all threads. */
+static rrd_worker_t *rrd_queue_worker(const char *filename) {
+  if (workers_num == 1)
+    return workers;
+
+  return workers + (fnv1a_append(FNV1A_INIT, filename) % workers_num);
+} /* rrd_worker_t *rrd_queue_worker */
+
+static int rrd_queue_enqueue(const char *filename, bool flush) {
+  rrd_worker_t *w = rrd_queue_worker(filename);
   rrd_queue_t *queue_entry;
 
   queue_entry = malloc(sizeof(*queue_entry));
@@ -433,29 +477,33 @@ static int rrd_queue_enqueue(const char *filename, rrd_queue_t **head,
 
   queue_entry->next = NULL;
 
-  pthread_mutex_lock(&queue_lock);
+  pthread_mutex_lock(&w->lock);
+
+  rrd_queue_t **head = flush ? &w->flushq_head : &w->queue_head;
+  rrd_queue_t **tail = flush ? &w->flushq_tail : &w->queue_tail;
 
   if (*tail == NULL)
     *head = queue_entry;
   else
     (*tail)->next = queue_entry;
   *tail = queue_entry;
+  w->queue_length++;
 
-  pthread_cond_signal(&queue_cond);
-  pthread_mutex_unlock(&queue_lock);
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
 
   return 0;
 } /* int rrd_queue_enqueue */
 
-static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
-                             rrd_queue_t **tail) {
+static int rrd_queue_dequeue(const char *filename) {
+  rrd_worker_t *w = rrd_queue_worker(filename);
   rrd_queue_t *this;
   rrd_queue_t *prev;
 
-  pthread_mutex_lock(&queue_lock);
+  pthread_mutex_lock(&w->lock);
 
   prev = NULL;
-  this = *head;
+  this = w->queue_head;
 
   while (this != NULL) {
     if (strcmp(this->filename, filename) == 0)
@@ -466,19 +514,20 @@ static int rrd_queue_dequeue(const char *filename, rrd_queue_t **head,
   }
 
   if (this == NULL) {
-    pthread_mutex_unlock(&queue_lock);
+    pthread_mutex_unlock(&w->lock);
     return -1;
   }
 
   if (prev == NULL)
-    *head = this->next;
+    w->queue_head = this->next;
   else
     prev->next = this->next;
 
   if (this->next == NULL)
-    *tail = prev;
+    w->queue_tail = prev;
+  w->queue_length--;
 
-  pthread_mutex_unlock(&queue_lock);
+  pthread_mutex_unlock(&w->lock);
 
   sfree(this->filename);
   sfree(this);
@@ -513,7 +562,7 @@ static void rrd_cache_flush(cdtime_t timeout) {
     else if (rc->values_num > 0) {
       int status;
 
-      status = rrd_queue_enqueue(key, &queue_head, &queue_tail);
+      status = rrd_queue_enqueue(key, /* flush = */ false);
       if (status == 0)
         rc->flags = FLAG_QUEUED;
     } else /* ancient and no values -> waste of memory */
@@ -582,14 +631,14 @@ static int rrd_cache_flush_identifier(cdtime_t timeout,
   if (rc->flags == FLAG_FLUSHQ) {
     status = 0;
   } else if (rc->flags == FLAG_QUEUED) {
-    rrd_queue_dequeue(key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue(key, &flushq_head, &flushq_tail);
+    rrd_queue_dequeue(key);
+    status = rrd_queue_enqueue(key, /* flush = */ true);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   } else if ((now - rc->first_value) < timeout) {
     status = 0;
   } else if (rc->values_num > 0) {
-    status = rrd_queue_enqueue(key, &flushq_head, &flushq_tail);
+    status = rrd_queue_enqueue(key, /* flush = */ true);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -696,12 +745,12 @@ static int rrd_cache_insert(const char *filename, const char *value,
 
   if ((rc->last_value - rc->first_value) >=
       (cache_timeout + rc->random_variation)) {
-    /* XXX: If you need to lock both, cache_lock and queue_lock, at
+    /* XXX: If you need to lock both, cache_lock and a worker's lock, at
      * the same time, ALWAYS lock `cache_lock' first! */
     if (rc->flags == FLAG_NONE) {
       int status;
 
-      status = rrd_queue_enqueue(filename, &queue_head, &queue_tail);
+      status = rrd_queue_enqueue(filename, /* flush = */ false);
       if (status == 0)
         rc->flags = FLAG_QUEUED;
 
@@ -978,39 +1027,134 @@ static int rrd_config(const char *key, const char *value) {
     } else {
       random_timeout = DOUBLE_TO_CDTIME_T(tmp);
     }
+  } else if (strcasecmp("UpdateThreads", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      fprintf(stderr, "rrdtool: `UpdateThreads' must "
+                      "be greater than 0.\n");
+      ERROR("rrdtool: `UpdateThreads' must "
+            "be greater than 0.");
+      return 1;
+    }
+    update_threads = (size_t)tmp;
+  } else if (strcasecmp("CollectStatistics", key) == 0) {
+    collect_statistics = IS_TRUE(value);
   } else {
     return -1;
   }
   return 0;
 } /* int rrd_config */
 
+static int rrd_read(void) {
+  value_list_t vl = VALUE_LIST_INIT;
+  vl.values_len = 1;
+  sstrncpy(vl.plugin, "rrdtool", sizeof(vl.plugin));
+
+  for (size_t i = 0; i < workers_num; i++) {
+    rrd_worker_t *w = workers + i;
+
+    pthread_mutex_lock(&w->lock);
+    gauge_t queue_length = (gauge_t)w->queue_length;
+    derive_t updates = (derive_t)w->updates;
+    gauge_t latency = NAN;
+    if (w->interval_updates > 0)
+      latency = CDTIME_T_TO_DOUBLE(w->interval_latency) /
+                (double)w->interval_updates;
+    w->interval_updates = 0;
+    w->interval_latency = 0;
+    pthread_mutex_unlock(&w->lock);
+
+    ssnprintf(vl.plugin_instance, sizeof(vl.plugin_instance), "%" PRIsz, i);
+
+    vl.values = &(value_t){.gauge = queue_length};
+    sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+
+    vl.values = &(value_t){.derive = updates};
+    sstrncpy(vl.type, "operations", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "update", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+
+    vl.values = &(value_t){.gauge = latency};
+    sstrncpy(vl.type, "latency", sizeof(vl.type));
+    sstrncpy(vl.type_instance, "update", sizeof(vl.type_instance));
+    plugin_dispatch_values(&vl);
+  }
+
+  return 0;
+} /* int rrd_read */
+
+static void rrd_workers_destroy(void) /* {{{ */
+{
+  for (size_t i = 0; i < workers_num; i++) {
+    rrd_worker_t *w = workers + i;
+
+    /* Only left over if the thread could not be started. */
+    rrd_queue_t *lists[] = {w->queue_head, w->flushq_head};
+    for (size_t j = 0; j < STATIC_ARRAY_SIZE(lists); j++) {
+      while (lists[j] != NULL) {
+        rrd_queue_t *next = lists[j]->next;
+        sfree(lists[j]->filename);
+        sfree(lists[j]);
+        lists[j] = next;
+      }
+    }
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+  }
+
+  sfree(workers);
+  workers_num = 0;
+} /* }}} void rrd_workers_destroy */
+
 static int rrd_shutdown(void) {
   pthread_mutex_lock(&cache_lock);
-  rrd_cache_flush(0);
+  if (cache != NULL)
+    rrd_cache_flush(0);
   pthread_mutex_unlock(&cache_lock);
 
-  pthread_mutex_lock(&queue_lock);
   do_shutdown = 1;
-  pthread_cond_signal(&queue_cond);
-  pthread_mutex_unlock(&queue_lock);
-
-  if ((queue_thread_running != 0) &&
-      ((queue_head != NULL) || (flushq_head != NULL))) {
-    INFO("rrdtool plugin: Shutting down the queue thread. "
-         "This may take a while.");
-  } else if (queue_thread_running != 0) {
-    INFO("rrdtool plugin: Shutting down the queue thread.");
+
+  size_t queue_length = 0;
+  size_t running = 0;
+  for (size_t i = 0; i < workers_num; i++) {
+    rrd_worker_t *w = workers + i;
+
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_signal(&w->cond);
+    if (w->running) {
+      queue_length += w->queue_length;
+      running++;
+    }
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  if ((running != 0) && (queue_length != 0)) {
+    INFO("rrdtool plugin: Shutting down the queue %s. "
+         "This may take a while.",
+         (running == 1) ? "thread" : "threads");
+  } else if (running != 0) {
+    INFO("rrdtool plugin: Shutting down the queue %s.",
+         (running == 1) ? "thread" : "threads");
   }
 
   /* Wait for all the values to be written to disk before returning. */
-  if (queue_thread_running != 0) {
-    pthread_join(queue_thread, NULL);
-    memset(&queue_thread, 0, sizeof(queue_thread));
-    queue_thread_running = 0;
-    DEBUG("rrdtool plugin: queue_thread exited.");
+  for (size_t i = 0; i < workers_num; i++) {
+    rrd_worker_t *w = workers + i;
+
+    if (!w->running)
+      continue;
+
+    pthread_join(w->thread, NULL);
+    memset(&w->thread, 0, sizeof(w->thread));
+    w->running = false;
+    DEBUG("rrdtool plugin: queue thread #%" PRIsz " exited.", i);
   }
 
   rrd_cache_destroy();
+  rrd_workers_destroy();
 
   return 0;
 } /* int rrd_shutdown */
@@ -1025,6 +1169,30 @@ static int rrd_init(void) {
   if (rrdcreate_config.heartbeat <= 0)
     rrdcreate_config.heartbeat = 2 * rrdcreate_config.stepsize;
 
+#if !HAVE_THREADSAFE_LIBRRD
+  /* All calls into a non-thread-safe librrd are serialized by "librrd_lock",
+   * so additional threads would only wait for each other. */
+  if (update_threads > 1) {
+    WARNING("rrdtool plugin: librrd is not thread-safe. Ignoring "
+            "\"UpdateThreads %" PRIsz "\".",
+            update_threads);
+    update_threads = 1;
+  }
+#endif
+
+  /* Set the update queues up */
+  workers = calloc(update_threads, sizeof(*workers));
+  if (workers == NULL) {
+    ERROR("rrdtool plugin: calloc failed.");
+    return -1;
+  }
+  workers_num = update_threads;
+  for (size_t i = 0; i < workers_num; i++) {
+    workers[i].index = i;
+    pthread_mutex_init(&workers[i].lock, /* attr = */ NULL);
+    pthread_cond_init(&workers[i].cond, /* attr = */ NULL);
+  }
+
   /* Set the cache up */
   pthread_mutex_lock(&cache_lock);
 
@@ -1057,19 +1225,28 @@ static int rrd_init(void) {
 
   pthread_mutex_unlock(&cache_lock);
 
-  int status = plugin_thread_create(&queue_thread, rrd_queue_thread,
-                                    /* args = */ NULL, "rrdtool queue");
-  if (status != 0) {
-    ERROR("rrdtool plugin: Cannot create queue-thread.");
-    return -1;
+  for (size_t i = 0; i < workers_num; i++) {
+    rrd_worker_t *w = workers + i;
+    char name[16];
+
+    ssnprintf(name, sizeof(name), "rrdtool upd#%" PRIsz, i);
+    int status = plugin_thread_create(&w->thread, rrd_queue_thread, w, name);
+    if (status != 0) {
+      ERROR("rrdtool plugin: Cannot create queue-thread #%" PRIsz ".", i);
+      return -1;
+    }
+    w->running = true;
   }
-  queue_thread_running = 1;
+
+  if (collect_statistics)
+    plugin_register_read("rrdtool", rrd_read);
 
   DEBUG("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
-        " heartbeat = %i; rrarows = %i; xff = %lf;",
+        " heartbeat = %i; rrarows = %i; xff = %lf; update threads = %" PRIsz
+        ";",
         (datadir == NULL) ? "(null)" : datadir, rrdcreate_config.stepsize,
         rrdcreate_config.heartbeat, rrdcreate_config.rrarows,
-        rrdcreate_config.xff);
+        rrdcreate_config.xff, workers_num);
 
   return 0;
 } /* int rrd_init */
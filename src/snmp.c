@@ -78,6 +78,8 @@ struct data_definition_s {
 };
 typedef struct data_definition_s data_definition_t;
 
+typedef struct csnmp_walk_s csnmp_walk_t;
+
 struct host_definition_s {
   char *name;
   char *address;
@@ -104,10 +106,24 @@ struct host_definition_s {
   data_definition_t **data_list;
   int data_list_len;
   int bulk_size;
+  cdtime_t interval;
+
+  /* Used by the poller threads, see csnmp_poll_enqueue(). "queued" is
+   * protected by the poller's lock, the other members are only used by the
+   * poller thread. */
+  size_t index;
+  int max_inflight;
+  bool queued;
+  c_complain_t busy_complaint;
+  struct host_definition_s *poll_next;
+  csnmp_walk_t *walks;
+  int walks_next;
+  int inflight;
+  bool failed;
 };
 typedef struct host_definition_s host_definition_t;
 
-/* These two types are used to cache values in `csnmp_read_table' to handle
+/* These two types are used to cache values in `csnmp_walk_response' to handle
  * gaps in tables. */
 struct csnmp_cell_char_s {
   oid_t suffix;
@@ -132,15 +148,87 @@ typedef enum {
   OID_TYPE_FILTER,
 } csnmp_oid_type_t;
 
+/* State of reading one data definition from a host. A walk is driven by
+ * alternately calling csnmp_walk_request() and csnmp_walk_response() until
+ * the former returns NULL, either synchronously by csnmp_read_data() or
+ * asynchronously by a poller thread. */
+struct csnmp_walk_s {
+  host_definition_t *host;
+  data_definition_t *data;
+  const data_set_t *ds;
+  int status;
+  bool done;
+
+  /* Values of a non-table data definition. */
+  value_t *values;
+
+  /* Holds the last OID returned by the device. We use this in the GETNEXT
+   * request to proceed. */
+  oid_t *oid_list;
+  size_t oid_list_len;
+  /* Set to OID_TYPE_SKIP when an OID has left its subtree so we don't
+   * re-request it again. */
+  csnmp_oid_type_t *oid_list_todo;
+  /* Maps the variables of the last request to "oid_list". */
+  size_t *var_idx;
+  size_t oid_list_todo_num;
+
+  bool bulk;
+  int max_repetitions;
+
+  /* `value_list_head' and `value_cells_tail' implement a linked list for each
+   * value. `instance_cells_head' and `instance_cells_tail' implement a linked
+   * list of instance names. This is used to jump gaps in the table. */
+  csnmp_cell_char_t *type_instance_cells_head;
+  csnmp_cell_char_t *type_instance_cells_tail;
+  csnmp_cell_char_t *plugin_instance_cells_head;
+  csnmp_cell_char_t *plugin_instance_cells_tail;
+  csnmp_cell_char_t *hostname_cells_head;
+  csnmp_cell_char_t *hostname_cells_tail;
+  csnmp_cell_char_t *filter_cells_head;
+  csnmp_cell_char_t *filter_cells_tail;
+  csnmp_cell_value_t **value_cells_head;
+  csnmp_cell_value_t **value_cells_tail;
+
+  /* Used by the poller threads. */
+  bool inflight;
+  bool finished;
+};
+
+/* A poller thread multiplexes the sessions of its hosts and keeps requests to
+ * all of them in flight at the same time. */
+struct csnmp_poller_s {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int wakeup[2];
+  bool shutdown;
+
+  /* Hosts whose read callback has fired, to be started by the thread. */
+  host_definition_t *queue_head;
+  host_definition_t *queue_tail;
+
+  /* Hosts being polled. Only used by the poller thread. */
+  host_definition_t *active;
+};
+typedef struct csnmp_poller_s csnmp_poller_t;
+
 /*
  * Private variables
  */
 static data_definition_t *data_head;
 
+static int poller_threads;
+static size_t hosts_num;
+
+static csnmp_poller_t *pollers;
+static size_t pollers_num;
+static pthread_mutex_t pollers_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Prototypes
  */
 static int csnmp_read_host(user_data_t *ud);
+static void csnmp_pollers_stop(void);
 
 /*
  * Private functions
@@ -205,6 +293,10 @@ static void csnmp_host_definition_destroy(void *arg) /* {{{ */
     DEBUG("snmp plugin: Destroying host definition for host `%s'.", hd->name);
   }
 
+  /* The poller threads may still be using this host. The hosts are destroyed
+   * after the read threads have been stopped, so no new polls are queued. */
+  csnmp_pollers_stop();
+
   csnmp_host_close_session(hd);
 
   sfree(hd->name);
@@ -831,7 +923,9 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
   if (hd == NULL)
     return -1;
   hd->version = 2;
+  hd->max_inflight = 1;
   C_COMPLAIN_INIT(&hd->complaint);
+  C_COMPLAIN_INIT(&hd->busy_complaint);
 
   status = cf_util_get_string(ci, &hd->name);
   if (status != 0) {
@@ -879,6 +973,8 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &hd->context);
     else if (strcasecmp("BulkSize", option->key) == 0)
       status = cf_util_get_int(option, &hd->bulk_size);
+    else if (strcasecmp("ConcurrentRequests", option->key) == 0)
+      status = cf_util_get_int(option, &hd->max_inflight);
     else {
       WARNING(
           "snmp plugin: csnmp_config_add_host: Option `%s' not allowed here.",
@@ -906,6 +1002,13 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
               "later, host '%s' is configured as version '%d'",
               hd->name, hd->version);
     }
+    if (hd->max_inflight < 1) {
+      WARNING("snmp plugin: `ConcurrentRequests' must be at least 1 for host "
+              "`%s'",
+              hd->name);
+      status = -1;
+      break;
+    }
     if (hd->version == 3) {
       if (hd->username == NULL) {
         WARNING("snmp plugin: `Username' not given for host `%s'", hd->name);
@@ -961,6 +1064,9 @@ static int csnmp_config_add_host(oconfig_item_t *ci) {
         "= %i }",
         hd->name, hd->address, hd->community, hd->version);
 
+  hd->interval = interval;
+  hd->index = hosts_num++;
+
   ssnprintf(cb_name, sizeof(cb_name), "snmp-%s", hd->name);
 
   status = plugin_register_complex_read(
@@ -986,6 +1092,8 @@ static int csnmp_config(oconfig_item_t *ci) {
       csnmp_config_add_data(child);
     else if (strcasecmp("Host", child->key) == 0)
       csnmp_config_add_host(child);
+    else if (strcasecmp("PollerThreads", child->key) == 0)
+      cf_util_get_int(child, &poller_threads);
     else {
       WARNING("snmp plugin: Ignoring unknown config option `%s'.", child->key);
     }
@@ -1409,6 +1517,7 @@ static int csnmp_dispatch_table(host_definition_t *host,
 
   sstrncpy(vl.plugin, data->plugin_name, sizeof(vl.plugin));
   sstrncpy(vl.type, data->type, sizeof(vl.type));
+  vl.interval = host->interval;
 
   have_more = 1;
   while (have_more) {
@@ -1681,64 +1790,88 @@ static int csnmp_dispatch_table(host_definition_t *host,
   return 0;
 } /* int csnmp_dispatch_table */
 
-static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
-  struct variable_list *vb;
-
-  const data_set_t *ds;
-
-  size_t oid_list_len = data->values_len;
+static void csnmp_walk_free(csnmp_walk_t *walk) {
+  /* Free all allocated variables here */
+  while (walk->type_instance_cells_head != NULL) {
+    csnmp_cell_char_t *next = walk->type_instance_cells_head->next;
+    sfree(walk->type_instance_cells_head);
+    walk->type_instance_cells_head = next;
+  }
 
-  if (data->type_instance.oid.oid_len > 0)
-    oid_list_len++;
+  while (walk->plugin_instance_cells_head != NULL) {
+    csnmp_cell_char_t *next = walk->plugin_instance_cells_head->next;
+    sfree(walk->plugin_instance_cells_head);
+    walk->plugin_instance_cells_head = next;
+  }
 
-  if (data->plugin_instance.oid.oid_len > 0)
-    oid_list_len++;
+  while (walk->hostname_cells_head != NULL) {
+    csnmp_cell_char_t *next = walk->hostname_cells_head->next;
+    sfree(walk->hostname_cells_head);
+    walk->hostname_cells_head = next;
+  }
 
-  if (data->host.oid.oid_len > 0)
-    oid_list_len++;
+  while (walk->filter_cells_head != NULL) {
+    csnmp_cell_char_t *next = walk->filter_cells_head->next;
+    sfree(walk->filter_cells_head);
+    walk->filter_cells_head = next;
+  }
 
-  if (data->filter_oid.oid_len > 0)
-    oid_list_len++;
+  for (size_t i = 0;
+       (walk->value_cells_head != NULL) && (i < walk->data->values_len); i++) {
+    while (walk->value_cells_head[i] != NULL) {
+      csnmp_cell_value_t *next = walk->value_cells_head[i]->next;
+      sfree(walk->value_cells_head[i]);
+      walk->value_cells_head[i] = next;
+    }
+  }
 
-  /* Holds the last OID returned by the device. We use this in the GETNEXT
-   * request to proceed. */
-  oid_t oid_list[oid_list_len];
-  /* Set to false when an OID has left its subtree so we don't re-request it
-   * again. */
-  csnmp_oid_type_t oid_list_todo[oid_list_len];
+  sfree(walk->value_cells_head);
+  sfree(walk->value_cells_tail);
+  sfree(walk->oid_list);
+  sfree(walk->oid_list_todo);
+  sfree(walk->var_idx);
+  sfree(walk->values);
+} /* void csnmp_walk_free */
 
-  int status;
+static int csnmp_walk_init(csnmp_walk_t *walk, host_definition_t *host,
+                           data_definition_t *data) {
+  const data_set_t *ds;
   size_t i;
 
-  /* `value_list_head' and `value_cells_tail' implement a linked list for each
-   * value. `instance_cells_head' and `instance_cells_tail' implement a linked
-   * list of instance names. This is used to jump gaps in the table. */
-  csnmp_cell_char_t *type_instance_cells_head = NULL;
-  csnmp_cell_char_t *type_instance_cells_tail = NULL;
-  csnmp_cell_char_t *plugin_instance_cells_head = NULL;
-  csnmp_cell_char_t *plugin_instance_cells_tail = NULL;
-  csnmp_cell_char_t *hostname_cells_head = NULL;
-  csnmp_cell_char_t *hostname_cells_tail = NULL;
-  csnmp_cell_char_t *filter_cells_head = NULL;
-  csnmp_cell_char_t *filter_cells_tail = NULL;
-  csnmp_cell_value_t **value_cells_head;
-  csnmp_cell_value_t **value_cells_tail;
-
-  DEBUG("snmp plugin: csnmp_read_table (host = %s, data = %s)", host->name,
-        data->name);
-
-  if (host->sess_handle == NULL) {
-    DEBUG("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
-    return -1;
-  }
+  memset(walk, 0, sizeof(*walk));
+  walk->host = host;
+  walk->data = data;
+  walk->status = -1;
 
   ds = plugin_get_ds(data->type);
   if (!ds) {
     ERROR("snmp plugin: DataSet `%s' not defined.", data->type);
     return -1;
   }
+  walk->ds = ds;
+
+  if (!data->is_table) {
+    if (ds->ds_num != data->values_len) {
+      ERROR("snmp plugin: DataSet `%s' requires %" PRIsz
+            " values, but config talks "
+            "about %" PRIsz,
+            data->type, ds->ds_num, data->values_len);
+      return -1;
+    }
+
+    walk->values = malloc(sizeof(*walk->values) * data->values_len);
+    if (walk->values == NULL)
+      return -1;
+    for (i = 0; i < data->values_len; i++) {
+      if (ds->ds[i].type == DS_TYPE_COUNTER)
+        walk->values[i].counter = 0;
+      else
+        walk->values[i].gauge = NAN;
+    }
+
+    walk->status = 0;
+    return 0;
+  }
 
   if (data->count) {
     if (ds->ds_num != 1) {
@@ -1758,94 +1891,477 @@ static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
   }
   assert(data->values_len > 0);
 
+  walk->oid_list_len = data->values_len;
+  if (data->type_instance.oid.oid_len > 0)
+    walk->oid_list_len++;
+  if (data->plugin_instance.oid.oid_len > 0)
+    walk->oid_list_len++;
+  if (data->host.oid.oid_len > 0)
+    walk->oid_list_len++;
+  if (data->filter_oid.oid_len > 0)
+    walk->oid_list_len++;
+
+  /* We're going to construct n linked lists, one for each "value".
+   * value_cells_head will contain pointers to the heads of these linked lists,
+   * value_cells_tail will contain pointers to the tail of the lists. */
+  walk->oid_list = calloc(walk->oid_list_len, sizeof(*walk->oid_list));
+  walk->oid_list_todo =
+      calloc(walk->oid_list_len, sizeof(*walk->oid_list_todo));
+  walk->var_idx = calloc(walk->oid_list_len, sizeof(*walk->var_idx));
+  walk->value_cells_head =
+      calloc(data->values_len, sizeof(*walk->value_cells_head));
+  walk->value_cells_tail =
+      calloc(data->values_len, sizeof(*walk->value_cells_tail));
+  if ((walk->oid_list == NULL) || (walk->oid_list_todo == NULL) ||
+      (walk->var_idx == NULL) || (walk->value_cells_head == NULL) ||
+      (walk->value_cells_tail == NULL)) {
+    ERROR("snmp plugin: csnmp_walk_init: calloc failed.");
+    csnmp_walk_free(walk);
+    return -1;
+  }
+
   for (i = 0; i < data->values_len; i++)
-    oid_list_todo[i] = OID_TYPE_VARIABLE;
+    walk->oid_list_todo[i] = OID_TYPE_VARIABLE;
 
   /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
-  memcpy(oid_list, data->values, data->values_len * sizeof(oid_t));
+  memcpy(walk->oid_list, data->values, data->values_len * sizeof(oid_t));
 
   if (data->type_instance.oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->type_instance.oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_TYPEINSTANCE;
+    memcpy(walk->oid_list + i, &data->type_instance.oid, sizeof(oid_t));
+    walk->oid_list_todo[i] = OID_TYPE_TYPEINSTANCE;
     i++;
   }
 
   if (data->plugin_instance.oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->plugin_instance.oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_PLUGININSTANCE;
+    memcpy(walk->oid_list + i, &data->plugin_instance.oid, sizeof(oid_t));
+    walk->oid_list_todo[i] = OID_TYPE_PLUGININSTANCE;
     i++;
   }
 
   if (data->host.oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->host.oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_HOST;
+    memcpy(walk->oid_list + i, &data->host.oid, sizeof(oid_t));
+    walk->oid_list_todo[i] = OID_TYPE_HOST;
     i++;
   }
 
   if (data->filter_oid.oid_len > 0) {
-    memcpy(oid_list + i, &data->filter_oid, sizeof(oid_t));
-    oid_list_todo[i] = OID_TYPE_FILTER;
+    memcpy(walk->oid_list + i, &data->filter_oid, sizeof(oid_t));
+    walk->oid_list_todo[i] = OID_TYPE_FILTER;
     i++;
   }
 
-  /* We're going to construct n linked lists, one for each "value".
-   * value_cells_head will contain pointers to the heads of these linked lists,
-   * value_cells_tail will contain pointers to the tail of the lists. */
-  value_cells_head = calloc(data->values_len, sizeof(*value_cells_head));
-  value_cells_tail = calloc(data->values_len, sizeof(*value_cells_tail));
-  if ((value_cells_head == NULL) || (value_cells_tail == NULL)) {
-    ERROR("snmp plugin: csnmp_read_table: calloc failed.");
-    sfree(value_cells_head);
-    sfree(value_cells_tail);
-    return -1;
-  }
+  /* If SNMP v2 and later and bulk transfers enabled, use GETBULK PDU */
+  walk->bulk = (host->version > 1) && (host->bulk_size > 0);
+  walk->max_repetitions = host->bulk_size;
 
-  status = 0;
-  while (status == 0) {
-    /* If SNMP v2 and later and bulk transfers enabled, use GETBULK PDU */
-    if (host->version > 1 && host->bulk_size > 0) {
-      req = snmp_pdu_create(SNMP_MSG_GETBULK);
-      req->non_repeaters = 0;
-      req->max_repetitions = host->bulk_size;
-    } else {
-      req = snmp_pdu_create(SNMP_MSG_GETNEXT);
-    }
+  walk->status = 0;
+  return 0;
+} /* int csnmp_walk_init */
+
+/* Returns the next request of the walk or NULL if the walk is finished, either
+ * because all variables have left their subtree or because of an error. */
+static struct snmp_pdu *csnmp_walk_request(csnmp_walk_t *walk) {
+  data_definition_t *data = walk->data;
+  struct snmp_pdu *req;
+
+  if ((walk->status != 0) || walk->done)
+    return NULL;
+
+  if (!data->is_table) {
+    req = snmp_pdu_create(SNMP_MSG_GET);
     if (req == NULL) {
       ERROR("snmp plugin: snmp_pdu_create failed.");
-      status = -1;
-      break;
+      walk->status = -1;
+      return NULL;
     }
 
-    size_t oid_list_todo_num = 0;
-    size_t var_idx[oid_list_len];
-    memset(var_idx, 0, sizeof(var_idx));
+    for (size_t i = 0; i < data->values_len; i++)
+      snmp_add_null_var(req, data->values[i].oid, data->values[i].oid_len);
 
-    for (i = 0; i < oid_list_len; i++) {
-      /* Do not rerequest already finished OIDs */
-      if (!oid_list_todo[i])
-        continue;
-      snmp_add_null_var(req, oid_list[i].oid, oid_list[i].oid_len);
-      var_idx[oid_list_todo_num] = i;
-      oid_list_todo_num++;
+    return req;
+  }
+
+  if (walk->bulk) {
+    req = snmp_pdu_create(SNMP_MSG_GETBULK);
+    if (req != NULL) {
+      req->non_repeaters = 0;
+      req->max_repetitions = walk->max_repetitions;
+    }
+  } else {
+    req = snmp_pdu_create(SNMP_MSG_GETNEXT);
+  }
+  if (req == NULL) {
+    ERROR("snmp plugin: snmp_pdu_create failed.");
+    walk->status = -1;
+    return NULL;
+  }
+
+  walk->oid_list_todo_num = 0;
+  memset(walk->var_idx, 0, walk->oid_list_len * sizeof(*walk->var_idx));
+
+  for (size_t i = 0; i < walk->oid_list_len; i++) {
+    /* Do not rerequest already finished OIDs */
+    if (!walk->oid_list_todo[i])
+      continue;
+    snmp_add_null_var(req, walk->oid_list[i].oid, walk->oid_list[i].oid_len);
+    walk->var_idx[walk->oid_list_todo_num] = i;
+    walk->oid_list_todo_num++;
+  }
+
+  if (walk->oid_list_todo_num == 0) {
+    /* The request is still empty - so we are finished */
+    DEBUG("snmp plugin: all variables have left their subtree");
+    snmp_free_pdu(req);
+    walk->done = true;
+    return NULL;
+  }
+
+  if (req->command == SNMP_MSG_GETBULK) {
+    /* In bulk mode the host will send 'max_repetitions' values per
+       requested variable, so we need to split it per number of variable
+       to stay 'in budget' */
+    req->max_repetitions =
+        walk->max_repetitions / (int)walk->oid_list_todo_num;
+    if (req->max_repetitions < 1)
+      req->max_repetitions = 1;
+  }
+
+  return req;
+} /* struct snmp_pdu *csnmp_walk_request */
+
+static void csnmp_walk_response_value(csnmp_walk_t *walk,
+                                      struct snmp_pdu *res) {
+  host_definition_t *host = walk->host;
+  data_definition_t *data = walk->data;
+
+  for (struct variable_list *vb = res->variables; vb != NULL;
+       vb = vb->next_variable) {
+#if COLLECT_DEBUG
+    char buffer[1024];
+    snprint_variable(buffer, sizeof(buffer), vb->name, vb->name_length, vb);
+    DEBUG("snmp plugin: Got this variable: %s", buffer);
+#endif /* COLLECT_DEBUG */
+
+    for (size_t i = 0; i < data->values_len; i++)
+      if (snmp_oid_compare(data->values[i].oid, data->values[i].oid_len,
+                           vb->name, vb->name_length) == 0)
+        walk->values[i] = csnmp_value_list_to_value(
+            vb, walk->ds->ds[i].type, data->scale, data->shift, host->name,
+            data->name);
+  } /* for (res->variables) */
+
+  walk->done = true;
+} /* void csnmp_walk_response_value */
+
+/* Handles the response to the last request of the walk. Does not free "res".
+ */
+static void csnmp_walk_response(csnmp_walk_t *walk, struct snmp_pdu *res) {
+  host_definition_t *host = walk->host;
+  data_definition_t *data = walk->data;
+  const data_set_t *ds = walk->ds;
+  struct variable_list *vb;
+  size_t i;
+
+  if (!data->is_table) {
+    csnmp_walk_response_value(walk, res);
+    return;
+  }
+
+  if ((res->errstat == SNMP_ERR_TOOBIG) && walk->bulk &&
+      (walk->max_repetitions / (int)walk->oid_list_todo_num > 1)) {
+    /* The agent could not fit all repetitions into one message. Ask for fewer
+     * and repeat the request. */
+    walk->max_repetitions /= 2;
+    DEBUG("snmp plugin: host = %s; data = %s; Reducing the bulk size to %i.",
+          host->name, data->name, walk->max_repetitions);
+    return;
+  }
+
+  vb = res->variables;
+  if (vb == NULL) {
+    walk->status = -1;
+    return;
+  }
+
+  if (res->errstat != SNMP_ERR_NOERROR) {
+    if (res->errindex != 0) {
+      /* Find the OID which caused error */
+      for (i = 1, vb = res->variables; vb != NULL && i != res->errindex;
+           vb = vb->next_variable, i++)
+        /* do nothing */;
+    }
+
+    if ((res->errindex == 0) || (vb == NULL)) {
+      ERROR("snmp plugin: host %s; data %s: response error: %s (%li) ",
+            host->name, data->name, snmp_errstring(res->errstat),
+            res->errstat);
+      walk->status = -1;
+      return;
     }
 
-    if (oid_list_todo_num == 0) {
-      /* The request is still empty - so we are finished */
-      DEBUG("snmp plugin: all variables have left their subtree");
-      snmp_free_pdu(req);
-      status = 0;
+    char oid_buffer[1024] = {0};
+    snprint_objid(oid_buffer, sizeof(oid_buffer) - 1, vb->name,
+                  vb->name_length);
+    NOTICE("snmp plugin: host %s; data %s: OID `%s` failed: %s", host->name,
+           data->name, oid_buffer, snmp_errstring(res->errstat));
+
+    /* Get value index from todo list and skip OID found */
+    assert(res->errindex <= walk->oid_list_todo_num);
+    i = walk->var_idx[res->errindex - 1];
+    assert(i < walk->oid_list_len);
+    walk->oid_list_todo[i] = 0;
+    return;
+  }
+
+  size_t j;
+  for (vb = res->variables, j = 0; (vb != NULL); vb = vb->next_variable, j++) {
+    i = j;
+    /* If bulk request is active convert value index of the extra value */
+    if (walk->bulk) {
+      i %= walk->oid_list_todo_num;
+    }
+    /* Calculate value index from todo list */
+    while ((i < walk->oid_list_len) && !walk->oid_list_todo[i]) {
+      i++;
+      j++;
+    }
+    if (i >= walk->oid_list_len) {
       break;
     }
 
-    if (req->command == SNMP_MSG_GETBULK) {
-      /* In bulk mode the host will send 'max_repetitions' values per
-         requested variable, so we need to split it per number of variable
-         to stay 'in budget' */
-      req->max_repetitions = floor(host->bulk_size / oid_list_todo_num);
+    /* An instance is configured and the res variable we process is the
+     * instance value */
+    if (walk->oid_list_todo[i] == OID_TYPE_TYPEINSTANCE) {
+      if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+          (snmp_oid_ncompare(
+               data->type_instance.oid.oid, data->type_instance.oid.oid_len,
+               vb->name, vb->name_length,
+               data->type_instance.oid.oid_len) != 0)) {
+        DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
+              "subtree.",
+              host->name, data->name);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+       * add it to the list */
+      csnmp_cell_char_t *cell =
+          csnmp_get_char_cell(vb, &data->type_instance.oid, host, data);
+      if (cell == NULL) {
+        ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
+              host->name);
+        walk->status = -1;
+        return;
+      }
+
+      if (csnmp_ignore_instance(cell, data)) {
+        sfree(cell);
+      } else {
+        csnmp_cell_replace_reserved_chars(cell);
+
+        DEBUG("snmp plugin: il->type_instance = `%s';", cell->value);
+        csnmp_cells_append(&walk->type_instance_cells_head,
+                           &walk->type_instance_cells_tail, cell);
+      }
+    } else if (walk->oid_list_todo[i] == OID_TYPE_PLUGININSTANCE) {
+      if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+          (snmp_oid_ncompare(data->plugin_instance.oid.oid,
+                             data->plugin_instance.oid.oid_len, vb->name,
+                             vb->name_length,
+                             data->plugin_instance.oid.oid_len) != 0)) {
+        DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
+              "subtree.",
+              host->name, data->name);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+       * add it to the list */
+      csnmp_cell_char_t *cell =
+          csnmp_get_char_cell(vb, &data->plugin_instance.oid, host, data);
+      if (cell == NULL) {
+        ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
+              host->name);
+        walk->status = -1;
+        return;
+      }
+
+      csnmp_cell_replace_reserved_chars(cell);
+
+      DEBUG("snmp plugin: il->plugin_instance = `%s';", cell->value);
+      csnmp_cells_append(&walk->plugin_instance_cells_head,
+                         &walk->plugin_instance_cells_tail, cell);
+    } else if (walk->oid_list_todo[i] == OID_TYPE_HOST) {
+      if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+          (snmp_oid_ncompare(data->host.oid.oid, data->host.oid.oid_len,
+                             vb->name, vb->name_length,
+                             data->host.oid.oid_len) != 0)) {
+        DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
+              host->name, data->name);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+       * add it to the list */
+      csnmp_cell_char_t *cell =
+          csnmp_get_char_cell(vb, &data->host.oid, host, data);
+      if (cell == NULL) {
+        ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
+              host->name);
+        walk->status = -1;
+        return;
+      }
+
+      csnmp_cell_replace_reserved_chars(cell);
+
+      DEBUG("snmp plugin: il->hostname = `%s';", cell->value);
+      csnmp_cells_append(&walk->hostname_cells_head,
+                         &walk->hostname_cells_tail, cell);
+    } else if (walk->oid_list_todo[i] == OID_TYPE_FILTER) {
+      if ((vb->type == SNMP_ENDOFMIBVIEW) ||
+          (snmp_oid_ncompare(data->filter_oid.oid, data->filter_oid.oid_len,
+                             vb->name, vb->name_length,
+                             data->filter_oid.oid_len) != 0)) {
+        DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
+              host->name, data->name);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Allocate a new `csnmp_cell_char_t', insert the instance name and
+       * add it to the list */
+      csnmp_cell_char_t *cell =
+          csnmp_get_char_cell(vb, &data->filter_oid, host, data);
+      if (cell == NULL) {
+        ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
+              host->name);
+        walk->status = -1;
+        return;
+      }
+
+      csnmp_cell_replace_reserved_chars(cell);
+
+      DEBUG("snmp plugin: il->filter = `%s';", cell->value);
+      csnmp_cells_append(&walk->filter_cells_head, &walk->filter_cells_tail,
+                         cell);
+    } else /* The variable we are processing is a normal value */
+    {
+      assert(walk->oid_list_todo[i] == OID_TYPE_VARIABLE);
+
+      csnmp_cell_value_t *vt;
+      oid_t vb_name;
+      oid_t suffix;
+      int ret;
+
+      csnmp_oid_init(&vb_name, vb->name, vb->name_length);
+
+      /* Calculate the current suffix. This is later used to check that the
+       * suffix is increasing. This also checks if we left the subtree */
+      ret = csnmp_oid_suffix(&suffix, &vb_name, data->values + i);
+      if (ret != 0) {
+        DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
+              "Value probably left its subtree.",
+              host->name, data->name, i);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      /* Make sure the OIDs returned by the agent are increasing. Otherwise
+       * our table matching algorithm will get confused. */
+      if ((walk->value_cells_tail[i] != NULL) &&
+          (csnmp_oid_compare(&suffix, &walk->value_cells_tail[i]->suffix) <=
+           0)) {
+        DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
+              "Suffix is not increasing.",
+              host->name, data->name, i);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      vt = calloc(1, sizeof(*vt));
+      if (vt == NULL) {
+        ERROR("snmp plugin: calloc failed.");
+        walk->status = -1;
+        return;
+      }
+
+      vt->value = csnmp_value_list_to_value(vb, ds->ds[i].type, data->scale,
+                                            data->shift, host->name,
+                                            data->name);
+      memcpy(&vt->suffix, &suffix, sizeof(vt->suffix));
+      vt->next = NULL;
+
+      if (walk->value_cells_tail[i] == NULL)
+        walk->value_cells_head[i] = vt;
+      else
+        walk->value_cells_tail[i]->next = vt;
+      walk->value_cells_tail[i] = vt;
     }
 
-    res = NULL;
-    status = snmp_sess_synch_response(host->sess_handle, req, &res);
+    /* Copy OID to oid_list[i] */
+    memcpy(walk->oid_list[i].oid, vb->name, sizeof(oid) * vb->name_length);
+    walk->oid_list[i].oid_len = vb->name_length;
+
+  } /* for (vb = res->variables ...) */
+} /* void csnmp_walk_response */
+
+/* Dispatches the values collected by a successful walk and frees the walk's
+ * resources. */
+static int csnmp_walk_finish(csnmp_walk_t *walk) {
+  host_definition_t *host = walk->host;
+  data_definition_t *data = walk->data;
+  int status = walk->status;
+
+  if ((status == 0) && data->is_table) {
+    csnmp_dispatch_table(host, data, walk->type_instance_cells_head,
+                         walk->plugin_instance_cells_head,
+                         walk->hostname_cells_head, walk->filter_cells_head,
+                         walk->value_cells_head, data->count);
+  } else if (status == 0) {
+    value_list_t vl = VALUE_LIST_INIT;
+
+    vl.values = walk->values;
+    vl.values_len = data->values_len;
+    vl.interval = host->interval;
+    sstrncpy(vl.host, host->name, sizeof(vl.host));
+    sstrncpy(vl.plugin, data->plugin_name, sizeof(vl.plugin));
+    sstrncpy(vl.type, data->type, sizeof(vl.type));
+    if (data->type_instance.value)
+      sstrncpy(vl.type_instance, data->type_instance.value,
+               sizeof(vl.type_instance));
+    if (data->plugin_instance.value)
+      sstrncpy(vl.plugin_instance, data->plugin_instance.value,
+               sizeof(vl.plugin_instance));
+
+    DEBUG("snmp plugin: -> plugin_dispatch_values (&vl);");
+    plugin_dispatch_values(&vl);
+  }
+
+  csnmp_walk_free(walk);
+  return status;
+} /* int csnmp_walk_finish */
+
+static int csnmp_read_data(host_definition_t *host, data_definition_t *data) {
+  csnmp_walk_t walk;
+  struct snmp_pdu *req;
+
+  DEBUG("snmp plugin: csnmp_read_data (host = %s, data = %s)", host->name,
+        data->name);
+
+  if (host->sess_handle == NULL) {
+    DEBUG("snmp plugin: csnmp_read_data: host->sess_handle == NULL");
+    return -1;
+  }
+
+  if (csnmp_walk_init(&walk, host, data) != 0)
+    return -1;
+
+  while ((req = csnmp_walk_request(&walk)) != NULL) {
+    struct snmp_pdu *res = NULL;
+    int status = snmp_sess_synch_response(host->sess_handle, req, &res);
 
     /* snmp_sess_synch_response always frees our req PDU */
     req = NULL;
@@ -1866,406 +2382,362 @@ static int csnmp_read_table(host_definition_t *host, data_definition_t *data) {
       sfree(errstr);
       csnmp_host_close_session(host);
 
-      status = -1;
+      walk.status = -1;
       break;
     }
 
-    status = 0;
-    assert(res != NULL);
     c_release(LOG_INFO, &host->complaint,
               "snmp plugin: host %s: snmp_sess_synch_response successful.",
               host->name);
 
-    vb = res->variables;
-    if (vb == NULL) {
-      status = -1;
-      break;
-    }
+    csnmp_walk_response(&walk, res);
+    snmp_free_pdu(res);
+  }
 
-    if (res->errstat != SNMP_ERR_NOERROR) {
-      if (res->errindex != 0) {
-        /* Find the OID which caused error */
-        for (i = 1, vb = res->variables; vb != NULL && i != res->errindex;
-             vb = vb->next_variable, i++)
-          /* do nothing */;
-      }
+  return csnmp_walk_finish(&walk);
+} /* int csnmp_read_data */
 
-      if ((res->errindex == 0) || (vb == NULL)) {
-        ERROR("snmp plugin: host %s; data %s: response error: %s (%li) ",
-              host->name, data->name, snmp_errstring(res->errstat),
-              res->errstat);
-        status = -1;
-        break;
-      }
+/* The asynchronous poller. {{{
+ *
+ * With "PollerThreads", the read callback of a host only queues the host with
+ * one of the poller threads and returns immediately. The poller thread opens
+ * the host's session if needed, starts walking up to "ConcurrentRequests" of
+ * the host's data definitions and waits for the responses of all its hosts at
+ * once. Whenever a response arrives, the next request of that walk is sent. A
+ * slow or unreachable host thus only delays itself, not the other hosts.
+ */
+static void csnmp_poller_wakeup(csnmp_poller_t *p) {
+  /* If the pipe is full, the thread will wake up anyway. */
+  if (write(p->wakeup[1], "", 1) < 0 && errno != EAGAIN)
+    ERROR("snmp plugin: Waking up the poller thread failed: %s", STRERRNO);
+} /* void csnmp_poller_wakeup */
+
+static int csnmp_walk_callback(int operation, netsnmp_session *sess, int reqid,
+                               netsnmp_pdu *res, void *magic) {
+  csnmp_walk_t *walk = magic;
+  host_definition_t *host = walk->host;
+
+  walk->inflight = false;
+  host->inflight--;
+
+  if (operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) {
+    c_complain(LOG_ERR, &host->complaint,
+               "snmp plugin: host %s: Request %i %s.", host->name, reqid,
+               (operation == NETSNMP_CALLBACK_OP_TIMED_OUT) ? "timed out"
+                                                           : "failed");
+    walk->status = -1;
+    host->failed = true;
+    return 1;
+  }
 
-      char oid_buffer[1024] = {0};
-      snprint_objid(oid_buffer, sizeof(oid_buffer) - 1, vb->name,
-                    vb->name_length);
-      NOTICE("snmp plugin: host %s; data %s: OID `%s` failed: %s", host->name,
-             data->name, oid_buffer, snmp_errstring(res->errstat));
+  c_release(LOG_INFO, &host->complaint,
+            "snmp plugin: host %s: Received a response.", host->name);
 
-      /* Get value index from todo list and skip OID found */
-      assert(res->errindex <= oid_list_todo_num);
-      i = var_idx[res->errindex - 1];
-      assert(i < oid_list_len);
-      oid_list_todo[i] = 0;
+  /* The library frees "res" after we return. */
+  csnmp_walk_response(walk, res);
+  return 1;
+} /* int csnmp_walk_callback */
 
-      snmp_free_pdu(res);
-      res = NULL;
-      continue;
-    }
+/* Sends the next request of a walk or finishes the walk. */
+static void csnmp_walk_send(csnmp_walk_t *walk) {
+  host_definition_t *host = walk->host;
+  struct snmp_pdu *req;
 
-    size_t j;
-    for (vb = res->variables, j = 0; (vb != NULL);
-         vb = vb->next_variable, j++) {
-      i = j;
-      /* If bulk request is active convert value index of the extra value */
-      if (host->version > 1 && host->bulk_size > 0) {
-        i %= oid_list_todo_num;
-      }
-      /* Calculate value index from todo list */
-      while ((i < oid_list_len) && !oid_list_todo[i]) {
-        i++;
-        j++;
-      }
-      if (i >= oid_list_len) {
-        break;
-      }
+  /* Don't dispatch incomplete tables after a request to this host failed. */
+  if (host->failed)
+    walk->status = -1;
 
-      /* An instance is configured and the res variable we process is the
-       * instance value */
-      if (oid_list_todo[i] == OID_TYPE_TYPEINSTANCE) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->type_instance.oid.oid,
-                               data->type_instance.oid.oid_len, vb->name,
-                               vb->name_length,
-                               data->type_instance.oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
-                "subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+  req = csnmp_walk_request(walk);
+  if (req == NULL) {
+    csnmp_walk_finish(walk);
+    walk->finished = true;
+    return;
+  }
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->type_instance.oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+  if (snmp_sess_async_send(host->sess_handle, req, csnmp_walk_callback, walk) ==
+      0) {
+    char *errstr = NULL;
 
-        if (csnmp_ignore_instance(cell, data)) {
-          sfree(cell);
-        } else {
-          csnmp_cell_replace_reserved_chars(cell);
+    snmp_sess_error(host->sess_handle, NULL, NULL, &errstr);
+    c_complain(LOG_ERR, &host->complaint,
+               "snmp plugin: host %s: snmp_sess_async_send failed: %s",
+               host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+    sfree(errstr);
+    snmp_free_pdu(req);
 
-          DEBUG("snmp plugin: il->type_instance = `%s';", cell->value);
-          csnmp_cells_append(&type_instance_cells_head,
-                             &type_instance_cells_tail, cell);
-        }
-      } else if (oid_list_todo[i] == OID_TYPE_PLUGININSTANCE) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->plugin_instance.oid.oid,
-                               data->plugin_instance.oid.oid_len, vb->name,
-                               vb->name_length,
-                               data->plugin_instance.oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; TypeInstance left its "
-                "subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+    host->failed = true;
+    walk->status = -1;
+    csnmp_walk_finish(walk);
+    walk->finished = true;
+    return;
+  }
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->plugin_instance.oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+  walk->inflight = true;
+  host->inflight++;
+} /* void csnmp_walk_send */
 
-        csnmp_cell_replace_reserved_chars(cell);
+/* Marks the host as idle, so that its next read callback queues it again. */
+static void csnmp_poll_done(csnmp_poller_t *p, host_definition_t *host) {
+  pthread_mutex_lock(&p->lock);
+  host->queued = false;
+  pthread_mutex_unlock(&p->lock);
+} /* void csnmp_poll_done */
 
-        DEBUG("snmp plugin: il->plugin_instance = `%s';", cell->value);
-        csnmp_cells_append(&plugin_instance_cells_head,
-                           &plugin_instance_cells_tail, cell);
-      } else if (oid_list_todo[i] == OID_TYPE_HOST) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->host.oid.oid, data->host.oid.oid_len,
-                               vb->name, vb->name_length,
-                               data->host.oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+static void csnmp_poll_start(csnmp_poller_t *p, host_definition_t *host) {
+  if (host->sess_handle == NULL)
+    csnmp_host_open_session(host);
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->host.oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+  if (host->sess_handle == NULL) {
+    csnmp_poll_done(p, host);
+    return;
+  }
 
-        csnmp_cell_replace_reserved_chars(cell);
+  host->walks = calloc(host->data_list_len, sizeof(*host->walks));
+  if (host->walks == NULL) {
+    ERROR("snmp plugin: host %s: calloc failed.", host->name);
+    csnmp_poll_done(p, host);
+    return;
+  }
+  host->walks_next = 0;
+  host->inflight = 0;
+  host->failed = false;
 
-        DEBUG("snmp plugin: il->hostname = `%s';", cell->value);
-        csnmp_cells_append(&hostname_cells_head, &hostname_cells_tail, cell);
-      } else if (oid_list_todo[i] == OID_TYPE_FILTER) {
-        if ((vb->type == SNMP_ENDOFMIBVIEW) ||
-            (snmp_oid_ncompare(data->filter_oid.oid, data->filter_oid.oid_len,
-                               vb->name, vb->name_length,
-                               data->filter_oid.oid_len) != 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; Host left its subtree.",
-                host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+  host->poll_next = p->active;
+  p->active = host;
+} /* void csnmp_poll_start */
 
-        /* Allocate a new `csnmp_cell_char_t', insert the instance name and
-         * add it to the list */
-        csnmp_cell_char_t *cell =
-            csnmp_get_char_cell(vb, &data->filter_oid, host, data);
-        if (cell == NULL) {
-          ERROR("snmp plugin: host %s: csnmp_get_char_cell() failed.",
-                host->name);
-          status = -1;
-          break;
-        }
+/* Continues the walks which have received their response and starts new ones
+ * as the host's limit allows. Returns true when all walks are finished. */
+static bool csnmp_poll_advance(host_definition_t *host) {
+  for (int i = 0; i < host->walks_next; i++) {
+    csnmp_walk_t *walk = host->walks + i;
+    if (!walk->finished && !walk->inflight)
+      csnmp_walk_send(walk);
+  }
 
-        csnmp_cell_replace_reserved_chars(cell);
+  while (!host->failed && (host->inflight < host->max_inflight) &&
+         (host->walks_next < host->data_list_len)) {
+    csnmp_walk_t *walk = host->walks + host->walks_next;
+    data_definition_t *data = host->data_list[host->walks_next];
 
-        DEBUG("snmp plugin: il->filter = `%s';", cell->value);
-        csnmp_cells_append(&filter_cells_head, &filter_cells_tail, cell);
-      } else /* The variable we are processing is a normal value */
-      {
-        assert(oid_list_todo[i] == OID_TYPE_VARIABLE);
-
-        csnmp_cell_value_t *vt;
-        oid_t vb_name;
-        oid_t suffix;
-        int ret;
-
-        csnmp_oid_init(&vb_name, vb->name, vb->name_length);
-
-        /* Calculate the current suffix. This is later used to check that the
-         * suffix is increasing. This also checks if we left the subtree */
-        ret = csnmp_oid_suffix(&suffix, &vb_name, data->values + i);
-        if (ret != 0) {
-          DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
-                "Value probably left its subtree.",
-                host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        /* Make sure the OIDs returned by the agent are increasing. Otherwise
-         * our table matching algorithm will get confused. */
-        if ((value_cells_tail[i] != NULL) &&
-            (csnmp_oid_compare(&suffix, &value_cells_tail[i]->suffix) <= 0)) {
-          DEBUG("snmp plugin: host = %s; data = %s; i = %" PRIsz "; "
-                "Suffix is not increasing.",
-                host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+    host->walks_next++;
+    if (csnmp_walk_init(walk, host, data) != 0) {
+      walk->finished = true;
+      continue;
+    }
+    csnmp_walk_send(walk);
+  }
 
-        vt = calloc(1, sizeof(*vt));
-        if (vt == NULL) {
-          ERROR("snmp plugin: calloc failed.");
-          status = -1;
-          break;
-        }
+  return (host->inflight == 0);
+} /* bool csnmp_poll_advance */
 
-        vt->value =
-            csnmp_value_list_to_value(vb, ds->ds[i].type, data->scale,
-                                      data->shift, host->name, data->name);
-        memcpy(&vt->suffix, &suffix, sizeof(vt->suffix));
-        vt->next = NULL;
+static void csnmp_poll_finish(csnmp_poller_t *p, host_definition_t *host) {
+  /* Closing the session may call csnmp_walk_callback() for requests still in
+   * flight, so do this before freeing the walks. */
+  if (host->failed)
+    csnmp_host_close_session(host);
 
-        if (value_cells_tail[i] == NULL)
-          value_cells_head[i] = vt;
-        else
-          value_cells_tail[i]->next = vt;
-        value_cells_tail[i] = vt;
-      }
+  for (int i = 0; i < host->walks_next; i++) {
+    csnmp_walk_t *walk = host->walks + i;
+    if (walk->finished)
+      continue;
 
-      /* Copy OID to oid_list[i] */
-      memcpy(oid_list[i].oid, vb->name, sizeof(oid) * vb->name_length);
-      oid_list[i].oid_len = vb->name_length;
+    walk->status = -1;
+    csnmp_walk_finish(walk);
+    walk->finished = true;
+  }
+  sfree(host->walks);
+  host->walks_next = 0;
 
-    } /* for (vb = res->variables ...) */
+  csnmp_poll_done(p, host);
+} /* void csnmp_poll_finish */
 
-    if (res != NULL)
-      snmp_free_pdu(res);
-    res = NULL;
-  } /* while (status == 0) */
+static void *csnmp_poller_thread(void *arg) {
+  csnmp_poller_t *p = arg;
+  netsnmp_large_fd_set fdset;
 
-  if (res != NULL)
-    snmp_free_pdu(res);
-  res = NULL;
+  netsnmp_large_fd_set_init(&fdset, FD_SETSIZE);
 
-  if (status == 0)
-    csnmp_dispatch_table(host, data, type_instance_cells_head,
-                         plugin_instance_cells_head, hostname_cells_head,
-                         filter_cells_head, value_cells_head, data->count);
+  while (true) {
+    pthread_mutex_lock(&p->lock);
+    bool shutdown = p->shutdown;
+    host_definition_t *queue = p->queue_head;
+    p->queue_head = NULL;
+    p->queue_tail = NULL;
+    pthread_mutex_unlock(&p->lock);
 
-  /* Free all allocated variables here */
-  while (type_instance_cells_head != NULL) {
-    csnmp_cell_char_t *next = type_instance_cells_head->next;
-    sfree(type_instance_cells_head);
-    type_instance_cells_head = next;
-  }
+    if (shutdown)
+      break;
 
-  while (plugin_instance_cells_head != NULL) {
-    csnmp_cell_char_t *next = plugin_instance_cells_head->next;
-    sfree(plugin_instance_cells_head);
-    plugin_instance_cells_head = next;
-  }
+    while (queue != NULL) {
+      host_definition_t *host = queue;
+      queue = host->poll_next;
+      csnmp_poll_start(p, host);
+    }
 
-  while (hostname_cells_head != NULL) {
-    csnmp_cell_char_t *next = hostname_cells_head->next;
-    sfree(hostname_cells_head);
-    hostname_cells_head = next;
-  }
+    host_definition_t **host_ptr = &p->active;
+    while (*host_ptr != NULL) {
+      host_definition_t *host = *host_ptr;
+      if (csnmp_poll_advance(host)) {
+        *host_ptr = host->poll_next;
+        csnmp_poll_finish(p, host);
+      } else {
+        host_ptr = &host->poll_next;
+      }
+    }
 
-  while (filter_cells_head != NULL) {
-    csnmp_cell_char_t *next = filter_cells_head->next;
-    sfree(filter_cells_head);
-    filter_cells_head = next;
-  }
+    NETSNMP_LARGE_FD_ZERO(&fdset);
+    netsnmp_large_fd_setfd(p->wakeup[0], &fdset);
+    int numfds = p->wakeup[0] + 1;
+    struct timeval timeout = {0};
+    bool have_timeout = false;
+
+    for (host_definition_t *host = p->active; host != NULL;
+         host = host->poll_next) {
+      struct timeval tv = {0};
+      int block = 1;
+
+      snmp_sess_select_info2(host->sess_handle, &numfds, &fdset, &tv, &block);
+      if (!block && (!have_timeout || timercmp(&tv, &timeout, <))) {
+        timeout = tv;
+        have_timeout = true;
+      }
+    }
 
-  for (i = 0; i < data->values_len; i++) {
-    while (value_cells_head[i] != NULL) {
-      csnmp_cell_value_t *next = value_cells_head[i]->next;
-      sfree(value_cells_head[i]);
-      value_cells_head[i] = next;
+    int status = netsnmp_large_fd_set_select(numfds, &fdset, NULL, NULL,
+                                             have_timeout ? &timeout : NULL);
+    if (status < 0) {
+      if (errno != EINTR)
+        ERROR("snmp plugin: select failed: %s", STRERRNO);
+      continue;
     }
-  }
 
-  sfree(value_cells_head);
-  sfree(value_cells_tail);
+    if (netsnmp_large_fd_is_set(p->wakeup[0], &fdset)) {
+      char buffer[64];
+      while (read(p->wakeup[0], buffer, sizeof(buffer)) > 0)
+        /* drain the pipe */;
+    }
 
-  return 0;
-} /* int csnmp_read_table */
+    /* Calls csnmp_walk_callback() for received responses and for requests
+     * which have timed out after all retries. */
+    for (host_definition_t *host = p->active; host != NULL;
+         host = host->poll_next) {
+      if (status > 0)
+        snmp_sess_read2(host->sess_handle, &fdset);
+      snmp_sess_timeout(host->sess_handle);
+    }
+  }
 
-static int csnmp_read_value(host_definition_t *host, data_definition_t *data) {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
-  struct variable_list *vb;
+  while (p->active != NULL) {
+    host_definition_t *host = p->active;
+    p->active = host->poll_next;
 
-  const data_set_t *ds;
-  value_list_t vl = VALUE_LIST_INIT;
+    host->failed = true;
+    csnmp_poll_finish(p, host);
+  }
 
-  int status;
-  size_t i;
+  netsnmp_large_fd_set_cleanup(&fdset);
+  return NULL;
+} /* void *csnmp_poller_thread */
 
-  DEBUG("snmp plugin: csnmp_read_value (host = %s, data = %s)", host->name,
-        data->name);
+static int csnmp_poll_enqueue(host_definition_t *host) {
+  csnmp_poller_t *p = pollers + (host->index % pollers_num);
 
-  if (host->sess_handle == NULL) {
-    DEBUG("snmp plugin: csnmp_read_value: host->sess_handle == NULL");
-    return -1;
+  pthread_mutex_lock(&p->lock);
+  if (host->queued) {
+    pthread_mutex_unlock(&p->lock);
+    c_complain(LOG_WARNING, &host->busy_complaint,
+               "snmp plugin: host %s: The previous poll has not finished yet, "
+               "skipping this interval.",
+               host->name);
+    return 0;
   }
 
-  ds = plugin_get_ds(data->type);
-  if (!ds) {
-    ERROR("snmp plugin: DataSet `%s' not defined.", data->type);
-    return -1;
-  }
+  host->queued = true;
+  host->poll_next = NULL;
+  if (p->queue_tail == NULL)
+    p->queue_head = host;
+  else
+    p->queue_tail->poll_next = host;
+  p->queue_tail = host;
+  pthread_mutex_unlock(&p->lock);
 
-  if (ds->ds_num != data->values_len) {
-    ERROR("snmp plugin: DataSet `%s' requires %" PRIsz
-          " values, but config talks "
-          "about %" PRIsz,
-          data->type, ds->ds_num, data->values_len);
-    return -1;
-  }
+  c_release(LOG_INFO, &host->busy_complaint,
+            "snmp plugin: host %s: The previous poll has finished.",
+            host->name);
 
-  vl.values_len = ds->ds_num;
-  vl.values = malloc(sizeof(*vl.values) * vl.values_len);
-  if (vl.values == NULL)
-    return -1;
-  for (i = 0; i < vl.values_len; i++) {
-    if (ds->ds[i].type == DS_TYPE_COUNTER)
-      vl.values[i].counter = 0;
-    else
-      vl.values[i].gauge = NAN;
-  }
+  csnmp_poller_wakeup(p);
+  return 0;
+} /* int csnmp_poll_enqueue */
 
-  sstrncpy(vl.host, host->name, sizeof(vl.host));
-  sstrncpy(vl.plugin, data->plugin_name, sizeof(vl.plugin));
-  sstrncpy(vl.type, data->type, sizeof(vl.type));
-  if (data->type_instance.value)
-    sstrncpy(vl.type_instance, data->type_instance.value,
-             sizeof(vl.type_instance));
-  if (data->plugin_instance.value)
-    sstrncpy(vl.plugin_instance, data->plugin_instance.value,
-             sizeof(vl.plugin_instance));
-
-  req = snmp_pdu_create(SNMP_MSG_GET);
-  if (req == NULL) {
-    ERROR("snmp plugin: snmp_pdu_create failed.");
-    sfree(vl.values);
+static int csnmp_pollers_start(size_t num) {
+  pthread_mutex_lock(&pollers_lock);
+
+  pollers = calloc(num, sizeof(*pollers));
+  if (pollers == NULL) {
+    pthread_mutex_unlock(&pollers_lock);
+    ERROR("snmp plugin: calloc failed.");
     return -1;
   }
 
-  for (i = 0; i < data->values_len; i++)
-    snmp_add_null_var(req, data->values[i].oid, data->values[i].oid_len);
+  for (size_t i = 0; i < num; i++) {
+    csnmp_poller_t *p = pollers + i;
+    char name[16];
 
-  status = snmp_sess_synch_response(host->sess_handle, req, &res);
+    if (pipe(p->wakeup) != 0) {
+      ERROR("snmp plugin: pipe failed: %s", STRERRNO);
+      break;
+    }
+    fcntl(p->wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(p->wakeup[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&p->lock, NULL);
 
-  if ((status != STAT_SUCCESS) || (res == NULL)) {
-    char *errstr = NULL;
+    ssnprintf(name, sizeof(name), "snmp poll#%" PRIsz, i);
+    int status = plugin_thread_create(&p->thread, csnmp_poller_thread, p, name);
+    if (status != 0) {
+      ERROR("snmp plugin: Cannot create poller thread #%" PRIsz ".", i);
+      pthread_mutex_destroy(&p->lock);
+      close(p->wakeup[0]);
+      close(p->wakeup[1]);
+      break;
+    }
 
-    snmp_sess_error(host->sess_handle, NULL, NULL, &errstr);
-    ERROR("snmp plugin: host %s: snmp_sess_synch_response failed: %s",
-          host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+    pollers_num++;
+  }
 
-    if (res != NULL)
-      snmp_free_pdu(res);
+  if (pollers_num == 0) {
+    WARNING("snmp plugin: No poller thread could be started, polling hosts "
+            "synchronously.");
+    sfree(pollers);
+  }
 
-    sfree(errstr);
-    sfree(vl.values);
-    csnmp_host_close_session(host);
+  pthread_mutex_unlock(&pollers_lock);
+  return 0;
+} /* int csnmp_pollers_start */
 
-    return -1;
-  }
+static void csnmp_pollers_stop(void) {
+  pthread_mutex_lock(&pollers_lock);
 
-  for (vb = res->variables; vb != NULL; vb = vb->next_variable) {
-#if COLLECT_DEBUG
-    char buffer[1024];
-    snprint_variable(buffer, sizeof(buffer), vb->name, vb->name_length, vb);
-    DEBUG("snmp plugin: Got this variable: %s", buffer);
-#endif /* COLLECT_DEBUG */
+  for (size_t i = 0; i < pollers_num; i++) {
+    csnmp_poller_t *p = pollers + i;
 
-    for (i = 0; i < data->values_len; i++)
-      if (snmp_oid_compare(data->values[i].oid, data->values[i].oid_len,
-                           vb->name, vb->name_length) == 0)
-        vl.values[i] =
-            csnmp_value_list_to_value(vb, ds->ds[i].type, data->scale,
-                                      data->shift, host->name, data->name);
-  } /* for (res->variables) */
+    pthread_mutex_lock(&p->lock);
+    p->shutdown = true;
+    pthread_mutex_unlock(&p->lock);
+    csnmp_poller_wakeup(p);
 
-  snmp_free_pdu(res);
+    pthread_join(p->thread, NULL);
+    pthread_mutex_destroy(&p->lock);
+    close(p->wakeup[0]);
+    close(p->wakeup[1]);
+  }
 
-  DEBUG("snmp plugin: -> plugin_dispatch_values (&vl);");
-  plugin_dispatch_values(&vl);
-  sfree(vl.values);
+  sfree(pollers);
+  pollers_num = 0;
 
-  return 0;
-} /* int csnmp_read_value */
+  pthread_mutex_unlock(&pollers_lock);
+} /* void csnmp_pollers_stop */
+/* }}} End of the asynchronous poller. */
 
 static int csnmp_read_host(user_data_t *ud) {
   host_definition_t *host;
@@ -2275,6 +2747,9 @@ static int csnmp_read_host(user_data_t *ud) {
 
   host = ud->data;
 
+  if (pollers_num > 0)
+    return csnmp_poll_enqueue(host);
+
   if (host->sess_handle == NULL)
     csnmp_host_open_session(host);
 
@@ -2285,10 +2760,7 @@ static int csnmp_read_host(user_data_t *ud) {
   for (i = 0; i < host->data_list_len; i++) {
     data_definition_t *data = host->data_list[i];
 
-    if (data->is_table)
-      status = csnmp_read_table(host, data);
-    else
-      status = csnmp_read_value(host, data);
+    status = csnmp_read_data(host, data);
 
     if (status == 0)
       success++;
@@ -2303,6 +2775,9 @@ static int csnmp_read_host(user_data_t *ud) {
 static int csnmp_init(void) {
   call_snmp_init_once();
 
+  if ((poller_threads > 0) && (pollers == NULL))
+    return csnmp_pollers_start((size_t)poller_threads);
+
   return 0;
 } /* int csnmp_init */
 
@@ -2312,6 +2787,8 @@ static int csnmp_shutdown(void) {
 
   /* When we get here, the read threads have been stopped and all the
    * `host_definition_t' will be freed. */
+  csnmp_pollers_stop();
+
   DEBUG("snmp plugin: Destroying all data definitions.");
 
   data_this = data_head;
@@ -0,0 +1,375 @@
+/**
+ * collectd - src/snmp_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ **/
+
+/* The sessions are mocked, the PDUs are built with the real library. */
+#define plugin_dispatch_values plugin_dispatch_values_snmp_test
+#define snmp_sess_async_send snmp_sess_async_send_snmp_test
+#define snmp_sess_close snmp_sess_close_snmp_test
+#define snmp_sess_error snmp_sess_error_snmp_test
+
+#include "snmp.c" /* sic */
+#include "testing.h"
+
+#define MOCK_REQUESTS_MAX 8
+#define TEST_OID_LEN 8
+
+typedef struct {
+  netsnmp_pdu *req;
+  netsnmp_callback callback;
+  void *magic;
+  int reqid;
+} mock_request_t;
+
+/* A session which keeps the requests sent with snmp_sess_async_send() until
+ * the test answers them with mock_reply() or mock_fail(). */
+typedef struct {
+  mock_request_t requests[MOCK_REQUESTS_MAX];
+  size_t requests_num;
+  int reqid;
+  bool fail_send;
+  int closed;
+} mock_session_t;
+
+static size_t dispatched;
+static derive_t dispatched_sum;
+
+int plugin_dispatch_values_snmp_test(value_list_t const *vl) {
+  dispatched++;
+  dispatched_sum += vl->values[0].derive;
+  return 0;
+}
+
+int snmp_sess_async_send_snmp_test(void *sessp, netsnmp_pdu *req,
+                                   netsnmp_callback callback, void *magic) {
+  mock_session_t *s = sessp;
+
+  if (s->fail_send || (s->requests_num >= MOCK_REQUESTS_MAX))
+    return 0;
+
+  s->reqid++;
+  s->requests[s->requests_num] = (mock_request_t){
+      .req = req,
+      .callback = callback,
+      .magic = magic,
+      .reqid = s->reqid,
+  };
+  s->requests_num++;
+  return s->reqid;
+}
+
+int snmp_sess_close_snmp_test(void *sessp) {
+  mock_session_t *s = sessp;
+
+  s->closed++;
+  return 1;
+}
+
+void snmp_sess_error_snmp_test(__attribute__((unused)) void *sessp,
+                               __attribute__((unused)) int *clib_errorno,
+                               __attribute__((unused)) int *snmp_errorno,
+                               char **errstring) {
+  *errstring = strdup("mock error");
+}
+
+/* Removes the oldest request from the session. */
+static mock_request_t mock_pop(mock_session_t *s) {
+  mock_request_t r = s->requests[0];
+
+  s->requests_num--;
+  memmove(s->requests, s->requests + 1,
+          s->requests_num * sizeof(*s->requests));
+  return r;
+}
+
+/* Answers the oldest request. Each requested variable gets the value "value"
+ * at its own OID, or, for GETNEXT requests, at the row "next" of its column.
+ * "next" == 0 makes GETNEXT requests leave their subtree. */
+static void mock_reply(mock_session_t *s, long value, oid next) {
+  mock_request_t r = mock_pop(s);
+  netsnmp_pdu *res = snmp_pdu_create(SNMP_MSG_RESPONSE);
+
+  for (netsnmp_variable_list *vb = r.req->variables; vb != NULL;
+       vb = vb->next_variable) {
+    oid name[MAX_OID_LEN];
+    size_t name_len = vb->name_length;
+
+    memcpy(name, vb->name, name_len * sizeof(oid));
+    if (r.req->command == SNMP_MSG_GETNEXT) {
+      name_len = TEST_OID_LEN;
+      if (next == 0)
+        name[name_len - 1]++;
+      else
+        name[name_len++] = next;
+    }
+
+    snmp_pdu_add_variable(res, name, name_len, ASN_COUNTER, (u_char *)&value,
+                          sizeof(value));
+  }
+
+  r.callback(NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE, NULL, r.reqid, res,
+             r.magic);
+
+  snmp_free_pdu(res);
+  snmp_free_pdu(r.req);
+}
+
+/* Lets the oldest request time out. */
+static void mock_fail(mock_session_t *s) {
+  mock_request_t r = mock_pop(s);
+
+  r.callback(NETSNMP_CALLBACK_OP_TIMED_OUT, NULL, r.reqid, NULL, r.magic);
+  snmp_free_pdu(r.req);
+}
+
+static data_definition_t *data_new(bool is_table, oid last) {
+  data_definition_t *data = calloc(1, sizeof(*data));
+  oid_t value = {.oid = {1, 3, 6, 1, 2, 1, 2, last},
+                 .oid_len = TEST_OID_LEN};
+
+  data->name = strdup("test");
+  data->type = strdup("MAGIC");
+  data->plugin_name = strdup("snmp");
+  data->is_table = is_table;
+  data->scale = 1.0;
+  data->values = calloc(1, sizeof(*data->values));
+  memcpy(data->values, &value, sizeof(value));
+  data->values_len = 1;
+
+  return data;
+}
+
+static host_definition_t *host_new(mock_session_t *s, int max_inflight) {
+  host_definition_t *host = calloc(1, sizeof(*host));
+
+  host->name = strdup("test.example.com");
+  host->version = 1;
+  host->sess_handle = s;
+  host->max_inflight = max_inflight;
+  C_COMPLAIN_INIT(&host->complaint);
+  C_COMPLAIN_INIT(&host->busy_complaint);
+
+  host->data_list_len = 2;
+  host->data_list = calloc(host->data_list_len, sizeof(*host->data_list));
+  host->data_list[0] = data_new(false, 1);
+  host->data_list[1] = data_new(false, 2);
+
+  host->queued = true;
+  return host;
+}
+
+static void host_free(host_definition_t *host) {
+  for (int i = 0; i < host->data_list_len; i++)
+    csnmp_data_definition_destroy(host->data_list[i]);
+
+  host->sess_handle = NULL;
+  csnmp_host_definition_destroy(host);
+}
+
+static void reset(void) {
+  dispatched = 0;
+  dispatched_sum = 0;
+}
+
+DEF_TEST(poll_sequential) {
+  mock_session_t s = {0};
+  csnmp_poller_t p = {0};
+  host_definition_t *host = host_new(&s, 1);
+
+  reset();
+  pthread_mutex_init(&p.lock, NULL);
+
+  csnmp_poll_start(&p, host);
+  OK(p.active == host);
+
+  /* Only one request may be in flight. */
+  OK(!csnmp_poll_advance(host));
+  EXPECT_EQ_INT(1, (int)s.requests_num);
+  EXPECT_EQ_INT(SNMP_MSG_GET, s.requests[0].req->command);
+  EXPECT_EQ_INT(1, host->inflight);
+
+  mock_reply(&s, 10, 0);
+  EXPECT_EQ_INT(0, host->inflight);
+  EXPECT_EQ_INT(0, (int)dispatched);
+
+  /* The first walk is finished and the second one started. */
+  OK(!csnmp_poll_advance(host));
+  EXPECT_EQ_INT(1, (int)dispatched);
+  EXPECT_EQ_INT(1, (int)s.requests_num);
+
+  mock_reply(&s, 20, 0);
+  OK(csnmp_poll_advance(host));
+  EXPECT_EQ_INT(2, (int)dispatched);
+  EXPECT_EQ_INT(30, (int)dispatched_sum);
+
+  csnmp_poll_finish(&p, host);
+  OK(!host->queued);
+  OK(host->walks == NULL);
+  EXPECT_EQ_INT(0, s.closed);
+
+  host_free(host);
+  pthread_mutex_destroy(&p.lock);
+  return 0;
+}
+
+DEF_TEST(poll_concurrent) {
+  mock_session_t s = {0};
+  csnmp_poller_t p = {0};
+  host_definition_t *host = host_new(&s, 2);
+
+  reset();
+  pthread_mutex_init(&p.lock, NULL);
+
+  csnmp_poll_start(&p, host);
+  OK(!csnmp_poll_advance(host));
+  EXPECT_EQ_INT(2, (int)s.requests_num);
+  EXPECT_EQ_INT(2, host->inflight);
+
+  /* Responses may arrive in any order. */
+  mock_request_t first = mock_pop(&s);
+  mock_reply(&s, 20, 0);
+  s.requests[s.requests_num++] = first;
+
+  OK(!csnmp_poll_advance(host));
+  EXPECT_EQ_INT(1, (int)dispatched);
+  EXPECT_EQ_INT(20, (int)dispatched_sum);
+
+  mock_reply(&s, 10, 0);
+  OK(csnmp_poll_advance(host));
+  EXPECT_EQ_INT(2, (int)dispatched);
+  EXPECT_EQ_INT(30, (int)dispatched_sum);
+
+  csnmp_poll_finish(&p, host);
+  OK(!host->queued);
+
+  host_free(host);
+  pthread_mutex_destroy(&p.lock);
+  return 0;
+}
+
+DEF_TEST(poll_table) {
+  mock_session_t s = {0};
+  csnmp_poller_t p = {0};
+  host_definition_t *host = host_new(&s, 1);
+
+  reset();
+  pthread_mutex_init(&p.lock, NULL);
+
+  csnmp_data_definition_destroy(host->data_list[0]);
+  host->data_list[0] = data_new(true, 3);
+  host->data_list_len = 1;
+
+  csnmp_poll_start(&p, host);
+
+  /* Walk the table with GETNEXT until the agent leaves the subtree. */
+  OK(!csnmp_poll_advance(host));
+  EXPECT_EQ_INT(SNMP_MSG_GETNEXT, s.requests[0].req->command);
+  mock_reply(&s, 1, 1);
+
+  OK(!csnmp_poll_advance(host));
+  EXPECT_EQ_INT(1, (int)s.requests_num);
+  EXPECT_EQ_INT(TEST_OID_LEN + 1,
+                (int)s.requests[0].req->variables->name_length);
+  mock_reply(&s, 2, 2);
+
+  OK(!csnmp_poll_advance(host));
+  mock_reply(&s, 3, 0);
+
+  /* The walk is finished and dispatches one value per row. */
+  OK(csnmp_poll_advance(host));
+  EXPECT_EQ_INT(0, (int)s.requests_num);
+  EXPECT_EQ_INT(2, (int)dispatched);
+  EXPECT_EQ_INT(3, (int)dispatched_sum);
+
+  csnmp_poll_finish(&p, host);
+  OK(!host->queued);
+
+  host->data_list_len = 2;
+  host_free(host);
+  pthread_mutex_destroy(&p.lock);
+  return 0;
+}
+
+DEF_TEST(poll_timeout) {
+  mock_session_t s = {0};
+  csnmp_poller_t p = {0};
+  host_definition_t *host = host_new(&s, 1);
+
+  reset();
+  pthread_mutex_init(&p.lock, NULL);
+
+  csnmp_poll_start(&p, host);
+  OK(!csnmp_poll_advance(host));
+  mock_fail(&s);
+  OK(host->failed);
+  EXPECT_EQ_INT(0, host->inflight);
+
+  /* No further walks are started after a failure and nothing is dispatched.
+   */
+  OK(csnmp_poll_advance(host));
+  EXPECT_EQ_INT(0, (int)s.requests_num);
+  EXPECT_EQ_INT(1, host->walks_next);
+  EXPECT_EQ_INT(0, (int)dispatched);
+
+  /* The session is closed, so the next poll opens a new one. */
+  csnmp_poll_finish(&p, host);
+  EXPECT_EQ_INT(1, s.closed);
+  OK(host->sess_handle == NULL);
+  OK(!host->queued);
+
+  host_free(host);
+  pthread_mutex_destroy(&p.lock);
+  return 0;
+}
+
+DEF_TEST(poll_send_failure) {
+  mock_session_t s = {.fail_send = true};
+  csnmp_poller_t p = {0};
+  host_definition_t *host = host_new(&s, 2);
+
+  reset();
+  pthread_mutex_init(&p.lock, NULL);
+
+  csnmp_poll_start(&p, host);
+  OK(csnmp_poll_advance(host));
+  OK(host->failed);
+  EXPECT_EQ_INT(0, host->inflight);
+  EXPECT_EQ_INT(1, host->walks_next);
+  EXPECT_EQ_INT(0, (int)dispatched);
+
+  csnmp_poll_finish(&p, host);
+  EXPECT_EQ_INT(1, s.closed);
+  OK(!host->queued);
+
+  host_free(host);
+  pthread_mutex_destroy(&p.lock);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(poll_sequential);
+  RUN_TEST(poll_concurrent);
+  RUN_TEST(poll_table);
+  RUN_TEST(poll_timeout);
+  RUN_TEST(poll_send_failure);
+
+  END_TEST;
+}
@@ -24,6 +24,8 @@
  *   Florian octo Forster <octo at collectd.org>
  */
 
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
 #include "collectd.h"
 
 #include "plugin.h"
@@ -48,10 +50,26 @@
 #define STATSD_DEFAULT_SERVICE "8125"
 #endif
 
+/* Size of the receive buffer. Longer datagrams are truncated. */
+#define STATSD_PACKET_SIZE 4096
+
+/* Maximum number of datagrams read with one recvmmsg(2) call. */
+#define STATSD_RECEIVE_BATCH 32
+
+/* Number of independently locked parts of the metrics table. */
+#define STATSD_STRIPES 64
+
+/* Initial number of hash buckets per stripe; always a power of two. */
+#define STATSD_BUCKETS_INIT 64
+
 enum metric_type_e { STATSD_COUNTER, STATSD_TIMER, STATSD_GAUGE, STATSD_SET };
 typedef enum metric_type_e metric_type_t;
 
 struct statsd_metric_s {
+  char *name; /* with type prefix, e.g. "c:" */
+  uint32_t hash;
+  struct statsd_metric_s *next;
+
   metric_type_t type;
   double value;
   derive_t counter;
@@ -61,15 +79,64 @@ struct statsd_metric_s {
 };
 typedef struct statsd_metric_s statsd_metric_t;
 
-static c_avl_tree_t *metrics_tree;
-static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The metrics table is split into stripes, each with its own lock and hash
+ * table. A metric's stripe is chosen by the hash of its name, so receive
+ * threads updating different metrics rarely wait for each other. */
+struct statsd_stripe_s {
+  pthread_mutex_t lock;
+  statsd_metric_t **buckets;
+  size_t buckets_num;
+  size_t metrics_num;
+};
+typedef struct statsd_stripe_s statsd_stripe_t;
+
+/* statsd_read() copies the values of all metrics into snapshots while holding
+ * the stripe locks and dispatches them afterwards. The name points into the
+ * metric, which is safe because only statsd_read() frees metrics. */
+struct statsd_snapshot_s {
+  char const *name;
+  metric_type_t type;
+  bool have_events;
+
+  gauge_t value;
+  gauge_t delta;
+  derive_t counter;
+
+  gauge_t timer_average;
+  gauge_t timer_lower;
+  gauge_t timer_upper;
+  gauge_t timer_sum;
+  size_t timer_count;
+};
+typedef struct statsd_snapshot_s statsd_snapshot_t;
+
+struct statsd_receiver_s {
+  pthread_t thread;
+  bool running;
+
+  char *buffer;
+#if HAVE_RECVMMSG
+  struct mmsghdr *msgs;
+  struct iovec *iov;
+#endif
+};
+typedef struct statsd_receiver_s statsd_receiver_t;
 
-static pthread_t network_thread;
-static bool network_thread_running;
+static statsd_stripe_t stripes[STATSD_STRIPES];
+static bool stripes_initialized;
+static pthread_mutex_t stripes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static statsd_snapshot_t *snapshots;
+static gauge_t *snapshot_percentiles;
+static size_t snapshots_size;
+
+static statsd_receiver_t *receivers;
+static size_t receivers_num;
 static bool network_thread_shutdown;
 
 static char *conf_node;
 static char *conf_service;
+static int conf_receive_threads = 1;
 
 static bool conf_delete_counters;
 static bool conf_delete_timers;
@@ -78,6 +145,7 @@ static bool conf_delete_sets;
 
 static double *conf_timer_percentile;
 static size_t conf_timer_percentile_num;
+static double conf_timer_relative_error;
 
 static bool conf_counter_sum;
 static bool conf_counter_gauge;
@@ -86,13 +154,53 @@ static bool conf_timer_upper;
 static bool conf_timer_sum;
 static bool conf_timer_count;
 
-/* Must hold metrics_lock when calling this function. */
-static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
-                                                    metric_type_t type) {
+static size_t statsd_bucket_index(statsd_stripe_t const *stripe, /* {{{ */
+                                  uint32_t hash) {
+  return (size_t)(hash / STATSD_STRIPES) & (stripe->buckets_num - 1);
+} /* }}} size_t statsd_bucket_index */
+
+/* Must hold the stripe's lock when calling this function. */
+static int statsd_stripe_grow_unsafe(statsd_stripe_t *stripe) /* {{{ */
+{
+  size_t buckets_num = (stripe->buckets_num == 0) ? STATSD_BUCKETS_INIT
+                                                   : 2 * stripe->buckets_num;
+
+  statsd_metric_t **buckets = calloc(buckets_num, sizeof(*buckets));
+  if (buckets == NULL) {
+    ERROR("statsd plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  statsd_metric_t **old_buckets = stripe->buckets;
+  size_t old_buckets_num = stripe->buckets_num;
+
+  stripe->buckets = buckets;
+  stripe->buckets_num = buckets_num;
+
+  for (size_t i = 0; i < old_buckets_num; i++) {
+    statsd_metric_t *metric = old_buckets[i];
+    while (metric != NULL) {
+      statsd_metric_t *next = metric->next;
+      size_t idx = statsd_bucket_index(stripe, metric->hash);
+
+      metric->next = buckets[idx];
+      buckets[idx] = metric;
+      metric = next;
+    }
+  }
+
+  sfree(old_buckets);
+  return 0;
+} /* }}} int statsd_stripe_grow_unsafe */
+
+/* Returns the metric "name" of type "type", creating it if necessary. On
+ * success, the metric's stripe is locked and returned in "ret_stripe"; the
+ * caller must unlock it. */
+static statsd_metric_t *statsd_metric_lookup(char const *name, /* {{{ */
+                                             metric_type_t type,
+                                             statsd_stripe_t **ret_stripe) {
   char key[DATA_MAX_NAME_LEN + 2];
-  char *key_copy;
   statsd_metric_t *metric;
-  int status;
 
   switch (type) {
   case STATSD_COUNTER:
@@ -114,74 +222,85 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
   key[1] = ':';
   sstrncpy(&key[2], name, sizeof(key) - 2);
 
-  status = c_avl_get(metrics_tree, key, (void *)&metric);
-  if (status == 0)
-    return metric;
+  if (!stripes_initialized)
+    return NULL;
 
-  key_copy = strdup(key);
-  if (key_copy == NULL) {
-    ERROR("statsd plugin: strdup failed.");
+  uint32_t hash = (uint32_t)fnv1a_append(FNV1A_INIT, key);
+  statsd_stripe_t *stripe = stripes + (hash % STATSD_STRIPES);
+
+  pthread_mutex_lock(&stripe->lock);
+
+  for (metric = stripe->buckets[statsd_bucket_index(stripe, hash)];
+       metric != NULL; metric = metric->next) {
+    if ((metric->hash == hash) && (strcmp(metric->name, key) == 0)) {
+      *ret_stripe = stripe;
+      return metric;
+    }
+  }
+
+  if ((stripe->metrics_num >= stripe->buckets_num) &&
+      (statsd_stripe_grow_unsafe(stripe) != 0)) {
+    pthread_mutex_unlock(&stripe->lock);
     return NULL;
   }
 
   metric = calloc(1, sizeof(*metric));
   if (metric == NULL) {
+    pthread_mutex_unlock(&stripe->lock);
     ERROR("statsd plugin: calloc failed.");
-    sfree(key_copy);
     return NULL;
   }
 
+  metric->name = strdup(key);
+  if (metric->name == NULL) {
+    pthread_mutex_unlock(&stripe->lock);
+    ERROR("statsd plugin: strdup failed.");
+    sfree(metric);
+    return NULL;
+  }
+
+  metric->hash = hash;
   metric->type = type;
   metric->latency = NULL;
   metric->set = NULL;
 
-  status = c_avl_insert(metrics_tree, key_copy, metric);
-  if (status != 0) {
-    ERROR("statsd plugin: c_avl_insert failed.");
-    sfree(key_copy);
-    sfree(metric);
-    return NULL;
-  }
+  size_t idx = statsd_bucket_index(stripe, hash);
+  metric->next = stripe->buckets[idx];
+  stripe->buckets[idx] = metric;
+  stripe->metrics_num++;
 
+  *ret_stripe = stripe;
   return metric;
-} /* }}} statsd_metric_lookup_unsafe */
+} /* }}} statsd_metric_lookup */
 
 static int statsd_metric_set(char const *name, double value, /* {{{ */
                              metric_type_t type) {
-  statsd_metric_t *metric;
-
-  pthread_mutex_lock(&metrics_lock);
+  statsd_stripe_t *stripe = NULL;
 
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  statsd_metric_t *metric = statsd_metric_lookup(name, type, &stripe);
+  if (metric == NULL)
     return -1;
-  }
 
   metric->value = value;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&stripe->lock);
 
   return 0;
 } /* }}} int statsd_metric_set */
 
 static int statsd_metric_add(char const *name, double delta, /* {{{ */
                              metric_type_t type) {
-  statsd_metric_t *metric;
-
-  pthread_mutex_lock(&metrics_lock);
+  statsd_stripe_t *stripe = NULL;
 
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  statsd_metric_t *metric = statsd_metric_lookup(name, type, &stripe);
+  if (metric == NULL)
     return -1;
-  }
 
   metric->value += delta;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&stripe->lock);
 
   return 0;
 } /* }}} int statsd_metric_add */
@@ -209,6 +328,7 @@ static void statsd_metric_free(statsd_metric_t *metric) /* {{{ */
     metric->set = NULL;
   }
 
+  sfree(metric->name);
   sfree(metric);
 } /* }}} void statsd_metric_free */
 
@@ -248,7 +368,7 @@ static int statsd_handle_counter(char const *name, /* {{{ */
     return status;
 
   /* Changes to the counter are added to (statsd_metric_t*)->value. ->counter is
-   * only updated in statsd_metric_submit_unsafe(). */
+   * only updated in statsd_metric_snapshot_unsafe(). */
   return statsd_metric_add(name, (double)(value.gauge / scale.gauge),
                            STATSD_COUNTER);
 } /* }}} int statsd_handle_counter */
@@ -297,25 +417,24 @@ static int statsd_handle_timer(char const *name, /* {{{ */
 
   value = MS_TO_CDTIME_T(value_ms.gauge / scale.gauge);
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_TIMER);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  statsd_stripe_t *stripe = NULL;
+  metric = statsd_metric_lookup(name, STATSD_TIMER, &stripe);
+  if (metric == NULL)
     return -1;
-  }
 
-  if (metric->latency == NULL)
+  if ((metric->latency == NULL) && (conf_timer_relative_error > 0.0))
+    metric->latency = latency_counter_create_sketch(conf_timer_relative_error);
+  else if (metric->latency == NULL)
     metric->latency = latency_counter_create();
   if (metric->latency == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&stripe->lock);
     return -1;
   }
 
   latency_counter_add(metric->latency, value);
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&stripe->lock);
   return 0;
 } /* }}} int statsd_handle_timer */
 
@@ -325,34 +444,31 @@ static int statsd_handle_set(char const *name, /* {{{ */
   char *set_key;
   int status;
 
-  pthread_mutex_lock(&metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe(name, STATSD_SET);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  statsd_stripe_t *stripe = NULL;
+  metric = statsd_metric_lookup(name, STATSD_SET, &stripe);
+  if (metric == NULL)
     return -1;
-  }
 
   /* Make sure metric->set exists. */
   if (metric->set == NULL)
     metric->set = c_avl_create((int (*)(const void *, const void *))strcmp);
 
   if (metric->set == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&stripe->lock);
     ERROR("statsd plugin: c_avl_create failed.");
     return -1;
   }
 
   set_key = strdup(set_key_orig);
   if (set_key == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&stripe->lock);
     ERROR("statsd plugin: strdup failed.");
     return -1;
   }
 
   status = c_avl_insert(metric->set, set_key, /* value = */ NULL);
   if (status < 0) {
-    pthread_mutex_unlock(&metrics_lock);
+    pthread_mutex_unlock(&stripe->lock);
     ERROR("statsd plugin: c_avl_insert (\"%s\") failed with status %i.",
           set_key, status);
     sfree(set_key);
@@ -364,7 +480,7 @@ static int statsd_handle_set(char const *name, /* {{{ */
 
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&stripe->lock);
   return 0;
 } /* }}} int statsd_handle_set */
 
@@ -438,28 +554,81 @@ static void statsd_parse_buffer(char *buffer) /* {{{ */
   }
 } /* }}} void statsd_parse_buffer */
 
-static void statsd_network_read(int fd) /* {{{ */
+static int statsd_receiver_alloc(statsd_receiver_t *r) /* {{{ */
+{
+#if HAVE_RECVMMSG
+  size_t batch = STATSD_RECEIVE_BATCH;
+#else
+  size_t batch = 1;
+#endif
+
+  r->buffer = calloc(batch, STATSD_PACKET_SIZE);
+  if (r->buffer == NULL) {
+    ERROR("statsd plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+#if HAVE_RECVMMSG
+  r->msgs = calloc(batch, sizeof(*r->msgs));
+  r->iov = calloc(batch, sizeof(*r->iov));
+  if ((r->msgs == NULL) || (r->iov == NULL)) {
+    ERROR("statsd plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  for (size_t i = 0; i < batch; i++) {
+    /* Leave room for the terminating null byte. */
+    r->iov[i].iov_base = r->buffer + (i * STATSD_PACKET_SIZE);
+    r->iov[i].iov_len = STATSD_PACKET_SIZE - 1;
+    r->msgs[i].msg_hdr.msg_iov = r->iov + i;
+    r->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+
+  return 0;
+} /* }}} int statsd_receiver_alloc */
+
+static void statsd_receiver_free(statsd_receiver_t *r) /* {{{ */
 {
-  char buffer[4096];
-  size_t buffer_size;
-  ssize_t status;
+  sfree(r->buffer);
+#if HAVE_RECVMMSG
+  sfree(r->msgs);
+  sfree(r->iov);
+#endif
+} /* }}} void statsd_receiver_free */
 
-  status = recv(fd, buffer, sizeof(buffer), /* flags = */ MSG_DONTWAIT);
+static void statsd_network_read(statsd_receiver_t *r, int fd) /* {{{ */
+{
+#if HAVE_RECVMMSG
+  int status = recvmmsg(fd, r->msgs, STATSD_RECEIVE_BATCH, MSG_DONTWAIT,
+                        /* timeout = */ NULL);
+#else
+  ssize_t status =
+      recv(fd, r->buffer, STATSD_PACKET_SIZE - 1, /* flags = */ MSG_DONTWAIT);
+#endif
   if (status < 0) {
 
     if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
       return;
 
+#if HAVE_RECVMMSG
+    ERROR("statsd plugin: recvmmsg(2) failed: %s", STRERRNO);
+#else
     ERROR("statsd plugin: recv(2) failed: %s", STRERRNO);
+#endif
     return;
   }
 
-  buffer_size = (size_t)status;
-  if (buffer_size >= sizeof(buffer))
-    buffer_size = sizeof(buffer) - 1;
-  buffer[buffer_size] = 0;
-
-  statsd_parse_buffer(buffer);
+#if HAVE_RECVMMSG
+  for (int i = 0; i < status; i++) {
+    char *buffer = r->buffer + (i * STATSD_PACKET_SIZE);
+    buffer[r->msgs[i].msg_len] = 0;
+    statsd_parse_buffer(buffer);
+  }
+#else
+  r->buffer[status] = 0;
+  statsd_parse_buffer(r->buffer);
+#endif
 } /* }}} void statsd_network_read */
 
 static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
@@ -507,6 +676,17 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
       continue;
     }
 
+#ifdef SO_REUSEPORT
+    /* Every receive thread binds its own socket; the kernel spreads the
+     * senders across them. */
+    if ((receivers_num > 1) &&
+        (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1)) {
+      ERROR("statsd plugin: setsockopt (reuseport): %s", STRERRNO);
+      close(fd);
+      continue;
+    }
+#endif
+
     getnameinfo(ai_ptr->ai_addr, ai_ptr->ai_addrlen, str_node, sizeof(str_node),
                 str_service, sizeof(str_service),
                 NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV);
@@ -550,15 +730,23 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
   return 0;
 } /* }}} int statsd_network_init */
 
-static void *statsd_network_thread(__attribute__((unused)) void *args) /* {{{ */
+static void *statsd_network_thread(void *args) /* {{{ */
 {
+  statsd_receiver_t *r = args;
   struct pollfd *fds = NULL;
   size_t fds_num = 0;
   int status;
 
+  status = statsd_receiver_alloc(r);
+  if (status != 0) {
+    statsd_receiver_free(r);
+    pthread_exit((void *)0);
+  }
+
   status = statsd_network_init(&fds, &fds_num);
   if (status != 0) {
     ERROR("statsd plugin: Unable to open listening sockets.");
+    statsd_receiver_free(r);
     pthread_exit((void *)0);
   }
 
@@ -577,7 +765,7 @@ static void *statsd_network_thread(__attribute__((unused)) void *args) /* {{{ */
       if ((fds[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
 
-      statsd_network_read(fds[i].fd);
+      statsd_network_read(r, fds[i].fd);
       fds[i].revents = 0;
     }
   } /* while (!network_thread_shutdown) */
@@ -586,6 +774,7 @@ static void *statsd_network_thread(__attribute__((unused)) void *args) /* {{{ */
   for (size_t i = 0; i < fds_num; i++)
     close(fds[i].fd);
   sfree(fds);
+  statsd_receiver_free(r);
 
   return (void *)0;
 } /* }}} void *statsd_network_thread */
@@ -629,7 +818,13 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_string(child, &conf_node);
     else if (strcasecmp("Port", child->key) == 0)
       cf_util_get_service(child, &conf_service);
-    else if (strcasecmp("DeleteCounters", child->key) == 0)
+    else if (strcasecmp("ReceiveThreads", child->key) == 0) {
+      cf_util_get_int(child, &conf_receive_threads);
+      if (conf_receive_threads < 1) {
+        ERROR("statsd plugin: \"ReceiveThreads\" must be at least 1.");
+        conf_receive_threads = 1;
+      }
+    } else if (strcasecmp("DeleteCounters", child->key) == 0)
       cf_util_get_boolean(child, &conf_delete_counters);
     else if (strcasecmp("DeleteTimers", child->key) == 0)
       cf_util_get_boolean(child, &conf_delete_timers);
@@ -651,7 +846,14 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_boolean(child, &conf_timer_count);
     else if (strcasecmp("TimerPercentile", child->key) == 0)
       statsd_config_timer_percentile(child);
-    else
+    else if (strcasecmp("TimerRelativeError", child->key) == 0) {
+      cf_util_get_double(child, &conf_timer_relative_error);
+      if ((conf_timer_relative_error < 0.0) ||
+          (conf_timer_relative_error >= 1.0)) {
+        ERROR("statsd plugin: \"TimerRelativeError\" must be between 0 and 1.");
+        conf_timer_relative_error = 0.0;
+      }
+    } else
       ERROR("statsd plugin: The \"%s\" config option is not valid.",
             child->key);
   }
@@ -659,32 +861,75 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int statsd_config */
 
+/* Stops the receive threads and waits for them to close their sockets. */
+static void statsd_network_stop(void) /* {{{ */
+{
+  network_thread_shutdown = true;
+  for (size_t i = 0; i < receivers_num; i++) {
+    if (!receivers[i].running)
+      continue;
+
+    pthread_kill(receivers[i].thread, SIGTERM);
+    pthread_join(receivers[i].thread, /* retval = */ NULL);
+    receivers[i].running = false;
+  }
+  sfree(receivers);
+  receivers_num = 0;
+  network_thread_shutdown = false;
+} /* }}} void statsd_network_stop */
+
 static int statsd_init(void) /* {{{ */
 {
-  pthread_mutex_lock(&metrics_lock);
-  if (metrics_tree == NULL)
-    metrics_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
+  pthread_mutex_lock(&stripes_lock);
+  if (!stripes_initialized) {
+    for (size_t i = 0; i < STATSD_STRIPES; i++) {
+      statsd_stripe_t *stripe = stripes + i;
+
+      pthread_mutex_init(&stripe->lock, /* attr = */ NULL);
+      if (statsd_stripe_grow_unsafe(stripe) != 0) {
+        pthread_mutex_unlock(&stripes_lock);
+        return ENOMEM;
+      }
+    }
+    stripes_initialized = true;
+  }
+  pthread_mutex_unlock(&stripes_lock);
 
-  if (!network_thread_running) {
-    int status;
+  if (receivers != NULL)
+    return 0;
 
-    status = pthread_create(&network_thread,
-                            /* attr = */ NULL, statsd_network_thread,
-                            /* args = */ NULL);
+#ifndef SO_REUSEPORT
+  if (conf_receive_threads > 1) {
+    WARNING("statsd plugin: SO_REUSEPORT is not available on this system, "
+            "ignoring \"ReceiveThreads %d\".",
+            conf_receive_threads);
+    conf_receive_threads = 1;
+  }
+#endif
+
+  receivers = calloc((size_t)conf_receive_threads, sizeof(*receivers));
+  if (receivers == NULL) {
+    ERROR("statsd plugin: calloc failed.");
+    return ENOMEM;
+  }
+  receivers_num = (size_t)conf_receive_threads;
+
+  for (size_t i = 0; i < receivers_num; i++) {
+    int status = pthread_create(&receivers[i].thread,
+                                /* attr = */ NULL, statsd_network_thread,
+                                /* args = */ receivers + i);
     if (status != 0) {
-      pthread_mutex_unlock(&metrics_lock);
-      ERROR("statsd plugin: pthread_create failed: %s", STRERRNO);
+      ERROR("statsd plugin: pthread_create failed: %s", STRERROR(status));
+      statsd_network_stop();
       return status;
     }
+    receivers[i].running = true;
   }
-  network_thread_running = true;
-
-  pthread_mutex_unlock(&metrics_lock);
 
   return 0;
 } /* }}} int statsd_init */
 
-/* Must hold metrics_lock when calling this function. */
+/* Must hold the metric's stripe lock when calling this function. */
 static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
 {
   void *key;
@@ -704,76 +949,113 @@ static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
   return 0;
 } /* }}} int statsd_metric_clear_set_unsafe */
 
-/* Must hold metrics_lock when calling this function. */
-static int statsd_metric_submit_unsafe(char const *name,
-                                       statsd_metric_t *metric) /* {{{ */
-{
+/* Copies the values of "metric" to "snap" and resets the metric for the next
+ * interval. Must hold the metric's stripe lock when calling this function. */
+static void statsd_metric_snapshot_unsafe(statsd_metric_t *metric, /* {{{ */
+                                          statsd_snapshot_t *snap,
+                                          gauge_t *percentiles) {
+  /* Names have a prefix, e.g. "c:", which determines the (statsd) type.
+   * Remove this here. */
+  snap->name = metric->name + 2;
+  snap->type = metric->type;
+  snap->have_events = (metric->updates_num > 0);
+
+  if (metric->type == STATSD_GAUGE) {
+    snap->value = (gauge_t)metric->value;
+  } else if (metric->type == STATSD_TIMER) {
+    bool have_events = snap->have_events;
+    latency_counter_t *lc = metric->latency;
+
+    snap->timer_average =
+        have_events ? CDTIME_T_TO_DOUBLE(latency_counter_get_average(lc)) : NAN;
+    snap->timer_lower =
+        have_events ? CDTIME_T_TO_DOUBLE(latency_counter_get_min(lc)) : NAN;
+    snap->timer_upper =
+        have_events ? CDTIME_T_TO_DOUBLE(latency_counter_get_max(lc)) : NAN;
+    snap->timer_sum =
+        have_events ? CDTIME_T_TO_DOUBLE(latency_counter_get_sum(lc)) : NAN;
+    snap->timer_count = latency_counter_get_num(lc);
+
+    for (size_t i = 0; i < conf_timer_percentile_num; i++)
+      percentiles[i] = have_events ? CDTIME_T_TO_DOUBLE(
+                                         latency_counter_get_percentile(
+                                             lc, conf_timer_percentile[i]))
+                                   : NAN;
+
+    latency_counter_reset(lc);
+  } else if (metric->type == STATSD_SET) {
+    if (metric->set == NULL)
+      snap->value = 0.0;
+    else
+      snap->value = (gauge_t)c_avl_size(metric->set);
+    statsd_metric_clear_set_unsafe(metric);
+  } else { /* STATSD_COUNTER */
+    snap->value = (gauge_t)metric->value;
+    snap->delta = nearbyint(metric->value);
+
+    /* Rather than resetting value to zero, subtract delta so we correctly keep
+     * track of residuals. */
+    metric->value -= snap->delta;
+    metric->counter += (derive_t)snap->delta;
+
+    snap->counter = metric->counter;
+  }
+
+  metric->updates_num = 0;
+} /* }}} void statsd_metric_snapshot_unsafe */
+
+static int statsd_snapshot_submit(statsd_snapshot_t const *snap, /* {{{ */
+                                  gauge_t const *percentiles) {
+  char const *name = snap->name;
   value_list_t vl = VALUE_LIST_INIT;
 
   vl.values = &(value_t){.gauge = NAN};
   vl.values_len = 1;
   sstrncpy(vl.plugin, "statsd", sizeof(vl.plugin));
 
-  if (metric->type == STATSD_GAUGE)
+  if (snap->type == STATSD_GAUGE)
     sstrncpy(vl.type, "gauge", sizeof(vl.type));
-  else if (metric->type == STATSD_TIMER)
+  else if (snap->type == STATSD_TIMER)
     sstrncpy(vl.type, "latency", sizeof(vl.type));
-  else if (metric->type == STATSD_SET)
+  else if (snap->type == STATSD_SET)
     sstrncpy(vl.type, "objects", sizeof(vl.type));
-  else /* if (metric->type == STATSD_COUNTER) */
+  else /* if (snap->type == STATSD_COUNTER) */
     sstrncpy(vl.type, "derive", sizeof(vl.type));
 
   sstrncpy(vl.type_instance, name, sizeof(vl.type_instance));
 
-  if (metric->type == STATSD_GAUGE)
-    vl.values[0].gauge = (gauge_t)metric->value;
-  else if (metric->type == STATSD_TIMER) {
-    bool have_events = (metric->updates_num > 0);
-
+  if (snap->type == STATSD_GAUGE)
+    vl.values[0].gauge = snap->value;
+  else if (snap->type == STATSD_TIMER) {
     /* Make sure all timer metrics share the *same* timestamp. */
     vl.time = cdtime();
 
     snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-average", name);
-    vl.values[0].gauge =
-        have_events
-            ? CDTIME_T_TO_DOUBLE(latency_counter_get_average(metric->latency))
-            : NAN;
+    vl.values[0].gauge = snap->timer_average;
     plugin_dispatch_values(&vl);
 
     if (conf_timer_lower) {
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-lower", name);
-      vl.values[0].gauge =
-          have_events
-              ? CDTIME_T_TO_DOUBLE(latency_counter_get_min(metric->latency))
-              : NAN;
+      vl.values[0].gauge = snap->timer_lower;
       plugin_dispatch_values(&vl);
     }
 
     if (conf_timer_upper) {
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-upper", name);
-      vl.values[0].gauge =
-          have_events
-              ? CDTIME_T_TO_DOUBLE(latency_counter_get_max(metric->latency))
-              : NAN;
+      vl.values[0].gauge = snap->timer_upper;
       plugin_dispatch_values(&vl);
     }
 
     if (conf_timer_sum) {
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-sum", name);
-      vl.values[0].gauge =
-          have_events
-              ? CDTIME_T_TO_DOUBLE(latency_counter_get_sum(metric->latency))
-              : NAN;
+      vl.values[0].gauge = snap->timer_sum;
       plugin_dispatch_values(&vl);
     }
 
     for (size_t i = 0; i < conf_timer_percentile_num; i++) {
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-percentile-%.0f",
                name, conf_timer_percentile[i]);
-      vl.values[0].gauge =
-          have_events ? CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(
-                            metric->latency, conf_timer_percentile[i]))
-                      : NAN;
+      vl.values[0].gauge = percentiles[i];
       plugin_dispatch_values(&vl);
     }
 
@@ -782,27 +1064,21 @@ static int statsd_metric_submit_unsafe(char const *name,
     if (conf_timer_count) {
       sstrncpy(vl.type, "gauge", sizeof(vl.type));
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-count", name);
-      vl.values[0].gauge = latency_counter_get_num(metric->latency);
+      vl.values[0].gauge = (gauge_t)snap->timer_count;
       plugin_dispatch_values(&vl);
     }
 
-    latency_counter_reset(metric->latency);
     return 0;
-  } else if (metric->type == STATSD_SET) {
-    if (metric->set == NULL)
-      vl.values[0].gauge = 0.0;
-    else
-      vl.values[0].gauge = (gauge_t)c_avl_size(metric->set);
+  } else if (snap->type == STATSD_SET) {
+    vl.values[0].gauge = snap->value;
   } else { /* STATSD_COUNTER */
-    gauge_t delta = nearbyint(metric->value);
-
     /* Etsy's statsd writes counters as two metrics: a rate and the change since
      * the last write. Since collectd does not reset its DERIVE metrics to zero,
      * this makes little sense, but we're dispatching a "count" metric here
      * anyway - if requested by the user - for compatibility reasons. */
     if (conf_counter_sum) {
       sstrncpy(vl.type, "count", sizeof(vl.type));
-      vl.values[0].gauge = delta;
+      vl.values[0].gauge = snap->delta;
       plugin_dispatch_values(&vl);
 
       /* restore vl.type */
@@ -833,116 +1109,163 @@ static int statsd_metric_submit_unsafe(char const *name,
      * as a counter metric. This was previously inconsistent in this
      * implementation. */
     if (conf_counter_gauge) {
-      gauge_t previous_gauge = vl.values[0].gauge;
-
       sstrncpy(vl.type, "gauge", sizeof(vl.type));
-      vl.values[0].gauge = (gauge_t)metric->value;
-      metric->value = 0.0;
+      vl.values[0].gauge = snap->value;
       plugin_dispatch_values(&vl);
 
-      /* restore vl.type and values[0].gauge */
+      /* restore vl.type */
       sstrncpy(vl.type, "derive", sizeof(vl.type));
-      metric->value = vl.values[0].gauge;
-      vl.values[0].gauge = previous_gauge;
     }
 
-    /* Rather than resetting value to zero, subtract delta so we correctly keep
-     * track of residuals. */
-    metric->value -= delta;
-    metric->counter += (derive_t)delta;
-
-    vl.values[0].derive = metric->counter;
+    vl.values[0].derive = snap->counter;
   }
 
   return plugin_dispatch_values(&vl);
-} /* }}} int statsd_metric_submit_unsafe */
+} /* }}} int statsd_snapshot_submit */
 
-static int statsd_read(void) /* {{{ */
+/* Makes sure there is room for "num" snapshots. Only called by statsd_read(),
+ * which serializes access with "stripes_lock". */
+static int statsd_snapshots_reserve(size_t num) /* {{{ */
 {
-  c_avl_iterator_t *iter;
-  char *name;
-  statsd_metric_t *metric;
+  if (num <= snapshots_size)
+    return 0;
+
+  size_t size = (snapshots_size == 0) ? 1024 : snapshots_size;
+  while (size < num)
+    size *= 2;
+
+  statsd_snapshot_t *tmp = realloc(snapshots, size * sizeof(*snapshots));
+  if (tmp == NULL) {
+    ERROR("statsd plugin: realloc failed.");
+    return ENOMEM;
+  }
+  snapshots = tmp;
+
+  if (conf_timer_percentile_num > 0) {
+    gauge_t *p = realloc(snapshot_percentiles, size *
+                                                   conf_timer_percentile_num *
+                                                   sizeof(*p));
+    if (p == NULL) {
+      ERROR("statsd plugin: realloc failed.");
+      return ENOMEM;
+    }
+    snapshot_percentiles = p;
+  }
+
+  snapshots_size = size;
+  return 0;
+} /* }}} int statsd_snapshots_reserve */
 
-  char **to_be_deleted = NULL;
-  size_t to_be_deleted_num = 0;
+static bool statsd_metric_is_stale(statsd_metric_t const *metric) /* {{{ */
+{
+  return (metric->updates_num == 0) &&
+         ((conf_delete_counters && (metric->type == STATSD_COUNTER)) ||
+          (conf_delete_timers && (metric->type == STATSD_TIMER)) ||
+          (conf_delete_gauges && (metric->type == STATSD_GAUGE)) ||
+          (conf_delete_sets && (metric->type == STATSD_SET)));
+} /* }}} bool statsd_metric_is_stale */
+
+/* statsd_read takes a snapshot of one stripe at a time and dispatches the
+ * values once all locks have been released, so the receive threads are only
+ * blocked for as long as it takes to copy a stripe. */
+static int statsd_read(void) /* {{{ */
+{
+  statsd_metric_t *to_be_deleted = NULL;
+  size_t snapshots_num = 0;
 
-  pthread_mutex_lock(&metrics_lock);
+  pthread_mutex_lock(&stripes_lock);
 
-  if (metrics_tree == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  if (!stripes_initialized) {
+    pthread_mutex_unlock(&stripes_lock);
     return 0;
   }
 
-  iter = c_avl_get_iterator(metrics_tree);
-  while (c_avl_iterator_next(iter, (void *)&name, (void *)&metric) == 0) {
-    if ((metric->updates_num == 0) &&
-        ((conf_delete_counters && (metric->type == STATSD_COUNTER)) ||
-         (conf_delete_timers && (metric->type == STATSD_TIMER)) ||
-         (conf_delete_gauges && (metric->type == STATSD_GAUGE)) ||
-         (conf_delete_sets && (metric->type == STATSD_SET)))) {
-      DEBUG("statsd plugin: Deleting metric \"%s\".", name);
-      strarray_add(&to_be_deleted, &to_be_deleted_num, name);
-      continue;
+  for (size_t i = 0; i < STATSD_STRIPES; i++) {
+    statsd_stripe_t *stripe = stripes + i;
+
+    pthread_mutex_lock(&stripe->lock);
+
+    if (statsd_snapshots_reserve(snapshots_num + stripe->metrics_num) != 0) {
+      pthread_mutex_unlock(&stripe->lock);
+      break;
     }
 
-    /* Names have a prefix, e.g. "c:", which determines the (statsd) type.
-     * Remove this here. */
-    statsd_metric_submit_unsafe(name + 2, metric);
+    for (size_t j = 0; j < stripe->buckets_num; j++) {
+      statsd_metric_t **prev = stripe->buckets + j;
 
-    /* Reset the metric. */
-    metric->updates_num = 0;
-    if (metric->type == STATSD_SET)
-      statsd_metric_clear_set_unsafe(metric);
-  }
-  c_avl_iterator_destroy(iter);
+      while (*prev != NULL) {
+        statsd_metric_t *metric = *prev;
 
-  for (size_t i = 0; i < to_be_deleted_num; i++) {
-    int status;
+        if (statsd_metric_is_stale(metric)) {
+          DEBUG("statsd plugin: Deleting metric \"%s\".", metric->name);
+          *prev = metric->next;
+          stripe->metrics_num--;
 
-    status = c_avl_remove(metrics_tree, to_be_deleted[i], (void *)&name,
-                          (void *)&metric);
-    if (status != 0) {
-      ERROR("stats plugin: c_avl_remove (\"%s\") failed with status %i.",
-            to_be_deleted[i], status);
-      continue;
+          metric->next = to_be_deleted;
+          to_be_deleted = metric;
+          continue;
+        }
+
+        statsd_metric_snapshot_unsafe(
+            metric, snapshots + snapshots_num,
+            snapshot_percentiles + (snapshots_num * conf_timer_percentile_num));
+        snapshots_num++;
+        prev = &metric->next;
+      }
     }
 
-    sfree(name);
-    statsd_metric_free(metric);
+    pthread_mutex_unlock(&stripe->lock);
   }
 
-  pthread_mutex_unlock(&metrics_lock);
+  for (size_t i = 0; i < snapshots_num; i++)
+    statsd_snapshot_submit(snapshots + i, snapshot_percentiles +
+                                              (i * conf_timer_percentile_num));
+
+  pthread_mutex_unlock(&stripes_lock);
 
-  strarray_free(to_be_deleted, to_be_deleted_num);
+  while (to_be_deleted != NULL) {
+    statsd_metric_t *next = to_be_deleted->next;
+    statsd_metric_free(to_be_deleted);
+    to_be_deleted = next;
+  }
 
   return 0;
 } /* }}} int statsd_read */
 
 static int statsd_shutdown(void) /* {{{ */
 {
-  void *key;
-  void *value;
-
-  if (network_thread_running) {
-    network_thread_shutdown = true;
-    pthread_kill(network_thread, SIGTERM);
-    pthread_join(network_thread, /* retval = */ NULL);
+  statsd_network_stop();
+
+  pthread_mutex_lock(&stripes_lock);
+
+  if (stripes_initialized) {
+    for (size_t i = 0; i < STATSD_STRIPES; i++) {
+      statsd_stripe_t *stripe = stripes + i;
+
+      for (size_t j = 0; j < stripe->buckets_num; j++) {
+        while (stripe->buckets[j] != NULL) {
+          statsd_metric_t *metric = stripe->buckets[j];
+          stripe->buckets[j] = metric->next;
+          statsd_metric_free(metric);
+        }
+      }
+      sfree(stripe->buckets);
+      stripe->buckets_num = 0;
+      stripe->metrics_num = 0;
+
+      pthread_mutex_destroy(&stripe->lock);
+    }
+    stripes_initialized = false;
   }
-  network_thread_running = false;
-
-  pthread_mutex_lock(&metrics_lock);
 
-  while (c_avl_pick(metrics_tree, &key, &value) == 0) {
-    sfree(key);
-    statsd_metric_free(value);
-  }
-  c_avl_destroy(metrics_tree);
-  metrics_tree = NULL;
+  sfree(snapshots);
+  sfree(snapshot_percentiles);
+  snapshots_size = 0;
 
   sfree(conf_node);
   sfree(conf_service);
 
-  pthread_mutex_unlock(&metrics_lock);
+  pthread_mutex_unlock(&stripes_lock);
 
   return 0;
 } /* }}} int statsd_shutdown */
@@ -264,6 +264,9 @@ static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 static int port_collect_listening;
 static int port_collect_total;
 static port_entry_t *port_list_head;
+/* Index into the entries of port_list_head by port number, so looking up the
+ * entry of a connection does not depend on the number of entries. */
+static port_entry_t *port_table[UINT16_MAX + 1];
 static uint32_t count_total[TCP_STATE_MAX + 1];
 
 #if KERNEL_LINUX
@@ -344,14 +347,7 @@ static void conn_submit_all(void) {
 } /* void conn_submit_all */
 
 static port_entry_t *conn_get_port_entry(uint16_t port, int create) {
-  port_entry_t *ret;
-
-  ret = port_list_head;
-  while (ret != NULL) {
-    if (ret->port == port)
-      break;
-    ret = ret->next;
-  }
+  port_entry_t *ret = port_table[port];
 
   if ((ret == NULL) && (create != 0)) {
     ret = calloc(1, sizeof(*ret));
@@ -361,6 +357,7 @@ static port_entry_t *conn_get_port_entry(uint16_t port, int create) {
     ret->port = port;
     ret->next = port_list_head;
     port_list_head = ret;
+    port_table[port] = ret;
   }
 
   return ret;
@@ -390,6 +387,7 @@ static void conn_reset_port_entry(void) {
       else
         prev->next = next;
 
+      port_table[pe->port] = NULL;
       sfree(pe);
       pe = next;
 
@@ -444,26 +442,134 @@ static int conn_handle_ports(uint16_t port_local, uint16_t port_remote,
 } /* int conn_handle_ports */
 
 #if KERNEL_LINUX
-/* Returns zero on success, less than zero on socket error and greater than
- * zero on other errors. */
-static int conn_read_netlink(void) {
 #if HAVE_STRUCT_LINUX_INET_DIAG_REQ
-  int fd;
-  struct inet_diag_msg *r;
-  char buf[8192];
+/* Size of the buffer replies are read into. The kernel fills each dump message
+ * up to the size of the largest buffer the reader has used, capped at 32 KiB,
+ * so this keeps the number of recvmsg(2) calls per socket table low. */
+#define NETLINK_BUFFER_SIZE 32768
+
+/* Bit mask of all TCP states, as used in "idiag_states". */
+#define NETLINK_STATES_ALL 0xfff
+
+/* Maximum number of port ranges matched by the kernel side filter. Each range
+ * takes five bytecode instructions; with more ranges, all sockets are dumped
+ * and filtered by conn_handle_ports(). */
+#define NETLINK_FILTER_RANGES_MAX 1024
+
+typedef struct {
+  unsigned char code_ge;
+  unsigned char code_le;
+  uint16_t first;
+  uint16_t last;
+} conn_port_range_t;
+
+static char netlink_buffer[NETLINK_BUFFER_SIZE];
+static struct inet_diag_bc_op
+    netlink_filter[5 * NETLINK_FILTER_RANGES_MAX];
+static bool netlink_filter_disabled;
+
+/* Appends "port" to the ranges built in "ranges", merging it into the last
+ * range if the ports are adjacent. Returns non-zero if there are too many
+ * ranges. */
+static int conn_filter_add_port(conn_port_range_t *ranges, size_t *ranges_num,
+                                unsigned char code_ge, unsigned char code_le,
+                                uint16_t port) {
+  if (*ranges_num > 0) {
+    conn_port_range_t *last = ranges + (*ranges_num - 1);
+    if ((last->code_ge == code_ge) && (last->last + 1 == port)) {
+      last->last = port;
+      return 0;
+    }
+  }
 
-  /* If this fails, it's likely a permission problem. We'll fall back to
-   * reading this information from files below. */
-  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
-  if (fd < 0) {
-    ERROR("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
-          "NETLINK_INET_DIAG) failed: %s",
-          STRERRNO);
+  if (*ranges_num >= NETLINK_FILTER_RANGES_MAX)
     return -1;
+
+  ranges[*ranges_num] = (conn_port_range_t){
+      .code_ge = code_ge, .code_le = code_le, .first = port, .last = port};
+  (*ranges_num)++;
+  return 0;
+} /* int conn_filter_add_port */
+
+/* Builds an inet_diag bytecode program in "netlink_filter" which accepts only
+ * sockets conn_handle_ports() would count for one of the port entries, i.e.
+ * sockets whose local port is collected or listening, or whose remote port is
+ * collected. Returns the length of the program in bytes, zero if no port
+ * entry exists and less than zero if the ports cannot be filtered in the
+ * kernel. */
+static ssize_t conn_filter_build(void) {
+  conn_port_range_t ranges[NETLINK_FILTER_RANGES_MAX];
+  size_t ranges_num = 0;
+
+  for (int collect = PORT_COLLECT_LOCAL; collect <= PORT_COLLECT_REMOTE;
+       collect <<= 1) {
+    uint16_t flags = collect;
+    unsigned char code_ge = INET_DIAG_BC_S_GE;
+    unsigned char code_le = INET_DIAG_BC_S_LE;
+    if (collect == PORT_COLLECT_LOCAL) {
+      flags |= PORT_IS_LISTENING;
+    } else {
+      code_ge = INET_DIAG_BC_D_GE;
+      code_le = INET_DIAG_BC_D_LE;
+    }
+
+    for (size_t port = 0; port < STATIC_ARRAY_SIZE(port_table); port++) {
+      port_entry_t *pe = port_table[port];
+      if ((pe == NULL) || ((pe->flags & flags) == 0))
+        continue;
+
+      if (conn_filter_add_port(ranges, &ranges_num, code_ge, code_le,
+                               (uint16_t)port) != 0)
+        return -1;
+    }
+  }
+
+  if (ranges_num == 0)
+    return 0;
+
+  /* Every range but the last is "port >= first && port <= last", jumping to
+   * the next range if either comparison fails and to the end of the program,
+   * i.e. accepting the socket, if both succeed. Comparisons of the last range
+   * jump past the end of the program, i.e. reject the socket, if they fail.
+   * Offsets are in bytes; a comparison takes two instructions because the
+   * port is stored in the second one. */
+  size_t len = 20 * ranges_num - 4;
+  struct inet_diag_bc_op *op = netlink_filter;
+  for (size_t i = 0; i < ranges_num; i++) {
+    size_t offset = 20 * i;
+    bool last = (i == ranges_num - 1);
+
+    op[0] = (struct inet_diag_bc_op){.code = ranges[i].code_ge,
+                                     .yes = 8,
+                                     .no = last ? (len - offset + 4) : 20};
+    op[1] = (struct inet_diag_bc_op){.no = ranges[i].first};
+    op[2] = (struct inet_diag_bc_op){.code = ranges[i].code_le,
+                                     .yes = 8,
+                                     .no = last ? (len - offset - 4) : 12};
+    op[3] = (struct inet_diag_bc_op){.no = ranges[i].last};
+    if (!last)
+      op[4] = (struct inet_diag_bc_op){
+          .code = INET_DIAG_BC_JMP, .yes = 4, .no = len - offset - 16};
+    op += 5;
   }
 
+  return (ssize_t)len;
+} /* ssize_t conn_filter_build */
+
+/* Dumps the sockets in one of the "states" (a bit mask) that are accepted by
+ * the bytecode program "filter", or all of them if "filter" is NULL, and
+ * passes them to conn_handle_ports(). Returns zero on success, less than zero
+ * on socket error and greater than zero on other errors. */
+static int conn_read_netlink_dump(int fd, uint32_t states,
+                                  const struct inet_diag_bc_op *filter,
+                                  size_t filter_len) {
+  struct inet_diag_msg *r;
+
   struct sockaddr_nl nladdr = {.nl_family = AF_NETLINK};
 
+  struct nlattr attr = {.nla_len = NLA_HDRLEN + filter_len,
+                        .nla_type = INET_DIAG_REQ_BYTECODE};
+
   struct nlreq req = {
       .nlh.nlmsg_len = sizeof(req),
       .nlh.nlmsg_type = TCPDIAG_GETSOCK,
@@ -477,25 +583,33 @@ static int conn_read_netlink(void) {
        * message in case the system is/was out of memory. */
       .nlh.nlmsg_seq = ++sequence_number,
       .r.idiag_family = AF_INET,
-      .r.idiag_states = 0xfff,
+      .r.idiag_states = states,
       .r.idiag_ext = 0};
 
-  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct iovec iov[3] = {
+      {.iov_base = &req, .iov_len = sizeof(req)},
+      {.iov_base = &attr, .iov_len = sizeof(attr)},
+      {.iov_base = (void *)filter, .iov_len = filter_len},
+  };
+  size_t iov_num = 1;
+  if (filter != NULL) {
+    req.nlh.nlmsg_len += NLA_HDRLEN + NLA_ALIGN(filter_len);
+    iov_num = STATIC_ARRAY_SIZE(iov);
+  }
 
   struct msghdr msg = {.msg_name = (void *)&nladdr,
                        .msg_namelen = sizeof(nladdr),
-                       .msg_iov = &iov,
-                       .msg_iovlen = 1};
+                       .msg_iov = iov,
+                       .msg_iovlen = iov_num};
 
   if (sendmsg(fd, &msg, 0) < 0) {
     ERROR("tcpconns plugin: conn_read_netlink: sendmsg(2) failed: %s",
           STRERRNO);
-    close(fd);
     return -1;
   }
 
-  iov.iov_base = buf;
-  iov.iov_len = sizeof(buf);
+  iov[0].iov_base = netlink_buffer;
+  iov[0].iov_len = sizeof(netlink_buffer);
 
   while (1) {
     struct nlmsghdr *h;
@@ -503,7 +617,7 @@ static int conn_read_netlink(void) {
     memset(&msg, 0, sizeof(msg));
     msg.msg_name = (void *)&nladdr;
     msg.msg_namelen = sizeof(nladdr);
-    msg.msg_iov = &iov;
+    msg.msg_iov = iov;
     msg.msg_iovlen = 1;
 
     ssize_t status = recvmsg(fd, (void *)&msg, /* flags = */ 0);
@@ -513,16 +627,14 @@ static int conn_read_netlink(void) {
 
       ERROR("tcpconns plugin: conn_read_netlink: recvmsg(2) failed: %s",
             STRERRNO);
-      close(fd);
       return -1;
     } else if (status == 0) {
-      close(fd);
       DEBUG("tcpconns plugin: conn_read_netlink: Unexpected zero-sized "
             "reply from netlink socket.");
       return 0;
     }
 
-    h = (struct nlmsghdr *)buf;
+    h = (struct nlmsghdr *)netlink_buffer;
     while (NLMSG_OK(h, status)) {
       if (h->nlmsg_seq != sequence_number) {
         h = NLMSG_NEXT(h, status);
@@ -530,7 +642,6 @@ static int conn_read_netlink(void) {
       }
 
       if (h->nlmsg_type == NLMSG_DONE) {
-        close(fd);
         return 0;
       } else if (h->nlmsg_type == NLMSG_ERROR) {
         struct nlmsgerr *msg_error;
@@ -539,7 +650,6 @@ static int conn_read_netlink(void) {
         WARNING("tcpconns plugin: conn_read_netlink: Received error %i.",
                 msg_error->error);
 
-        close(fd);
         return 1;
       }
 
@@ -555,6 +665,68 @@ static int conn_read_netlink(void) {
 
   /* Not reached because the while() loop above handles the exit condition. */
   return 0;
+} /* int conn_read_netlink_dump */
+
+/* Dumps the sockets which are counted for one of the port entries. The
+ * listening sockets are dumped first so that entries for listening ports exist
+ * before the remaining sockets are filtered in the kernel by the ports of the
+ * entries. */
+static int conn_read_netlink_ports(int fd) {
+  uint32_t states = NETLINK_STATES_ALL;
+
+  if (port_collect_listening != 0) {
+    int status = conn_read_netlink_dump(fd, 1 << TCP_STATE_LISTEN, NULL, 0);
+    if (status != 0)
+      return status;
+    states &= ~(1 << TCP_STATE_LISTEN);
+  }
+
+  ssize_t filter_len = netlink_filter_disabled ? -1 : conn_filter_build();
+  if (filter_len == 0)
+    return 0;
+  if (filter_len < 0)
+    return conn_read_netlink_dump(fd, states, NULL, 0);
+
+  int status =
+      conn_read_netlink_dump(fd, states, netlink_filter, (size_t)filter_len);
+  if (status > 0) {
+    /* The kernel rejected the filter before sending any socket. */
+    NOTICE("tcpconns plugin: The kernel does not accept socket filters. "
+           "Filtering connections in user space from now on.");
+    netlink_filter_disabled = true;
+    status = conn_read_netlink_dump(fd, states, NULL, 0);
+  }
+
+  return status;
+} /* int conn_read_netlink_ports */
+#endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
+
+/* Returns zero on success, less than zero on socket error and greater than
+ * zero on other errors. */
+static int conn_read_netlink(void) {
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+  int fd;
+  int status;
+
+  /* If this fails, it's likely a permission problem. We'll fall back to
+   * reading this information from files below. */
+  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
+  if (fd < 0) {
+    ERROR("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
+          "NETLINK_INET_DIAG) failed: %s",
+          STRERRNO);
+    return -1;
+  }
+
+  /* The summary counts every socket, so only the port entries allow the
+   * kernel to leave out the sockets we are not interested in. */
+  if (port_collect_total != 0)
+    status = conn_read_netlink_dump(fd, NETLINK_STATES_ALL, NULL, 0);
+  else
+    status = conn_read_netlink_ports(fd);
+
+  close(fd);
+  return status;
 #else
   return 1;
 #endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
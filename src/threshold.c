@@ -31,6 +31,13 @@
 #include "utils_cache.h"
 #include "utils_threshold.h"
 
+/* Thresholds resolved for the identifiers in the cache, by name. Thresholds
+ * are searched once, when a value is added to the cache; only values with a
+ * threshold subscribe to cache updates, so other values cost nothing. The
+ * entries are dropped when the value expires or the configuration changes. */
+static c_avl_tree_t *resolved_tree;
+static pthread_mutex_t resolved_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Threshold management
  * ====================
@@ -603,35 +610,23 @@ static int ut_check_one_threshold(const data_set_t *ds, const value_list_t *vl,
  * Gets a list of matching thresholds and searches for the worst status by one
  * of the thresholds. Then reports that status using the ut_report_state
  * function above.
- * Returns zero on success and if no threshold has been configured. Returns
- * less than zero on failure.
+ * Returns zero on success and if the value has no rate yet. Returns less than
+ * zero on failure.
  */
-static int ut_check_threshold(const data_set_t *ds, const value_list_t *vl,
-                              __attribute__((unused))
-                              user_data_t *ud) { /* {{{ */
-  threshold_t *th;
-  gauge_t *values;
+static int ut_check_threshold(const value_list_t *vl,
+                              const threshold_t *th) { /* {{{ */
   int status;
 
   int worst_state = -1;
-  threshold_t *worst_th = NULL;
+  const threshold_t *worst_th = NULL;
   int worst_ds_index = -1;
 
-  if (threshold_tree == NULL)
-    return 0;
-
-  /* Is this lock really necessary? So far, thresholds are only inserted at
-   * startup. -octo */
-  pthread_mutex_lock(&threshold_lock);
-  th = threshold_search(vl);
-  pthread_mutex_unlock(&threshold_lock);
-  if (th == NULL)
+  const data_set_t *ds = plugin_get_ds(vl->type);
+  if ((ds == NULL) || (ds->ds_num != vl->values_len))
     return 0;
 
-  DEBUG("ut_check_threshold: Found matching threshold(s)");
-
-  values = uc_get_rate(ds, vl);
-  if (values == NULL)
+  gauge_t values[ds->ds_num];
+  if (uc_get_rate_values(vl, values, ds->ds_num) != 0)
     return 0;
 
   while (th != NULL) {
@@ -640,7 +635,6 @@ static int ut_check_threshold(const data_set_t *ds, const value_list_t *vl,
     status = ut_check_one_threshold(ds, vl, th, values, &ds_index);
     if (status < 0) {
       ERROR("ut_check_threshold: ut_check_one_threshold failed.");
-      sfree(values);
       return -1;
     }
 
@@ -657,15 +651,115 @@ static int ut_check_threshold(const data_set_t *ds, const value_list_t *vl,
       ut_report_state(ds, vl, worst_th, values, worst_ds_index, worst_state);
   if (status != 0) {
     ERROR("ut_check_threshold: ut_report_state failed.");
-    sfree(values);
     return -1;
   }
 
-  sfree(values);
-
   return 0;
 } /* }}} int ut_check_threshold */
 
+/*
+ * threshold_t *ut_resolved_get
+ *
+ * Returns the thresholds resolved for the cache entry "name", or NULL if the
+ * value has no threshold.
+ */
+static threshold_t *ut_resolved_get(const char *name) { /* {{{ */
+  threshold_t *th = NULL;
+
+  pthread_mutex_lock(&resolved_lock);
+  if (c_avl_get(resolved_tree, name, (void *)&th) != 0)
+    th = NULL;
+  pthread_mutex_unlock(&resolved_lock);
+
+  return th;
+} /* }}} threshold_t *ut_resolved_get */
+
+/*
+ * threshold_t *ut_resolved_add
+ *
+ * Searches the thresholds of "vl" and remembers them for the cache entry
+ * "name". Returns NULL if the value has no threshold.
+ */
+static threshold_t *ut_resolved_add(const char *name, /* {{{ */
+                                    const value_list_t *vl) {
+  pthread_mutex_lock(&threshold_lock);
+  threshold_t *th = threshold_search(vl);
+  pthread_mutex_unlock(&threshold_lock);
+  if (th == NULL)
+    return NULL;
+
+  char *key = strdup(name);
+  if (key == NULL) {
+    ERROR("ut_resolved_add: strdup failed.");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&resolved_lock);
+  int status = c_avl_insert(resolved_tree, key, th);
+  pthread_mutex_unlock(&resolved_lock);
+  if (status != 0)
+    sfree(key);
+
+  return th;
+} /* }}} threshold_t *ut_resolved_add */
+
+static void ut_resolved_flush(void) { /* {{{ */
+  char *name;
+  threshold_t *th;
+
+  pthread_mutex_lock(&resolved_lock);
+  while (c_avl_pick(resolved_tree, (void *)&name, (void *)&th) == 0)
+    sfree(name);
+  pthread_mutex_unlock(&resolved_lock);
+} /* }}} void ut_resolved_flush */
+
+/*
+ * int ut_cache_event
+ *
+ * Resolves the thresholds of new cache entries and subscribes to the updates
+ * of the entries having one, which are then checked with ut_check_threshold.
+ */
+static int ut_cache_event(cache_event_t *event,
+                          __attribute__((unused)) user_data_t *ud) { /* {{{ */
+  const value_list_t *vl = event->value_list;
+  threshold_t *th;
+
+  switch (event->type) {
+  case CE_VALUE_NEW:
+    th = ut_resolved_add(event->value_list_name, vl);
+    if (th == NULL)
+      return 0;
+
+    DEBUG("ut_cache_event: Found matching threshold(s) for %s",
+          event->value_list_name);
+    event->ret = 1;
+    return ut_check_threshold(vl, th);
+
+  case CE_VALUE_UPDATE:
+    /* The entry may have been dropped by a CE_VALUE_EXPIRED event although
+     * the value has been updated before it was removed from the cache. */
+    th = ut_resolved_get(event->value_list_name);
+    if (th == NULL)
+      th = ut_resolved_add(event->value_list_name, vl);
+    if (th == NULL)
+      return 0;
+    return ut_check_threshold(vl, th);
+
+  case CE_VALUE_EXPIRED: {
+    char *name = NULL;
+
+    pthread_mutex_lock(&resolved_lock);
+    c_avl_remove(resolved_tree, event->value_list_name, (void *)&name, NULL);
+    pthread_mutex_unlock(&resolved_lock);
+
+    sfree(name);
+    return 0;
+  }
+  }
+
+  return 0;
+} /* }}} int ut_cache_event */
+
 /*
  * int ut_missing
  *
@@ -682,14 +776,17 @@ static int ut_missing(const value_list_t *vl,
   if (threshold_tree == NULL)
     return 0;
 
-  th = threshold_search(vl);
+  plugin_format_name_vl(identifier, sizeof(identifier), vl);
+
+  /* Expiring values are still in the cache, so their thresholds have been
+   * resolved if they have any. */
+  th = ut_resolved_get(identifier);
   /* dispatch notifications for "interesting" values only */
   if ((th == NULL) || ((th->flags & UT_FLAG_INTERESTING) == 0))
     return 0;
 
   now = cdtime();
   missing_time = now - vl->time;
-  FORMAT_VL(identifier, sizeof(identifier), vl);
 
   NOTIFICATION_INIT_VL(&n, vl);
   ssnprintf(n.message, sizeof(n.message),
@@ -713,6 +810,13 @@ static int ut_config(oconfig_item_t *ci) { /* {{{ */
       return -1;
     }
   }
+  if (resolved_tree == NULL) {
+    resolved_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (resolved_tree == NULL) {
+      ERROR("ut_config: c_avl_create failed.");
+      return -1;
+    }
+  }
 
   threshold_t th = {
       .warning_min = NAN,
@@ -740,12 +844,15 @@ static int ut_config(oconfig_item_t *ci) { /* {{{ */
       break;
   }
 
+  /* The thresholds may have changed. */
+  ut_resolved_flush();
+
   /* register callbacks if this is the first time we see a valid config */
   if ((old_size == 0) && (c_avl_size(threshold_tree) > 0)) {
     plugin_register_missing("threshold", ut_missing,
                             /* user data = */ NULL);
-    plugin_register_write("threshold", ut_check_threshold,
-                          /* user data = */ NULL);
+    plugin_register_cache_event("threshold", ut_cache_event,
+                                /* user data = */ NULL);
   }
 
   return status;
@@ -1622,6 +1622,16 @@ void strarray_free(char **array, size_t array_len) /* {{{ */
   sfree(array);
 } /* }}} void strarray_free */
 
+uint64_t fnv1a_append(uint64_t hash, char const *str) /* {{{ */
+{
+  for (unsigned char const *ptr = (unsigned char const *)str; *ptr != 0;
+       ptr++) {
+    hash ^= (uint64_t)*ptr;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+} /* }}} uint64_t fnv1a_append */
+
 #if HAVE_CAPABILITY
 int check_capability(int arg) /* {{{ */
 {
@@ -397,6 +397,15 @@ int strtogauge(const char *string, gauge_t *ret_value);
 int strarray_add(char ***ret_array, size_t *ret_array_len, char const *str);
 void strarray_free(char **array, size_t array_len);
 
+/* Offset basis of the 64 bit FNV-1a hash, i.e. the hash of the empty string.
+ * Pass it to the first call of fnv1a_append(). */
+#define FNV1A_INIT 14695981039346656037ULL
+
+/* Appends the bytes of "str", without the terminating null byte, to the
+ * 64 bit FNV-1a hash "hash" and returns the new hash. Call it repeatedly to
+ * hash several strings without concatenating them first. */
+uint64_t fnv1a_append(uint64_t hash, char const *str);
+
 /** Check if the current process benefits from the capability passed in
  * argument. Returns zero if it does, less than zero if it doesn't or on error.
  * See capabilities(7) for the list of possible capabilities.
@@ -383,6 +383,27 @@ DEF_TEST(value_to_rate) {
   return 0;
 }
 
+DEF_TEST(fnv1a_append) {
+  struct {
+    char const *str;
+    uint64_t want;
+  } cases[] = {
+      {"", 0xcbf29ce484222325ULL},
+      {"a", 0xaf63dc4c8601ec8cULL},
+      {"foobar", 0x85944171f73967e8ULL},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    EXPECT_EQ_UINT64(cases[i].want, fnv1a_append(FNV1A_INIT, cases[i].str));
+  }
+
+  /* Appending the parts equals hashing the concatenation. */
+  EXPECT_EQ_UINT64(fnv1a_append(FNV1A_INIT, "foobar"),
+                   fnv1a_append(fnv1a_append(FNV1A_INIT, "foo"), "bar"));
+
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(sstrncpy);
   RUN_TEST(sstrdup);
@@ -393,6 +414,7 @@ int main(void) {
   RUN_TEST(strunescape);
   RUN_TEST(parse_values);
   RUN_TEST(value_to_rate);
+  RUN_TEST(fnv1a_append);
 
   END_TEST;
 }
@@ -42,6 +42,13 @@
 #define HISTOGRAM_DEFAULT_BIN_WIDTH 1048576
 #endif
 
+/* Upper bound for the number of buckets of a sketch. When more are needed,
+ * the lowest buckets are collapsed, so only the accuracy of the lowest
+ * percentiles suffers. */
+#ifndef SKETCH_MAX_BUCKETS
+#define SKETCH_MAX_BUCKETS 2048
+#endif
+
 struct latency_counter_s {
   cdtime_t start_time;
 
@@ -51,8 +58,18 @@ struct latency_counter_s {
   cdtime_t min;
   cdtime_t max;
 
+  /* Log-linear buckets, used instead of "histogram" when relative_error is
+   * greater than zero. Bucket i counts the values in (gamma^(i-1), gamma^i]
+   * and is stored in sketch[i - sketch_offset]. */
+  double relative_error;
+  double gamma_ln;
+  int sketch_offset;
+  size_t sketch_num;
+  uint32_t *sketch;
+
   cdtime_t bin_width;
-  int histogram[HISTOGRAM_NUM_BINS];
+  /* HISTOGRAM_NUM_BINS elements; not allocated for sketches. */
+  int histogram[];
 };
 
 /*
@@ -113,11 +130,99 @@ static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
         CDTIME_T_TO_DOUBLE(new_bin_width));
 } /* }}} void change_bin_width */
 
+/*
+ * A sketch maps a value x to the bucket ceil(log_gamma(x)), with
+ * gamma = (1 + relative_error) / (1 - relative_error). Reporting the bucket's
+ * midpoint 2 * gamma^i / (gamma + 1) for a percentile is then off by at most
+ * relative_error, regardless of the range of the values. Buckets are kept in
+ * a dense array that grows at either end as needed.
+ */
+static int sketch_index(latency_counter_t const *lc, cdtime_t value) /* {{{ */
+{
+  return (int)ceil(log((double)value) / lc->gamma_ln);
+} /* }}} int sketch_index */
+
+static double sketch_bound(latency_counter_t const *lc, int index) /* {{{ */
+{
+  return exp(lc->gamma_ln * (double)index);
+} /* }}} double sketch_bound */
+
+/* Makes sure the buckets "first" to "last" (inclusive) exist. Once the sketch
+ * has SKETCH_MAX_BUCKETS buckets, buckets below the first one are not added;
+ * the caller collapses them into the first bucket instead. */
+static int sketch_reserve(latency_counter_t *lc, int first, int last) /* {{{ */
+{
+  int cur_first = lc->sketch_offset;
+  int cur_last = lc->sketch_offset + (int)lc->sketch_num - 1;
+
+  if (lc->sketch_num > 0) {
+    if ((first >= cur_first) && (last <= cur_last))
+      return 0;
+    if ((lc->sketch_num >= SKETCH_MAX_BUCKETS) && (last <= cur_last))
+      return 0;
+
+    if (first > cur_first)
+      first = cur_first;
+    if (last < cur_last)
+      last = cur_last;
+  }
+
+  /* Leave some room to grow, so that a slowly widening range does not cause
+   * a reallocation for every value. */
+  int slack = (last - first + 1) / 4;
+  if (slack < 8)
+    slack = 8;
+  if (lc->sketch_num == 0) {
+    first -= slack / 2;
+    last += slack / 2;
+  } else {
+    if (first < cur_first)
+      first -= slack;
+    if (last > cur_last)
+      last += slack;
+  }
+
+  /* Collapse the lowest buckets into the first one. */
+  if (last - first + 1 > SKETCH_MAX_BUCKETS)
+    first = last - SKETCH_MAX_BUCKETS + 1;
+
+  size_t num = (size_t)(last - first + 1);
+  uint32_t *sketch = calloc(num, sizeof(*sketch));
+  if (sketch == NULL)
+    return ENOMEM;
+
+  for (size_t i = 0; i < lc->sketch_num; i++) {
+    int index = lc->sketch_offset + (int)i;
+    if (index < first)
+      index = first;
+    sketch[index - first] += lc->sketch[i];
+  }
+
+  sfree(lc->sketch);
+  lc->sketch = sketch;
+  lc->sketch_num = num;
+  lc->sketch_offset = first;
+  return 0;
+} /* }}} int sketch_reserve */
+
+static void sketch_add(latency_counter_t *lc, int index, /* {{{ */
+                       uint32_t count) {
+  if (sketch_reserve(lc, index, index) != 0) {
+    P_ERROR("latency_counter_add: Allocating sketch buckets failed.");
+    return;
+  }
+
+  /* The bucket may have been collapsed into the first one. */
+  if (index < lc->sketch_offset)
+    index = lc->sketch_offset;
+  lc->sketch[index - lc->sketch_offset] += count;
+} /* }}} void sketch_add */
+
 latency_counter_t *latency_counter_create(void) /* {{{ */
 {
   latency_counter_t *lc;
 
-  lc = calloc(1, sizeof(*lc));
+  lc = calloc(1, sizeof(*lc) + HISTOGRAM_NUM_BINS * sizeof(lc->histogram[0]));
   if (lc == NULL)
     return NULL;
 
@@ -126,8 +231,28 @@ latency_counter_t *latency_counter_create(void) /* {{{ */
   return lc;
 } /* }}} latency_counter_t *latency_counter_create */
 
+latency_counter_t *
+latency_counter_create_sketch(double relative_error) /* {{{ */
+{
+  if (!(relative_error > 0.0) || !(relative_error < 1.0))
+    return NULL;
+
+  latency_counter_t *lc = calloc(1, sizeof(*lc));
+  if (lc == NULL)
+    return NULL;
+
+  lc->relative_error = relative_error;
+  lc->gamma_ln = log((1.0 + relative_error) / (1.0 - relative_error));
+  latency_counter_reset(lc);
+  return lc;
+} /* }}} latency_counter_t *latency_counter_create_sketch */
+
 void latency_counter_destroy(latency_counter_t *lc) /* {{{ */
 {
+  if (lc == NULL)
+    return;
+
+  sfree(lc->sketch);
   sfree(lc);
 } /* }}} void latency_counter_destroy */
 
@@ -148,6 +273,11 @@ void latency_counter_add(latency_counter_t *lc, cdtime_t latency) /* {{{ */
   if (lc->max < latency)
     lc->max = latency;
 
+  if (lc->relative_error > 0.0) {
+    sketch_add(lc, sketch_index(lc, latency), 1);
+    return;
+  }
+
   /* A latency of _exactly_ 1.0 ms is stored in the buffer 0, so
    * subtract one from the cdtime_t value so that exactly 1.0 ms get sorted
    * accordingly. */
@@ -168,6 +298,19 @@ void latency_counter_reset(latency_counter_t *lc) /* {{{ */
   if (lc == NULL)
     return;
 
+  if (lc->relative_error > 0.0) {
+    /* Keep the buckets, values are likely to fall into the same range. */
+    if (lc->sketch_num > 0)
+      memset(lc->sketch, 0, lc->sketch_num * sizeof(*lc->sketch));
+
+    lc->sum = 0;
+    lc->num = 0;
+    lc->min = 0;
+    lc->max = 0;
+    lc->start_time = cdtime();
+    return;
+  }
+
   cdtime_t bin_width = lc->bin_width;
   cdtime_t max_bin = (lc->max - 1) / lc->bin_width;
 
@@ -188,7 +331,7 @@ void latency_counter_reset(latency_counter_t *lc) /* {{{ */
           CDTIME_T_TO_DOUBLE(lc->bin_width), CDTIME_T_TO_DOUBLE(bin_width));
   }
 
-  memset(lc, 0, sizeof(*lc));
+  memset(lc, 0, sizeof(*lc) + HISTOGRAM_NUM_BINS * sizeof(lc->histogram[0]));
 
   /* preserve bin width */
   lc->bin_width = bin_width;
@@ -247,6 +390,29 @@ cdtime_t latency_counter_get_percentile(latency_counter_t *lc, /* {{{ */
   if ((lc == NULL) || (lc->num == 0) || !((percent > 0.0) && (percent < 100.0)))
     return 0;
 
+  if (lc->relative_error > 0.0) {
+    double rank = percent * ((double)lc->num) / 100.0;
+    double cumulative = 0.0;
+
+    for (i = 0; i < lc->sketch_num; i++) {
+      cumulative += (double)lc->sketch[i];
+      if (cumulative >= rank)
+        break;
+    }
+    if (i >= lc->sketch_num)
+      return lc->max;
+
+    /* The midpoint of bucket (gamma^(j-1), gamma^j] in the relative sense. */
+    double gamma = exp(lc->gamma_ln);
+    double bound = sketch_bound(lc, lc->sketch_offset + (int)i);
+    cdtime_t value = (cdtime_t)(2.0 * bound / (gamma + 1.0));
+    if (value < lc->min)
+      value = lc->min;
+    if (value > lc->max)
+      value = lc->max;
+    return value;
+  }
+
   /* Find index i so that at least "percent" events are within i+1 ms. */
   percent_upper = 0.0;
   percent_lower = 0.0;
@@ -294,6 +460,32 @@ double latency_counter_get_rate(const latency_counter_t *lc, /* {{{ */
   if (lower == upper)
     return 0;
 
+  if (lc->relative_error > 0.0) {
+    /* Like below, values are assumed to be spread evenly within a bucket. */
+    double sum = 0;
+    for (size_t i = 0; i < lc->sketch_num; i++) {
+      if (lc->sketch[i] == 0)
+        continue;
+
+      int index = lc->sketch_offset + (int)i;
+      double bucket_lower = sketch_bound(lc, index - 1);
+      double bucket_upper = sketch_bound(lc, index);
+
+      double from =
+          (bucket_lower > (double)lower) ? bucket_lower : (double)lower;
+      double to = bucket_upper;
+      if (upper && ((double)upper < to))
+        to = (double)upper;
+      if (to <= from)
+        continue;
+
+      sum +=
+          (double)lc->sketch[i] * (to - from) / (bucket_upper - bucket_lower);
+    }
+
+    return sum / (CDTIME_T_TO_DOUBLE(now - lc->start_time));
+  }
+
   /* Buckets have an exclusive lower bound and an inclusive upper bound. That
    * means that the first bucket, index 0, represents (0-bin_width]. That means
    * that latency==bin_width needs to result in bin=0, that's why we need to
@@ -342,3 +534,59 @@ double latency_counter_get_rate(const latency_counter_t *lc, /* {{{ */
 
   return sum / (CDTIME_T_TO_DOUBLE(now - lc->start_time));
 } /* }}} double latency_counter_get_rate */
+
+int latency_counter_merge(latency_counter_t *dst, /* {{{ */
+                          latency_counter_t const *src) {
+  if ((dst == NULL) || (src == NULL))
+    return EINVAL;
+  if (dst->relative_error != src->relative_error)
+    return EINVAL;
+
+  if (src->num == 0)
+    return 0;
+
+  if (dst->relative_error > 0.0) {
+    /* Find the used range of "src" first, so "dst" is only resized once. */
+    size_t first = 0;
+    while ((first < src->sketch_num) && (src->sketch[first] == 0))
+      first++;
+    size_t last = src->sketch_num - 1;
+    while ((last > first) && (src->sketch[last] == 0))
+      last--;
+
+    if (sketch_reserve(dst, src->sketch_offset + (int)first,
+                       src->sketch_offset + (int)last) != 0)
+      return ENOMEM;
+
+    for (size_t i = first; i <= last; i++) {
+      if (src->sketch[i] != 0)
+        sketch_add(dst, src->sketch_offset + (int)i, src->sketch[i]);
+    }
+  } else {
+    /* Bring "dst" to the wider bin width of the two, then move each of the
+     * bins of "src" to the bin containing its upper bound. */
+    if (dst->bin_width < src->bin_width)
+      change_bin_width(dst, src->bin_width * HISTOGRAM_NUM_BINS - 1);
+
+    for (size_t i = 0; i < HISTOGRAM_NUM_BINS; i++) {
+      if (src->histogram[i] == 0)
+        continue;
+
+      size_t bin = (size_t)(((i + 1) * src->bin_width - 1) / dst->bin_width);
+      if (bin >= HISTOGRAM_NUM_BINS)
+        bin = HISTOGRAM_NUM_BINS - 1;
+      dst->histogram[bin] += src->histogram[i];
+    }
+  }
+
+  if ((dst->num == 0) || (src->min < dst->min))
+    dst->min = src->min;
+  if ((dst->num == 0) || (src->max > dst->max))
+    dst->max = src->max;
+  dst->sum += src->sum;
+  dst->num += src->num;
+  if (src->start_time < dst->start_time)
+    dst->start_time = src->start_time;
+
+  return 0;
+} /* }}} int latency_counter_merge */
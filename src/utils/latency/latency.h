@@ -41,6 +41,19 @@ typedef struct latency_counter_s latency_counter_t;
 latency_counter_t *latency_counter_create(void);
 void latency_counter_destroy(latency_counter_t *lc);
 
+/*
+ * NAME
+ *  latency_counter_create_sketch(relative_error)
+ *
+ * DESCRIPTION
+ *   Creates a latency counter that uses logarithmically sized buckets instead
+ *   of the fixed-width histogram. Percentiles reported by such a counter are
+ *   within "relative_error" (e.g. 0.01 for 1%) of the true value, independent
+ *   of the range of the latencies. Returns NULL if "relative_error" is not in
+ *   the range (0, 1).
+ */
+latency_counter_t *latency_counter_create_sketch(double relative_error);
+
 void latency_counter_add(latency_counter_t *lc, cdtime_t latency);
 void latency_counter_reset(latency_counter_t *lc);
 
@@ -65,4 +78,16 @@ cdtime_t latency_counter_get_percentile(latency_counter_t *lc, double percent);
 double latency_counter_get_rate(const latency_counter_t *lc, cdtime_t lower,
                                 cdtime_t upper, const cdtime_t now);
 
+/*
+ * NAME
+ *  latency_counter_merge(dst,src)
+ *
+ * DESCRIPTION
+ *   Adds all latencies recorded in "src" to "dst". Both counters must be of the
+ *   same kind, i.e. both fixed-width histograms or both sketches with the same
+ *   relative error. Returns zero on success, EINVAL if the counters cannot be
+ *   merged.
+ */
+int latency_counter_merge(latency_counter_t *dst, latency_counter_t const *src);
+
 #endif /* UTILS_LATENCY_LATENCY_H */
@@ -91,6 +91,24 @@ static int latency_config_add_bucket(latency_config_t *conf,
   return 0;
 } /* int latency_config_add_bucket */
 
+static int latency_config_relative_error(latency_config_t *conf,
+                                         oconfig_item_t *ci) {
+  double relative_error;
+  int status = cf_util_get_double(ci, &relative_error);
+  if (status != 0)
+    return status;
+
+  if ((relative_error <= 0.0) || (relative_error >= 1.0)) {
+    P_ERROR("The value for \"%s\" must be between 0 and 1, "
+            "exclusively.",
+            ci->key);
+    return ERANGE;
+  }
+
+  conf->relative_error = relative_error;
+  return 0;
+} /* int latency_config_relative_error */
+
 int latency_config(latency_config_t *conf, oconfig_item_t *ci) {
   int status = 0;
 
@@ -103,6 +121,8 @@ int latency_config(latency_config_t *conf, oconfig_item_t *ci) {
       status = latency_config_add_bucket(conf, child);
     else if (strcasecmp("BucketType", child->key) == 0)
       status = cf_util_get_string(child, &conf->bucket_type);
+    else if (strcasecmp("RelativeError", child->key) == 0)
+      status = latency_config_relative_error(conf, child);
     else
       P_WARNING("\"%s\" is not a valid option within a \"%s\" block.",
                 child->key, ci->key);
@@ -126,6 +146,7 @@ int latency_config_copy(latency_config_t *dst, const latency_config_t src) {
   *dst = (latency_config_t){
       .percentile_num = src.percentile_num,
       .buckets_num = src.buckets_num,
+      .relative_error = src.relative_error,
   };
 
   dst->percentile = calloc(dst->percentile_num, sizeof(*dst->percentile));
@@ -46,6 +46,10 @@ typedef struct {
   size_t buckets_num;
   char *bucket_type;
 
+  /* If greater than zero, use a sketch with this relative error instead of a
+   * fixed-width histogram. */
+  double relative_error;
+
   /*
   bool lower;
   bool upper;
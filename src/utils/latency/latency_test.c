@@ -30,7 +30,7 @@
 #include "utils/common/common.h" /* for STATIC_ARRAY_SIZE */
 
 #include "testing.h"
-#include "utils/latency/latency.h"
+#include "utils/latency/latency.c" /* sic */
 #include "utils_time.h"
 
 DEF_TEST(simple) {
@@ -109,6 +109,11 @@ DEF_TEST(get_rate) {
     size_t num;
     cdtime_t min;
     cdtime_t max;
+    double relative_error;
+    double gamma_ln;
+    int sketch_offset;
+    size_t sketch_num;
+    uint32_t *sketch;
     cdtime_t bin_width;
     int histogram[HISTOGRAM_NUM_BINS];
   } * peek;
@@ -242,10 +247,218 @@ DEF_TEST(get_rate) {
   return 0;
 }
 
+DEF_TEST(sketch_percentile) {
+  double const relative_error = 0.01;
+  latency_counter_t *l;
+
+  CHECK_NOT_NULL(l = latency_counter_create_sketch(relative_error));
+  EXPECT_EQ_PTR(NULL, latency_counter_create_sketch(0.0));
+  EXPECT_EQ_PTR(NULL, latency_counter_create_sketch(1.0));
+
+  /* 1µs to 1000s: far more than the fixed-width histogram can resolve. */
+  size_t const num = 10000;
+  double const min = 1e-6;
+  double const max = 1e3;
+  for (size_t i = 0; i < num; i++) {
+    double v = min * pow(max / min, ((double)i) / ((double)(num - 1)));
+    latency_counter_add(l, DOUBLE_TO_CDTIME_T(v));
+  }
+
+  EXPECT_EQ_UINT64(num, latency_counter_get_num(l));
+
+  double percents[] = {0.1, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(percents); i++) {
+    size_t rank = (size_t)ceil(percents[i] * ((double)num) / 100.0) - 1;
+    double want = min * pow(max / min, ((double)rank) / ((double)(num - 1)));
+    double got =
+        CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(l, percents[i]));
+
+    printf("# percentile %g: want %g, got %g\n", percents[i], want, got);
+    /* allow for the cdtime_t conversion of tiny values */
+    OK(fabs(got - want) <= relative_error * want + 1e-9);
+  }
+
+  latency_counter_reset(l);
+  EXPECT_EQ_UINT64(0, latency_counter_get_num(l));
+  EXPECT_EQ_UINT64(0, latency_counter_get_percentile(l, 50.0));
+
+  latency_counter_destroy(l);
+  return 0;
+}
+
+DEF_TEST(sketch_get_rate) {
+  latency_counter_t *l;
+
+  CHECK_NOT_NULL(l = latency_counter_create_sketch(0.01));
+
+  for (time_t i = 1; i <= 125; i++)
+    latency_counter_add(l, TIME_T_TO_CDTIME_T(i));
+
+  cdtime_t now = cdtime() + TIME_T_TO_CDTIME_T(1);
+  double got = latency_counter_get_rate(l, 0, TIME_T_TO_CDTIME_T(1000), now);
+  OK(fabs(got - 125.0) < 1.0);
+
+  /* Values are 1s apart, wider than the buckets, so bounds between two
+   * values are exact. */
+  got = latency_counter_get_rate(l, DOUBLE_TO_CDTIME_T(10.5),
+                                 DOUBLE_TO_CDTIME_T(20.5), now);
+  OK(fabs(got - 10.0) < 0.1);
+
+  latency_counter_destroy(l);
+  return 0;
+}
+
+DEF_TEST(merge) {
+  latency_counter_t *a;
+  latency_counter_t *b;
+
+  /* fixed-width histograms with different bin widths */
+  CHECK_NOT_NULL(a = latency_counter_create());
+  CHECK_NOT_NULL(b = latency_counter_create());
+  for (size_t i = 0; i < 100; i++) {
+    latency_counter_add(a, TIME_T_TO_CDTIME_T(((time_t)i) + 1));
+    latency_counter_add(b, MS_TO_CDTIME_T(i + 1));
+  }
+
+  CHECK_ZERO(latency_counter_merge(a, b));
+  EXPECT_EQ_UINT64(200, latency_counter_get_num(a));
+  EXPECT_EQ_DOUBLE(0.001, CDTIME_T_TO_DOUBLE(latency_counter_get_min(a)));
+  EXPECT_EQ_DOUBLE(100.0, CDTIME_T_TO_DOUBLE(latency_counter_get_max(a)));
+  EXPECT_EQ_DOUBLE(5050.0 + 5.05,
+                   CDTIME_T_TO_DOUBLE(latency_counter_get_sum(a)));
+  /* the lower half of the values is below 0.1s */
+  OK(CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(a, 50.0)) <= 0.125);
+  EXPECT_EQ_DOUBLE(50.0,
+                   CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(a, 75.0)));
+
+  latency_counter_destroy(a);
+  latency_counter_destroy(b);
+
+  /* sketches */
+  CHECK_NOT_NULL(a = latency_counter_create_sketch(0.01));
+  CHECK_NOT_NULL(b = latency_counter_create_sketch(0.01));
+  for (size_t i = 0; i < 100; i++) {
+    latency_counter_add(a, TIME_T_TO_CDTIME_T(((time_t)i) + 1));
+    latency_counter_add(b, MS_TO_CDTIME_T(i + 1));
+  }
+
+  CHECK_ZERO(latency_counter_merge(a, b));
+  EXPECT_EQ_UINT64(200, latency_counter_get_num(a));
+  EXPECT_EQ_DOUBLE(0.001, CDTIME_T_TO_DOUBLE(latency_counter_get_min(a)));
+  EXPECT_EQ_DOUBLE(100.0, CDTIME_T_TO_DOUBLE(latency_counter_get_max(a)));
+
+  double got = CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(a, 25.0));
+  OK(fabs(got - 0.050) <= 0.01 * 0.050);
+  got = CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(a, 75.0));
+  OK(fabs(got - 50.0) <= 0.01 * 50.0);
+
+  /* different kinds of counters cannot be merged */
+  latency_counter_t *c;
+  CHECK_NOT_NULL(c = latency_counter_create());
+  EXPECT_EQ_INT(EINVAL, latency_counter_merge(a, c));
+  EXPECT_EQ_INT(EINVAL, latency_counter_merge(c, a));
+  latency_counter_destroy(c);
+
+  CHECK_NOT_NULL(c = latency_counter_create_sketch(0.02));
+  EXPECT_EQ_INT(EINVAL, latency_counter_merge(a, c));
+  latency_counter_destroy(c);
+
+  latency_counter_destroy(a);
+  latency_counter_destroy(b);
+  return 0;
+}
+
+DEF_TEST(sketch_merge_combined) {
+  double const relative_error = 0.01;
+  latency_counter_t *a;
+  latency_counter_t *b;
+  latency_counter_t *all;
+
+  CHECK_NOT_NULL(a = latency_counter_create_sketch(relative_error));
+  CHECK_NOT_NULL(b = latency_counter_create_sketch(relative_error));
+  CHECK_NOT_NULL(all = latency_counter_create_sketch(relative_error));
+
+  /* Overlapping ranges, so the merge has to add to existing buckets as well
+   * as grow the bucket range of "a" in both directions. */
+  for (size_t i = 0; i < 5000; i++) {
+    cdtime_t va = US_TO_CDTIME_T(100 + 7 * i);
+    cdtime_t vb = US_TO_CDTIME_T(10 + 31 * i);
+    latency_counter_add(a, va);
+    latency_counter_add(b, vb);
+    latency_counter_add(all, va);
+    latency_counter_add(all, vb);
+  }
+
+  CHECK_ZERO(latency_counter_merge(a, b));
+  EXPECT_EQ_UINT64(latency_counter_get_num(all), latency_counter_get_num(a));
+  EXPECT_EQ_UINT64(latency_counter_get_min(all), latency_counter_get_min(a));
+  EXPECT_EQ_UINT64(latency_counter_get_max(all), latency_counter_get_max(a));
+  EXPECT_EQ_UINT64(latency_counter_get_sum(all), latency_counter_get_sum(a));
+
+  /* Both sketches hold the same bucket counts, so the quantiles are equal. */
+  double percents[] = {1.0, 10.0, 25.0, 50.0, 75.0, 90.0, 99.0, 99.9};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(percents); i++) {
+    EXPECT_EQ_UINT64(latency_counter_get_percentile(all, percents[i]),
+                     latency_counter_get_percentile(a, percents[i]));
+  }
+
+  latency_counter_destroy(a);
+  latency_counter_destroy(b);
+  latency_counter_destroy(all);
+  return 0;
+}
+
+DEF_TEST(sketch_collapse_low) {
+  double const relative_error = 0.001;
+  latency_counter_t *l;
+
+  CHECK_NOT_NULL(l = latency_counter_create_sketch(relative_error));
+
+  /* 1ms to 1000ms needs more than SKETCH_MAX_BUCKETS buckets at this error,
+   * so the lowest values are collapsed into the first bucket. */
+  for (uint64_t i = 1; i <= 1000; i++)
+    latency_counter_add(l, MS_TO_CDTIME_T(i));
+  EXPECT_EQ_UINT64(SKETCH_MAX_BUCKETS, l->sketch_num);
+
+  int offset = l->sketch_offset;
+  uint32_t *sketch = l->sketch;
+
+  /* Values below the first bucket must neither move nor reallocate the
+   * buckets. */
+  size_t const num_low = 10;
+  for (size_t i = 0; i < num_low; i++) {
+    latency_counter_add(l, MS_TO_CDTIME_T(1));
+    EXPECT_EQ_INT(offset, l->sketch_offset);
+    EXPECT_EQ_UINT64(SKETCH_MAX_BUCKETS, l->sketch_num);
+    EXPECT_EQ_PTR(sketch, l->sketch);
+  }
+
+  /* The values above the collapsed range are still within relative_error. */
+  double percents[] = {10.0, 50.0, 90.0, 99.0};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(percents); i++) {
+    size_t num = 1000 + num_low;
+    size_t rank = (size_t)ceil(percents[i] * ((double)num) / 100.0);
+    double want = ((double)(rank - num_low)) / 1000.0;
+    double got =
+        CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(l, percents[i]));
+
+    printf("# percentile %g: want %g, got %g\n", percents[i], want, got);
+    OK(fabs(got - want) <= relative_error * want + 1e-9);
+  }
+
+  latency_counter_destroy(l);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(simple);
   RUN_TEST(percentile);
   RUN_TEST(get_rate);
+  RUN_TEST(sketch_percentile);
+  RUN_TEST(sketch_get_rate);
+  RUN_TEST(merge);
+  RUN_TEST(sketch_merge_combined);
+  RUN_TEST(sketch_collapse_low);
 
   END_TEST;
 }
@@ -257,6 +257,14 @@ match_create_callback(const char *regex, const char *excluderegex,
 
 cu_match_t *match_create_simple(const char *regex, const char *excluderegex,
                                 int match_ds_type) {
+  return match_create_simple_sketch(regex, excluderegex, match_ds_type,
+                                    /* relative_error = */ 0.0);
+} /* cu_match_t *match_create_simple */
+
+cu_match_t *match_create_simple_sketch(const char *regex,
+                                       const char *excluderegex,
+                                       int match_ds_type,
+                                       double relative_error) {
   cu_match_value_t *user_data;
   cu_match_t *obj;
 
@@ -267,7 +275,10 @@ cu_match_t *match_create_simple(const char *regex, const char *excluderegex,
 
   if ((match_ds_type & UTILS_MATCH_DS_TYPE_GAUGE) &&
       (match_ds_type & UTILS_MATCH_CF_GAUGE_DIST)) {
-    user_data->latency = latency_counter_create();
+    if (relative_error > 0.0)
+      user_data->latency = latency_counter_create_sketch(relative_error);
+    else
+      user_data->latency = latency_counter_create();
     if (user_data->latency == NULL) {
       ERROR("match_create_simple(): latency_counter_create() failed.");
       free(user_data);
@@ -285,7 +296,7 @@ cu_match_t *match_create_simple(const char *regex, const char *excluderegex,
     return NULL;
   }
   return obj;
-} /* cu_match_t *match_create_simple */
+} /* cu_match_t *match_create_simple_sketch */
 
 void match_value_reset(cu_match_value_t *mv) {
   if (mv == NULL)
@@ -132,6 +132,20 @@ match_create_callback(const char *regex, const char *excluderegex,
 cu_match_t *match_create_simple(const char *regex, const char *excluderegex,
                                 int ds_type);
 
+/*
+ * NAME
+ *  match_create_simple_sketch
+ *
+ * DESCRIPTION
+ *  Same as `match_create_simple', but a `UTILS_MATCH_CF_GAUGE_DIST' match
+ *  records its values in a sketch with the relative error `relative_error'
+ *  (see `latency_counter_create_sketch') instead of a fixed-width histogram.
+ *  A `relative_error' of zero selects the fixed-width histogram.
+ */
+cu_match_t *match_create_simple_sketch(const char *regex,
+                                       const char *excluderegex, int ds_type,
+                                       double relative_error);
+
 /*
  * NAME
  *  match_value_reset
@@ -32,6 +32,11 @@
 
 #define MD_MAX_NONSTRING_CHARS 128
 
+/* Initial capacity of a block. Most meta data has only a handful of entries
+ * and fits into this without growing. */
+#define MD_INLINE_ENTRIES 4
+#define MD_INLINE_STRINGS 128
+
 /*
  * Data types
  */
@@ -48,12 +53,26 @@ struct meta_entry_s {
   char *key;
   meta_value_t value;
   int type;
-  meta_entry_t *next;
 };
 
+/* A block holds all entries of a meta data object together with its keys and
+ * string values in one allocation. Entries are sorted by key (ignoring case)
+ * and followed by an entry whose key is NULL, which ends the iteration.
+ *
+ * Blocks are shared between clones and reference counted. A block with more
+ * than one reference is never modified: writes copy it first. */
+typedef struct {
+  size_t refs;
+  size_t num;
+  size_t size;
+  char *strings;
+  size_t strings_len;
+  size_t strings_size;
+  meta_entry_t entry[];
+} md_block_t;
+
 struct meta_data_s {
-  meta_entry_t *head;
-  pthread_mutex_t lock;
+  md_block_t *block;
 };
 
 /*
@@ -77,204 +96,209 @@ static char *md_strdup(const char *orig) /* {{{ */
   return dest;
 } /* }}} char *md_strdup */
 
-static meta_entry_t *md_entry_alloc(const char *key) /* {{{ */
+static md_block_t *md_block_alloc(size_t size, size_t strings_size) /* {{{ */
 {
-  meta_entry_t *e;
-
-  e = calloc(1, sizeof(*e));
-  if (e == NULL) {
-    ERROR("md_entry_alloc: calloc failed.");
+  md_block_t *b = malloc(sizeof(*b) + (size + 1) * sizeof(b->entry[0]) +
+                         strings_size);
+  if (b == NULL) {
+    ERROR("md_block_alloc: malloc failed.");
     return NULL;
   }
 
-  e->key = md_strdup(key);
-  if (e->key == NULL) {
-    free(e);
-    ERROR("md_entry_alloc: md_strdup failed.");
-    return NULL;
-  }
-
-  e->type = 0;
-  e->next = NULL;
+  b->refs = 1;
+  b->num = 0;
+  b->size = size;
+  b->strings = (char *)&b->entry[size + 1];
+  b->strings_len = 0;
+  b->strings_size = strings_size;
+  b->entry[0] = (meta_entry_t){.key = NULL};
 
-  return e;
-} /* }}} meta_entry_t *md_entry_alloc */
+  return b;
+} /* }}} md_block_t *md_block_alloc */
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_clone_contents(const meta_entry_t *orig) /* {{{ */
+static md_block_t *md_block_ref(md_block_t *b) /* {{{ */
 {
-  meta_entry_t *copy;
-
-  /* WARNINGS :
-   *  - we do not check that orig != NULL here. You should have done it before.
-   *  - we do not set copy->next. DO NOT FORGET TO SET copy->next IN YOUR
-   * FUNCTION
-   */
-
-  copy = md_entry_alloc(orig->key);
-  if (copy == NULL)
-    return NULL;
-  copy->type = orig->type;
-  if (copy->type == MD_TYPE_STRING)
-    copy->value.mv_string = strdup(orig->value.mv_string);
-  else
-    copy->value = orig->value;
-
-  return copy;
-} /* }}} meta_entry_t *md_entry_clone_contents */
+  if (b != NULL)
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+  return b;
+} /* }}} md_block_t *md_block_ref */
 
-static meta_entry_t *md_entry_clone(const meta_entry_t *orig) /* {{{ */
+static void md_block_unref(md_block_t *b) /* {{{ */
 {
-  meta_entry_t *copy;
-
-  if (orig == NULL)
-    return NULL;
-
-  copy = md_entry_clone_contents(orig);
+  if (b == NULL)
+    return;
 
-  copy->next = md_entry_clone(orig->next);
-  return copy;
-} /* }}} meta_entry_t *md_entry_clone */
+  if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(b);
+} /* }}} void md_block_unref */
 
-static void md_entry_free(meta_entry_t *e) /* {{{ */
+static bool md_block_shared(md_block_t *b) /* {{{ */
 {
-  if (e == NULL)
-    return;
-
-  free(e->key);
+  return __atomic_load_n(&b->refs, __ATOMIC_ACQUIRE) > 1;
+} /* }}} bool md_block_shared */
 
+/* Number of bytes the keys and strings of the entry occupy in a block. */
+static size_t md_entry_strings(const meta_entry_t *e) /* {{{ */
+{
+  size_t sz = strlen(e->key) + 1;
   if (e->type == MD_TYPE_STRING)
-    free(e->value.mv_string);
+    sz += strlen(e->value.mv_string) + 1;
+  return sz;
+} /* }}} size_t md_entry_strings */
 
-  if (e->next != NULL)
-    md_entry_free(e->next);
+static size_t md_block_strings(const md_block_t *b) /* {{{ */
+{
+  size_t sz = 0;
 
-  free(e);
-} /* }}} void md_entry_free */
+  if (b == NULL)
+    return 0;
 
-static int md_entry_insert(meta_data_t *md, meta_entry_t *e) /* {{{ */
-{
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  for (size_t i = 0; i < b->num; i++)
+    sz += md_entry_strings(&b->entry[i]);
+  return sz;
+} /* }}} size_t md_block_strings */
 
-  if ((md == NULL) || (e == NULL))
-    return -EINVAL;
+/* The caller must make sure the block has enough space left. */
+static char *md_block_strdup(md_block_t *b, const char *s) /* {{{ */
+{
+  size_t sz = strlen(s) + 1;
+  char *dest = b->strings + b->strings_len;
 
-  pthread_mutex_lock(&md->lock);
+  assert(b->strings_len + sz <= b->strings_size);
+  memcpy(dest, s, sz);
+  b->strings_len += sz;
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL) {
-    if (strcasecmp(e->key, this->key) == 0)
-      break;
+  return dest;
+} /* }}} char *md_block_strdup */
 
-    prev = this;
-    this = this->next;
-  }
+/* Appends a copy of "orig" to the block. The caller must make sure the block
+ * has enough space left and that the entries stay sorted. */
+static void md_block_append(md_block_t *b, const meta_entry_t *orig) /* {{{ */
+{
+  meta_entry_t *e = &b->entry[b->num];
 
-  if (this == NULL) {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else {
-      assert(prev != NULL);
-      prev->next = e;
+  assert(b->num < b->size);
+  e->key = md_block_strdup(b, orig->key);
+  e->type = orig->type;
+  if (orig->type == MD_TYPE_STRING)
+    e->value.mv_string = md_block_strdup(b, orig->value.mv_string);
+  else
+    e->value = orig->value;
+
+  b->num++;
+  b->entry[b->num] = (meta_entry_t){.key = NULL};
+} /* }}} void md_block_append */
+
+/* Returns the index of "key" in the block. If the key does not exist, the
+ * index at which it would have to be inserted is returned and "found" is set
+ * to false. */
+static size_t md_block_find(const md_block_t *b, /* {{{ */
+                            const char *key, bool *found) {
+  size_t lo = 0;
+  size_t hi = b->num;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcasecmp(key, b->entry[mid].key);
+    if (cmp == 0) {
+      *found = true;
+      return mid;
     }
 
-    e->next = NULL;
-  } else /* (this != NULL) */
-  {
-    if (prev == NULL)
-      md->head = e;
+    if (cmp < 0)
+      hi = mid;
     else
-      prev->next = e;
-
-    e->next = this->next;
+      lo = mid + 1;
   }
 
-  pthread_mutex_unlock(&md->lock);
-
-  if (this != NULL) {
-    this->next = NULL;
-    md_entry_free(this);
-  }
-
-  return 0;
-} /* }}} int md_entry_insert */
-
-/* XXX: The lock on md must be held while calling this function! */
-static int md_entry_insert_clone(meta_data_t *md, meta_entry_t *orig) /* {{{ */
-{
-  meta_entry_t *e;
-  meta_entry_t *this;
-  meta_entry_t *prev;
-
-  /* WARNINGS :
-   *  - we do not check that md and e != NULL here. You should have done it
-   * before.
-   *  - we do not use the lock. You should have set it before.
-   */
-
-  e = md_entry_clone_contents(orig);
-
-  prev = NULL;
-  this = md->head;
-  while (this != NULL) {
-    if (strcasecmp(e->key, this->key) == 0)
-      break;
+  *found = false;
+  return lo;
+} /* }}} size_t md_block_find */
+
+/* Makes sure that md owns its block exclusively and that the block has room
+ * for "entries" more entries and "strings" more bytes. If a new block is
+ * allocated, the previous one is returned in "old". The caller must release it
+ * once it no longer needs pointers into it, e.g. keys passed by the user. */
+static int md_prepare(meta_data_t *md, size_t entries, /* {{{ */
+                      size_t strings, md_block_t **old) {
+  md_block_t *b = md->block;
+
+  *old = NULL;
+  if ((b != NULL) && !md_block_shared(b) && (b->num + entries <= b->size) &&
+      (b->strings_size - b->strings_len >= strings))
+    return 0;
 
-    prev = this;
-    this = this->next;
-  }
+  size_t num = (b != NULL) ? b->num : 0;
+  size_t size = MAX(MD_INLINE_ENTRIES, 2 * (num + entries));
+  size_t strings_size =
+      MAX(MD_INLINE_STRINGS, 2 * (md_block_strings(b) + strings));
 
-  if (this == NULL) {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else {
-      assert(prev != NULL);
-      prev->next = e;
-    }
+  md_block_t *copy = md_block_alloc(size, strings_size);
+  if (copy == NULL)
+    return -ENOMEM;
 
-    e->next = NULL;
-  } else /* (this != NULL) */
-  {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
+  for (size_t i = 0; i < num; i++)
+    md_block_append(copy, &b->entry[i]);
 
-    e->next = this->next;
+  md->block = copy;
+  *old = b;
+  return 0;
+} /* }}} int md_prepare */
+
+static int md_entry_insert(meta_data_t *md, const char *key, /* {{{ */
+                           int type, meta_value_t value) {
+  size_t strings = strlen(key) + 1;
+  if (type == MD_TYPE_STRING)
+    strings += strlen(value.mv_string) + 1;
+
+  md_block_t *old;
+  int status = md_prepare(md, 1, strings, &old);
+  if (status != 0)
+    return status;
+
+  md_block_t *b = md->block;
+  bool found;
+  size_t i = md_block_find(b, key, &found);
+  if (!found) {
+    /* Also moves the terminating entry. */
+    memmove(&b->entry[i + 1], &b->entry[i],
+            (b->num - i + 1) * sizeof(b->entry[0]));
+    b->num++;
   }
 
-  if (this != NULL) {
-    this->next = NULL;
-    md_entry_free(this);
-  }
+  /* Replaced keys and strings stay in the block until it is copied. */
+  meta_entry_t *e = &b->entry[i];
+  if (!found || (strcmp(e->key, key) != 0))
+    e->key = md_block_strdup(b, key);
+  e->type = type;
+  if (type == MD_TYPE_STRING)
+    e->value.mv_string = md_block_strdup(b, value.mv_string);
+  else
+    e->value = value;
 
+  md_block_unref(old);
   return 0;
-} /* }}} int md_entry_insert_clone */
+} /* }}} int md_entry_insert */
 
-/* XXX: The lock on md must be held while calling this function! */
 static meta_entry_t *md_entry_lookup(meta_data_t *md, /* {{{ */
                                      const char *key) {
-  meta_entry_t *e;
-
-  if ((md == NULL) || (key == NULL))
+  if ((md == NULL) || (md->block == NULL) || (key == NULL))
     return NULL;
 
-  for (e = md->head; e != NULL; e = e->next)
-    if (strcasecmp(key, e->key) == 0)
-      break;
+  bool found;
+  size_t i = md_block_find(md->block, key, &found);
+  if (!found)
+    return NULL;
 
-  return e;
+  return &md->block->entry[i];
 } /* }}} meta_entry_t *md_entry_lookup */
 
 /*
  * Each value_list_t*, as it is going through the system, is handled by exactly
  * one thread. Plugins which pass a value_list_t* to another thread, e.g. the
  * rrdtool plugin, must create a copy first. The meta data within a
- * value_list_t* is not thread safe and doesn't need to be.
+ * value_list_t* is not thread safe and doesn't need to be. Copies share their
+ * entries until one of them is modified, so creating a copy is cheap.
  *
  * The meta data associated with cache entries are a different story. There, we
  * need to ensure exclusive locking to prevent leaks and other funky business.
@@ -294,8 +318,6 @@ meta_data_t *meta_data_create(void) /* {{{ */
     return NULL;
   }
 
-  pthread_mutex_init(&md->lock, /* attr = */ NULL);
-
   return md;
 } /* }}} meta_data_t *meta_data_create */
 
@@ -310,9 +332,7 @@ meta_data_t *meta_data_clone(meta_data_t *orig) /* {{{ */
   if (copy == NULL)
     return NULL;
 
-  pthread_mutex_lock(&orig->lock);
-  copy->head = md_entry_clone(orig->head);
-  pthread_mutex_unlock(&orig->lock);
+  copy->block = md_block_ref(orig->block);
 
   return copy;
 } /* }}} meta_data_t *meta_data_clone */
@@ -327,11 +347,45 @@ int meta_data_clone_merge(meta_data_t **dest, meta_data_t *orig) /* {{{ */
     return 0;
   }
 
-  pthread_mutex_lock(&orig->lock);
-  for (meta_entry_t *e = orig->head; e != NULL; e = e->next) {
-    md_entry_insert_clone((*dest), e);
+  md_block_t *d = (*dest)->block;
+  md_block_t *o = orig->block;
+  if ((o == NULL) || (o->num == 0))
+    return 0;
+
+  if ((d == NULL) || (d->num == 0)) {
+    (*dest)->block = md_block_ref(o);
+    md_block_unref(d);
+    return 0;
+  }
+
+  /* Merge both sorted lists into a new block; entries of "orig" win. */
+  md_block_t *b = md_block_alloc(d->num + o->num,
+                                 md_block_strings(d) + md_block_strings(o));
+  if (b == NULL)
+    return -ENOMEM;
+
+  size_t i = 0;
+  size_t j = 0;
+  while ((i < d->num) || (j < o->num)) {
+    int cmp;
+    if (i == d->num)
+      cmp = 1;
+    else if (j == o->num)
+      cmp = -1;
+    else
+      cmp = strcasecmp(d->entry[i].key, o->entry[j].key);
+
+    if (cmp < 0) {
+      md_block_append(b, &d->entry[i++]);
+    } else {
+      md_block_append(b, &o->entry[j++]);
+      if (cmp == 0)
+        i++;
+    }
   }
-  pthread_mutex_unlock(&orig->lock);
+
+  (*dest)->block = b;
+  md_block_unref(d);
 
   return 0;
 } /* }}} int meta_data_clone_merge */
@@ -341,8 +395,7 @@ void meta_data_destroy(meta_data_t *md) /* {{{ */
   if (md == NULL)
     return;
 
-  md_entry_free(md->head);
-  pthread_mutex_destroy(&md->lock);
+  md_block_unref(md->block);
   free(md);
 } /* }}} void meta_data_destroy */
 
@@ -351,17 +404,7 @@ int meta_data_exists(meta_data_t *md, const char *key) /* {{{ */
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next) {
-    if (strcasecmp(key, e->key) == 0) {
-      pthread_mutex_unlock(&md->lock);
-      return 1;
-    }
-  }
-
-  pthread_mutex_unlock(&md->lock);
-  return 0;
+  return md_entry_lookup(md, key) != NULL;
 } /* }}} int meta_data_exists */
 
 int meta_data_type(meta_data_t *md, const char *key) /* {{{ */
@@ -369,79 +412,57 @@ int meta_data_type(meta_data_t *md, const char *key) /* {{{ */
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next) {
-    if (strcasecmp(key, e->key) == 0) {
-      pthread_mutex_unlock(&md->lock);
-      return e->type;
-    }
-  }
+  meta_entry_t *e = md_entry_lookup(md, key);
+  if (e == NULL)
+    return 0;
 
-  pthread_mutex_unlock(&md->lock);
-  return 0;
+  return e->type;
 } /* }}} int meta_data_type */
 
 int meta_data_toc(meta_data_t *md, char ***toc) /* {{{ */
 {
-  int i = 0, count = 0;
-
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next)
-    ++count;
+  if ((md->block == NULL) || (md->block->num == 0))
+    return 0;
 
-  if (count == 0) {
-    pthread_mutex_unlock(&md->lock);
-    return count;
+  md_block_t *b = md->block;
+  *toc = calloc(b->num, sizeof(**toc));
+  if (*toc == NULL) {
+    ERROR("meta_data_toc: calloc failed.");
+    return -ENOMEM;
   }
 
-  *toc = calloc(count, sizeof(**toc));
-  for (meta_entry_t *e = md->head; e != NULL; e = e->next)
-    (*toc)[i++] = strdup(e->key);
+  for (size_t i = 0; i < b->num; i++)
+    (*toc)[i] = strdup(b->entry[i].key);
 
-  pthread_mutex_unlock(&md->lock);
-  return count;
+  return (int)b->num;
 } /* }}} int meta_data_toc */
 
 int meta_data_delete(meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  prev = NULL;
-  this = md->head;
-  while (this != NULL) {
-    if (strcasecmp(key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
-  }
-
-  if (this == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (md_entry_lookup(md, key) == NULL)
     return -ENOENT;
-  }
 
-  if (prev == NULL)
-    md->head = this->next;
-  else
-    prev->next = this->next;
+  md_block_t *old;
+  int status = md_prepare(md, 0, 0, &old);
+  if (status != 0)
+    return status;
 
-  pthread_mutex_unlock(&md->lock);
+  md_block_t *b = md->block;
+  bool found;
+  size_t i = md_block_find(b, key, &found);
+  assert(found);
 
-  this->next = NULL;
-  md_entry_free(this);
+  /* Also moves the terminating entry. */
+  memmove(&b->entry[i], &b->entry[i + 1], (b->num - i) * sizeof(b->entry[0]));
+  b->num--;
 
+  md_block_unref(old);
   return 0;
 } /* }}} int meta_data_delete */
 
@@ -450,98 +471,54 @@ int meta_data_delete(meta_data_t *md, const char *key) /* {{{ */
  */
 int meta_data_add_string(meta_data_t *md, /* {{{ */
                          const char *key, const char *value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_string = md_strdup(value);
-  if (e->value.mv_string == NULL) {
-    ERROR("meta_data_add_string: md_strdup failed.");
-    md_entry_free(e);
-    return -ENOMEM;
-  }
-  e->type = MD_TYPE_STRING;
-
-  return md_entry_insert(md, e);
+  meta_value_t v = {.mv_string = (char *)value};
+  return md_entry_insert(md, key, MD_TYPE_STRING, v);
 } /* }}} int meta_data_add_string */
 
 int meta_data_add_signed_int(meta_data_t *md, /* {{{ */
                              const char *key, int64_t value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_signed_int = value;
-  e->type = MD_TYPE_SIGNED_INT;
-
-  return md_entry_insert(md, e);
+  meta_value_t v = {.mv_signed_int = value};
+  return md_entry_insert(md, key, MD_TYPE_SIGNED_INT, v);
 } /* }}} int meta_data_add_signed_int */
 
 int meta_data_add_unsigned_int(meta_data_t *md, /* {{{ */
                                const char *key, uint64_t value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_unsigned_int = value;
-  e->type = MD_TYPE_UNSIGNED_INT;
-
-  return md_entry_insert(md, e);
+  meta_value_t v = {.mv_unsigned_int = value};
+  return md_entry_insert(md, key, MD_TYPE_UNSIGNED_INT, v);
 } /* }}} int meta_data_add_unsigned_int */
 
 int meta_data_add_double(meta_data_t *md, /* {{{ */
                          const char *key, double value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_double = value;
-  e->type = MD_TYPE_DOUBLE;
-
-  return md_entry_insert(md, e);
+  meta_value_t v = {.mv_double = value};
+  return md_entry_insert(md, key, MD_TYPE_DOUBLE, v);
 } /* }}} int meta_data_add_double */
 
 int meta_data_add_boolean(meta_data_t *md, /* {{{ */
                           const char *key, bool value) {
-  meta_entry_t *e;
-
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  e = md_entry_alloc(key);
-  if (e == NULL)
-    return -ENOMEM;
-
-  e->value.mv_boolean = value;
-  e->type = MD_TYPE_BOOLEAN;
-
-  return md_entry_insert(md, e);
+  meta_value_t v = {.mv_boolean = value};
+  return md_entry_insert(md, key, MD_TYPE_BOOLEAN, v);
 } /* }}} int meta_data_add_boolean */
 
 /*
  * Get functions
  */
-int _meta_data_get_string(meta_data_t *md, meta_entry_t *e, char **value) {
+static int md_entry_get_string(meta_entry_t *e, char **value) /* {{{ */
+{
   char *temp;
 
   if (e->type != MD_TYPE_STRING) {
@@ -558,28 +535,20 @@ int _meta_data_get_string(meta_data_t *md, meta_entry_t *e, char **value) {
   *value = temp;
 
   return 0;
-}
+} /* }}} int md_entry_get_string */
 
 int meta_data_get_string(meta_data_t *md, /* {{{ */
                          const char *key, char **value) {
   meta_entry_t *e;
-  int res = 0;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
-
-  res = _meta_data_get_string(md, e, value);
 
-  pthread_mutex_unlock(&md->lock);
-  return res;
+  return md_entry_get_string(e, value);
 } /* }}} int meta_data_get_string */
 
 int meta_data_get_signed_int(meta_data_t *md, /* {{{ */
@@ -589,23 +558,16 @@ int meta_data_get_signed_int(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_SIGNED_INT) {
     ERROR("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_signed_int;
-
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_signed_int */
 
@@ -616,23 +578,16 @@ int meta_data_get_unsigned_int(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_UNSIGNED_INT) {
     ERROR("meta_data_get_unsigned_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_unsigned_int;
-
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_unsigned_int */
 
@@ -643,23 +598,16 @@ int meta_data_get_double(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_DOUBLE) {
     ERROR("meta_data_get_double: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_double;
-
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_double */
 
@@ -670,23 +618,16 @@ int meta_data_get_boolean(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   if (e->type != MD_TYPE_BOOLEAN) {
     ERROR("meta_data_get_boolean: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock(&md->lock);
     return -ENOENT;
   }
 
   *value = e->value.mv_boolean;
-
-  pthread_mutex_unlock(&md->lock);
   return 0;
 } /* }}} int meta_data_get_boolean */
 
@@ -701,13 +642,9 @@ int meta_data_as_string(meta_data_t *md, /* {{{ */
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
   e = md_entry_lookup(md, key);
-  if (e == NULL) {
-    pthread_mutex_unlock(&md->lock);
+  if (e == NULL)
     return -ENOENT;
-  }
 
   type = e->type;
 
@@ -731,13 +668,10 @@ int meta_data_as_string(meta_data_t *md, /* {{{ */
     actual = e->value.mv_boolean ? "true" : "false";
     break;
   default:
-    pthread_mutex_unlock(&md->lock);
     ERROR("meta_data_as_string: unknown type %d for key `%s'", type, key);
     return -ENOENT;
   }
 
-  pthread_mutex_unlock(&md->lock);
-
   temp = md_strdup(actual);
   if (temp == NULL) {
     ERROR("meta_data_as_string: md_strdup failed for key `%s'.", key);
@@ -749,9 +683,16 @@ int meta_data_as_string(meta_data_t *md, /* {{{ */
   return 0;
 } /* }}} int meta_data_as_string */
 
-meta_entry_t *meta_data_iter(meta_data_t *md) { return md->head; }
+/* Entries are returned sorted by key. */
+meta_entry_t *meta_data_iter(meta_data_t *md) {
+  if ((md->block == NULL) || (md->block->num == 0))
+    return NULL;
+  return &md->block->entry[0];
+}
 
-meta_entry_t *meta_data_iter_next(meta_entry_t *iter) { return iter->next; }
+meta_entry_t *meta_data_iter_next(meta_entry_t *iter) {
+  return (iter[1].key != NULL) ? &iter[1] : NULL;
+}
 
 int meta_data_iter_type(meta_entry_t *iter) { return iter->type; }
 
@@ -759,15 +700,8 @@ const char *meta_data_iter_key(meta_entry_t *iter) { return iter->key; }
 
 int meta_data_iter_get_string(meta_data_t *md, meta_entry_t *iter,
                               char **value) {
-  int res = 0;
-
   if ((md == NULL) || (iter == NULL) || (value == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock(&md->lock);
-
-  res = _meta_data_get_string(md, iter, value);
-
-  pthread_mutex_unlock(&md->lock);
-  return res;
+  return md_entry_get_string(iter, value);
 }
@@ -110,8 +110,86 @@ DEF_TEST(base) {
   return 0;
 }
 
+DEF_TEST(clone) {
+  meta_data_t *m;
+  meta_data_t *c;
+  char *s;
+  int64_t si;
+
+  CHECK_NOT_NULL(m = meta_data_create());
+  CHECK_ZERO(meta_data_add_string(m, "b", "bar"));
+  CHECK_ZERO(meta_data_add_string(m, "A", "foo"));
+  CHECK_ZERO(meta_data_add_signed_int(m, "c", 42));
+
+  /* keys are case insensitive and iterated in order */
+  OK(meta_data_exists(m, "a"));
+  char *want[] = {"A", "b", "c", "d"};
+  size_t n = 0;
+  for (meta_entry_t *e = meta_data_iter(m); e != NULL;
+       e = meta_data_iter_next(e)) {
+    OK(n < 3);
+    EXPECT_EQ_STR(want[n], meta_data_iter_key(e));
+    n++;
+  }
+  EXPECT_EQ_INT(3, (int)n);
+
+  /* modifying the copy does not change the original, and vice versa */
+  CHECK_NOT_NULL(c = meta_data_clone(m));
+  CHECK_ZERO(meta_data_add_string(c, "b", "baz"));
+  CHECK_ZERO(meta_data_delete(c, "c"));
+  CHECK_ZERO(meta_data_add_signed_int(m, "d", 23));
+
+  CHECK_ZERO(meta_data_get_string(m, "b", &s));
+  EXPECT_EQ_STR("bar", s);
+  sfree(s);
+  CHECK_ZERO(meta_data_get_signed_int(m, "c", &si));
+  EXPECT_EQ_INT(42, (int)si);
+
+  CHECK_ZERO(meta_data_get_string(c, "b", &s));
+  EXPECT_EQ_STR("baz", s);
+  sfree(s);
+  EXPECT_EQ_INT(0, meta_data_exists(c, "c"));
+  EXPECT_EQ_INT(0, meta_data_exists(c, "d"));
+
+  /* merging overwrites existing keys */
+  CHECK_ZERO(meta_data_clone_merge(&c, m));
+  char **toc = NULL;
+  EXPECT_EQ_INT(4, meta_data_toc(c, &toc));
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_EQ_STR(want[i], toc[i]);
+    sfree(toc[i]);
+  }
+  sfree(toc);
+  CHECK_ZERO(meta_data_get_string(c, "b", &s));
+  EXPECT_EQ_STR("bar", s);
+  sfree(s);
+
+  /* grow beyond the initial capacity */
+  for (int i = 0; i < 100; i++) {
+    char key[16];
+    ssnprintf(key, sizeof(key), "key%03d", 99 - i);
+    CHECK_ZERO(meta_data_add_string(c, key, key));
+  }
+  for (int i = 0; i < 100; i++) {
+    char key[16];
+    ssnprintf(key, sizeof(key), "KEY%03d", i);
+    CHECK_ZERO(meta_data_as_string(c, key, &s));
+    EXPECT_EQ_STR(key + 3, s + 3);
+    sfree(s);
+  }
+  EXPECT_EQ_INT(4, meta_data_toc(m, &toc));
+  for (size_t i = 0; i < 4; i++)
+    sfree(toc[i]);
+  sfree(toc);
+
+  meta_data_destroy(c);
+  meta_data_destroy(m);
+  return 0;
+}
+
 int main(void) {
   RUN_TEST(base);
+  RUN_TEST(clone);
 
   END_TEST;
 }
@@ -31,12 +31,20 @@
 #include <linux/genetlink.h>
 #include <linux/taskstats.h>
 
+/* ac_flag of the last task of a thread group, from <linux/acct.h> */
+#ifndef AGROUP
+#define AGROUP 0x20
+#endif
+
 struct ts_s {
   struct mnl_socket *nl;
   pid_t pid;
   uint32_t seq;
   uint16_t genl_id_taskstats;
   unsigned int port_id;
+
+  /* cpumask the handle is registered for exit notifications with, if any */
+  char *cpumask;
 };
 
 /* nlmsg_errno returns the errno encoded in nlh or zero if not an error. */
@@ -55,20 +63,26 @@ static int nlmsg_errno(struct nlmsghdr *nlh, size_t sz) {
   return nlerr->error * (-1);
 }
 
+/* copy_taskstats copies the taskstats structure in attr to ret_taskstats. The
+ * structure is only ever extended, so the kernel may send a longer or shorter
+ * version than the one in our headers. Missing fields are set to zero. */
+static void copy_taskstats(struct taskstats *ret_taskstats,
+                           const struct nlattr *attr) {
+  size_t len = (size_t)mnl_attr_get_payload_len(attr);
+  if (len > sizeof(*ret_taskstats))
+    len = sizeof(*ret_taskstats);
+
+  memset(ret_taskstats, 0, sizeof(*ret_taskstats));
+  memmove(ret_taskstats, mnl_attr_get_payload(attr), len);
+}
+
 static int get_taskstats_attr_cb(const struct nlattr *attr, void *data) {
   struct taskstats *ret_taskstats = data;
 
   uint16_t type = mnl_attr_get_type(attr);
   switch (type) {
   case TASKSTATS_TYPE_STATS:
-    if (mnl_attr_get_payload_len(attr) != sizeof(*ret_taskstats)) {
-      ERROR("utils_taskstats: mnl_attr_get_payload_len(attr) = %" PRIu32
-            ", want %zu",
-            mnl_attr_get_payload_len(attr), sizeof(*ret_taskstats));
-      return MNL_CB_ERROR;
-    }
-    struct taskstats *ts = mnl_attr_get_payload(attr);
-    memmove(ret_taskstats, ts, sizeof(*ret_taskstats));
+    copy_taskstats(ret_taskstats, attr);
     return MNL_CB_OK;
 
   case TASKSTATS_TYPE_AGGR_PID: /* fall through */
@@ -240,11 +254,76 @@ static int get_family_id(ts_t *ts) {
   return 0;
 }
 
+/* set_exit_listener registers (or deregisters) the handle for the exit
+ * notifications of tasks running on the CPUs in cpumask. */
+static int set_exit_listener(ts_t *ts, const char *cpumask, bool enable) {
+  char buffer[MNL_SOCKET_BUFFER_SIZE];
+  uint32_t seq = ts->seq++;
+
+  struct nlmsghdr *nlh = mnl_nlmsg_put_header(buffer);
+  *nlh = (struct nlmsghdr){
+      .nlmsg_len = nlh->nlmsg_len,
+      .nlmsg_type = ts->genl_id_taskstats,
+      .nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK,
+      .nlmsg_seq = seq,
+      .nlmsg_pid = ts->pid,
+  };
+
+  struct genlmsghdr *genh = mnl_nlmsg_put_extra_header(nlh, sizeof(*genh));
+  *genh = (struct genlmsghdr){
+      .cmd = TASKSTATS_CMD_GET,
+      .version = TASKSTATS_GENL_VERSION,
+  };
+
+  mnl_attr_put_strz(nlh,
+                    enable ? TASKSTATS_CMD_ATTR_REGISTER_CPUMASK
+                           : TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK,
+                    cpumask);
+
+  if (mnl_socket_sendto(ts->nl, nlh, nlh->nlmsg_len) < 0) {
+    int status = errno;
+    ERROR("utils_taskstats: mnl_socket_sendto() = %s", STRERROR(status));
+    return status;
+  }
+
+  /* Exit notifications may already be queued in front of the ack. */
+  while (42) {
+    int status = mnl_socket_recvfrom(ts->nl, buffer, sizeof(buffer));
+    if (status < 0) {
+      status = errno;
+      ERROR("utils_taskstats: mnl_socket_recvfrom() = %s", STRERROR(status));
+      return status;
+    } else if (status == 0) {
+      ERROR("utils_taskstats: mnl_socket_recvfrom() = 0");
+      return ECONNABORTED;
+    }
+    size_t buffer_size = (size_t)status;
+
+    struct nlmsghdr *reply = (void *)buffer;
+    if (!mnl_nlmsg_ok(reply, (int)buffer_size) || (reply->nlmsg_seq != seq) ||
+        (reply->nlmsg_type != NLMSG_ERROR))
+      continue;
+
+    if ((status = nlmsg_errno(reply, buffer_size)) != 0) {
+      ERROR("utils_taskstats: TASKSTATS_CMD_GET(%s = \"%s\") = %s",
+            enable ? "TASKSTATS_CMD_ATTR_REGISTER_CPUMASK"
+                   : "TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK",
+            cpumask, STRERROR(status));
+    }
+    return status;
+  }
+}
+
 void ts_destroy(ts_t *ts) {
   if (ts == NULL) {
     return;
   }
 
+  if ((ts->nl != NULL) && (ts->cpumask != NULL)) {
+    set_exit_listener(ts, ts->cpumask, /* enable = */ false);
+  }
+  sfree(ts->cpumask);
+
   if (ts->nl != NULL) {
     mnl_socket_close(ts->nl);
     ts->nl = NULL;
@@ -305,3 +384,169 @@ int ts_delay_by_tgid(ts_t *ts, uint32_t tgid, ts_delay_t *out) {
   };
   return 0;
 }
+
+ts_t *ts_create_exit_listener(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (cpus < 1) {
+    cpus = 1;
+  }
+
+  char cpumask[32];
+  snprintf(cpumask, sizeof(cpumask), "0-%ld", cpus - 1);
+
+  ts_t *ts = ts_create();
+  if (ts == NULL) {
+    return NULL;
+  }
+
+  /* Bursts of exiting tasks easily overflow the default socket buffer. */
+  int rcvbuf = 4 * 1024 * 1024;
+  if (setsockopt(mnl_socket_get_fd(ts->nl), SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                 sizeof(rcvbuf)) != 0) {
+    WARNING("utils_taskstats: setsockopt(SO_RCVBUF) = %s", STRERRNO);
+  }
+
+  int status = set_exit_listener(ts, cpumask, /* enable = */ true);
+  if (status != 0) {
+    ts_destroy(ts);
+    return NULL;
+  }
+
+  ts->cpumask = strdup(cpumask);
+  if (ts->cpumask == NULL) {
+    set_exit_listener(ts, cpumask, /* enable = */ false);
+    ts_destroy(ts);
+    return NULL;
+  }
+
+  return ts;
+}
+
+int ts_fd(ts_t *ts) {
+  if ((ts == NULL) || (ts->nl == NULL)) {
+    return -1;
+  }
+
+  return mnl_socket_get_fd(ts->nl);
+}
+
+typedef struct {
+  uint32_t pid;
+  struct taskstats raw;
+  bool have_stats;
+} exit_record_t;
+
+static int get_exit_pid_attr_cb(const struct nlattr *attr, void *data) {
+  exit_record_t *rec = data;
+
+  switch (mnl_attr_get_type(attr)) {
+  case TASKSTATS_TYPE_PID:
+    if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0) {
+      return MNL_CB_ERROR;
+    }
+    rec->pid = mnl_attr_get_u32(attr);
+    return MNL_CB_OK;
+
+  case TASKSTATS_TYPE_STATS:
+    copy_taskstats(&rec->raw, attr);
+    rec->have_stats = true;
+    return MNL_CB_OK;
+  }
+
+  return MNL_CB_OK;
+}
+
+static int get_exit_attr_cb(const struct nlattr *attr, void *data) {
+  /* TASKSTATS_TYPE_AGGR_TGID only holds the delay accounting of the thread
+   * group, so only the per-task records are of interest. */
+  if (mnl_attr_get_type(attr) != TASKSTATS_TYPE_AGGR_PID) {
+    return MNL_CB_OK;
+  }
+
+  return mnl_attr_parse_nested(attr, get_exit_pid_attr_cb, data);
+}
+
+typedef struct {
+  ts_exit_callback_t callback;
+  void *user_data;
+} exit_callback_t;
+
+static int get_exit_msg_cb(const struct nlmsghdr *nlh, void *data) {
+  exit_callback_t *cb = data;
+  exit_record_t rec = {0};
+
+  int status = mnl_attr_parse(nlh, sizeof(struct genlmsghdr), get_exit_attr_cb,
+                              &rec);
+  if ((status < MNL_CB_STOP) || !rec.have_stats) {
+    return status;
+  }
+
+  ts_exit_t ex = {
+      .pid = (rec.pid != 0) ? rec.pid : rec.raw.ac_pid,
+#if TASKSTATS_VERSION >= 12
+      .tgid = rec.raw.ac_tgid,
+#endif
+      .group_dead = (rec.raw.ac_flag & AGROUP) != 0,
+      .utime_us = rec.raw.ac_utime,
+      .stime_us = rec.raw.ac_stime,
+      .minflt = rec.raw.ac_minflt,
+      .majflt = rec.raw.ac_majflt,
+      .read_char = rec.raw.read_char,
+      .write_char = rec.raw.write_char,
+      .read_syscalls = rec.raw.read_syscalls,
+      .write_syscalls = rec.raw.write_syscalls,
+      .read_bytes = rec.raw.read_bytes,
+      .write_bytes = rec.raw.write_bytes,
+      .nvcsw = rec.raw.nvcsw,
+      .nivcsw = rec.raw.nivcsw,
+  };
+  sstrncpy(ex.comm, rec.raw.ac_comm, sizeof(ex.comm));
+
+  cb->callback(&ex, cb->user_data);
+  return MNL_CB_OK;
+}
+
+int ts_read_exits(ts_t *ts, ts_exit_callback_t callback, void *user_data) {
+  if ((ts == NULL) || (ts->cpumask == NULL) || (callback == NULL)) {
+    return EINVAL;
+  }
+
+  exit_callback_t cb = {
+      .callback = callback,
+      .user_data = user_data,
+  };
+  int fd = mnl_socket_get_fd(ts->nl);
+  int ret = 0;
+
+  while (42) {
+    char buffer[MNL_SOCKET_BUFFER_SIZE];
+
+    ssize_t status = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (status < 0) {
+      if (errno == EINTR) {
+        continue;
+      } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        break;
+      } else if (errno == ENOBUFS) {
+        /* notifications have been dropped; keep reading the rest */
+        ret = ENOBUFS;
+        continue;
+      }
+      status = errno;
+      ERROR("utils_taskstats: recv() = %s", STRERROR((int)status));
+      return (int)status;
+    } else if (status == 0) {
+      break;
+    }
+
+    /* Replies to earlier requests have a sequence number, notifications
+     * don't; let mnl_cb_run() skip the sequence number check. */
+    status = mnl_cb_run(buffer, (size_t)status, /* seq = */ 0,
+                        /* portid = */ 0, get_exit_msg_cb, &cb);
+    if (status < MNL_CB_STOP) {
+      ERROR("utils_taskstats: Parsing exit notification failed.");
+    }
+  }
+
+  return ret;
+}
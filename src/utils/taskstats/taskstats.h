@@ -44,4 +44,44 @@ void ts_destroy(ts_t *);
  * identified by tgid. Returns zero on success and an errno otherwise. */
 int ts_delay_by_tgid(ts_t *ts, uint32_t tgid, ts_delay_t *out);
 
+/* ts_exit_t is the accounting information the kernel sends when a task
+ * (i.e. a thread) exits. All counters are totals over the task's lifetime. */
+typedef struct {
+  uint32_t pid;
+  /* thread group of the task; zero if the kernel doesn't report it */
+  uint32_t tgid;
+  /* set for the last task of a thread group */
+  bool group_dead;
+  char comm[32];
+
+  uint64_t utime_us;
+  uint64_t stime_us;
+  uint64_t minflt;
+  uint64_t majflt;
+
+  uint64_t read_char;
+  uint64_t write_char;
+  uint64_t read_syscalls;
+  uint64_t write_syscalls;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+
+  uint64_t nvcsw;
+  uint64_t nivcsw;
+} ts_exit_t;
+
+typedef void (*ts_exit_callback_t)(const ts_exit_t *, void *);
+
+/* ts_create_exit_listener returns a handle which is registered for the exit
+ * notifications of all tasks on the host. Requires CAP_NET_ADMIN. */
+ts_t *ts_create_exit_listener(void);
+
+/* ts_fd returns the file descriptor of the handle, e.g. for poll(2). */
+int ts_fd(ts_t *ts);
+
+/* ts_read_exits reads the pending exit notifications of an exit listener
+ * without blocking and calls callback for each of them. Returns zero on
+ * success, ENOBUFS if notifications have been lost, and an errno otherwise. */
+int ts_read_exits(ts_t *ts, ts_exit_callback_t callback, void *user_data);
+
 #endif /* UTILS_TASKSTATS_H */
@@ -0,0 +1,160 @@
+/**
+ * collectd - src/utils/worker_pool/worker_pool.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+
+#include "plugin.h"
+#include "utils/common/common.h"
+#include "utils/worker_pool/worker_pool.h"
+
+typedef struct {
+  worker_pool_t *pool;
+  size_t index;
+  pthread_t thread;
+} worker_pool_thread_t;
+
+struct worker_pool_s {
+  worker_pool_callback_t callback;
+  void *user_data;
+
+  worker_pool_thread_t *threads;
+  size_t threads_num;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_cond_t done_cond;
+  uint64_t round;
+  size_t busy;
+  bool shutdown;
+};
+
+static void *worker_pool_thread(void *arg) /* {{{ */
+{
+  worker_pool_thread_t *t = arg;
+  worker_pool_t *pool = t->pool;
+  uint64_t round = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while (!pool->shutdown && (pool->round == round))
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (pool->shutdown)
+      break;
+    round = pool->round;
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->callback(t->index, pool->user_data);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy--;
+    if (pool->busy == 0)
+      pthread_cond_signal(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+} /* }}} void *worker_pool_thread */
+
+worker_pool_t *worker_pool_create(size_t threads_num, /* {{{ */
+                                  worker_pool_callback_t callback,
+                                  void *user_data, char const *name) {
+  if (callback == NULL)
+    return NULL;
+
+  worker_pool_t *pool = calloc(1, sizeof(*pool));
+  if (pool == NULL)
+    return NULL;
+
+  pool->callback = callback;
+  pool->user_data = user_data;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  if (threads_num < 2)
+    return pool;
+
+  pool->threads = calloc(threads_num - 1, sizeof(*pool->threads));
+  if (pool->threads == NULL) {
+    worker_pool_destroy(pool);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < threads_num - 1; i++) {
+    worker_pool_thread_t *t = pool->threads + i;
+    t->pool = pool;
+    t->index = i + 1;
+
+    int status = plugin_thread_create(&t->thread, worker_pool_thread, t, name);
+    if (status != 0) {
+      ERROR("worker pool: Starting thread \"%s\" failed: %s",
+            (name != NULL) ? name : "(unnamed)", STRERROR(status));
+      break;
+    }
+    pool->threads_num++;
+  }
+
+  return pool;
+} /* }}} worker_pool_t *worker_pool_create */
+
+size_t worker_pool_size(worker_pool_t const *pool) /* {{{ */
+{
+  if (pool == NULL)
+    return 1;
+  return pool->threads_num + 1;
+} /* }}} size_t worker_pool_size */
+
+void worker_pool_run(worker_pool_t *pool) /* {{{ */
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->busy = pool->threads_num;
+  pool->round++;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  pool->callback(0, pool->user_data);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0)
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+} /* }}} void worker_pool_run */
+
+void worker_pool_destroy(worker_pool_t *pool) /* {{{ */
+{
+  if (pool == NULL)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->threads_num; i++)
+    pthread_join(pool->threads[i].thread, NULL);
+  sfree(pool->threads);
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+  sfree(pool);
+} /* }}} void worker_pool_destroy */
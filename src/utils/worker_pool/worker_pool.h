@@ -0,0 +1,81 @@
+/**
+ * collectd - src/utils/worker_pool/worker_pool.h
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_WORKER_POOL_H
+#define UTILS_WORKER_POOL_H 1
+
+#include <stddef.h>
+
+struct worker_pool_s;
+typedef struct worker_pool_s worker_pool_t;
+
+/* Called once per round by each participant. "index" is zero for the thread
+ * calling worker_pool_run() and 1 ... size-1 for the pool's threads. */
+typedef void (*worker_pool_callback_t)(size_t index, void *user_data);
+
+/*
+ * NAME
+ *   worker_pool_create
+ *
+ * DESCRIPTION
+ *   Starts "threads_num - 1" threads which run "callback" in every round; the
+ *   thread calling worker_pool_run() is the remaining participant. If starting
+ *   a thread fails, the pool continues with the threads started so far, see
+ *   worker_pool_size().
+ *
+ * RETURN VALUE
+ *   A worker_pool_t-pointer upon success or NULL upon failure.
+ */
+worker_pool_t *worker_pool_create(size_t threads_num,
+                                  worker_pool_callback_t callback,
+                                  void *user_data, char const *name);
+
+/*
+ * NAME
+ *   worker_pool_size
+ *
+ * DESCRIPTION
+ *   Returns the number of participants of a round, including the thread
+ *   calling worker_pool_run().
+ */
+size_t worker_pool_size(worker_pool_t const *pool);
+
+/*
+ * NAME
+ *   worker_pool_run
+ *
+ * DESCRIPTION
+ *   Runs one round: wakes up the pool's threads, runs the callback with index
+ *   zero itself and returns once all threads have finished the round.
+ */
+void worker_pool_run(worker_pool_t *pool);
+
+/*
+ * NAME
+ *   worker_pool_destroy
+ *
+ * DESCRIPTION
+ *   Stops and joins the pool's threads and frees the pool.
+ */
+void worker_pool_destroy(worker_pool_t *pool);
+
+#endif /* UTILS_WORKER_POOL_H */
@@ -0,0 +1,95 @@
+/**
+ * collectd - src/utils/worker_pool/worker_pool_test.c
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/* The mocked plugin_thread_create() does not start threads. */
+#define plugin_thread_create plugin_thread_create_worker_pool_test
+
+#include "testing.h"
+#include "utils/worker_pool/worker_pool.c" /* sic */
+
+#define TEST_THREADS_NUM 4
+
+int plugin_thread_create_worker_pool_test(pthread_t *thread,
+                                          void *(*start_routine)(void *),
+                                          void *arg,
+                                          __attribute__((unused))
+                                          char const *name) {
+  return pthread_create(thread, NULL, start_routine, arg);
+}
+
+typedef struct {
+  size_t calls[TEST_THREADS_NUM];
+  pthread_t thread[TEST_THREADS_NUM];
+} test_state_t;
+
+static void test_callback(size_t index, void *user_data) {
+  test_state_t *s = user_data;
+
+  /* Each index is only ever used by the same thread. */
+  if (s->calls[index] == 0)
+    s->thread[index] = pthread_self();
+  else if (!pthread_equal(s->thread[index], pthread_self()))
+    s->calls[index] = SIZE_MAX / 2;
+
+  s->calls[index]++;
+}
+
+DEF_TEST(run) {
+  test_state_t s = {0};
+  worker_pool_t *pool =
+      worker_pool_create(TEST_THREADS_NUM, test_callback, &s, "test");
+  CHECK_NOT_NULL(pool);
+  EXPECT_EQ_INT(TEST_THREADS_NUM, (int)worker_pool_size(pool));
+
+  for (size_t round = 1; round <= 3; round++) {
+    worker_pool_run(pool);
+    /* All participants have finished when worker_pool_run() returns. */
+    for (size_t i = 0; i < TEST_THREADS_NUM; i++)
+      EXPECT_EQ_INT(round, s.calls[i]);
+  }
+  OK(pthread_equal(s.thread[0], pthread_self()));
+
+  worker_pool_destroy(pool);
+  return 0;
+}
+
+DEF_TEST(single) {
+  test_state_t s = {0};
+  worker_pool_t *pool = worker_pool_create(1, test_callback, &s, "test");
+  CHECK_NOT_NULL(pool);
+  EXPECT_EQ_INT(1, (int)worker_pool_size(pool));
+
+  worker_pool_run(pool);
+  EXPECT_EQ_INT(1, s.calls[0]);
+  EXPECT_EQ_INT(0, s.calls[1]);
+
+  worker_pool_destroy(pool);
+  worker_pool_destroy(NULL);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(run);
+  RUN_TEST(single);
+
+  END_TEST;
+}
@@ -261,7 +261,8 @@ int tail_match_add_match_simple(cu_tail_match_t *obj, const char *regex,
   cu_tail_match_simple_t *user_data;
   int status;
 
-  match = match_create_simple(regex, excluderegex, ds_type);
+  match = match_create_simple_sketch(regex, excluderegex, ds_type,
+                                     latency_cfg.relative_error);
   if (match == NULL)
     return -1;
 
@@ -338,31 +338,27 @@ static int wg_flush(cdtime_t timeout,
   return status;
 }
 
-static int wg_send_message(char const *message, struct wg_callback *cb) {
+static int wg_send_message_nolock(char const *message,
+                                  struct wg_callback *cb) {
   int status;
   size_t message_len;
 
   message_len = strlen(message);
 
-  pthread_mutex_lock(&cb->send_lock);
-
   wg_force_reconnect_check(cb);
 
   if (cb->sock_fd < 0) {
     status = wg_callback_init(cb);
     if (status != 0) {
       /* An error message has already been printed. */
-      pthread_mutex_unlock(&cb->send_lock);
       return -1;
     }
   }
 
   if (message_len >= cb->send_buf_free) {
     status = wg_flush_nolock(/* timeout = */ 0, cb);
-    if (status != 0) {
-      pthread_mutex_unlock(&cb->send_lock);
+    if (status != 0)
       return status;
-    }
   }
 
   /* Assert that we have enough space for this message. */
@@ -381,11 +377,11 @@ static int wg_send_message(char const *message, struct wg_callback *cb) {
         100.0 * ((double)cb->send_buf_fill) / ((double)sizeof(cb->send_buf)),
         message);
 
-  pthread_mutex_unlock(&cb->send_lock);
-
   return 0;
 }
 
+/* Formats the value list and appends it to the send buffer. Must be called
+ * with cb->send_lock held. */
 static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
                              struct wg_callback *cb) {
   char buffer[WG_SEND_BUF_SIZE] = {0};
@@ -403,24 +399,30 @@ static int wg_write_messages(const data_set_t *ds, const value_list_t *vl,
     return status;
 
   /* Send the message to graphite */
-  status = wg_send_message(buffer, cb);
+  status = wg_send_message_nolock(buffer, cb);
   if (status != 0) /* error message has been printed already. */
     return status;
 
   return 0;
 } /* int wg_write_messages */
 
-static int wg_write(const data_set_t *ds, const value_list_t *vl,
-                    user_data_t *user_data) {
+static int wg_write(const data_set_t *const *ds, const value_list_t *const *vl,
+                    size_t num, user_data_t *user_data) {
   struct wg_callback *cb;
-  int status;
+  int status = 0;
 
   if (user_data == NULL)
     return EINVAL;
 
   cb = user_data->data;
 
-  status = wg_write_messages(ds, vl, cb);
+  pthread_mutex_lock(&cb->send_lock);
+  for (size_t i = 0; i < num; i++) {
+    int tmp = wg_write_messages(ds[i], vl[i], cb);
+    if (tmp != 0)
+      status = tmp;
+  }
+  pthread_mutex_unlock(&cb->send_lock);
 
   return status;
 }
@@ -549,11 +551,11 @@ static int wg_config_node(oconfig_item_t *ci) {
     snprintf(callback_name, sizeof(callback_name), "write_graphite/%s",
              cb->name);
 
-  plugin_register_write(callback_name, wg_write,
-                        &(user_data_t){
-                            .data = cb,
-                            .free_func = wg_callback_free,
-                        });
+  plugin_register_write_batch(callback_name, wg_write,
+                              &(user_data_t){
+                                  .data = cb,
+                                  .free_func = wg_callback_free,
+                              });
 
   plugin_register_flush(callback_name, wg_flush, &(user_data_t){.data = cb});
 
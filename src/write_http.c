@@ -418,6 +418,8 @@ static void wh_callback_free(void *data) /* {{{ */
   sfree(cb);
 } /* }}} void wh_callback_free */
 
+/* The wh_write_* functions append one value list to the send buffer. They must
+ * be called with cb->send_lock held and the callback initialized. */
 static int wh_write_command(const data_set_t *ds,
                             const value_list_t *vl, /* {{{ */
                             wh_callback_t *cb) {
@@ -439,7 +441,7 @@ static int wh_write_command(const data_set_t *ds,
   }
 
   /* Copy the identifier to `key' and escape it. */
-  status = FORMAT_VL(key, sizeof(key), vl);
+  status = plugin_format_name_vl(key, sizeof(key), vl);
   if (status != 0) {
     ERROR("write_http plugin: error with format_name");
     return status;
@@ -465,19 +467,10 @@ static int wh_write_command(const data_set_t *ds,
     return -1;
   }
 
-  pthread_mutex_lock(&cb->send_lock);
-  if (wh_callback_init(cb) != 0) {
-    ERROR("write_http plugin: wh_callback_init failed.");
-    pthread_mutex_unlock(&cb->send_lock);
-    return -1;
-  }
-
   if (command_len >= cb->send_buffer_free) {
     status = wh_flush_nolock(/* timeout = */ 0, cb);
-    if (status != 0) {
-      pthread_mutex_unlock(&cb->send_lock);
+    if (status != 0)
       return status;
-    }
   }
   assert(command_len < cb->send_buffer_free);
 
@@ -495,9 +488,6 @@ static int wh_write_command(const data_set_t *ds,
         100.0 * ((double)cb->send_buffer_fill) / ((double)cb->send_buffer_size),
         command);
 
-  /* Check if we have enough space for this command. */
-  pthread_mutex_unlock(&cb->send_lock);
-
   return 0;
 } /* }}} int wh_write_command */
 
@@ -505,13 +495,6 @@ static int wh_write_json(const data_set_t *ds, const value_list_t *vl, /* {{{ */
                          wh_callback_t *cb) {
   int status;
 
-  pthread_mutex_lock(&cb->send_lock);
-  if (wh_callback_init(cb) != 0) {
-    ERROR("write_http plugin: wh_callback_init failed.");
-    pthread_mutex_unlock(&cb->send_lock);
-    return -1;
-  }
-
   status =
       format_json_value_list(cb->send_buffer, &cb->send_buffer_fill,
                              &cb->send_buffer_free, ds, vl, cb->store_rates);
@@ -519,7 +502,6 @@ static int wh_write_json(const data_set_t *ds, const value_list_t *vl, /* {{{ */
     status = wh_flush_nolock(/* timeout = */ 0, cb);
     if (status != 0) {
       wh_reset_buffer(cb);
-      pthread_mutex_unlock(&cb->send_lock);
       return status;
     }
 
@@ -527,19 +509,14 @@ static int wh_write_json(const data_set_t *ds, const value_list_t *vl, /* {{{ */
         format_json_value_list(cb->send_buffer, &cb->send_buffer_fill,
                                &cb->send_buffer_free, ds, vl, cb->store_rates);
   }
-  if (status != 0) {
-    pthread_mutex_unlock(&cb->send_lock);
+  if (status != 0)
     return status;
-  }
 
   DEBUG("write_http plugin: <%s> buffer %" PRIsz "/%" PRIsz " (%g%%)",
         cb->location, cb->send_buffer_fill, cb->send_buffer_size,
         100.0 * ((double)cb->send_buffer_fill) /
             ((double)cb->send_buffer_size));
 
-  /* Check if we have enough space for this command. */
-  pthread_mutex_unlock(&cb->send_lock);
-
   return 0;
 } /* }}} int wh_write_json */
 
@@ -548,17 +525,6 @@ static int wh_write_kairosdb(const data_set_t *ds,
                              wh_callback_t *cb) {
   int status;
 
-  pthread_mutex_lock(&cb->send_lock);
-
-  if (cb->curl == NULL) {
-    status = wh_callback_init(cb);
-    if (status != 0) {
-      ERROR("write_http plugin: wh_callback_init failed.");
-      pthread_mutex_unlock(&cb->send_lock);
-      return -1;
-    }
-  }
-
   status = format_kairosdb_value_list(
       cb->send_buffer, &cb->send_buffer_fill, &cb->send_buffer_free, ds, vl,
       cb->store_rates, (char const *const *)http_attrs, http_attrs_num,
@@ -567,7 +533,6 @@ static int wh_write_kairosdb(const data_set_t *ds,
     status = wh_flush_nolock(/* timeout = */ 0, cb);
     if (status != 0) {
       wh_reset_buffer(cb);
-      pthread_mutex_unlock(&cb->send_lock);
       return status;
     }
 
@@ -576,19 +541,14 @@ static int wh_write_kairosdb(const data_set_t *ds,
         cb->store_rates, (char const *const *)http_attrs, http_attrs_num,
         cb->data_ttl, cb->metrics_prefix);
   }
-  if (status != 0) {
-    pthread_mutex_unlock(&cb->send_lock);
+  if (status != 0)
     return status;
-  }
 
   DEBUG("write_http plugin: <%s> buffer %" PRIsz "/%" PRIsz " (%g%%)",
         cb->location, cb->send_buffer_fill, cb->send_buffer_size,
         100.0 * ((double)cb->send_buffer_fill) /
             ((double)cb->send_buffer_size));
 
-  /* Check if we have enough space for this command. */
-  pthread_mutex_unlock(&cb->send_lock);
-
   return 0;
 } /* }}} int wh_write_kairosdb */
 
@@ -597,13 +557,6 @@ static int wh_write_influxdb(const data_set_t *ds,
                              wh_callback_t *cb) {
   int status;
 
-  pthread_mutex_lock(&cb->send_lock);
-  if (wh_callback_init(cb) != 0) {
-    ERROR("write_http plugin: wh_callback_init failed.");
-    pthread_mutex_unlock(&cb->send_lock);
-    return -1;
-  }
-
   status = format_influxdb_value_list(cb->send_buffer + cb->send_buffer_fill,
                                       cb->send_buffer_free, ds, vl, NS,
                                       cb->store_rates, true);
@@ -611,7 +564,6 @@ static int wh_write_influxdb(const data_set_t *ds,
     status = wh_flush_nolock(/* timeout = */ 0, cb);
     if (status != 0) {
       wh_reset_buffer(cb);
-      pthread_mutex_unlock(&cb->send_lock);
       return status;
     }
 
@@ -619,24 +571,20 @@ static int wh_write_influxdb(const data_set_t *ds,
                                         cb->send_buffer_free, ds, vl, NS,
                                         cb->store_rates, true);
   }
-  if (status < 0) {
-    pthread_mutex_unlock(&cb->send_lock);
+  if (status < 0)
     return status;
-  }
 
   cb->send_buffer_fill += status;
   cb->send_buffer_free -= status;
 
-  /* Check if we have enough space for this command. */
-  pthread_mutex_unlock(&cb->send_lock);
-
   return 0;
 } /* }}} int wh_write_influxdb */
 
-static int wh_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
+static int wh_write(const data_set_t *const *ds, /* {{{ */
+                    const value_list_t *const *vl, size_t num,
                     user_data_t *user_data) {
   wh_callback_t *cb;
-  int status;
+  int status = 0;
 
   if (user_data == NULL)
     return -EINVAL;
@@ -644,20 +592,35 @@ static int wh_write(const data_set_t *ds, const value_list_t *vl, /* {{{ */
   cb = user_data->data;
   assert(cb->send_metrics);
 
-  switch (cb->format) {
-  case WH_FORMAT_JSON:
-    status = wh_write_json(ds, vl, cb);
-    break;
-  case WH_FORMAT_KAIROSDB:
-    status = wh_write_kairosdb(ds, vl, cb);
-    break;
-  case WH_FORMAT_INFLUXDB:
-    status = wh_write_influxdb(ds, vl, cb);
-    break;
-  default:
-    status = wh_write_command(ds, vl, cb);
-    break;
+  pthread_mutex_lock(&cb->send_lock);
+  if (wh_callback_init(cb) != 0) {
+    ERROR("write_http plugin: wh_callback_init failed.");
+    pthread_mutex_unlock(&cb->send_lock);
+    return -1;
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    int tmp;
+
+    switch (cb->format) {
+    case WH_FORMAT_JSON:
+      tmp = wh_write_json(ds[i], vl[i], cb);
+      break;
+    case WH_FORMAT_KAIROSDB:
+      tmp = wh_write_kairosdb(ds[i], vl[i], cb);
+      break;
+    case WH_FORMAT_INFLUXDB:
+      tmp = wh_write_influxdb(ds[i], vl[i], cb);
+      break;
+    default:
+      tmp = wh_write_command(ds[i], vl[i], cb);
+      break;
+    }
+    if (tmp != 0)
+      status = tmp;
   }
+  pthread_mutex_unlock(&cb->send_lock);
+
   return status;
 } /* }}} int wh_write */
 
@@ -959,7 +922,7 @@ static int wh_config_node(oconfig_item_t *ci) /* {{{ */
   };
 
   if (cb->send_metrics) {
-    plugin_register_write(callback_name, wh_write, &user_data);
+    plugin_register_write_batch(callback_name, wh_write, &user_data);
     user_data.free_func = NULL;
 
     plugin_register_flush(callback_name, wh_flush, &user_data);
@@ -36,6 +36,10 @@
 
 #include <microhttpd.h>
 
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -57,14 +61,91 @@
 #define MHD_RESULT int
 #endif
 
+/* Exposition formats. Each metric family caches its rendering in both formats,
+ * so a scrape only has to re-render the families that changed since. */
+#define PROM_FORMAT_TEXT 0
+#define PROM_FORMAT_PROTO 1
+#define PROM_FORMAT_MAX 2
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  bool dirty;
+} prom_render_t;
+
+/* prom_shadow_t is the scrape side copy of a metric family. Scrapes render the
+ * shadow copy without holding metrics_lock, while writes keep updating the
+ * family itself. Shadows are only accessed with render_lock held; a shadow of a
+ * deleted family is put on "shadows_orphaned" and freed by the next scrape. */
+typedef struct prom_shadow_s {
+  Io__Prometheus__Client__MetricFamily *pb;
+  prom_render_t render[PROM_FORMAT_MAX];
+  struct prom_shadow_s *next;
+} prom_shadow_t;
+
+/* metric_slot_t is a bucket of a metric family's hash index. It maps the hash
+ * of a metric's label values to the metric's position in the family's "metric"
+ * array. */
+typedef struct {
+  uint64_t hash;
+  size_t index;
+} metric_slot_t;
+
+#define METRIC_SLOT_EMPTY SIZE_MAX
+#define METRIC_SLOTS_MIN 8
+
+/* prom_family_t wraps a metric family. Metrics are kept in "pb->metric" in
+ * insertion order and are looked up through the open addressing hash table
+ * "slots". Deleting a metric leaves a NULL hole in "pb->metric", which is
+ * closed up lazily by metric_family_compact(). */
+typedef struct {
+  Io__Prometheus__Client__MetricFamily *pb;
+
+  /* "shadow" is rebuilt if metrics have been added or removed since the last
+   * scrape; if only values changed, they are copied over. */
+  prom_shadow_t *shadow;
+  bool structure_changed;
+  bool values_changed;
+
+  size_t metric_alloc;
+  size_t holes;
+
+  metric_slot_t *slots;
+  size_t slots_num;
+  size_t slots_used;
+} prom_family_t;
+
+/* prom_snapshot_t is a complete, pre-rendered scrape response. Snapshots are
+ * immutable and reference counted: the current snapshot of each format is
+ * held by "snapshots" and every in-flight response holds one more reference,
+ * so a new snapshot can be swapped in while an old one is still being sent. */
+typedef struct {
+  size_t refs;
+  uint64_t generation;
+  bool gzip;
+  size_t size;
+  uint8_t data[];
+} prom_snapshot_t;
+
 static c_avl_tree_t *metrics;
 static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+/* metrics_generation is incremented with every change to "metrics". */
+static uint64_t metrics_generation = 1;
+
+/* snapshots[format][gzip], protected by snapshot_lock. render_lock serializes
+ * rebuilding snapshots so concurrent scrapes don't duplicate the work. */
+static prom_snapshot_t *snapshots[PROM_FORMAT_MAX][2];
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+/* protected by metrics_lock */
+static prom_shadow_t *shadows_orphaned;
 
 static char *httpd_host = NULL;
 static unsigned short httpd_port = 9103;
 static struct MHD_Daemon *httpd;
 
 static cdtime_t staleness_delta = PROMETHEUS_DEFAULT_STALENESS_DELTA;
+static bool compression = true;
 
 /* Unfortunately, protoc-c doesn't export its implementation of varint, so we
  * need to implement our own. */
@@ -83,30 +164,21 @@ static size_t varint(uint8_t buffer[static VARINT_UINT32_BYTES],
   return 0;
 }
 
-/* format_protobuf iterates over all metric families in "metrics" and adds them
- * to a buffer in ProtoBuf format. It prefixes each protobuf with its encoded
- * size, the so called "delimited" format. */
-static void format_protobuf(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
-
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    /* Prometheus uses a message length prefix to determine where one
-     * MetricFamily ends and the next begins. This delimiter is encoded as a
-     * "varint", which is common in Protobufs. */
-    uint8_t delim[VARINT_UINT32_BYTES] = {0};
-    size_t delim_len = varint(
-        delim,
-        (uint32_t)io__prometheus__client__metric_family__get_packed_size(fam));
-    buffer->append(buffer, delim_len, delim);
-
-    io__prometheus__client__metric_family__pack_to_buffer(fam, buffer);
-  }
-  c_avl_iterator_destroy(iter);
-
-  pthread_mutex_unlock(&metrics_lock);
+/* format_protobuf adds a metric family to a buffer in ProtoBuf format. It
+ * prefixes the protobuf with its encoded size, the so called "delimited"
+ * format. */
+static void format_protobuf(ProtobufCBuffer *buffer,
+                            Io__Prometheus__Client__MetricFamily const *fam) {
+  /* Prometheus uses a message length prefix to determine where one
+   * MetricFamily ends and the next begins. This delimiter is encoded as a
+   * "varint", which is common in Protobufs. */
+  uint8_t delim[VARINT_UINT32_BYTES] = {0};
+  size_t delim_len = varint(
+      delim,
+      (uint32_t)io__prometheus__client__metric_family__get_packed_size(fam));
+  buffer->append(buffer, delim_len, delim);
+
+  io__prometheus__client__metric_family__pack_to_buffer(fam, buffer);
 }
 
 static char const *escape_label_value(char *buffer, size_t buffer_size,
@@ -179,56 +251,383 @@ static char *format_labels(char *buffer, size_t buffer_size,
   return buffer;
 }
 
-/* format_text iterates over all metric families in "metrics" and adds them
- * to a buffer in plain text format. */
-static void format_text(ProtobufCBuffer *buffer) {
-  pthread_mutex_lock(&metrics_lock);
+/* format_text adds a metric family to a buffer in plain text format. */
+static void format_text(ProtobufCBuffer *buffer,
+                        Io__Prometheus__Client__MetricFamily const *fam) {
+  char line[1024]; /* 4x DATA_MAX_NAME_LEN? */
 
-  char *unused_name;
-  Io__Prometheus__Client__MetricFamily *fam;
-  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
-  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&fam) == 0) {
-    char line[1024]; /* 4x DATA_MAX_NAME_LEN? */
+  ssnprintf(line, sizeof(line), "# HELP %s %s\n", fam->name, fam->help);
+  buffer->append(buffer, strlen(line), (uint8_t *)line);
 
-    ssnprintf(line, sizeof(line), "# HELP %s %s\n", fam->name, fam->help);
-    buffer->append(buffer, strlen(line), (uint8_t *)line);
+  ssnprintf(line, sizeof(line), "# TYPE %s %s\n", fam->name,
+            (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
+                ? "gauge"
+                : "counter");
+  buffer->append(buffer, strlen(line), (uint8_t *)line);
+
+  for (size_t i = 0; i < fam->n_metric; i++) {
+    Io__Prometheus__Client__Metric *m = fam->metric[i];
+
+    char labels[1024];
+
+    char timestamp_ms[24] = "";
+    if (m->has_timestamp_ms)
+      ssnprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
+                m->timestamp_ms);
+
+    if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
+      ssnprintf(line, sizeof(line), "%s{%s} " GAUGE_FORMAT "%s\n", fam->name,
+                format_labels(labels, sizeof(labels), m), m->gauge->value,
+                timestamp_ms);
+    else /* if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER) */
+      ssnprintf(line, sizeof(line), "%s{%s} %.0f%s\n", fam->name,
+                format_labels(labels, sizeof(labels), m), m->counter->value,
+                timestamp_ms);
 
-    ssnprintf(line, sizeof(line), "# TYPE %s %s\n", fam->name,
-              (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-                  ? "gauge"
-                  : "counter");
     buffer->append(buffer, strlen(line), (uint8_t *)line);
+  }
+}
 
-    for (size_t i = 0; i < fam->n_metric; i++) {
-      Io__Prometheus__Client__Metric *m = fam->metric[i];
+/* format_text_footer returns the comment appended to the text exposition. */
+static size_t format_text_footer(char *buffer, size_t buffer_size) {
+  ssnprintf(buffer, buffer_size, "\n# collectd/write_prometheus %s at %s\n",
+            PACKAGE_VERSION, hostname_g);
+  return strlen(buffer);
+}
 
-      char labels[1024];
+/*
+ * Pre-rendered snapshots. Every metric family has a scrape side copy, which
+ * keeps a rendering of itself in each format. A scrape first brings the copies
+ * of changed families up to date with metrics_lock held: copies of families
+ * whose metrics have been added or removed are rebuilt, otherwise only the
+ * values are copied. The copies are then rendered into new buffers without the
+ * lock and concatenated into an immutable snapshot, which is reused by all
+ * following scrapes until the next change. prom_write() therefore only ever
+ * waits for a copy of the changed values, never for formatting.
+ * {{{ */
+static int prom_family_sync(prom_family_t *pf);
+static void prom_shadows_orphaned_free(void);
+
+/* shadow_render updates the cached rendering of a shadow copy in the given
+ * format, if its values changed. The new rendering replaces the old one once
+ * complete. */
+static int shadow_render(prom_shadow_t *shadow, int format) {
+  prom_render_t *r = shadow->render + format;
+  if (!r->dirty)
+    return 0;
 
-      char timestamp_ms[24] = "";
-      if (m->has_timestamp_ms)
-        ssnprintf(timestamp_ms, sizeof(timestamp_ms), " %" PRIi64,
-                  m->timestamp_ms);
+  uint8_t scratch[4096];
+  ProtobufCBufferSimple simple = PROTOBUF_C_BUFFER_SIMPLE_INIT(scratch);
+  ProtobufCBuffer *buffer = (ProtobufCBuffer *)&simple;
 
-      if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__GAUGE)
-        ssnprintf(line, sizeof(line), "%s{%s} " GAUGE_FORMAT "%s\n", fam->name,
-                  format_labels(labels, sizeof(labels), m), m->gauge->value,
-                  timestamp_ms);
-      else /* if (fam->type == IO__PROMETHEUS__CLIENT__METRIC_TYPE__COUNTER) */
-        ssnprintf(line, sizeof(line), "%s{%s} %.0f%s\n", fam->name,
-                  format_labels(labels, sizeof(labels), m), m->counter->value,
-                  timestamp_ms);
+  if (format == PROM_FORMAT_PROTO)
+    format_protobuf(buffer, shadow->pb);
+  else
+    format_text(buffer, shadow->pb);
 
-      buffer->append(buffer, strlen(line), (uint8_t *)line);
+  uint8_t *data = malloc(simple.len);
+  if (data == NULL) {
+    PROTOBUF_C_BUFFER_SIMPLE_CLEAR(&simple);
+    return ENOMEM;
+  }
+  memcpy(data, simple.data, simple.len);
+
+  sfree(r->data);
+  r->data = data;
+  r->size = simple.len;
+  r->dirty = false;
+
+  PROTOBUF_C_BUFFER_SIMPLE_CLEAR(&simple);
+  return 0;
+}
+
+static void snapshot_unref(prom_snapshot_t *snap) {
+  if (snap == NULL)
+    return;
+
+  pthread_mutex_lock(&snapshot_lock);
+  assert(snap->refs > 0);
+  snap->refs--;
+  bool destroy = (snap->refs == 0);
+  pthread_mutex_unlock(&snapshot_lock);
+
+  if (destroy)
+    free(snap);
+}
+
+/* snapshot_current returns a new reference to the current snapshot, if it is
+ * up to date with "generation". */
+static prom_snapshot_t *snapshot_current(int format, bool gzip,
+                                         uint64_t generation) {
+  pthread_mutex_lock(&snapshot_lock);
+  prom_snapshot_t *snap = snapshots[format][gzip];
+  if ((snap != NULL) && (snap->generation == generation))
+    snap->refs++;
+  else
+    snap = NULL;
+  pthread_mutex_unlock(&snapshot_lock);
+
+  return snap;
+}
+
+/* snapshot_install makes snap the current snapshot. The caller's reference is
+ * not consumed. */
+static void snapshot_install(int format, bool gzip, prom_snapshot_t *snap) {
+  pthread_mutex_lock(&snapshot_lock);
+  prom_snapshot_t *old = snapshots[format][gzip];
+  snapshots[format][gzip] = snap;
+  snap->refs++;
+  pthread_mutex_unlock(&snapshot_lock);
+
+  snapshot_unref(old);
+}
+
+/* snapshot_build renders all metric families in "metrics" into a new snapshot.
+ * Only the families changed since the last build are formatted, and this is
+ * done without holding metrics_lock. Must be called with render_lock held. */
+static prom_snapshot_t *snapshot_build(int format) {
+  char footer[1024] = "";
+  size_t footer_size = 0;
+  if (format == PROM_FORMAT_TEXT)
+    footer_size = format_text_footer(footer, sizeof(footer));
+
+  pthread_mutex_lock(&metrics_lock);
+
+  prom_shadows_orphaned_free();
+
+  prom_shadow_t **shadows =
+      calloc((size_t)c_avl_size(metrics) + 1, sizeof(*shadows));
+  if (shadows == NULL) {
+    pthread_mutex_unlock(&metrics_lock);
+    ERROR("write_prometheus plugin: calloc failed.");
+    return NULL;
+  }
+
+  size_t shadows_num = 0;
+  uint64_t generation = metrics_generation;
+  char *unused_name;
+  prom_family_t *pf;
+  c_avl_iterator_t *iter = c_avl_get_iterator(metrics);
+  while (c_avl_iterator_next(iter, (void *)&unused_name, (void *)&pf) == 0) {
+    int status = prom_family_sync(pf);
+    if (status != 0) {
+      ERROR("write_prometheus plugin: Copying metric family \"%s\" failed "
+            "with status %d",
+            pf->pb->name, status);
+      continue;
     }
+    shadows[shadows_num] = pf->shadow;
+    shadows_num++;
   }
   c_avl_iterator_destroy(iter);
 
-  char server[1024];
-  ssnprintf(server, sizeof(server), "\n# collectd/write_prometheus %s at %s\n",
-            PACKAGE_VERSION, hostname_g);
-  buffer->append(buffer, strlen(server), (uint8_t *)server);
+  pthread_mutex_unlock(&metrics_lock);
+
+  /* The shadow copies stay valid until the next build, even if their family
+   * is deleted in the meantime. */
+  size_t size = footer_size;
+  for (size_t i = 0; i < shadows_num; i++) {
+    int status = shadow_render(shadows[i], format);
+    if (status != 0) {
+      ERROR("write_prometheus plugin: Rendering metric family \"%s\" failed "
+            "with status %d",
+            shadows[i]->pb->name, status);
+      continue;
+    }
+    size += shadows[i]->render[format].size;
+  }
+
+  prom_snapshot_t *snap = malloc(sizeof(*snap) + size);
+  if (snap == NULL) {
+    sfree(shadows);
+    ERROR("write_prometheus plugin: Allocating a %zu byte snapshot failed.",
+          size);
+    return NULL;
+  }
+  snap->refs = 1;
+  snap->generation = generation;
+  snap->gzip = false;
+  snap->size = 0;
+
+  for (size_t i = 0; i < shadows_num; i++) {
+    prom_render_t const *r = shadows[i]->render + format;
+    if (r->dirty || (r->size == 0))
+      continue;
+    memcpy(snap->data + snap->size, r->data, r->size);
+    snap->size += r->size;
+  }
+  sfree(shadows);
+
+  memcpy(snap->data + snap->size, footer, footer_size);
+  snap->size += footer_size;
+
+  return snap;
+}
+
+#if HAVE_ZLIB
+/* snapshot_compress returns a gzip compressed copy of plain. */
+static prom_snapshot_t *snapshot_compress(prom_snapshot_t const *plain) {
+  z_stream zs = {0};
+  /* 15 window bits, plus 16 to get a gzip header instead of a zlib one. */
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    ERROR("write_prometheus plugin: deflateInit2 failed.");
+    return NULL;
+  }
+
+  size_t bound = (size_t)deflateBound(&zs, (uLong)plain->size);
+  prom_snapshot_t *snap = malloc(sizeof(*snap) + bound);
+  if (snap == NULL) {
+    deflateEnd(&zs);
+    return NULL;
+  }
+
+  zs.next_in = (Bytef *)plain->data;
+  zs.avail_in = (uInt)plain->size;
+  zs.next_out = snap->data;
+  zs.avail_out = (uInt)bound;
+
+  int status = deflate(&zs, Z_FINISH);
+  deflateEnd(&zs);
+  if (status != Z_STREAM_END) {
+    ERROR("write_prometheus plugin: deflate failed with status %d.", status);
+    free(snap);
+    return NULL;
+  }
+
+  snap->refs = 1;
+  snap->generation = plain->generation;
+  snap->gzip = true;
+  snap->size = (size_t)zs.total_out;
+  return snap;
+}
+#endif
+
+/* snapshot_get returns a reference to an up-to-date snapshot in the requested
+ * format, building a new one if metrics changed since the last scrape. If
+ * compression fails, the uncompressed snapshot is returned instead. */
+static prom_snapshot_t *snapshot_get(int format, bool gzip) {
+#if !HAVE_ZLIB
+  gzip = false;
+#endif
+
+  pthread_mutex_lock(&render_lock);
 
+  pthread_mutex_lock(&metrics_lock);
+  uint64_t generation = metrics_generation;
   pthread_mutex_unlock(&metrics_lock);
+
+  prom_snapshot_t *snap = snapshot_current(format, gzip, generation);
+  if (snap != NULL) {
+    pthread_mutex_unlock(&render_lock);
+    return snap;
+  }
+
+  prom_snapshot_t *plain = snapshot_current(format, false, generation);
+  if (plain == NULL) {
+    plain = snapshot_build(format);
+    if (plain == NULL) {
+      pthread_mutex_unlock(&render_lock);
+      return NULL;
+    }
+    snapshot_install(format, false, plain);
+  }
+
+#if HAVE_ZLIB
+  if (gzip) {
+    snap = snapshot_compress(plain);
+    if (snap != NULL) {
+      snapshot_install(format, true, snap);
+      snapshot_unref(plain);
+      pthread_mutex_unlock(&render_lock);
+      return snap;
+    }
+  }
+#endif
+
+  pthread_mutex_unlock(&render_lock);
+  return plain;
+}
+
+#if defined(MHD_VERSION) && MHD_VERSION >= 0x00096300
+/* snapshot_free_callback is called by microhttpd once a response has been
+ * sent. It releases the reference held by the response. */
+static void snapshot_free_callback(void *data) {
+  snapshot_unref(
+      (prom_snapshot_t *)((uint8_t *)data - offsetof(prom_snapshot_t, data)));
+}
+#endif
+
+static void snapshots_destroy(void) {
+  pthread_mutex_lock(&render_lock);
+  for (size_t i = 0; i < PROM_FORMAT_MAX; i++) {
+    for (size_t j = 0; j < 2; j++) {
+      pthread_mutex_lock(&snapshot_lock);
+      prom_snapshot_t *snap = snapshots[i][j];
+      snapshots[i][j] = NULL;
+      pthread_mutex_unlock(&snapshot_lock);
+
+      snapshot_unref(snap);
+    }
+  }
+  pthread_mutex_unlock(&render_lock);
+}
+/* }}} */
+
+/* accept_gzip parses the value of an Accept-Encoding header and returns true
+ * if it allows a gzip encoded response, i.e. if "gzip" or "*" is listed with a
+ * non-zero quality value. An explicit "gzip" entry takes precedence over "*",
+ * so "*, gzip;q=0" rejects gzip. */
+static bool accept_gzip(char const *accept_encoding) {
+  if (accept_encoding == NULL)
+    return false;
+
+  double gzip_q = -1.0;
+  double any_q = -1.0;
+
+  char const *ptr = accept_encoding;
+  while (*ptr != 0) {
+    size_t len = strcspn(ptr, ",");
+    char token[256];
+    sstrncpy(token, ptr, (len < sizeof(token)) ? len + 1 : sizeof(token));
+    ptr += len;
+    if (*ptr == ',')
+      ptr++;
+
+    /* token is "coding" followed by optional ";param=value" pairs. */
+    char *saveptr = NULL;
+    char *coding = strtok_r(token, "; \t", &saveptr);
+    if (coding == NULL)
+      continue;
+
+    double q = 1.0;
+    char *param;
+    while ((param = strtok_r(NULL, ";", &saveptr)) != NULL) {
+      while ((*param == ' ') || (*param == '\t'))
+        param++;
+      if (((param[0] != 'q') && (param[0] != 'Q')) || (param[1] != '='))
+        continue;
+
+      char *endptr = NULL;
+      errno = 0;
+      double value = strtod(param + 2, &endptr);
+      if ((errno == 0) && (endptr != param + 2) && (value >= 0.0) &&
+          (value <= 1.0))
+        q = value;
+      else
+        q = 0.0;
+    }
+
+    if ((strcasecmp("gzip", coding) == 0) ||
+        (strcasecmp("x-gzip", coding) == 0))
+      gzip_q = q;
+    else if (strcmp("*", coding) == 0)
+      any_q = q;
+  }
+
+  if (gzip_q >= 0.0)
+    return gzip_q > 0.0;
+  return any_q > 0.0;
 }
 
 /* http_handler is the callback called by the microhttpd library. It essentially
@@ -258,29 +657,48 @@ static MHD_RESULT http_handler(__attribute__((unused)) void *cls,
   bool want_proto = (accept != NULL) &&
                     (strstr(accept, "application/vnd.google.protobuf") != NULL);
 
-  uint8_t scratch[4096] = {0};
-  ProtobufCBufferSimple simple = PROTOBUF_C_BUFFER_SIMPLE_INIT(scratch);
-  ProtobufCBuffer *buffer = (ProtobufCBuffer *)&simple;
+  char const *accept_encoding = MHD_lookup_connection_value(
+      connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  bool want_gzip = compression && accept_gzip(accept_encoding);
 
-  if (want_proto)
-    format_protobuf(buffer);
-  else
-    format_text(buffer);
+  prom_snapshot_t *snap = snapshot_get(
+      want_proto ? PROM_FORMAT_PROTO : PROM_FORMAT_TEXT, want_gzip);
+  if (snap == NULL)
+    return MHD_NO;
 
-#if defined(MHD_VERSION) && MHD_VERSION >= 0x00090500
+  /* With a recent enough microhttpd, the snapshot is handed out without
+   * copying and the reference is dropped once the response has been sent. */
+#if defined(MHD_VERSION) && MHD_VERSION >= 0x00096300
+  struct MHD_Response *res = MHD_create_response_from_buffer_with_free_callback(
+      snap->size, snap->data, snapshot_free_callback);
+#elif defined(MHD_VERSION) && MHD_VERSION >= 0x00090500
   struct MHD_Response *res = MHD_create_response_from_buffer(
-      simple.len, simple.data, MHD_RESPMEM_MUST_COPY);
+      snap->size, snap->data, MHD_RESPMEM_MUST_COPY);
 #else
   struct MHD_Response *res = MHD_create_response_from_data(
-      simple.len, simple.data, /* must_free = */ 0, /* must_copy = */ 1);
+      snap->size, snap->data, /* must_free = */ 0, /* must_copy = */ 1);
+#endif
+  bool gzip = snap->gzip;
+#if !defined(MHD_VERSION) || MHD_VERSION < 0x00096300
+  snapshot_unref(snap);
+#else
+  if (res == NULL)
+    snapshot_unref(snap);
 #endif
+  if (res == NULL)
+    return MHD_NO;
+
   MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_TYPE,
                           want_proto ? CONTENT_TYPE_PROTO : CONTENT_TYPE_TEXT);
+  if (compression)
+    MHD_add_response_header(res, MHD_HTTP_HEADER_VARY,
+                            MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  if (gzip)
+    MHD_add_response_header(res, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
 
   MHD_RESULT status = MHD_queue_response(connection, MHD_HTTP_OK, res);
 
   MHD_destroy_response(res);
-  PROTOBUF_C_BUFFER_SIMPLE_CLEAR(&simple);
   return status;
 }
 
@@ -345,8 +763,8 @@ static void metric_destroy(Io__Prometheus__Client__Metric *msg) {
   sfree(msg);
 }
 
-/* metric_cmp compares two metrics. It's prototype makes it easy to use with
- * qsort(3) and bsearch(3). */
+/* metric_cmp compares two metrics. It is used to resolve hash collisions in a
+ * metric family's index, see metric_family_slot(). */
 static int metric_cmp(void const *a, void const *b) {
   Io__Prometheus__Client__Metric const *m_a =
       *((Io__Prometheus__Client__Metric **)a);
@@ -519,56 +937,179 @@ static int metric_update(Io__Prometheus__Client__Metric *m, value_t value,
   return 0;
 }
 
-/* metric_family_add_metric adds m to the metric list of fam. */
-static int metric_family_add_metric(Io__Prometheus__Client__MetricFamily *fam,
-                                    Io__Prometheus__Client__Metric *m) {
-  Io__Prometheus__Client__Metric **tmp =
-      realloc(fam->metric, (fam->n_metric + 1) * sizeof(*fam->metric));
-  if (tmp == NULL)
+/* metric_hash returns the FNV-1a hash of a metric's label values. Label names
+ * are not included, see metric_cmp(). */
+static uint64_t metric_hash(Io__Prometheus__Client__Metric const *m) {
+  uint64_t hash = FNV1A_INIT;
+  for (size_t i = 0; i < m->n_label; i++) {
+    hash = fnv1a_append(hash, m->label[i]->value);
+    /* separator, so that "ab"/"c" and "a"/"bc" hash differently. Collisions
+     * only cost a metric_cmp() call. */
+    hash = fnv1a_append(hash, "/");
+  }
+  return hash;
+}
+
+/* metric_family_slot returns the slot of the metric matching key, or the empty
+ * slot at which it would be inserted. */
+static metric_slot_t *metric_family_slot(prom_family_t const *pf,
+                                         Io__Prometheus__Client__Metric *key,
+                                         uint64_t hash) {
+  size_t mask = pf->slots_num - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    metric_slot_t *slot = pf->slots + i;
+    if (slot->index == METRIC_SLOT_EMPTY)
+      return slot;
+    if ((slot->hash == hash) &&
+        (metric_cmp(&key, &pf->pb->metric[slot->index]) == 0))
+      return slot;
+  }
+}
+
+/* metric_family_slot_by_index returns the slot pointing to position "index" of
+ * the metric array. */
+static metric_slot_t *metric_family_slot_by_index(prom_family_t const *pf,
+                                                  uint64_t hash,
+                                                  size_t index) {
+  size_t mask = pf->slots_num - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    metric_slot_t *slot = pf->slots + i;
+    assert(slot->index != METRIC_SLOT_EMPTY);
+    if (slot->index == index)
+      return slot;
+  }
+}
+
+/* metric_family_resize grows the hash index to "slots_num" buckets. */
+static int metric_family_resize(prom_family_t *pf, size_t slots_num) {
+  metric_slot_t *slots = malloc(slots_num * sizeof(*slots));
+  if (slots == NULL)
     return ENOMEM;
-  fam->metric = tmp;
+  for (size_t i = 0; i < slots_num; i++)
+    slots[i].index = METRIC_SLOT_EMPTY;
+
+  size_t mask = slots_num - 1;
+  for (size_t i = 0; i < pf->slots_num; i++) {
+    if (pf->slots[i].index == METRIC_SLOT_EMPTY)
+      continue;
+
+    size_t j = pf->slots[i].hash & mask;
+    while (slots[j].index != METRIC_SLOT_EMPTY)
+      j = (j + 1) & mask;
+    slots[j] = pf->slots[i];
+  }
+
+  sfree(pf->slots);
+  pf->slots = slots;
+  pf->slots_num = slots_num;
+  return 0;
+}
+
+/* metric_family_slot_remove empties a slot, moving following entries of the
+ * same probe sequence back so lookups never run into a gap. */
+static void metric_family_slot_remove(prom_family_t *pf, metric_slot_t *slot) {
+  size_t mask = pf->slots_num - 1;
+  size_t i = (size_t)(slot - pf->slots);
+
+  pf->slots[i].index = METRIC_SLOT_EMPTY;
+  pf->slots_used--;
+
+  for (size_t j = (i + 1) & mask; pf->slots[j].index != METRIC_SLOT_EMPTY;
+       j = (j + 1) & mask) {
+    size_t home = pf->slots[j].hash & mask;
+    /* Leave the entry if its home bucket lies cyclically in (i, j]. */
+    if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j)))
+      continue;
+
+    pf->slots[i] = pf->slots[j];
+    pf->slots[j].index = METRIC_SLOT_EMPTY;
+    i = j;
+  }
+}
+
+/* metric_family_compact closes the holes left in the metric array by deleted
+ * metrics, preserving the order of the remaining metrics. */
+static void metric_family_compact(prom_family_t *pf) {
+  if (pf->holes == 0)
+    return;
+
+  Io__Prometheus__Client__MetricFamily *fam = pf->pb;
+  size_t n = 0;
+  for (size_t i = 0; i < fam->n_metric; i++) {
+    Io__Prometheus__Client__Metric *m = fam->metric[i];
+    if (m == NULL)
+      continue;
+
+    if (i != n) {
+      metric_family_slot_by_index(pf, metric_hash(m), i)->index = n;
+      fam->metric[n] = m;
+    }
+    n++;
+  }
+
+  fam->n_metric = n;
+  pf->holes = 0;
+}
+
+/* metric_family_add_metric adds m to the metric list of fam. "slot" is the
+ * empty slot returned by metric_family_slot(). */
+static int metric_family_add_metric(prom_family_t *pf,
+                                    Io__Prometheus__Client__Metric *m,
+                                    metric_slot_t *slot, uint64_t hash) {
+  Io__Prometheus__Client__MetricFamily *fam = pf->pb;
+
+  if (fam->n_metric >= pf->metric_alloc) {
+    size_t alloc = (pf->metric_alloc == 0) ? 4 : 2 * pf->metric_alloc;
+    Io__Prometheus__Client__Metric **tmp =
+        realloc(fam->metric, alloc * sizeof(*fam->metric));
+    if (tmp == NULL)
+      return ENOMEM;
+    fam->metric = tmp;
+    pf->metric_alloc = alloc;
+  }
+
+  /* Keep the load factor at or below 1/2. Growing invalidates "slot". */
+  if (2 * (pf->slots_used + 1) > pf->slots_num) {
+    int status = metric_family_resize(pf, 2 * pf->slots_num);
+    if (status != 0)
+      return status;
+    slot = metric_family_slot(pf, m, hash);
+  }
+
+  slot->hash = hash;
+  slot->index = fam->n_metric;
+  pf->slots_used++;
 
   fam->metric[fam->n_metric] = m;
   fam->n_metric++;
 
-  /* Sort the metrics so that lookup is fast. */
-  qsort(fam->metric, fam->n_metric, sizeof(*fam->metric), metric_cmp);
-
   return 0;
 }
 
 /* metric_family_delete_metric looks up and deletes the metric corresponding to
  * vl. */
-static int
-metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
-                            value_list_t const *vl) {
+static int metric_family_delete_metric(prom_family_t *pf,
+                                       value_list_t const *vl) {
   Io__Prometheus__Client__Metric *key = METRIC_INIT;
   METRIC_ADD_LABELS(key, vl);
 
-  size_t i;
-  for (i = 0; i < fam->n_metric; i++) {
-    if (metric_cmp(&key, &fam->metric[i]) == 0)
-      break;
-  }
+  if (pf->slots_num == 0)
+    return ENOENT;
 
-  if (i >= fam->n_metric)
+  metric_slot_t *slot = metric_family_slot(pf, key, metric_hash(key));
+  if (slot->index == METRIC_SLOT_EMPTY)
     return ENOENT;
 
-  metric_destroy(fam->metric[i]);
-  if ((fam->n_metric - 1) > i)
-    memmove(&fam->metric[i], &fam->metric[i + 1],
-            ((fam->n_metric - 1) - i) * sizeof(fam->metric[i]));
-  fam->n_metric--;
+  size_t i = slot->index;
+  metric_family_slot_remove(pf, slot);
 
-  if (fam->n_metric == 0) {
-    sfree(fam->metric);
-    return 0;
-  }
+  metric_destroy(pf->pb->metric[i]);
+  pf->pb->metric[i] = NULL;
+  pf->holes++;
 
-  Io__Prometheus__Client__Metric **tmp =
-      realloc(fam->metric, fam->n_metric * sizeof(*fam->metric));
-  if (tmp != NULL)
-    fam->metric = tmp;
+  /* Compact once half of the array is holes, so deletes stay O(1) amortized. */
+  if (2 * pf->holes >= pf->pb->n_metric)
+    metric_family_compact(pf);
 
   return 0;
 }
@@ -576,26 +1117,25 @@ metric_family_delete_metric(Io__Prometheus__Client__MetricFamily *fam,
 /* metric_family_get_metric looks up the matching metric in a metric family,
  * allocating it if necessary. */
 static Io__Prometheus__Client__Metric *
-metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
-                         value_list_t const *vl) {
+metric_family_get_metric(prom_family_t *pf, value_list_t const *vl) {
   Io__Prometheus__Client__Metric *key = METRIC_INIT;
   METRIC_ADD_LABELS(key, vl);
 
-  /* Metrics are sorted in metric_family_add_metric() so that we can do a binary
-   * search here. */
-  Io__Prometheus__Client__Metric **m = bsearch(
-      &key, fam->metric, fam->n_metric, sizeof(*fam->metric), metric_cmp);
+  if ((pf->slots_num == 0) &&
+      (metric_family_resize(pf, METRIC_SLOTS_MIN) != 0))
+    return NULL;
 
-  if (m != NULL) {
-    return *m;
-  }
+  uint64_t hash = metric_hash(key);
+  metric_slot_t *slot = metric_family_slot(pf, key, hash);
+  if (slot->index != METRIC_SLOT_EMPTY)
+    return pf->pb->metric[slot->index];
 
   Io__Prometheus__Client__Metric *new_metric = metric_clone(key);
   if (new_metric == NULL)
     return NULL;
 
   DEBUG("write_prometheus plugin: created new metric in family");
-  int status = metric_family_add_metric(fam, new_metric);
+  int status = metric_family_add_metric(pf, new_metric, slot, hash);
   if (status != 0) {
     metric_destroy(new_metric);
     return NULL;
@@ -606,10 +1146,9 @@ metric_family_get_metric(Io__Prometheus__Client__MetricFamily *fam,
 
 /* metric_family_update looks up the matching metric in a metric family,
  * allocating it if necessary, and updates the metric to the latest value. */
-static int metric_family_update(Io__Prometheus__Client__MetricFamily *fam,
-                                data_set_t const *ds, value_list_t const *vl,
-                                size_t ds_index) {
-  Io__Prometheus__Client__Metric *m = metric_family_get_metric(fam, vl);
+static int metric_family_update(prom_family_t *pf, data_set_t const *ds,
+                                value_list_t const *vl, size_t ds_index) {
+  Io__Prometheus__Client__Metric *m = metric_family_get_metric(pf, vl);
   if (m == NULL)
     return -1;
 
@@ -660,6 +1199,168 @@ metric_family_create(char *name, data_set_t const *ds, value_list_t const *vl,
   return msg;
 }
 
+/* metric_copy_value copies the value and timestamp of src to dst. */
+static int metric_copy_value(Io__Prometheus__Client__Metric *dst,
+                             Io__Prometheus__Client__Metric const *src) {
+  if (src->gauge != NULL) {
+    sfree(dst->counter);
+    if (dst->gauge == NULL) {
+      dst->gauge = calloc(1, sizeof(*dst->gauge));
+      if (dst->gauge == NULL)
+        return ENOMEM;
+      io__prometheus__client__gauge__init(dst->gauge);
+    }
+    dst->gauge->value = src->gauge->value;
+    dst->gauge->has_value = src->gauge->has_value;
+  } else if (src->counter != NULL) {
+    sfree(dst->gauge);
+    if (dst->counter == NULL) {
+      dst->counter = calloc(1, sizeof(*dst->counter));
+      if (dst->counter == NULL)
+        return ENOMEM;
+      io__prometheus__client__counter__init(dst->counter);
+    }
+    dst->counter->value = src->counter->value;
+    dst->counter->has_value = src->counter->has_value;
+  }
+
+  dst->timestamp_ms = src->timestamp_ms;
+  dst->has_timestamp_ms = src->has_timestamp_ms;
+  return 0;
+}
+
+/* metric_family_clone returns a deep copy of orig, leaving out deleted
+ * metrics. */
+static Io__Prometheus__Client__MetricFamily *
+metric_family_clone(Io__Prometheus__Client__MetricFamily const *orig) {
+  Io__Prometheus__Client__MetricFamily *copy = calloc(1, sizeof(*copy));
+  if (copy == NULL)
+    return NULL;
+  io__prometheus__client__metric_family__init(copy);
+
+  copy->name = strdup(orig->name);
+  copy->help = (orig->help != NULL) ? strdup(orig->help) : NULL;
+  copy->type = orig->type;
+  copy->has_type = orig->has_type;
+  if (orig->n_metric > 0)
+    copy->metric = calloc(orig->n_metric, sizeof(*copy->metric));
+  if ((copy->name == NULL) || ((orig->help != NULL) && (copy->help == NULL)) ||
+      ((orig->n_metric > 0) && (copy->metric == NULL))) {
+    metric_family_destroy(copy);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < orig->n_metric; i++) {
+    if (orig->metric[i] == NULL)
+      continue;
+
+    Io__Prometheus__Client__Metric *m = metric_clone(orig->metric[i]);
+    if ((m == NULL) || (metric_copy_value(m, orig->metric[i]) != 0)) {
+      metric_destroy(m);
+      metric_family_destroy(copy);
+      return NULL;
+    }
+    copy->metric[copy->n_metric] = m;
+    copy->n_metric++;
+  }
+
+  return copy;
+}
+
+/* prom_family_changed records a modification of pf. "structure" is true if
+ * metrics have been added or removed. Must be called with metrics_lock held
+ * whenever pf is modified. */
+static void prom_family_changed(prom_family_t *pf, bool structure) {
+  if (structure)
+    pf->structure_changed = true;
+  else
+    pf->values_changed = true;
+  metrics_generation++;
+}
+
+/* prom_family_sync brings the shadow copy of pf up to date, rebuilding it if
+ * metrics have been added or removed. Must be called with metrics_lock and
+ * render_lock held. */
+static int prom_family_sync(prom_family_t *pf) {
+  prom_shadow_t *shadow = pf->shadow;
+
+  if ((shadow != NULL) && !pf->structure_changed) {
+    if (!pf->values_changed)
+      return 0;
+
+    /* Without structural changes, metrics are at the same positions in both
+     * copies. If copying fails half way, the shadow is rebuilt instead. */
+    bool ok = (shadow->pb->n_metric == pf->pb->n_metric);
+    for (size_t i = 0; ok && (i < pf->pb->n_metric); i++)
+      ok = (pf->pb->metric[i] != NULL) &&
+           (metric_copy_value(shadow->pb->metric[i], pf->pb->metric[i]) == 0);
+
+    if (ok) {
+      for (size_t i = 0; i < PROM_FORMAT_MAX; i++)
+        shadow->render[i].dirty = true;
+      pf->values_changed = false;
+      return 0;
+    }
+  }
+
+  /* Compact pf so that its metrics line up with the dense shadow copy. */
+  metric_family_compact(pf);
+
+  Io__Prometheus__Client__MetricFamily *pb = metric_family_clone(pf->pb);
+  if (pb == NULL)
+    return ENOMEM;
+
+  if (shadow == NULL) {
+    shadow = calloc(1, sizeof(*shadow));
+    if (shadow == NULL) {
+      metric_family_destroy(pb);
+      return ENOMEM;
+    }
+    pf->shadow = shadow;
+  }
+
+  metric_family_destroy(shadow->pb);
+  shadow->pb = pb;
+  for (size_t i = 0; i < PROM_FORMAT_MAX; i++)
+    shadow->render[i].dirty = true;
+
+  pf->structure_changed = false;
+  pf->values_changed = false;
+  return 0;
+}
+
+/* prom_shadows_orphaned_free frees the shadow copies of deleted metric
+ * families. Must be called with metrics_lock and render_lock held. */
+static void prom_shadows_orphaned_free(void) {
+  while (shadows_orphaned != NULL) {
+    prom_shadow_t *shadow = shadows_orphaned;
+    shadows_orphaned = shadow->next;
+
+    metric_family_destroy(shadow->pb);
+    for (size_t i = 0; i < PROM_FORMAT_MAX; i++)
+      sfree(shadow->render[i].data);
+    sfree(shadow);
+  }
+}
+
+/* prom_family_destroy frees the memory used by a metric family. Its shadow copy
+ * may still be rendered by a scrape and is freed later, see
+ * prom_shadows_orphaned_free(). Must be called with metrics_lock held. */
+static void prom_family_destroy(prom_family_t *pf) {
+  if (pf == NULL)
+    return;
+
+  if (pf->shadow != NULL) {
+    pf->shadow->next = shadows_orphaned;
+    shadows_orphaned = pf->shadow;
+  }
+
+  metric_family_destroy(pf->pb);
+  sfree(pf->slots);
+
+  sfree(pf);
+}
+
 /* metric_family_name creates a metric family's name from a data source. This is
  * done in the same way as done by the "collectd_exporter" for best possible
  * compatibility. In essence, the plugin, type and data source name go in the
@@ -697,20 +1398,20 @@ static char *metric_family_name(data_set_t const *ds, value_list_t const *vl,
 
 /* metric_family_get looks up the matching metric family, allocating it if
  * necessary. */
-static Io__Prometheus__Client__MetricFamily *
-metric_family_get(data_set_t const *ds, value_list_t const *vl, size_t ds_index,
-                  bool allocate) {
+static prom_family_t *metric_family_get(data_set_t const *ds,
+                                        value_list_t const *vl,
+                                        size_t ds_index, bool allocate) {
   char *name = metric_family_name(ds, vl, ds_index);
   if (name == NULL) {
     ERROR("write_prometheus plugin: Allocating metric family name failed.");
     return NULL;
   }
 
-  Io__Prometheus__Client__MetricFamily *fam = NULL;
-  if (c_avl_get(metrics, name, (void *)&fam) == 0) {
+  prom_family_t *pf = NULL;
+  if (c_avl_get(metrics, name, (void *)&pf) == 0) {
     sfree(name);
-    assert(fam != NULL);
-    return fam;
+    assert(pf != NULL);
+    return pf;
   }
 
   if (!allocate) {
@@ -718,26 +1419,34 @@ metric_family_get(data_set_t const *ds, value_list_t const *vl, size_t ds_index,
     return NULL;
   }
 
-  fam = metric_family_create(name, ds, vl, ds_index);
-  if (fam == NULL) {
+  pf = calloc(1, sizeof(*pf));
+  if (pf == NULL) {
     ERROR("write_prometheus plugin: Allocating metric family failed.");
     sfree(name);
     return NULL;
   }
 
+  pf->pb = metric_family_create(name, ds, vl, ds_index);
+  if (pf->pb == NULL) {
+    ERROR("write_prometheus plugin: Allocating metric family failed.");
+    sfree(name);
+    sfree(pf);
+    return NULL;
+  }
+
   /* If successful, "name" is owned by "fam", i.e. don't free it here. */
   DEBUG("write_prometheus plugin: metric family \"%s\" has been created.",
         name);
   name = NULL;
 
-  int status = c_avl_insert(metrics, fam->name, fam);
+  int status = c_avl_insert(metrics, pf->pb->name, pf);
   if (status != 0) {
-    ERROR("write_prometheus plugin: Adding \"%s\" failed.", fam->name);
-    metric_family_destroy(fam);
+    ERROR("write_prometheus plugin: Adding \"%s\" failed.", pf->pb->name);
+    prom_family_destroy(pf);
     return NULL;
   }
 
-  return fam;
+  return pf;
 }
 /* }}} */
 
@@ -885,6 +1594,14 @@ static int prom_config(oconfig_item_t *ci) {
         httpd_port = (unsigned short)status;
     } else if (strcasecmp("StalenessDelta", child->key) == 0) {
       cf_util_get_cdtime(child, &staleness_delta);
+    } else if (strcasecmp("Compression", child->key) == 0) {
+      cf_util_get_boolean(child, &compression);
+#if !HAVE_ZLIB
+      if (compression)
+        WARNING("write_prometheus plugin: Option `Compression' requires zlib "
+                "support, which is not available. Responses will not be "
+                "compressed.");
+#endif
     } else {
       WARNING("write_prometheus plugin: Ignoring unknown configuration option "
               "\"%s\".",
@@ -921,16 +1638,17 @@ static int prom_write(data_set_t const *ds, value_list_t const *vl,
   pthread_mutex_lock(&metrics_lock);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
-    Io__Prometheus__Client__MetricFamily *fam =
-        metric_family_get(ds, vl, i, /* allocate = */ true);
-    if (fam == NULL)
+    prom_family_t *pf = metric_family_get(ds, vl, i, /* allocate = */ true);
+    if (pf == NULL)
       continue;
 
-    int status = metric_family_update(fam, ds, vl, i);
+    size_t metrics_num = pf->pb->n_metric;
+    int status = metric_family_update(pf, ds, vl, i);
+    prom_family_changed(pf, pf->pb->n_metric != metrics_num);
     if (status != 0) {
       ERROR("write_prometheus plugin: Updating metric \"%s\" failed with "
             "status %d",
-            fam->name, status);
+            pf->pb->name, status);
       continue;
     }
   }
@@ -948,29 +1666,29 @@ static int prom_missing(value_list_t const *vl,
   pthread_mutex_lock(&metrics_lock);
 
   for (size_t i = 0; i < ds->ds_num; i++) {
-    Io__Prometheus__Client__MetricFamily *fam =
-        metric_family_get(ds, vl, i, /* allocate = */ false);
-    if (fam == NULL)
+    prom_family_t *pf = metric_family_get(ds, vl, i, /* allocate = */ false);
+    if (pf == NULL)
       continue;
 
-    int status = metric_family_delete_metric(fam, vl);
+    int status = metric_family_delete_metric(pf, vl);
     if (status != 0) {
       ERROR("write_prometheus plugin: Deleting a metric in family \"%s\" "
             "failed with status %d",
-            fam->name, status);
+            pf->pb->name, status);
 
       continue;
     }
+    prom_family_changed(pf, /* structure = */ true);
 
-    if (fam->n_metric == 0) {
-      int status = c_avl_remove(metrics, fam->name, NULL, NULL);
+    if (pf->pb->n_metric == pf->holes) {
+      int status = c_avl_remove(metrics, pf->pb->name, NULL, NULL);
       if (status != 0) {
         ERROR("write_prometheus plugin: Deleting metric family \"%s\" failed "
               "with status %d",
-              fam->name, status);
+              pf->pb->name, status);
         continue;
       }
-      metric_family_destroy(fam);
+      prom_family_destroy(pf);
     }
   }
 
@@ -984,19 +1702,22 @@ static int prom_shutdown() {
     httpd = NULL;
   }
 
+  snapshots_destroy();
+
   pthread_mutex_lock(&metrics_lock);
   if (metrics != NULL) {
     char *name;
-    Io__Prometheus__Client__MetricFamily *fam;
-    while (c_avl_pick(metrics, (void *)&name, (void *)&fam) == 0) {
-      assert(name == fam->name);
+    prom_family_t *pf;
+    while (c_avl_pick(metrics, (void *)&name, (void *)&pf) == 0) {
+      assert(name == pf->pb->name);
       name = NULL;
 
-      metric_family_destroy(fam);
+      prom_family_destroy(pf);
     }
     c_avl_destroy(metrics);
     metrics = NULL;
   }
+  prom_shadows_orphaned_free();
   pthread_mutex_unlock(&metrics_lock);
 
   sfree(httpd_host);
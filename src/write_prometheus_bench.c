@@ -0,0 +1,102 @@
+/**
+ * collectd - src/write_prometheus_bench.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Times inserting and deleting many series of a single metric family. This is
+ * not part of "make check"; build and run it with
+ * "make bench_plugin_write_prometheus". */
+
+#include "write_prometheus.c" /* sic */
+
+#define DEFAULT_SERIES 1000000
+
+static data_source_t bench_dsrc = {"value", DS_TYPE_GAUGE, NAN, NAN};
+static data_set_t bench_ds = {"gauge", 1, &bench_dsrc};
+
+/* plugin_mock's cdtime() is constant, so use a real clock for timing. */
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_value_list(value_list_t *vl, value_t *v, size_t n) {
+  *vl = (value_list_t){
+      .values = v,
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1480063672),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "gauge",
+  };
+  ssnprintf(vl->plugin_instance, sizeof(vl->plugin_instance), "%zu", n);
+  v->gauge = (gauge_t)n;
+}
+
+int main(int argc, char **argv) {
+  size_t num = DEFAULT_SERIES;
+  if (argc > 1)
+    num = (size_t)strtoull(argv[1], NULL, 10);
+
+  prom_family_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
+    return 1;
+
+  value_list_t vl = {.host = "example.com", .plugin = "test", .type = "gauge"};
+  pf->pb = metric_family_create(strdup("collectd_test_gauge"), &bench_ds, &vl,
+                                0);
+  if (pf->pb == NULL) {
+    sfree(pf);
+    return 1;
+  }
+
+  value_t v;
+  size_t failures = 0;
+
+  double start = bench_now();
+  for (size_t i = 0; i < num; i++) {
+    bench_value_list(&vl, &v, i);
+    if (metric_family_update(pf, &bench_ds, &vl, 0) != 0)
+      failures++;
+  }
+  double insert = bench_now() - start;
+
+  start = bench_now();
+  for (size_t i = 0; i < num; i++) {
+    bench_value_list(&vl, &v, i);
+    if (metric_family_delete_metric(pf, &vl) != 0)
+      failures++;
+  }
+  double delete = bench_now() - start;
+
+  printf("inserted %zu series in %.3fs, deleted them in %.3fs\n", num, insert,
+         delete);
+
+  prom_family_destroy(pf);
+
+  if (failures != 0) {
+    fprintf(stderr, "%zu inserts or deletes failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,311 @@
+/**
+ * collectd - src/write_prometheus_test.c
+ * Copyright (C) 2026       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "write_prometheus.c" /* sic */
+#include "testing.h"
+
+#define MANY_SERIES 20000
+
+static data_source_t test_dsrc = {"value", DS_TYPE_GAUGE, NAN, NAN};
+static data_set_t test_ds = {"gauge", 1, &test_dsrc};
+
+static prom_family_t *test_family_create(void) {
+  prom_family_t *pf = calloc(1, sizeof(*pf));
+  if (pf == NULL)
+    return NULL;
+
+  value_list_t vl = {
+      .host = "example.com", .plugin = "test", .type = "gauge"};
+  pf->pb = metric_family_create(strdup("collectd_test_gauge"), &test_ds, &vl,
+                                0);
+  if (pf->pb == NULL) {
+    sfree(pf);
+    return NULL;
+  }
+
+  return pf;
+}
+
+static void test_value_list(value_list_t *vl, value_t *v, size_t n) {
+  *vl = (value_list_t){
+      .values = v,
+      .values_len = 1,
+      .time = TIME_T_TO_CDTIME_T(1480063672),
+      .interval = TIME_T_TO_CDTIME_T(10),
+      .host = "example.com",
+      .plugin = "test",
+      .type = "gauge",
+  };
+  ssnprintf(vl->plugin_instance, sizeof(vl->plugin_instance), "%zu", n);
+  v->gauge = (gauge_t)n;
+}
+
+/* test_snapshot_contains returns true if the text snapshot contains "needle".
+ * Snapshots are not null terminated. */
+static bool test_snapshot_contains(prom_snapshot_t const *snap,
+                                   char const *needle) {
+  char *text = strndup((char const *)snap->data, snap->size);
+  bool found = (text != NULL) && (strstr(text, needle) != NULL);
+  sfree(text);
+  return found;
+}
+
+static void test_magic_value_list(value_list_t *vl, value_t *v, size_t n) {
+  test_value_list(vl, v, n);
+  sstrncpy(vl->type, "MAGIC", sizeof(vl->type));
+  v->derive = (derive_t)n;
+}
+
+DEF_TEST(metric_family_index) {
+  prom_family_t *pf = test_family_create();
+  CHECK_NOT_NULL(pf);
+
+  value_list_t vl;
+  value_t v;
+  for (size_t i = 0; i < 10; i++) {
+    test_value_list(&vl, &v, i);
+    CHECK_ZERO(metric_family_update(pf, &test_ds, &vl, 0));
+  }
+  EXPECT_EQ_INT(10, (int)pf->pb->n_metric);
+
+  /* updating an existing series must not add a metric. */
+  test_value_list(&vl, &v, 3);
+  CHECK_ZERO(metric_family_update(pf, &test_ds, &vl, 0));
+  EXPECT_EQ_INT(10, (int)pf->pb->n_metric);
+
+  /* delete every other series */
+  for (size_t i = 0; i < 10; i += 2) {
+    test_value_list(&vl, &v, i);
+    EXPECT_EQ_INT(0, metric_family_delete_metric(pf, &vl));
+  }
+  test_value_list(&vl, &v, 0);
+  EXPECT_EQ_INT(ENOENT, metric_family_delete_metric(pf, &vl));
+
+  /* the remaining metrics keep their insertion order */
+  metric_family_compact(pf);
+  EXPECT_EQ_INT(5, (int)pf->pb->n_metric);
+  for (size_t i = 0; i < pf->pb->n_metric; i++) {
+    char want[16];
+    ssnprintf(want, sizeof(want), "%zu", 2 * i + 1);
+    EXPECT_EQ_STR(want, pf->pb->metric[i]->label[0]->value);
+  }
+
+  /* lookups still find the moved metrics */
+  for (size_t i = 1; i < 10; i += 2) {
+    test_value_list(&vl, &v, i);
+    Io__Prometheus__Client__Metric *m = metric_family_get_metric(pf, &vl);
+    CHECK_NOT_NULL(m);
+    EXPECT_EQ_STR(vl.plugin_instance, m->label[0]->value);
+  }
+  EXPECT_EQ_INT(5, (int)pf->pb->n_metric);
+
+  prom_family_destroy(pf);
+  return 0;
+}
+
+/* many_series inserts enough series into a single metric family for the
+ * index to grow several times, looks all of them up and deletes them again. */
+DEF_TEST(many_series) {
+  prom_family_t *pf = test_family_create();
+  CHECK_NOT_NULL(pf);
+
+  value_list_t vl;
+  value_t v;
+
+  int failures = 0;
+  for (size_t i = 0; i < MANY_SERIES; i++) {
+    test_value_list(&vl, &v, i);
+    if (metric_family_update(pf, &test_ds, &vl, 0) != 0)
+      failures++;
+  }
+  EXPECT_EQ_INT(0, failures);
+  EXPECT_EQ_INT(MANY_SERIES, (int)pf->pb->n_metric);
+
+  for (size_t i = 0; i < MANY_SERIES; i++) {
+    test_value_list(&vl, &v, i);
+    Io__Prometheus__Client__Metric *m = metric_family_get_metric(pf, &vl);
+    if ((m == NULL) || (strcmp(vl.plugin_instance, m->label[0]->value) != 0))
+      failures++;
+  }
+  EXPECT_EQ_INT(0, failures);
+
+  for (size_t i = 0; i < MANY_SERIES; i++) {
+    test_value_list(&vl, &v, i);
+    if (metric_family_delete_metric(pf, &vl) != 0)
+      failures++;
+  }
+  EXPECT_EQ_INT(0, failures);
+  EXPECT_EQ_INT(0, (int)(pf->pb->n_metric - pf->holes));
+
+  test_value_list(&vl, &v, 0);
+  EXPECT_EQ_PTR(NULL, metric_family_get_metric(pf, &vl));
+
+  prom_family_destroy(pf);
+  return 0;
+}
+
+DEF_TEST(accept_gzip) {
+  struct {
+    char const *accept_encoding;
+    bool want;
+  } cases[] = {
+      {NULL, false},
+      {"", false},
+      {"gzip", true},
+      {"GZIP", true},
+      {"deflate, gzip", true},
+      {"gzip;q=0.5, deflate", true},
+      {"gzip; q=1.0", true},
+      {"x-gzip", true},
+      {"*", true},
+      {"identity", false},
+      {"gzip;q=0", false},
+      {"gzip; q=0.000", false},
+      {"deflate, gzip;q=0", false},
+      {"*, gzip;q=0", false},
+      {"*;q=0", false},
+      {"*;q=0, gzip", true},
+      {"gzipped", false},
+      {"br;q=1.0, gzip;q=0.8, *;q=0.1", true},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    printf("# Case %zu: \"%s\"\n", i,
+           (cases[i].accept_encoding != NULL) ? cases[i].accept_encoding
+                                              : "(null)");
+    EXPECT_EQ_INT(cases[i].want, accept_gzip(cases[i].accept_encoding));
+  }
+
+  return 0;
+}
+
+/* snapshot_reuse checks that snapshots are reused until metrics change, and
+ * that the scrape side copy of a family is only rebuilt on structural
+ * changes. */
+DEF_TEST(snapshot_reuse) {
+  /* plugin_mock only knows the "MAGIC" type, which prom_missing() looks up. */
+  data_set_t const *ds = plugin_get_ds("MAGIC");
+  OK(ds != NULL);
+
+  metrics = c_avl_create((int (*)(const void *, const void *))strcmp);
+  CHECK_NOT_NULL(metrics);
+
+  value_list_t vl;
+  value_t v;
+  for (size_t i = 0; i < 3; i++) {
+    test_magic_value_list(&vl, &v, i);
+    CHECK_ZERO(prom_write(ds, &vl, NULL));
+  }
+
+  prom_snapshot_t *first = snapshot_get(PROM_FORMAT_TEXT, false);
+  CHECK_NOT_NULL(first);
+  OK(test_snapshot_contains(first, "{test=\"2\",instance=\"example.com\"} 2 "));
+
+  prom_family_t *pf = NULL;
+  CHECK_ZERO(
+      c_avl_get(metrics, "collectd_test_MAGIC_total", (void *)&pf));
+  CHECK_NOT_NULL(pf->shadow);
+  Io__Prometheus__Client__MetricFamily *shadow_pb = pf->shadow->pb;
+
+  /* Without changes, the same snapshot is returned. */
+  prom_snapshot_t *snap = snapshot_get(PROM_FORMAT_TEXT, false);
+  OK(snap == first);
+  snapshot_unref(snap);
+
+  /* Updating a value builds a new snapshot, but keeps the shadow copy. */
+  test_magic_value_list(&vl, &v, 2);
+  v.derive = 42;
+  CHECK_ZERO(prom_write(ds, &vl, NULL));
+  OK(!pf->structure_changed);
+
+  snap = snapshot_get(PROM_FORMAT_TEXT, false);
+  CHECK_NOT_NULL(snap);
+  OK(snap != first);
+  OK(test_snapshot_contains(snap, "{test=\"2\",instance=\"example.com\"} 42 "));
+  OK(pf->shadow->pb == shadow_pb);
+  EXPECT_EQ_INT(3, (int)pf->shadow->pb->n_metric);
+  snapshot_unref(snap);
+
+  /* The snapshot handed out first stays intact. */
+  OK(test_snapshot_contains(first, "{test=\"2\",instance=\"example.com\"} 2 "));
+  snapshot_unref(first);
+
+  /* Adding a metric rebuilds the shadow copy. */
+  test_magic_value_list(&vl, &v, 3);
+  CHECK_ZERO(prom_write(ds, &vl, NULL));
+  OK(pf->structure_changed);
+
+  snap = snapshot_get(PROM_FORMAT_TEXT, false);
+  CHECK_NOT_NULL(snap);
+  OK(pf->shadow->pb != shadow_pb);
+  EXPECT_EQ_INT(4, (int)pf->shadow->pb->n_metric);
+  OK(test_snapshot_contains(snap, "{test=\"3\",instance=\"example.com\"} 3 "));
+  snapshot_unref(snap);
+
+  /* Removing a metric rebuilds it as well. */
+  test_magic_value_list(&vl, &v, 0);
+  CHECK_ZERO(prom_missing(&vl, NULL));
+
+  snap = snapshot_get(PROM_FORMAT_TEXT, false);
+  CHECK_NOT_NULL(snap);
+  EXPECT_EQ_INT(3, (int)pf->shadow->pb->n_metric);
+  OK(!test_snapshot_contains(snap, "{test=\"0\","));
+  snapshot_unref(snap);
+
+#if HAVE_ZLIB
+  /* The compressed snapshot is cached along with the plain one. */
+  prom_snapshot_t *gz = snapshot_get(PROM_FORMAT_TEXT, true);
+  CHECK_NOT_NULL(gz);
+  OK(gz->gzip);
+  snap = snapshot_get(PROM_FORMAT_TEXT, true);
+  OK(snap == gz);
+  snapshot_unref(snap);
+  snapshot_unref(gz);
+#endif
+
+  /* Deleting all metrics removes the family; its shadow copy is released by
+   * the next scrape. */
+  for (size_t i = 1; i < 4; i++) {
+    test_magic_value_list(&vl, &v, i);
+    CHECK_ZERO(prom_missing(&vl, NULL));
+  }
+  EXPECT_EQ_INT(0, c_avl_size(metrics));
+  CHECK_NOT_NULL(shadows_orphaned);
+
+  snap = snapshot_get(PROM_FORMAT_TEXT, false);
+  CHECK_NOT_NULL(snap);
+  OK(shadows_orphaned == NULL);
+  snapshot_unref(snap);
+
+  prom_shutdown();
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(metric_family_index);
+  RUN_TEST(many_series);
+  RUN_TEST(accept_gzip);
+  RUN_TEST(snapshot_reuse);
+
+  END_TEST;
+}